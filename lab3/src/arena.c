@@ -0,0 +1,218 @@
+#include "arena.h"
+
+#include <string.h>
+
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+
+#define ARENA_ALIGN 64
+#define HUGE_2M ((size_t)2 << 20)
+#define HUGE_1G ((size_t)1 << 30)
+
+static const char *kPagesNames[] = {"1g", "2m", "thp", "4k"};
+
+bool ArenaPagesParse(const char *name, enum ArenaPages *pages) {
+  for (int i = ARENA_PAGES_1G; i <= ARENA_PAGES_4K; i++) {
+    if (strcmp(name, kPagesNames[i]) == 0) {
+      *pages = i;
+      return true;
+    }
+  }
+  return false;
+}
+
+const char *ArenaPagesName(enum ArenaPages pages) {
+  return kPagesNames[pages];
+}
+
+bool ArenaPrefaultParse(const char *name, enum ArenaPrefault *prefault) {
+  if (strcmp(name, "none") == 0)
+    *prefault = ARENA_PREFAULT_NONE;
+  else if (strcmp(name, "populate") == 0)
+    *prefault = ARENA_PREFAULT_POPULATE;
+  else if (strcmp(name, "workers") == 0)
+    *prefault = ARENA_PREFAULT_WORKERS;
+  else
+    return false;
+  return true;
+}
+
+static size_t PageSize(enum ArenaPages pages) {
+  switch (pages) {
+  case ARENA_PAGES_1G:
+    return HUGE_1G;
+  case ARENA_PAGES_2M:
+  case ARENA_PAGES_THP:
+    return HUGE_2M;
+  default:
+    return 4096;
+  }
+}
+
+static size_t RoundUp(size_t size, size_t page) {
+  return (size + page - 1) / page * page;
+}
+
+static bool MapHugetlb(struct Arena *arena, size_t size, int huge_flag,
+                       int populate) {
+  void *map = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | huge_flag |
+                       populate,
+                   -1, 0);
+  if (map == MAP_FAILED)
+    return false;
+  arena->base = map;
+  arena->size = size;
+  return true;
+}
+
+/* THP only backs 2M aligned stretches, so map one huge page more and
+   trim both ends to an aligned start. */
+static bool MapTransparent(struct Arena *arena, size_t size, int populate) {
+  char *map = mmap(NULL, size + HUGE_2M, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (map == MAP_FAILED)
+    return false;
+  char *start = (char *)RoundUp((uintptr_t)map, HUGE_2M);
+  if (start > map)
+    munmap(map, start - map);
+  munmap(start + size, map + HUGE_2M - start);
+  if (madvise(start, size, MADV_HUGEPAGE) != 0) {
+    munmap(start, size);
+    return false;
+  }
+#ifdef MADV_POPULATE_WRITE
+  if (populate)
+    madvise(start, size, MADV_POPULATE_WRITE);
+#endif
+  arena->base = start;
+  arena->size = size;
+  return true;
+}
+
+static bool MapNormal(struct Arena *arena, size_t size, int populate) {
+  void *map = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | populate, -1, 0);
+  if (map == MAP_FAILED)
+    return false;
+  arena->base = map;
+  arena->size = size;
+  return true;
+}
+
+/* Prefaulting runs as a reduction over page numbers with the writes
+   done as a side effect, like the scan passes in lab4. */
+struct PrefaultJob {
+  char *base;
+  size_t page;
+};
+
+static void PrefaultNothing(void *acc, const void *ctx) {}
+
+static void PrefaultMerge(void *acc, const void *other, const void *ctx) {}
+
+static void PrefaultPages(void *acc, const void *ctx, uint64_t begin,
+                          uint64_t end) {
+  const struct PrefaultJob *job = ctx;
+  for (uint64_t i = begin; i < end; i++)
+    ((volatile char *)job->base)[i * job->page] = 0;
+}
+
+static bool PrefaultByWorkers(struct Arena *arena,
+                              const struct PreduceConfig *config) {
+  /* Touching every 4K page also works for huge pages, only the first
+     touch of each one faults. */
+  struct PrefaultJob job = {arena->base, 4096};
+  const struct PreduceOps ops = {1, PrefaultNothing, PrefaultPages,
+                                 PrefaultMerge};
+  struct PreduceConfig threads = {.backend = PREDUCE_SERIAL};
+  if (config != NULL && config->workers > 1) {
+    threads.backend = PREDUCE_THREADS;
+    threads.workers = config->workers;
+    threads.chunks = config->workers;
+  }
+  char unused;
+  return PreduceRun(&ops, &job, 0, arena->size / job.page, &threads, &unused);
+}
+
+bool ArenaInit(struct Arena *arena, size_t size, enum ArenaPages largest,
+               enum ArenaPrefault prefault, const struct PreduceConfig *config) {
+  memset(arena, 0, sizeof(*arena));
+  uint64_t faults = ArenaPageFaults();
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  if (size == 0)
+    size = 1;
+  int populate = prefault == ARENA_PREFAULT_POPULATE ? MAP_POPULATE : 0;
+
+  bool mapped = false;
+  for (int pages = largest; pages <= ARENA_PAGES_4K && !mapped; pages++) {
+    size_t page = PageSize(pages);
+    if (pages != ARENA_PAGES_4K && size < page)
+      continue;
+    size_t rounded = RoundUp(size, page);
+    switch (pages) {
+    case ARENA_PAGES_1G:
+      mapped = MapHugetlb(arena, rounded, MAP_HUGE_1GB, populate);
+      break;
+    case ARENA_PAGES_2M:
+      mapped = MapHugetlb(arena, rounded, MAP_HUGE_2MB, populate);
+      break;
+    case ARENA_PAGES_THP:
+      mapped = MapTransparent(arena, rounded, populate);
+      break;
+    default:
+      mapped = MapNormal(arena, rounded, populate);
+    }
+    arena->pages = pages;
+  }
+  if (!mapped)
+    return false;
+
+  if (prefault == ARENA_PREFAULT_WORKERS && !PrefaultByWorkers(arena, config)) {
+    ArenaFree(arena);
+    return false;
+  }
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  arena->init_faults = ArenaPageFaults() - faults;
+  arena->init_ms = (now.tv_sec - start.tv_sec) * 1000.0 +
+                   (now.tv_nsec - start.tv_nsec) / 1e6;
+  return true;
+}
+
+void *ArenaAlloc(struct Arena *arena, size_t size) {
+  size_t start = RoundUp(arena->used, ARENA_ALIGN);
+  if (start > arena->size || size > arena->size - start)
+    return NULL;
+  arena->used = start + size;
+  return arena->base + start;
+}
+
+void ArenaReset(struct Arena *arena) { arena->used = 0; }
+
+void ArenaFree(struct Arena *arena) {
+  if (arena->base != NULL)
+    munmap(arena->base, arena->size);
+  arena->base = NULL;
+  arena->size = 0;
+  arena->used = 0;
+}
+
+uint64_t ArenaPageFaults(void) {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_minflt + usage.ru_majflt;
+}
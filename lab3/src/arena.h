@@ -0,0 +1,58 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "preduce.h"
+
+/* One mapping for the big working arrays, handed out by bumping a
+   pointer. Large pages cut the number of first-touch faults and TLB
+   misses, ArenaInit tries them from the largest allowed down:
+
+     1G, 2M    MAP_HUGETLB, needs pages reserved in the hugetlb pool
+     thp       2M aligned normal mapping with madvise(MADV_HUGEPAGE)
+     4k        normal pages */
+
+enum ArenaPages {
+  ARENA_PAGES_1G,
+  ARENA_PAGES_2M,
+  ARENA_PAGES_THP,
+  ARENA_PAGES_4K,
+};
+
+enum ArenaPrefault {
+  ARENA_PREFAULT_NONE,     /* pages fault in on first touch */
+  ARENA_PREFAULT_POPULATE, /* MAP_POPULATE, the kernel faults serially */
+  ARENA_PREFAULT_WORKERS,  /* preduce workers touch a slice each */
+};
+
+struct Arena {
+  char *base;
+  size_t size; /* mapped, a multiple of the page size */
+  size_t used;
+  enum ArenaPages pages; /* what the mapping actually got */
+  uint64_t init_faults;  /* page faults taken by ArenaInit */
+  double init_ms;
+};
+
+bool ArenaPagesParse(const char *name, enum ArenaPages *pages);
+const char *ArenaPagesName(enum ArenaPages pages);
+bool ArenaPrefaultParse(const char *name, enum ArenaPrefault *prefault);
+
+/* Maps at least size bytes. A page size is only tried when size fills
+   at least one page of it. Workers prefault with the threads backend
+   whatever config says, forked children would fault their own copy. */
+bool ArenaInit(struct Arena *arena, size_t size, enum ArenaPages largest,
+               enum ArenaPrefault prefault, const struct PreduceConfig *config);
+
+/* 64 byte aligned, NULL when the arena is full. */
+void *ArenaAlloc(struct Arena *arena, size_t size);
+void ArenaReset(struct Arena *arena);
+void ArenaFree(struct Arena *arena);
+
+/* Minor and major page faults of this process so far. */
+uint64_t ArenaPageFaults(void);
+
+#endif
@@ -0,0 +1,90 @@
+#include "array_file.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+bool ArrayFileOpen(struct ArrayFile *file, const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  struct ArrayFileHeader header;
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return false;
+  }
+  bool ok = pread(fd, &header, sizeof(header), 0) == sizeof(header) &&
+            memcmp(header.magic, ARRAY_FILE_MAGIC, sizeof(header.magic)) == 0 &&
+            header.version == ARRAY_FILE_VERSION &&
+            header.type <= ELEM_F64 && header.alignment > 0 &&
+            header.data_offset % header.alignment == 0 &&
+            header.data_offset >= sizeof(header);
+  if (!ok) {
+    close(fd);
+    errno = EINVAL;
+    return false;
+  }
+
+  size_t elem_size = ElemTypeSize(header.type);
+  if (header.count > (UINT64_MAX - header.data_offset) / elem_size ||
+      header.data_offset + header.count * elem_size > (uint64_t)st.st_size) {
+    close(fd);
+    errno = EINVAL;
+    return false;
+  }
+
+  file->type = header.type;
+  file->count = header.count;
+  file->map_size = header.data_offset + header.count * elem_size;
+  file->map = mmap(NULL, file->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (file->map == MAP_FAILED)
+    return false;
+
+  /* Both are hints, a kernel without file-backed huge pages says no. */
+  madvise(file->map, file->map_size, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+  madvise(file->map, file->map_size, MADV_HUGEPAGE);
+#endif
+  file->data = (const char *)file->map + header.data_offset;
+  return true;
+}
+
+void ArrayFileClose(struct ArrayFile *file) {
+  if (file->map != NULL)
+    munmap(file->map, file->map_size);
+  file->map = NULL;
+  file->data = NULL;
+}
+
+bool ArrayFileWrite(const char *path, enum ElemType type, const void *data,
+                    uint64_t count) {
+  struct ArrayFileHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, ARRAY_FILE_MAGIC, sizeof(header.magic));
+  header.version = ARRAY_FILE_VERSION;
+  header.type = type;
+  header.count = count;
+  header.alignment = ARRAY_FILE_ALIGNMENT;
+  header.data_offset = ARRAY_FILE_ALIGNMENT;
+
+  FILE *out = fopen(path, "wb");
+  if (out == NULL)
+    return false;
+  char padding[ARRAY_FILE_ALIGNMENT - sizeof(header)];
+  memset(padding, 0, sizeof(padding));
+  size_t elem_size = ElemTypeSize(type);
+  bool ok = fwrite(&header, sizeof(header), 1, out) == 1 &&
+            fwrite(padding, sizeof(padding), 1, out) == 1 &&
+            fwrite(data, elem_size, count, out) == count;
+  if (fclose(out) != 0)
+    ok = false;
+  return ok;
+}
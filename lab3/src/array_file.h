@@ -0,0 +1,45 @@
+#ifndef ARRAY_FILE_H
+#define ARRAY_FILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "typed.h"
+
+/* Binary array file: a fixed header, then count elements of type in
+   native byte order starting at data_offset, a multiple of alignment.
+   With page alignment the data can be mapped and used in place. */
+
+#define ARRAY_FILE_MAGIC "OSARRAY"
+#define ARRAY_FILE_VERSION 1
+#define ARRAY_FILE_ALIGNMENT 4096
+
+struct ArrayFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t type; /* enum ElemType */
+  uint64_t count;
+  uint32_t alignment;
+  uint32_t reserved;
+  uint64_t data_offset;
+};
+
+/* An input file mapped read-only. Nothing is read up front: pages come
+   in when a worker first touches its own slice, and forked workers share
+   them through the page cache. */
+struct ArrayFile {
+  enum ElemType type;
+  uint64_t count;
+  const void *data;
+  void *map;
+  size_t map_size;
+};
+
+bool ArrayFileOpen(struct ArrayFile *file, const char *path);
+void ArrayFileClose(struct ArrayFile *file);
+
+bool ArrayFileWrite(const char *path, enum ElemType type, const void *data,
+                    uint64_t count);
+
+#endif
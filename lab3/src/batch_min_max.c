@@ -0,0 +1,274 @@
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "supervisor.h"
+
+/* One "seed arraysize" line of the job list. */
+struct Job {
+  char seed[16];
+  char size[16];
+  char *argv[4];
+  char *output;
+  size_t output_size;
+};
+
+struct Batch {
+  const char *program;
+  struct Job *jobs;
+  int count;
+};
+
+/* Filled here rather than in ReadJobs, the jobs move while it grows them. */
+static char *const *JobArgv(void *arg, int index) {
+  struct Batch *batch = arg;
+  struct Job *job = &batch->jobs[index];
+  job->argv[0] = (char *)batch->program;
+  job->argv[1] = job->seed;
+  job->argv[2] = job->size;
+  job->argv[3] = NULL;
+  return job->argv;
+}
+
+/* Output may come in pieces, it is parsed once the job is done. */
+static void JobOutput(void *arg, int index, const char *data, size_t size) {
+  struct Job *job = &((struct Batch *)arg)->jobs[index];
+  char *output = realloc(job->output, job->output_size + size + 1);
+  if (output == NULL)
+    return;
+  memcpy(output + job->output_size, data, size);
+  job->output = output;
+  job->output_size += size;
+  job->output[job->output_size] = '\0';
+}
+
+/* Only the last attempt's output counts, a failed one may have printed
+   a min before it died. */
+static void JobRestart(void *arg, int index) {
+  struct Job *job = &((struct Batch *)arg)->jobs[index];
+  free(job->output);
+  job->output = NULL;
+  job->output_size = 0;
+}
+
+static void FreeBatch(struct Batch *batch) {
+  for (int i = 0; i < batch->count; i++)
+    free(batch->jobs[i].output);
+  free(batch->jobs);
+}
+
+static bool ReadJobs(FILE *in, struct Batch *batch) {
+  int capacity = 0;
+  char line[256];
+  while (fgets(line, sizeof(line), in) != NULL) {
+    long seed, size;
+    char extra;
+    if (line[strspn(line, " \t\r\n")] == '\0' || line[0] == '#')
+      continue;
+    if (sscanf(line, "%ld %ld %c", &seed, &size, &extra) != 2 || seed <= 0 ||
+        size <= 0 || seed > 2147483647 || size > 2147483647) {
+      printf("job %d: expected \"seed arraysize\", got %s", batch->count + 1,
+             line);
+      return false;
+    }
+    if (batch->count == capacity) {
+      capacity = capacity ? 2 * capacity : 64;
+      struct Job *jobs = realloc(batch->jobs, capacity * sizeof(struct Job));
+      if (jobs == NULL)
+        return false;
+      batch->jobs = jobs;
+    }
+    struct Job *job = &batch->jobs[batch->count++];
+    memset(job, 0, sizeof(*job));
+    snprintf(job->seed, sizeof(job->seed), "%ld", seed);
+    snprintf(job->size, sizeof(job->size), "%ld", size);
+  }
+  return true;
+}
+
+static double Seconds(const struct timespec *from, const struct timespec *to) {
+  return (to->tv_sec - from->tv_sec) + (to->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+/* What exec_seq_min_max used to do per job: fork, execv, waitpid, one
+   job at a time. Output goes to /dev/null, the pass is only timed. */
+static int RunForkExec(struct Batch *batch) {
+  int failed = 0;
+  int null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+  for (int i = 0; i < batch->count; i++) {
+    pid_t pid = fork();
+    if (pid == 0) {
+      dup2(null_fd, STDOUT_FILENO);
+      execv(batch->program, JobArgv(batch, i));
+      _exit(127);
+    }
+    int status;
+    if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != 0)
+      failed++;
+  }
+  close(null_fd);
+  return failed;
+}
+
+int main(int argc, char **argv) {
+  const char *jobs_path = NULL;
+  const char *output_path = NULL;
+  const char *program = "./sequential_min_max";
+  struct SupervisorConfig config = {.parallel = sysconf(_SC_NPROCESSORS_ONLN)};
+  bool compare = false;
+
+  while (true) {
+    static struct option options[] = {{"jobs", required_argument, 0, 0},
+                                      {"output", required_argument, 0, 0},
+                                      {"parallel", required_argument, 0, 0},
+                                      {"timeout", required_argument, 0, 0},
+                                      {"retries", required_argument, 0, 0},
+                                      {"program", required_argument, 0, 0},
+                                      {"compare", no_argument, 0, 0},
+                                      {0, 0, 0, 0}};
+
+    int option_index = 0;
+    int c = getopt_long(argc, argv, "", options, &option_index);
+
+    if (c == -1) break;
+
+    switch (c) {
+      case 0:
+        switch (option_index) {
+          case 0:
+            jobs_path = optarg;
+            break;
+          case 1:
+            output_path = optarg;
+            break;
+          case 2:
+            config.parallel = atoi(optarg);
+            if (config.parallel <= 0) {
+              printf("parallel is a positive number\n");
+              return 1;
+            }
+            break;
+          case 3:
+            config.timeout_ms = atoi(optarg);
+            if (config.timeout_ms <= 0) {
+              printf("timeout is a positive number of milliseconds\n");
+              return 1;
+            }
+            break;
+          case 4:
+            config.retries = atoi(optarg);
+            if (config.retries < 0) {
+              printf("retries is a non-negative number\n");
+              return 1;
+            }
+            break;
+          case 5:
+            program = optarg;
+            break;
+          case 6:
+            compare = true;
+            break;
+        }
+        break;
+
+      case '?':
+        break;
+
+      default:
+        printf("getopt returned character code 0%o?\n", c);
+    }
+  }
+
+  if (jobs_path == NULL || output_path == NULL || optind < argc) {
+    printf("Usage: %s --jobs file|- --output file.csv [--parallel num] "
+           "[--timeout ms] [--retries num] [--program path] [--compare]\n",
+           argv[0]);
+    return 1;
+  }
+
+  FILE *in = strcmp(jobs_path, "-") == 0 ? stdin : fopen(jobs_path, "r");
+  if (in == NULL) {
+    perror("can not open jobs");
+    return 1;
+  }
+  struct Batch batch = {.program = program};
+  bool read_ok = ReadJobs(in, &batch);
+  if (in != stdin)
+    fclose(in);
+  if (!read_ok || batch.count == 0) {
+    if (read_ok)
+      printf("no jobs in %s\n", jobs_path);
+    FreeBatch(&batch);
+    return 1;
+  }
+
+  struct WorkerResult *results = malloc(batch.count * sizeof(*results));
+  struct SupervisorJob job = {.arg = &batch,
+                             .argv = JobArgv,
+                             .output = JobOutput,
+                             .restart = JobRestart};
+  struct timespec start, finish;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  if (results == NULL || !SupervisorRun(&job, batch.count, &config, results)) {
+    perror("supervisor failed");
+    free(results);
+    FreeBatch(&batch);
+    return 1;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &finish);
+
+  FILE *csv = fopen(output_path, "w");
+  if (csv == NULL) {
+    perror("can not open output");
+    free(results);
+    FreeBatch(&batch);
+    return 1;
+  }
+  int failed = 0;
+  fprintf(csv, "job,seed,array_size,min,max,status,exit_code,attempts,"
+               "elapsed_ms\n");
+  for (int i = 0; i < batch.count; i++) {
+    struct Job *j = &batch.jobs[i];
+    struct WorkerResult *r = &results[i];
+    const char *min = j->output ? strstr(j->output, "min: ") : NULL;
+    const char *max = j->output ? strstr(j->output, "max: ") : NULL;
+    if (r->outcome != WORKER_EXITED || min == NULL || max == NULL)
+      failed++;
+    fprintf(csv, "%d,%s,%s,", i + 1, j->seed, j->size);
+    if (r->outcome == WORKER_EXITED && min != NULL && max != NULL)
+      fprintf(csv, "%d,%d,", atoi(min + 5), atoi(max + 5));
+    else
+      fprintf(csv, ",,");
+    fprintf(csv, "%s,%d,%d,%.3f\n", WorkerOutcomeName(r->outcome), r->code,
+            r->attempts, r->elapsed_ms);
+  }
+  fclose(csv);
+
+  double elapsed = Seconds(&start, &finish);
+  printf("Jobs: %d, failed: %d, parallel: %d\n", batch.count, failed,
+         config.parallel);
+  printf("posix_spawn pool: %.3f s, %.1f jobs/s\n", elapsed,
+         batch.count / elapsed);
+
+  if (compare) {
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int fork_failed = RunForkExec(&batch);
+    clock_gettime(CLOCK_MONOTONIC, &finish);
+    double fork_elapsed = Seconds(&start, &finish);
+    printf("fork+exec one at a time: %.3f s, %.1f jobs/s (failed: %d)\n",
+           fork_elapsed, batch.count / fork_elapsed, fork_failed);
+    printf("Speedup: %.2fx\n", fork_elapsed / elapsed);
+  }
+
+  free(results);
+  FreeBatch(&batch);
+  return failed == 0 ? 0 : 1;
+}
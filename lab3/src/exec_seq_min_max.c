@@ -1,39 +1,43 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <unistd.h>
-#include <sys/types.h>
-#include <sys/wait.h>
+
+#include "supervisor.h"
+
+static char *const *SequentialArgv(void *arg, int index) {
+    (void)index;
+    return arg;
+}
 
 int main(int argc, char **argv) {
-    if (argc != 3) {
-        printf("Usage: %s seed arraysize\n", argv[0]);
+    if (argc < 3 || argc > 5) {
+        printf("Usage: %s seed arraysize [timeout_ms] [retries]\n", argv[0]);
         return 1;
     }
 
-    pid_t pid = fork();
-    
-    if (pid == -1) {
-        perror("fork failed");
+    char *args[] = {"./sequential_min_max", argv[1], argv[2], NULL};
+    struct SupervisorJob job = {.arg = args, .argv = SequentialArgv};
+    struct SupervisorConfig config = {
+        .timeout_ms = argc > 3 ? atoi(argv[3]) : 0,
+        .retries = argc > 4 ? atoi(argv[4]) : 0,
+    };
+    struct WorkerResult result;
+
+    if (!SupervisorRun(&job, 1, &config, &result)) {
+        perror("supervisor failed");
         return 1;
     }
-    
-    if (pid == 0) {
-        char *args[] = {"./sequential_min_max", argv[1], argv[2], NULL};
-        
-        execv(args[0], args);
-        
-        perror("execv failed");
-        exit(1);
+
+    if (result.outcome == WORKER_NOT_RUN) {
+        printf("Could not start %s\n", args[0]);
+        return 1;
+    }
+    if (result.outcome == WORKER_TIMED_OUT) {
+        printf("Child process timed out after %d attempts\n", result.attempts);
+    } else if (!result.signaled) {
+        printf("Child process exited with status %d\n", result.code);
     } else {
-        int status;
-        waitpid(pid, &status, 0);
-        
-        if (WIFEXITED(status)) {
-            printf("Child process exited with status %d\n", WEXITSTATUS(status));
-        } else {
-            printf("Child process terminated abnormally\n");
-        }
+        printf("Child process terminated abnormally\n");
     }
-    
-    return 0;
-}
\ No newline at end of file
+
+    return result.outcome == WORKER_EXITED ? 0 : 1;
+}
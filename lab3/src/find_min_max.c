@@ -2,18 +2,29 @@
 
 #include <limits.h>
 
+PREDUCE_DEFINE(MinMax, struct MinMax, int,
+               (acc.min = INT_MAX, acc.max = INT_MIN),
+               {
+                 if (ctx[i] < acc.min)
+                   acc.min = ctx[i];
+                 if (ctx[i] > acc.max)
+                   acc.max = ctx[i];
+               },
+               {
+                 if (other.min < acc.min)
+                   acc.min = other.min;
+                 if (other.max > acc.max)
+                   acc.max = other.max;
+               })
+
 struct MinMax GetMinMax(int *array, unsigned int begin, unsigned int end) {
   struct MinMax min_max;
-  min_max.min = INT_MAX;
-  min_max.max = INT_MIN;
-
-  for (int i = begin; i<=end; i ++){
-    if(array[i] < min_max.min){
-      min_max.min = array[i];
-    }
-    if(array[i] > min_max.max){
-      min_max.max = array[i];
-    }
-  }
+  MinMaxReduce(array, begin, end, NULL, &min_max);
   return min_max;
 }
+
+bool ParallelMinMax(int *array, unsigned int begin, unsigned int end,
+                    const struct PreduceConfig *config,
+                    struct MinMax *min_max) {
+  return MinMaxReduce(array, begin, end, config, min_max);
+}
@@ -1,8 +1,15 @@
 #ifndef FIND_MIN_MAX_H
 #define FIND_MIN_MAX_H
 
+#include <stdbool.h>
+
+#include "preduce.h"
 #include "utils.h"
 
+/* Min and max of array[begin, end). */
 struct MinMax GetMinMax(int *array, unsigned int begin, unsigned int end);
+bool ParallelMinMax(int *array, unsigned int begin, unsigned int end,
+                    const struct PreduceConfig *config,
+                    struct MinMax *min_max);
 
 #endif
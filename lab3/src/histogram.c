@@ -0,0 +1,226 @@
+#include "histogram.h"
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Bin indices are computed for a block at a time in a loop that
+   vectorizes, then counted in a scalar loop. */
+#define HIST_BLOCK 1024
+/* Up to this many slots the counting goes to several copies of the bins
+   in turn, so runs of equal bins do not wait on each other's stores. */
+#define HIST_LANES 4
+#define HIST_LANE_SLOTS 1024
+#define HIST_LANE_FLUSH (1u << 30)
+
+union FloatBits {
+  float f;
+  uint32_t u;
+};
+
+struct HistContext {
+  const int *array;
+  const struct HistSpec *spec;
+};
+
+/* Bins below 2^sub_bits hold one value each, above that every power of
+   two is split into 2^sub_bits bins. */
+static uint32_t LogBin(uint32_t v, uint32_t sub_bits) {
+  if (v < (1u << sub_bits))
+    return v;
+  uint32_t e = 31 - __builtin_clz(v);
+  return ((e - sub_bits + 1) << sub_bits) +
+         ((v >> (e - sub_bits)) & ((1u << sub_bits) - 1));
+}
+
+bool HistSpecInit(struct HistSpec *spec, enum HistScale scale, uint32_t bins,
+                  int lo, int hi) {
+  if (bins == 0 || bins > HIST_MAX_BINS || lo > hi)
+    return false;
+  uint64_t span = (uint64_t)((int64_t)hi - lo) + 1;
+  spec->scale = scale;
+  spec->lo = lo;
+  spec->hi = hi;
+  spec->mult = 0;
+  spec->sub_bits = 0;
+
+  if (scale == HIST_LINEAR) {
+    if (bins > span)
+      bins = span;
+    /* (span - 1) * mult < bins * 2^32, so the last value is in range. */
+    spec->mult = ((uint64_t)bins << 32) / span;
+    spec->bins = bins;
+    return true;
+  }
+
+  /* The finest split of the octaves that still fits, at least one bin
+     per octave. */
+  uint32_t last = (uint32_t)(span - 1);
+  while (spec->sub_bits < 16 && LogBin(last, spec->sub_bits + 1) < bins)
+    spec->sub_bits++;
+  spec->bins = LogBin(last, spec->sub_bits) + 1;
+  return true;
+}
+
+int64_t HistBinLow(const struct HistSpec *spec, uint32_t bin) {
+  if (bin >= spec->bins)
+    return (int64_t)spec->hi + 1;
+  if (spec->scale == HIST_LINEAR) {
+    uint64_t v = (((uint64_t)bin << 32) + spec->mult - 1) / spec->mult;
+    return spec->lo + (int64_t)v;
+  }
+  uint32_t s = spec->sub_bits;
+  if (bin < (1u << s))
+    return spec->lo + (int64_t)bin;
+  uint32_t octave = bin >> s, sub = bin & ((1u << s) - 1);
+  return spec->lo + (int64_t)((uint64_t)((1u << s) + sub) << (octave - 1));
+}
+
+size_t HistogramSize(const struct HistSpec *spec) {
+  return sizeof(struct Histogram) + (spec->bins + 2) * sizeof(uint64_t);
+}
+
+struct Histogram *HistogramNew(const struct HistSpec *spec) {
+  struct Histogram *hist = calloc(1, HistogramSize(spec));
+  if (hist == NULL)
+    return NULL;
+  hist->spec = *spec;
+  hist->min = INT_MAX;
+  hist->max = INT_MIN;
+  return hist;
+}
+
+/* Bin of every x[j] into bins[j], values out of range go to the two
+   slots after the last bin. */
+static void BinBlock(const struct HistSpec *spec, const int *x, uint32_t n,
+                     uint32_t *bins, int *min_out, int *max_out) {
+  int min = *min_out, max = *max_out, lo = spec->lo, hi = spec->hi;
+  uint32_t below = spec->bins, above = spec->bins + 1;
+
+  if (spec->scale == HIST_LINEAR) {
+    uint64_t mult = spec->mult;
+#pragma omp simd reduction(min : min) reduction(max : max)
+    for (uint32_t j = 0; j < n; j++) {
+      int value = x[j];
+      min = value < min ? value : min;
+      max = value > max ? value : max;
+      uint32_t v = (uint32_t)value - (uint32_t)lo;
+      uint32_t bin = (uint32_t)((v * mult) >> 32);
+      bins[j] = value < lo ? below : value > hi ? above : bin;
+    }
+  } else {
+    /* The exponent and top mantissa bits of a float are the octave and
+       the bin inside it. Conversion is exact below 2^24, larger values
+       are shifted down first. The selects are masks: a conditional int
+       to float conversion keeps the loop from vectorizing. */
+    uint32_t s = spec->sub_bits, small = 1u << s;
+    uint32_t base = ((127 + s) << s) - small;
+#pragma omp simd reduction(min : min) reduction(max : max)
+    for (uint32_t j = 0; j < n; j++) {
+      int value = x[j];
+      min = value < min ? value : min;
+      max = value > max ? value : max;
+      uint32_t v = (uint32_t)value - (uint32_t)lo;
+      uint32_t large = -(uint32_t)(v >> 24 != 0);
+      union FloatBits bits;
+      bits.f = (float)(int)(((v >> 8) & large) | (v & ~large));
+      uint32_t bin = (bits.u >> (23 - s)) - base + ((8u << s) & large);
+      uint32_t linear = -(uint32_t)(v < small);
+      bin = (v & linear) | (bin & ~linear);
+      uint32_t out = -(uint32_t)(value < lo || value > hi);
+      bins[j] = ((value < lo ? below : above) & out) | (bin & ~out);
+    }
+  }
+  *min_out = min;
+  *max_out = max;
+}
+
+static void FlushLanes(uint64_t *counts, uint32_t lanes[][HIST_LANE_SLOTS],
+                       uint32_t slots) {
+  for (uint32_t b = 0; b < slots; b++) {
+    counts[b] += (uint64_t)lanes[0][b] + lanes[1][b] + lanes[2][b] +
+                 lanes[3][b];
+    lanes[0][b] = lanes[1][b] = lanes[2][b] = lanes[3][b] = 0;
+  }
+}
+
+static void HistIdentity(void *out, const void *context) {
+  const struct HistContext *ctx = context;
+  struct Histogram *hist = out;
+  memset(hist, 0, HistogramSize(ctx->spec));
+  hist->spec = *ctx->spec;
+  hist->min = INT_MAX;
+  hist->max = INT_MIN;
+}
+
+static void HistRange(void *out, const void *context, uint64_t begin,
+                      uint64_t end) {
+  const struct HistContext *ctx = context;
+  struct Histogram *hist = out;
+  uint64_t *counts = hist->counts;
+  uint32_t slots = hist->spec.bins + 2;
+  bool use_lanes = slots <= HIST_LANE_SLOTS;
+  uint32_t lanes[HIST_LANES][HIST_LANE_SLOTS];
+  uint32_t bins[HIST_BLOCK];
+  uint64_t since_flush = 0;
+
+  if (use_lanes) {
+    for (int l = 0; l < HIST_LANES; l++)
+      memset(lanes[l], 0, slots * sizeof(uint32_t));
+  }
+
+  for (uint64_t i = begin; i < end; i += HIST_BLOCK) {
+    uint32_t n = end - i < HIST_BLOCK ? end - i : HIST_BLOCK;
+    BinBlock(&hist->spec, ctx->array + i, n, bins, &hist->min, &hist->max);
+    if (!use_lanes) {
+      for (uint32_t j = 0; j < n; j++)
+        counts[bins[j]]++;
+      continue;
+    }
+    uint32_t j = 0;
+    for (; j + HIST_LANES <= n; j += HIST_LANES) {
+      lanes[0][bins[j]]++;
+      lanes[1][bins[j + 1]]++;
+      lanes[2][bins[j + 2]]++;
+      lanes[3][bins[j + 3]]++;
+    }
+    for (; j < n; j++)
+      lanes[0][bins[j]]++;
+    since_flush += n;
+    if (since_flush >= HIST_LANE_FLUSH) {
+      FlushLanes(counts, lanes, slots);
+      since_flush = 0;
+    }
+  }
+  if (use_lanes)
+    FlushLanes(counts, lanes, slots);
+  hist->count += end - begin;
+}
+
+static void HistCombine(void *out, const void *in, const void *ctx) {
+  struct Histogram *hist = out;
+  const struct Histogram *other = in;
+  uint32_t slots = hist->spec.bins + 2;
+#pragma omp simd
+  for (uint32_t b = 0; b < slots; b++)
+    hist->counts[b] += other->counts[b];
+  hist->count += other->count;
+  hist->min = other->min < hist->min ? other->min : hist->min;
+  hist->max = other->max > hist->max ? other->max : hist->max;
+}
+
+bool ParallelHistogram(const int *array, uint64_t begin, uint64_t end,
+                       const struct PreduceConfig *config,
+                       struct Histogram *hist) {
+  struct HistSpec spec = hist->spec;
+  struct HistContext ctx = {array, &spec};
+  /* The accumulator size depends on the bins, so the ops are per call. */
+  struct PreduceOps ops = {HistogramSize(&spec), HistIdentity, HistRange,
+                           HistCombine};
+  if (config == NULL || config->backend == PREDUCE_SERIAL) {
+    HistIdentity(hist, &ctx);
+    HistRange(hist, &ctx, begin, end);
+    return true;
+  }
+  return PreduceRun(&ops, &ctx, begin, end, config, hist);
+}
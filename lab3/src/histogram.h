@@ -0,0 +1,52 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "preduce.h"
+
+enum HistScale {
+  HIST_LINEAR, /* bins of equal width */
+  HIST_LOG,    /* 2^sub_bits bins per power of two above lo */
+};
+
+/* Bins over [lo, hi]. HistSpecInit picks the layout closest to the
+   requested number of bins, bins holds the number actually used. */
+struct HistSpec {
+  enum HistScale scale;
+  uint32_t bins;
+  int lo;
+  int hi;
+  uint64_t mult;     /* linear: bin of x is (x - lo) * mult >> 32 */
+  uint32_t sub_bits; /* log: values below lo + 2^sub_bits get own bins */
+};
+
+#define HIST_MAX_BINS 65536
+
+bool HistSpecInit(struct HistSpec *spec, enum HistScale scale, uint32_t bins,
+                  int lo, int hi);
+/* Smallest value that falls into bin, bins itself gives hi + 1. */
+int64_t HistBinLow(const struct HistSpec *spec, uint32_t bin);
+
+/* counts[spec.bins] and counts[spec.bins + 1] count the values below lo
+   and above hi. min and max come from the same pass, over all values. */
+struct Histogram {
+  struct HistSpec spec;
+  uint64_t count;
+  int min;
+  int max;
+  uint64_t counts[];
+};
+
+size_t HistogramSize(const struct HistSpec *spec);
+struct Histogram *HistogramNew(const struct HistSpec *spec);
+
+/* Histogram of array[begin, end), config NULL means serial. Every worker
+   fills a private copy of the bins, the copies are merged at the end. */
+bool ParallelHistogram(const int *array, uint64_t begin, uint64_t end,
+                       const struct PreduceConfig *config,
+                       struct Histogram *hist);
+
+#endif
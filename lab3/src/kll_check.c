@@ -0,0 +1,183 @@
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "selection.h"
+#include "utils.h"
+
+/* Builds one KLL sketch per worker slice, sends each through
+   KllPack/KllUnpack as a server would and merges them. The merged copy
+   must give the same quantiles as merging the sketches directly, and
+   both must stay within the rank error of the exact order statistics. */
+
+static int CompareInts(const void *a, const void *b) {
+  int x = *(const int *)a, y = *(const int *)b;
+  return (x > y) - (x < y);
+}
+
+/* Distance from the rank of value in sorted to target, as a fraction
+   of n. Equal values cover a range of ranks. */
+static double RankError(const int *sorted, size_t n, int value, double target) {
+  size_t lo = 0, hi = n;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (sorted[mid] < value)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  size_t first = lo;
+  hi = n;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (sorted[mid] <= value)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  double last = lo > first ? lo - 1 : first;
+  if (target < first)
+    return (first - target) / n;
+  if (target > last)
+    return (target - last) / n;
+  return 0;
+}
+
+/* Packs sketch, unpacks it into out and checks that a short buffer is
+   refused. */
+static bool RoundTrip(const struct KllSketch *sketch, struct KllSketch *out) {
+  size_t size = KllPackedSize(sketch);
+  char *buf = malloc(size);
+  if (buf == NULL)
+    return false;
+  KllPack(sketch, buf);
+  bool ok = KllUnpack(out, buf, size) && !KllUnpack(out, buf, size - 1) &&
+            KllUnpack(out, buf, size);
+  free(buf);
+  return ok;
+}
+
+int main(int argc, char **argv) {
+  int seed = -1;
+  int array_size = -1;
+  int workers = 4;
+
+  while (true) {
+    static struct option options[] = {{"seed", required_argument, 0, 0},
+                                      {"array_size", required_argument, 0, 0},
+                                      {"workers", required_argument, 0, 0},
+                                      {0, 0, 0, 0}};
+
+    int option_index = 0;
+    int c = getopt_long(argc, argv, "", options, &option_index);
+
+    if (c == -1)
+      break;
+
+    switch (c) {
+    case 0:
+      switch (option_index) {
+      case 0:
+        seed = atoi(optarg);
+        if (seed <= 0) {
+          printf("seed must be a positive number\n");
+          return 1;
+        }
+        break;
+      case 1:
+        array_size = atoi(optarg);
+        if (array_size <= 0) {
+          printf("array_size must be a positive number\n");
+          return 1;
+        }
+        break;
+      case 2:
+        workers = atoi(optarg);
+        if (workers <= 0) {
+          printf("workers must be a positive number\n");
+          return 1;
+        }
+        break;
+      default:
+        printf("Index %d is out of options\n", option_index);
+      }
+      break;
+    case '?':
+      break;
+    default:
+      printf("getopt returned character code 0%o?\n", c);
+    }
+  }
+
+  if (seed == -1 || array_size == -1 || workers > array_size) {
+    printf("Usage: %s --seed \"num\" --array_size \"num\" "
+           "[--workers \"num\"]\n",
+           argv[0]);
+    return 1;
+  }
+
+  int *array = malloc(sizeof(int) * array_size);
+  struct KllSketch *sketches = malloc(sizeof(struct KllSketch) * 4);
+  if (array == NULL || sketches == NULL) {
+    printf("Error: not enough memory\n");
+    free(array);
+    free(sketches);
+    return 1;
+  }
+  GenerateArray(array, array_size, seed);
+
+  struct KllSketch *part = &sketches[0];
+  struct KllSketch *direct = &sketches[1];
+  struct KllSketch *received = &sketches[2];
+  struct KllSketch *copy = &sketches[3];
+  KllInit(direct);
+  KllInit(received);
+  bool ok = true;
+  for (int w = 0; w < workers && ok; w++) {
+    size_t begin = (size_t)array_size * w / workers;
+    size_t end = (size_t)array_size * (w + 1) / workers;
+    KllInit(part);
+    for (size_t i = begin; i < end; i++)
+      KllAdd(part, array[i]);
+    KllMerge(direct, part);
+
+    ok = RoundTrip(part, copy);
+    if (ok)
+      KllMerge(received, copy);
+  }
+  if (!ok) {
+    printf("Error: a sketch did not survive pack and unpack\n");
+    free(array);
+    free(sketches);
+    return 1;
+  }
+
+  qsort(array, array_size, sizeof(int), CompareInts);
+  /* Twice the expected rank error leaves room for unlucky seeds, one
+     more element for how a quantile rounds to a rank. */
+  double limit = 2 * 1.7 / KLL_K + 1.0 / array_size;
+  static const double quantiles[] = {0, 0.01, 0.1, 0.25, 0.5,
+                                     0.75, 0.9, 0.99, 1};
+  for (size_t i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); i++) {
+    double q = quantiles[i];
+    int expected, value;
+    if (!KllQuantile(direct, q, &expected) ||
+        !KllQuantile(received, q, &value)) {
+      printf("Error: not enough memory\n");
+      ok = false;
+      break;
+    }
+    double error = RankError(array, array_size, value, q * (array_size - 1));
+    printf("Quantile %g: %d (direct %d, rank error %.4f)\n", q, value,
+           expected, error);
+    if (value != expected || error > limit)
+      ok = false;
+  }
+  printf("%s\n", ok ? "Packed sketches merge like direct ones"
+                    : "Packed sketches differ");
+
+  free(array);
+  free(sketches);
+  return ok ? 0 : 1;
+}
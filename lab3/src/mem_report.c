@@ -0,0 +1,125 @@
+#include "mem_report.h"
+
+#include <ctype.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <sys/resource.h>
+
+static pthread_mutex_t report_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct MemUsage previous;
+
+/* Adds up the "Key: value kB" lines of a /proc file whose key is one
+   of keys[i] into values[i]. */
+static bool ReadKeys(const char *path, const char *const *keys,
+                     uint64_t *const *values, int count) {
+  FILE *file = fopen(path, "r");
+  if (file == NULL)
+    return false;
+  char line[256];
+  while (fgets(line, sizeof(line), file) != NULL) {
+    char *colon = strchr(line, ':');
+    if (colon == NULL)
+      continue;
+    *colon = '\0';
+    for (int i = 0; i < count; i++) {
+      unsigned long long kb;
+      if (strcmp(line, keys[i]) == 0 && sscanf(colon + 1, "%llu", &kb) == 1)
+        *values[i] += kb;
+    }
+  }
+  fclose(file);
+  return true;
+}
+
+/* Mapping headers start with the lower case hex address, fields with an
+   upper case key. */
+static bool ReadMappings(struct MemUsage *usage) {
+  FILE *file = fopen("/proc/self/smaps", "r");
+  if (file == NULL)
+    return false;
+  char line[512];
+  uint64_t *current = NULL;
+  while (fgets(line, sizeof(line), file) != NULL) {
+    if (!isupper((unsigned char)line[0])) {
+      char path[256] = "";
+      sscanf(line, "%*s %*s %*s %*s %*s %255[^\n]", path);
+      if (path[0] == '\0' || strncmp(path, "[anon", 5) == 0)
+        current = &usage->mmap_kb;
+      else if (strcmp(path, "[heap]") == 0)
+        current = &usage->heap_kb;
+      else if (strncmp(path, "[stack", 6) == 0)
+        current = &usage->stack_kb;
+      else if (path[0] == '/')
+        current = &usage->file_kb;
+      else
+        current = NULL; /* vdso and the like */
+      continue;
+    }
+    unsigned long long kb;
+    if (current != NULL && sscanf(line, "Rss: %llu", &kb) == 1)
+      *current += kb;
+  }
+  fclose(file);
+  return true;
+}
+
+bool MemUsageRead(struct MemUsage *usage) {
+  memset(usage, 0, sizeof(*usage));
+  struct rusage self, children;
+  getrusage(RUSAGE_SELF, &self);
+  getrusage(RUSAGE_CHILDREN, &children);
+  usage->minor_faults = self.ru_minflt;
+  usage->major_faults = self.ru_majflt;
+  usage->children_peak_rss_kb = children.ru_maxrss;
+  usage->children_minor_faults = children.ru_minflt;
+  usage->children_major_faults = children.ru_majflt;
+
+  const char *status_keys[] = {"VmRSS", "VmHWM"};
+  uint64_t *status_values[] = {&usage->rss_kb, &usage->peak_rss_kb};
+  const char *rollup_keys[] = {"AnonHugePages", "ShmemPmdMapped",
+                               "FilePmdMapped", "Shared_Hugetlb",
+                               "Private_Hugetlb"};
+  uint64_t *rollup_values[] = {&usage->thp_kb, &usage->pmd_mapped_kb,
+                               &usage->pmd_mapped_kb, &usage->hugetlb_kb,
+                               &usage->hugetlb_kb};
+  return ReadKeys("/proc/self/status", status_keys, status_values, 2) &&
+         ReadKeys("/proc/self/smaps_rollup", rollup_keys, rollup_values, 5) &&
+         ReadMappings(usage);
+}
+
+void MemReportPhase(const char *phase) {
+  struct MemUsage usage;
+  pthread_mutex_lock(&report_lock);
+  if (!MemUsageRead(&usage)) {
+    printf("Memory after %s: /proc/self is not readable\n", phase);
+    pthread_mutex_unlock(&report_lock);
+    return;
+  }
+  printf("Memory after %s:\n", phase);
+  printf("  RSS: %" PRIu64 " kB, peak %" PRIu64 " kB\n", usage.rss_kb,
+         usage.peak_rss_kb);
+  printf("  Faults: %" PRIu64 " minor, %" PRIu64 " major (+%" PRIu64
+         ", +%" PRIu64 ")\n",
+         usage.minor_faults, usage.major_faults,
+         usage.minor_faults - previous.minor_faults,
+         usage.major_faults - previous.major_faults);
+  printf("  Huge pages: %" PRIu64 " kB THP, %" PRIu64 " kB file/shmem, %" PRIu64
+         " kB hugetlb\n",
+         usage.thp_kb, usage.pmd_mapped_kb, usage.hugetlb_kb);
+  printf("  Mappings: heap %" PRIu64 " kB, mmap %" PRIu64 " kB, file %" PRIu64
+         " kB, stack %" PRIu64 " kB\n",
+         usage.heap_kb, usage.mmap_kb, usage.file_kb, usage.stack_kb);
+  if (usage.children_minor_faults + usage.children_major_faults > 0)
+    printf("  Children: peak RSS %" PRIu64 " kB, %" PRIu64 " minor, %" PRIu64
+           " major faults (+%" PRIu64 ", +%" PRIu64 ")\n",
+           usage.children_peak_rss_kb, usage.children_minor_faults,
+           usage.children_major_faults,
+           usage.children_minor_faults - previous.children_minor_faults,
+           usage.children_major_faults - previous.children_major_faults);
+  previous = usage;
+  fflush(stdout);
+  pthread_mutex_unlock(&report_lock);
+}
@@ -0,0 +1,38 @@
+#ifndef MEM_REPORT_H
+#define MEM_REPORT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Memory footprint of this process, for sizing machines. Sizes are in
+   kB as /proc reports them. Pages from the hugetlb pool (arena 1G and
+   2M pages) are not part of RSS, they only show in hugetlb_kb. */
+struct MemUsage {
+  uint64_t rss_kb;
+  uint64_t peak_rss_kb;
+  uint64_t minor_faults;
+  uint64_t major_faults;
+  /* From /proc/self/smaps_rollup. */
+  uint64_t thp_kb;        /* AnonHugePages */
+  uint64_t pmd_mapped_kb; /* file and shmem mapped with huge pages */
+  uint64_t hugetlb_kb;
+  /* RSS by mapping, from /proc/self/smaps: heap is what malloc gets
+     from brk, mmap the other anonymous mappings (large allocations,
+     arenas, thread stacks). */
+  uint64_t heap_kb;
+  uint64_t mmap_kb;
+  uint64_t file_kb;
+  uint64_t stack_kb;
+  /* Of the children reaped so far, e.g. forked preduce workers. */
+  uint64_t children_peak_rss_kb;
+  uint64_t children_minor_faults;
+  uint64_t children_major_faults;
+};
+
+bool MemUsageRead(struct MemUsage *usage);
+
+/* Prints the usage under the phase name, with the faults taken since
+   the previous phase. Safe to call from several threads. */
+void MemReportPhase(const char *phase);
+
+#endif
@@ -1,5 +1,7 @@
 #include <ctype.h>
+#include <errno.h>
 #include <limits.h>
+#include <math.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -15,20 +17,115 @@
 
 #include <getopt.h>
 
+#include "arena.h"
+#include "array_file.h"
 #include "find_min_max.h"
+#include "histogram.h"
+#include "mem_report.h"
+#include "selection.h"
+#include "stats.h"
+#include "typed.h"
 #include "utils.h"
 
-pid_t *child_pids = NULL;
-int child_count = 0;
+/* --quantiles and --topk. The sketch and the top-K heaps are built by the
+   forked workers, exact quantiles come from the threaded selection. */
+static int PrintSelection(int *array, int array_size,
+                          const struct PreduceConfig *config,
+                          const char *quantiles, int topk) {
+  if (quantiles != NULL) {
+    struct KllSketch *sketch = malloc(sizeof(struct KllSketch));
+    if (sketch == NULL ||
+        !PreduceRun(&KllOps, array, 0, array_size, config, sketch)) {
+      perror("quantile sketch failed");
+      free(sketch);
+      return 1;
+    }
 
-void timeout_handler(int sig) {
-    if (child_pids != NULL) {
-        for (int i = 0; i < child_count; i++) {
-            if (child_pids[i] > 0) {
-                kill(child_pids[i], SIGKILL);
-            }
-        }
+    char *list = strdup(quantiles), *save = NULL;
+    for (char *item = strtok_r(list, ",", &save); item != NULL;
+         item = strtok_r(NULL, ",", &save)) {
+      double q = atof(item);
+      int exact, estimate;
+      if (q < 0 || q > 1 ||
+          !ParallelSelect(array, array_size, (size_t)(q * (array_size - 1)),
+                          config->workers, &exact)) {
+        printf("quantile %s must be in [0, 1]\n", item);
+        free(list);
+        free(sketch);
+        return 1;
+      }
+      if (!KllQuantile(sketch, q, &estimate)) {
+        perror("quantile failed");
+        free(list);
+        free(sketch);
+        return 1;
+      }
+      printf("Quantile %g: %d (sketch: %d)\n", q, exact, estimate);
+    }
+    free(list);
+    free(sketch);
+  }
+
+  if (topk > 0) {
+    int *top = malloc(topk * sizeof(int));
+    uint32_t count = 0;
+    if (top == NULL ||
+        !ParallelTopK(array, array_size, topk, config, top, &count)) {
+      perror("top-k failed");
+      free(top);
+      return 1;
     }
+    printf("Top %u:", count);
+    for (uint32_t i = 0; i < count; i++)
+      printf(" %d", top[i]);
+    printf("\n");
+    free(top);
+  }
+  return 0;
+}
+
+/* The array is either generated into the arena or mapped from --input,
+   whichever is unused is empty. */
+static void FreeArray(struct Arena *arena, struct ArrayFile *file) {
+  ArrayFileClose(file);
+  ArenaFree(arena);
+}
+
+/* Non-empty bins as [first, last] value ranges. */
+static void PrintHistogram(const struct Histogram *hist) {
+  const struct HistSpec *spec = &hist->spec;
+  printf("Min: %d\n", hist->min);
+  printf("Max: %d\n", hist->max);
+  printf("Bins: %u %s\n", spec->bins,
+         spec->scale == HIST_LOG ? "log" : "linear");
+  for (uint32_t b = 0; b < spec->bins; b++) {
+    if (hist->counts[b] > 0)
+      printf("[%ld, %ld]: %lu\n", HistBinLow(spec, b),
+             HistBinLow(spec, b + 1) - 1, hist->counts[b]);
+  }
+  if (hist->counts[spec->bins] > 0)
+    printf("Below %d: %lu\n", spec->lo, hist->counts[spec->bins]);
+  if (hist->counts[spec->bins + 1] > 0)
+    printf("Above %d: %lu\n", spec->hi, hist->counts[spec->bins + 1]);
+}
+
+/* What a --timeout left out, when the workers did not all finish. */
+static void PrintPartial(const struct PreducePartial *partial, int timeout) {
+  if (partial->covered == partial->total)
+    return;
+  printf("Timed out after %d seconds, partial result over %lu of %lu "
+         "elements (%.1f%%)\n",
+         timeout, partial->covered, partial->total,
+         100.0 * partial->covered / partial->total);
+  printf("Finished chunks: %lu of %lu\n", partial->finished,
+         partial->chunk_count);
+  for (uint64_t i = 0; i < partial->chunk_count; i++) {
+    const struct PreduceChunk *chunk = &partial->chunks[i];
+    uint64_t size = chunk->end - chunk->begin;
+    if (chunk->covered < size)
+      printf("Chunk %lu [%lu, %lu): %.1f%%\n", i, chunk->begin, chunk->end,
+             100.0 * chunk->covered / size);
+  }
 }
 
 int main(int argc, char **argv) {
@@ -37,6 +134,20 @@ int main(int argc, char **argv) {
   int pnum = -1;
   int timeout = 0;
   bool with_files = false;
+  bool with_stats = false;
+  enum ElemType type = ELEM_I32;
+  const char *quantiles = NULL;
+  int topk = 0;
+  int hist_bins = 0;
+  enum HistScale hist_scale = HIST_LINEAR;
+  /* GenerateArray draws from rand(). */
+  int hist_lo = 0, hist_hi = RAND_MAX;
+  const char *input = NULL;
+  const char *output = NULL;
+  enum ArenaPages pages = ARENA_PAGES_1G;
+  enum ArenaPrefault prefault = ARENA_PREFAULT_NONE;
+  bool arena_report = false;
+  bool mem_report = false;
 
   while (true) {
     int current_optind = optind ? optind : 1;
@@ -46,10 +157,22 @@ int main(int argc, char **argv) {
                                       {"pnum", required_argument, 0, 0},
                                       {"timeout", required_argument, 0, 't'},
                                       {"by_files", no_argument, 0, 'f'},
+                                      {"stats", no_argument, 0, 's'},
+                                      {"type", required_argument, 0, 0},
+                                      {"quantiles", required_argument, 0, 0},
+                                      {"topk", required_argument, 0, 0},
+                                      {"hist", required_argument, 0, 0},
+                                      {"log_bins", no_argument, 0, 0},
+                                      {"hist_range", required_argument, 0, 0},
+                                      {"input", required_argument, 0, 0},
+                                      {"output", required_argument, 0, 0},
+                                      {"pages", required_argument, 0, 0},
+                                      {"prefault", required_argument, 0, 0},
+                                      {"mem-report", no_argument, 0, 0},
                                       {0, 0, 0, 0}};
 
     int option_index = 0;
-    int c = getopt_long(argc, argv, "ft:", options, &option_index);
+    int c = getopt_long(argc, argv, "fst:", options, &option_index);
 
     if (c == -1) break;
 
@@ -80,6 +203,62 @@ int main(int argc, char **argv) {
           case 3:
             with_files = true;
             break;
+          case 6:
+            if (!ElemTypeParse(optarg, &type)) {
+                printf("type must be int8, int16, int32, int64, float or double\n");
+                return 1;
+            }
+            break;
+          case 7:
+            quantiles = optarg;
+            break;
+          case 8:
+            topk = atoi(optarg);
+            if (topk <= 0 || topk > TOPK_MAX) {
+                printf("topk must be in [1, %d]\n", TOPK_MAX);
+                return 1;
+            }
+            break;
+          case 9:
+            hist_bins = atoi(optarg);
+            if (hist_bins <= 0 || hist_bins > HIST_MAX_BINS) {
+                printf("hist must be in [1, %d]\n", HIST_MAX_BINS);
+                return 1;
+            }
+            break;
+          case 10:
+            hist_scale = HIST_LOG;
+            break;
+          case 11:
+            if (sscanf(optarg, "%d:%d", &hist_lo, &hist_hi) != 2 ||
+                hist_lo > hist_hi) {
+                printf("hist_range must be \"lo:hi\" with lo <= hi\n");
+                return 1;
+            }
+            break;
+          case 12:
+            input = optarg;
+            break;
+          case 13:
+            output = optarg;
+            break;
+          case 14:
+            if (!ArenaPagesParse(optarg, &pages)) {
+                printf("pages must be 1g, 2m, thp or 4k\n");
+                return 1;
+            }
+            arena_report = true;
+            break;
+          case 15:
+            if (!ArenaPrefaultParse(optarg, &prefault)) {
+                printf("prefault must be none, populate or workers\n");
+                return 1;
+            }
+            arena_report = true;
+            break;
+          case 16:
+            mem_report = true;
+            break;
 
           default:
             printf("Index %d is out of options\n", option_index);
@@ -95,6 +274,9 @@ int main(int argc, char **argv) {
       case 'f':
         with_files = true;
         break;
+      case 's':
+        with_stats = true;
+        break;
 
       case '?':
         break;
@@ -109,190 +291,180 @@ int main(int argc, char **argv) {
     return 1;
   }
 
-  if (seed == -1 || array_size == -1 || pnum == -1) {
-    printf("Usage: %s --seed \"num\" --array_size \"num\" --pnum \"num\" [--timeout \"num\"] [--by_files]\n",
+  if ((input == NULL && (seed == -1 || array_size == -1)) || pnum == -1) {
+    printf("Usage: %s (--seed \"num\" --array_size \"num\" | --input \"file\") --pnum \"num\" [--output \"file\"] [--timeout \"num\"] [--by_files] [--stats] [--type \"name\"] [--quantiles \"q,...\"] [--topk \"num\"] [--hist \"bins\" [--log_bins] [--hist_range \"lo:hi\"]] [--pages 1g|2m|thp|4k] [--prefault none|populate|workers] [--mem-report]\n",
            argv[0]);
     return 1;
   }
 
-  if (timeout > 0) {
-      child_pids = malloc(pnum * sizeof(pid_t));
-      if (child_pids == NULL) {
-          perror("malloc failed");
-          return 1;
-      }
-      child_count = pnum;
-      for (int i = 0; i < pnum; i++) {
-          child_pids[i] = -1;
-      }
-      signal(SIGALRM, timeout_handler);
+  struct PreduceConfig config = {.backend = PREDUCE_FORK,
+                                 .workers = pnum,
+                                 .timeout = timeout,
+                                 .by_files = with_files};
+
+  /* A mapped input is used in place, every worker only touches the
+     pages of its own slice. */
+  struct ArrayFile file = {0};
+  struct Arena arena = {0};
+  void *array;
+  if (input != NULL) {
+    if (!ArrayFileOpen(&file, input)) {
+      perror("can not open input");
+      return 1;
+    }
+    if (file.count == 0 || file.count > INT_MAX) {
+      printf("input must hold 1 to %d elements\n", INT_MAX);
+      ArrayFileClose(&file);
+      return 1;
+    }
+    array = (void *)file.data;
+    array_size = file.count;
+    type = file.type;
+  } else {
+    if (!ArenaInit(&arena, (size_t)array_size * ElemTypeSize(type), pages,
+                   prefault, &config)) {
+      perror("can not map the array");
+      return 1;
+    }
+    uint64_t faults = ArenaPageFaults();
+    struct timeval fill_start, fill_end;
+    gettimeofday(&fill_start, NULL);
+    array = FillTypedArray(type, ArenaAlloc(&arena, arena.size), array_size,
+                           seed);
+    gettimeofday(&fill_end, NULL);
+    if (arena_report) {
+      printf("Pages: %s\n", ArenaPagesName(arena.pages));
+      printf("Map and prefault: %fms, %lu page faults\n", arena.init_ms,
+             arena.init_faults);
+      printf("Generate: %fms, %lu page faults\n",
+             (fill_end.tv_sec - fill_start.tv_sec) * 1000.0 +
+                 (fill_end.tv_usec - fill_start.tv_usec) / 1000.0,
+             ArenaPageFaults() - faults);
+    }
   }
+  if (mem_report)
+    MemReportPhase(input != NULL ? "load" : "generate");
 
+  if ((with_stats || quantiles != NULL || topk > 0 || hist_bins > 0) &&
+      type != ELEM_I32) {
+    printf("--stats, --quantiles, --topk and --hist support only int32 arrays\n");
+    FreeArray(&arena, &file);
+    return 1;
+  }
 
-  int *array = malloc(sizeof(int) * array_size);
-  GenerateArray(array, array_size, seed);
-  int active_child_processes = 0;
-
-  int **pipes = NULL;
-  if (!with_files) {
-    pipes = malloc(pnum * sizeof(int *));
-    for (int i = 0; i < pnum; i++) {
-      pipes[i] = malloc(2 * sizeof(int));
-      if (pipe(pipes[i]) == -1) {
-        perror("pipe failed");
-        return 1;
-      }
-    }
+  if (output != NULL && !ArrayFileWrite(output, type, array, array_size)) {
+    perror("can not write output");
+    FreeArray(&arena, &file);
+    return 1;
   }
 
   struct timeval start_time;
   gettimeofday(&start_time, NULL);
 
-  for (int i = 0; i < pnum; i++) {
-    pid_t child_pid = fork();
-    if (child_pid >= 0) {
-      // successful fork
-      active_child_processes += 1;
-
-      if (timeout > 0){
-        child_pids[i] = child_pid;
-      }
-      if (child_pid == 0) {
-        // child process
-        
-        int chunk_size = array_size / pnum;
-        int start = i * chunk_size;
-        int end = (i == pnum - 1) ? array_size : (i + 1) * chunk_size;
-        
-        struct MinMax local_min_max = GetMinMax(array, start, end);
-        
-        if (with_files) {
-          char filename[20];
-          sprintf(filename, "minmax_%d.txt", i);
-          
-          FILE *file = fopen(filename, "w");
-          if (file == NULL) {
-            perror("fopen failed");
-            exit(1);
-          }
-          fprintf(file, "%d %d", local_min_max.min, local_min_max.max);
-          fclose(file);
-        } else {
-          close(pipes[i][0]); 
-          
-          write(pipes[i][1], &local_min_max.min, sizeof(int));
-          write(pipes[i][1], &local_min_max.max, sizeof(int));
-          
-          close(pipes[i][1]);
-        }
-        
-        free(array);
-        if (!with_files) {
-          for (int j = 0; j < pnum; j++) {
-            if (pipes[j]) free(pipes[j]);
-          }
-          free(pipes);
-        }
-        exit(0);
-      }
-
-    } else {
-      printf("Fork failed!\n");
-      return 1;
-    }
+  if (quantiles != NULL || topk > 0) {
+    int result = PrintSelection(array, array_size, &config, quantiles, topk);
+    if (mem_report)
+      MemReportPhase("selection");
+    struct timeval finish_time;
+    gettimeofday(&finish_time, NULL);
+    printf("Elapsed time: %fms\n",
+           (finish_time.tv_sec - start_time.tv_sec) * 1000.0 +
+               (finish_time.tv_usec - start_time.tv_usec) / 1000.0);
+    FreeArray(&arena, &file);
+    return result;
   }
 
-  if (timeout > 0){
-    alarm(timeout);
-  }
-
-
- while (active_child_processes > 0) {
-    int status;
-    pid_t finished_pid = waitpid(-1, &status, 0);
-    
-    if (finished_pid > 0) {
-      active_child_processes -= 1;
-      
-      if (timeout > 0) {
-        // Обновляем массив child_pids
-        for (int i = 0; i < pnum; i++) {
-          if (child_pids[i] == finished_pid) {
-            child_pids[i] = -1;
-            break;
-          }
-        }
-        
-        if (WIFSIGNALED(status)) {
-          printf("Child process %d killed by signal: %d\n", 
-                 finished_pid, WTERMSIG(status));
-        } else if (WIFEXITED(status)) {
-          printf("Child process %d exited normally with status: %d\n",
-                 finished_pid, WEXITSTATUS(status));
-        }
-      }
+  /* From here on a timeout gives the result over what was covered. */
+  struct PreducePartial partial = {0};
+  if (timeout > 0)
+    config.partial = &partial;
+
+  /* The histogram pass finds min and max as well. */
+  if (hist_bins > 0) {
+    struct HistSpec spec;
+    HistSpecInit(&spec, hist_scale, hist_bins, hist_lo, hist_hi);
+    struct Histogram *hist = HistogramNew(&spec);
+    if (hist == NULL ||
+        !ParallelHistogram(array, 0, array_size, &config, hist)) {
+      if (errno == ETIMEDOUT)
+        printf("Timed out after %d seconds\n", timeout);
+      else
+        perror("histogram failed");
+      free(hist);
+      free(partial.chunks);
+      FreeArray(&arena, &file);
+      return 1;
     }
-  }
-
-  if (timeout > 0) {
-    alarm(0);
+    if (mem_report)
+      MemReportPhase("histogram");
+    struct timeval finish_time;
+    gettimeofday(&finish_time, NULL);
+    double elapsed_time =
+        (finish_time.tv_sec - start_time.tv_sec) * 1000.0 +
+        (finish_time.tv_usec - start_time.tv_usec) / 1000.0;
+    PrintHistogram(hist);
+    PrintPartial(&partial, timeout);
+    printf("Rate: %.1f Melem/s\n", array_size / elapsed_time / 1000);
+    printf("Elapsed time: %fms\n", elapsed_time);
+    free(hist);
+    free(partial.chunks);
+    FreeArray(&arena, &file);
+    return 0;
   }
 
   struct MinMax min_max;
-  min_max.min = INT_MAX;
-  min_max.max = INT_MIN;
-
-  for (int i = 0; i < pnum; i++) {
-    int min = INT_MAX;
-    int max = INT_MIN;
-
-    if (with_files) {
-      char filename[20];
-      sprintf(filename, "minmax_%d.txt", i);
-      
-      FILE *file = fopen(filename, "r");
-      if (file == NULL) {
-        perror("fopen failed");
-        return 1;
-      }
-      fscanf(file, "%d %d", &min, &max);
-      fclose(file);
-      remove(filename);
-    } else {
-      close(pipes[i][1]); 
-      
-      read(pipes[i][0], &min, sizeof(int));
-      read(pipes[i][0], &max, sizeof(int));
-      
-      close(pipes[i][0]);
-    }
-
-    if (min < min_max.min) min_max.min = min;
-    if (max > min_max.max) min_max.max = max;
+  struct Stats stats;
+  struct TypedMinMax typed;
+  bool ok;
+  if (with_stats)
+    ok = GetStats(array, 0, array_size, &config, &stats);
+  else if (type == ELEM_I32)
+    ok = ParallelMinMax(array, 0, array_size, &config, &min_max);
+  else
+    ok = TypedMinMax(type, array, 0, array_size, &config, &typed);
+  if (!ok) {
+    if (errno == ETIMEDOUT)
+      printf("Timed out after %d seconds\n", timeout);
+    else
+      perror("child processes failed");
+    free(partial.chunks);
+    FreeArray(&arena, &file);
+    return 1;
   }
 
   struct timeval finish_time;
   gettimeofday(&finish_time, NULL);
+  if (mem_report)
+    MemReportPhase(with_stats ? "stats" : "min/max");
 
   double elapsed_time = (finish_time.tv_sec - start_time.tv_sec) * 1000.0;
   elapsed_time += (finish_time.tv_usec - start_time.tv_usec) / 1000.0;
 
-  free(array);
-  if (!with_files) {
-    for (int i = 0; i < pnum; i++) {
-      if (pipes[i]) free(pipes[i]);
-    }
-    free(pipes);
+  FreeArray(&arena, &file);
+
+  if (with_stats) {
+    double variance = StatsVariance(&stats);
+    printf("Min: %d at %lu\n", stats.min, stats.argmin);
+    printf("Max: %d at %lu\n", stats.max, stats.argmax);
+    printf("Count: %lu\n", stats.count);
+    printf("Sum: %ld\n", stats.sum);
+    printf("Mean: %f\n", (double)stats.sum / stats.count);
+    printf("Variance: %f\n", variance);
+    printf("Stddev: %f\n", sqrt(variance));
+  } else if (type == ELEM_I32) {
+    printf("Min: %d\n", min_max.min);
+    printf("Max: %d\n", min_max.max);
+  } else {
+    char min[32], max[32];
+    FormatTypedScalar(min, sizeof(min), type, typed.min);
+    FormatTypedScalar(max, sizeof(max), type, typed.max);
+    printf("Min: %s\n", min);
+    printf("Max: %s\n", max);
+    if (typed.nans > 0)
+      printf("NaNs: %lu\n", typed.nans);
   }
-
-  if (child_pids != NULL) {
-    free(child_pids);
-    child_pids = NULL;
-    child_count = 0;
-  }
-
-  printf("Min: %d\n", min_max.min);
-  printf("Max: %d\n", min_max.max);
+  PrintPartial(&partial, timeout);
+  free(partial.chunks);
   printf("Elapsed time: %fms\n", elapsed_time);
   fflush(NULL);
   return 0;
@@ -0,0 +1,224 @@
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/time.h>
+
+#include "sample_sort.h"
+#include "utils.h"
+
+static double NowMs(void) {
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  return now.tv_sec * 1000.0 + now.tv_usec / 1000.0;
+}
+
+static int CompareInts(const void *a, const void *b) {
+  int x = *(const int *)a, y = *(const int *)b;
+  return (x > y) - (x < y);
+}
+
+static bool IsSorted(const int *array, size_t n) {
+  for (size_t i = 1; i < n; i++) {
+    if (array[i - 1] > array[i])
+      return false;
+  }
+  return true;
+}
+
+static bool IsFileSorted(const char *path, uint64_t expected) {
+  FILE *file = fopen(path, "rb");
+  if (file == NULL)
+    return false;
+  int buffer[65536], last = 0;
+  uint64_t total = 0;
+  size_t n;
+  bool sorted = true;
+  while (sorted && (n = fread(buffer, sizeof(int), 65536, file)) > 0) {
+    for (size_t i = 0; i < n; i++) {
+      if (total + i > 0 && buffer[i] < last)
+        sorted = false;
+      last = buffer[i];
+    }
+    total += n;
+  }
+  fclose(file);
+  return sorted && total == expected;
+}
+
+/* qsort, then the sample sort with 1, 2, 4, ... threads up to pnum. */
+static int Bench(const int *array, size_t n, int pnum) {
+  int *copy = malloc(n * sizeof(int));
+  if (copy == NULL) {
+    perror("malloc failed");
+    return 1;
+  }
+
+  memcpy(copy, array, n * sizeof(int));
+  double start = NowMs();
+  qsort(copy, n, sizeof(int), CompareInts);
+  double qsort_ms = NowMs() - start;
+  printf("qsort: %.1f Melem/s (%fms)\n", n / qsort_ms / 1000, qsort_ms);
+
+  double one_thread_ms = 0;
+  for (int threads = 1;; threads = threads * 2 < pnum ? threads * 2 : pnum) {
+    memcpy(copy, array, n * sizeof(int));
+    start = NowMs();
+    if (!SampleSort(copy, n, threads)) {
+      perror("sort failed");
+      free(copy);
+      return 1;
+    }
+    double ms = NowMs() - start;
+    if (threads == 1)
+      one_thread_ms = ms;
+    printf("threads %d: %.1f Melem/s (%fms), x%.2f vs qsort, x%.2f vs 1 "
+           "thread%s\n",
+           threads, n / ms / 1000, ms, qsort_ms / ms, one_thread_ms / ms,
+           IsSorted(copy, n) ? "" : ", NOT SORTED");
+    if (threads == pnum)
+      break;
+  }
+  free(copy);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  int seed = -1;
+  long long array_size = -1;
+  int pnum = -1;
+  bool bench = false;
+  long memory = 0;
+  const char *output = NULL;
+
+  while (true) {
+    static struct option options[] = {{"seed", required_argument, 0, 0},
+                                      {"array_size", required_argument, 0, 0},
+                                      {"pnum", required_argument, 0, 0},
+                                      {"bench", no_argument, 0, 0},
+                                      {"memory", required_argument, 0, 0},
+                                      {"output", required_argument, 0, 0},
+                                      {0, 0, 0, 0}};
+
+    int option_index = 0;
+    int c = getopt_long(argc, argv, "", options, &option_index);
+
+    if (c == -1) break;
+
+    switch (c) {
+      case 0:
+        switch (option_index) {
+          case 0:
+            seed = atoi(optarg);
+            if (seed <= 0) {
+                printf("seed must be a positive number\n");
+                return 1;
+            }
+            break;
+          case 1:
+            array_size = atoll(optarg);
+            if (array_size <= 0) {
+                printf("array_size must be a positive number\n");
+                return 1;
+            }
+            break;
+          case 2:
+            pnum = atoi(optarg);
+            if (pnum <= 0) {
+                printf("pnum must be a positive number\n");
+                return 1;
+            }
+            break;
+          case 3:
+            bench = true;
+            break;
+          case 4:
+            memory = atol(optarg);
+            if (memory <= 0) {
+                printf("memory must be a positive number of MiB\n");
+                return 1;
+            }
+            break;
+          case 5:
+            output = optarg;
+            break;
+
+          default:
+            printf("Index %d is out of options\n", option_index);
+        }
+        break;
+
+      case '?':
+        break;
+
+      default:
+        printf("getopt returned character code 0%o?\n", c);
+    }
+  }
+
+  if (seed == -1 || array_size == -1 || pnum == -1) {
+    printf("Usage: %s --seed \"num\" --array_size \"num\" --pnum \"num\" "
+           "[--bench] [--memory \"MiB\" --output \"file\"]\n",
+           argv[0]);
+    return 1;
+  }
+
+  /* Out of core: only memory MiB of the array are held at once. */
+  if (memory > 0) {
+    if (output == NULL) {
+      printf("--memory needs --output\n");
+      return 1;
+    }
+    double start = NowMs();
+    if (!ExternalSort(seed, array_size, memory * 1024 * 1024 / sizeof(int),
+                      pnum, output)) {
+      perror("external sort failed");
+      return 1;
+    }
+    double elapsed_time = NowMs() - start;
+    printf("Sorted: %s\n", IsFileSorted(output, array_size) ? "yes" : "no");
+    printf("Rate: %.1f Melem/s\n", array_size / elapsed_time / 1000);
+    printf("Elapsed time: %fms\n", elapsed_time);
+    return 0;
+  }
+
+  int *array = malloc(sizeof(int) * array_size);
+  GenerateArray(array, array_size, seed);
+
+  if (bench) {
+    int result = Bench(array, array_size, pnum);
+    free(array);
+    return result;
+  }
+
+  double start = NowMs();
+  if (!SampleSort(array, array_size, pnum)) {
+    perror("sort failed");
+    free(array);
+    return 1;
+  }
+  double elapsed_time = NowMs() - start;
+
+  if (output != NULL) {
+    FILE *file = fopen(output, "wb");
+    if (file == NULL ||
+        fwrite(array, sizeof(int), array_size, file) != (size_t)array_size) {
+      perror("write failed");
+      free(array);
+      return 1;
+    }
+    fclose(file);
+  }
+
+  printf("Sorted: %s\n", IsSorted(array, array_size) ? "yes" : "no");
+  printf("Min: %d\n", array[0]);
+  printf("Max: %d\n", array[array_size - 1]);
+  printf("Rate: %.1f Melem/s\n", array_size / elapsed_time / 1000);
+  printf("Elapsed time: %fms\n", elapsed_time);
+  free(array);
+  return 0;
+}
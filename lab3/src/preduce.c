@@ -0,0 +1,382 @@
+#define _GNU_SOURCE
+#include "preduce.h"
+#include "supervisor.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+
+struct PreduceJob {
+  const struct PreduceOps *ops;
+  const void *ctx;
+  const struct PreduceRemote *remote;
+  uint64_t begin;
+  uint64_t end;
+  uint64_t chunks;
+  char *accs; /* one accumulator per chunk */
+  /* Only for a partial result: per chunk, elements done shifted left by
+     one and the slot that holds their reduction. */
+  _Atomic uint64_t *progress;
+  char *slots; /* two accumulators per chunk */
+  _Atomic uint64_t next;
+  _Atomic bool failed;
+};
+
+/* The i-th of chunks nearly equal parts of [begin, end). */
+static void ChunkBounds(const struct PreduceJob *job, uint64_t i,
+                        uint64_t *chunk_begin, uint64_t *chunk_end) {
+  uint64_t length = job->end - job->begin;
+  uint64_t size = length / job->chunks, extra = length % job->chunks;
+  *chunk_begin = job->begin + i * size + (i < extra ? i : extra);
+  *chunk_end = *chunk_begin + size + (i < extra ? 1 : 0);
+}
+
+/* Elements between progress reports. */
+#define PROGRESS_STEP 65536
+
+/* The accumulator goes to the slot not named by the last report before
+   the next report names it, so a worker killed halfway through a copy
+   leaves a consistent one behind. */
+static void RunChunkReporting(struct PreduceJob *job, uint64_t i, void *acc,
+                              uint64_t chunk_begin, uint64_t chunk_end) {
+  size_t size = job->ops->acc_size;
+  char *slots = job->slots + 2 * i * size;
+  uint64_t step = 0;
+  for (uint64_t at = chunk_begin; at < chunk_end; step++) {
+    uint64_t next =
+        chunk_end - at > PROGRESS_STEP ? at + PROGRESS_STEP : chunk_end;
+    job->ops->range(acc, job->ctx, at, next);
+    at = next;
+    memcpy(slots + (step & 1) * size, acc, size);
+    atomic_store_explicit(&job->progress[i],
+                          (at - chunk_begin) << 1 | (step & 1),
+                          memory_order_release);
+  }
+}
+
+static void RunChunk(struct PreduceJob *job, uint64_t i) {
+  void *acc = job->accs + i * job->ops->acc_size;
+  uint64_t chunk_begin, chunk_end;
+  ChunkBounds(job, i, &chunk_begin, &chunk_end);
+
+  job->ops->identity(acc, job->ctx);
+  if (job->progress != NULL) {
+    RunChunkReporting(job, i, acc, chunk_begin, chunk_end);
+  } else if (job->remote != NULL) {
+    if (!job->remote->run(job->remote->remote, chunk_begin, chunk_end, acc))
+      atomic_store(&job->failed, true);
+  } else {
+    job->ops->range(acc, job->ctx, chunk_begin, chunk_end);
+  }
+}
+
+/* Workers claim chunks one by one, so uneven chunks balance out. */
+static void RunChunks(struct PreduceJob *job) {
+  for (;;) {
+    uint64_t i = atomic_fetch_add(&job->next, 1);
+    if (i >= job->chunks)
+      break;
+    RunChunk(job, i);
+  }
+}
+
+/* Pairwise tree over neighbouring chunks, which keeps range order. Each
+   combine joins two partials covering similar amounts of the range. */
+static void CombineChunks(const struct PreduceJob *job, void *acc) {
+  size_t size = job->ops->acc_size;
+  for (uint64_t stride = 1; stride < job->chunks; stride *= 2) {
+    for (uint64_t i = 0; i + stride < job->chunks; i += 2 * stride)
+      job->ops->combine(job->accs + i * size, job->accs + (i + stride) * size,
+                        job->ctx);
+  }
+  memcpy(acc, job->accs, size);
+}
+
+/* Threads are started on first use and kept for later reductions. One
+   job runs at a time, the calling thread works on it too. */
+static struct {
+  pthread_mutex_t run; /* serializes jobs */
+  pthread_mutex_t mutex;
+  pthread_cond_t wake;
+  pthread_cond_t done;
+  pthread_t threads[PREDUCE_MAX_WORKERS];
+  int size;
+  struct PreduceJob *job;
+  int job_workers;
+  uint64_t generation;
+  int active;
+} pool = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER,
+          PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER};
+
+static void *PoolWorker(void *arg) {
+  int index = (int)(intptr_t)arg;
+  /* Workers are started right before the job that needs them is
+     published, so a new worker always has that job to run. */
+  uint64_t seen = 0;
+
+  pthread_mutex_lock(&pool.mutex);
+  for (;;) {
+    while (pool.generation == seen)
+      pthread_cond_wait(&pool.wake, &pool.mutex);
+    seen = pool.generation;
+    if (index >= pool.job_workers)
+      continue;
+
+    struct PreduceJob *job = pool.job;
+    pthread_mutex_unlock(&pool.mutex);
+    RunChunks(job);
+    pthread_mutex_lock(&pool.mutex);
+    if (--pool.active == 0)
+      pthread_cond_signal(&pool.done);
+  }
+  return NULL;
+}
+
+static bool RunOnPool(struct PreduceJob *job, int workers) {
+  pthread_mutex_lock(&pool.run);
+  pthread_mutex_lock(&pool.mutex);
+  while (pool.size < workers - 1) {
+    if (pthread_create(&pool.threads[pool.size], NULL, PoolWorker,
+                       (void *)(intptr_t)pool.size) != 0)
+      break;
+    pthread_detach(pool.threads[pool.size]);
+    pool.size++;
+  }
+  int helpers = workers - 1 < pool.size ? workers - 1 : pool.size;
+  pool.job = job;
+  pool.job_workers = helpers;
+  pool.active = helpers;
+  pool.generation++;
+  pthread_cond_broadcast(&pool.wake);
+  pthread_mutex_unlock(&pool.mutex);
+
+  RunChunks(job);
+
+  pthread_mutex_lock(&pool.mutex);
+  while (pool.active > 0)
+    pthread_cond_wait(&pool.done, &pool.mutex);
+  pool.job = NULL;
+  pthread_mutex_unlock(&pool.mutex);
+  pthread_mutex_unlock(&pool.run);
+  return true;
+}
+
+static void PartFileName(char *name, size_t len, pid_t parent, int worker) {
+  snprintf(name, len, "preduce_%d_%d.part", (int)parent, worker);
+}
+
+/* Child `worker` takes every workers-th chunk. */
+static int ForkChild(struct PreduceJob *job, int workers, int worker,
+                     bool by_files, pid_t parent) {
+  for (uint64_t i = worker; i < job->chunks; i += workers)
+    RunChunk(job, i);
+  if (!by_files)
+    return 0;
+
+  char name[64];
+  PartFileName(name, sizeof(name), parent, worker);
+  int fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+    return 1;
+  for (uint64_t i = worker; i < job->chunks; i += workers) {
+    size_t size = job->ops->acc_size;
+    if (write(fd, job->accs + i * size, size) != (ssize_t)size) {
+      close(fd);
+      return 1;
+    }
+  }
+  close(fd);
+  return 0;
+}
+
+static bool ReadPartFile(struct PreduceJob *job, int workers, int worker) {
+  char name[64];
+  PartFileName(name, sizeof(name), getpid(), worker);
+  int fd = open(name, O_RDONLY);
+  if (fd < 0)
+    return false;
+  bool ok = true;
+  for (uint64_t i = worker; i < job->chunks && ok; i += workers) {
+    size_t size = job->ops->acc_size;
+    ok = read(fd, job->accs + i * size, size) == (ssize_t)size;
+  }
+  close(fd);
+  unlink(name);
+  return ok;
+}
+
+struct ForkArgs {
+  struct PreduceJob *job;
+  int workers;
+  bool by_files;
+  pid_t parent;
+};
+
+static int RunForkChild(void *arg, int worker) {
+  struct ForkArgs *args = arg;
+  return ForkChild(args->job, args->workers, worker, args->by_files,
+                   args->parent);
+}
+
+static bool RunForked(struct PreduceJob *job, int workers, int timeout,
+                      bool by_files) {
+  struct ForkArgs args = {job, workers, by_files, getpid()};
+  struct SupervisorJob supervised = {.run = RunForkChild, .arg = &args};
+  struct SupervisorConfig supervisor = {.timeout_ms = timeout * 1000};
+  struct WorkerResult *results = malloc(workers * sizeof(struct WorkerResult));
+  if (results == NULL ||
+      !SupervisorRun(&supervised, workers, &supervisor, results)) {
+    free(results);
+    return false;
+  }
+
+  bool ok = true;
+  int saved_errno = EIO;
+  for (int i = 0; i < workers; i++) {
+    if (results[i].outcome == WORKER_EXITED)
+      continue;
+    ok = false;
+    if (results[i].outcome == WORKER_NOT_RUN)
+      saved_errno = EAGAIN;
+    else if (results[i].outcome == WORKER_TIMED_OUT && saved_errno != EAGAIN)
+      saved_errno = ETIMEDOUT;
+  }
+
+  if (by_files) {
+    for (int i = 0; i < workers; i++) {
+      if (results[i].outcome != WORKER_NOT_RUN &&
+          !ReadPartFile(job, workers, i))
+        ok = false;
+    }
+  }
+  free(results);
+  if (!ok)
+    errno = saved_errno;
+  return ok;
+}
+
+/* Puts the reduction of the reported prefix of every chunk in its
+   accumulator and describes the coverage in partial. */
+static bool GatherPartial(struct PreduceJob *job,
+                          struct PreducePartial *partial) {
+  size_t size = job->ops->acc_size;
+  partial->chunks = malloc(job->chunks * sizeof(struct PreduceChunk));
+  if (partial->chunks == NULL)
+    return false;
+  partial->chunk_count = job->chunks;
+  partial->total = job->end - job->begin;
+  partial->covered = 0;
+  partial->finished = 0;
+  for (uint64_t i = 0; i < job->chunks; i++) {
+    struct PreduceChunk *chunk = &partial->chunks[i];
+    uint64_t report =
+        atomic_load_explicit(&job->progress[i], memory_order_acquire);
+    ChunkBounds(job, i, &chunk->begin, &chunk->end);
+    chunk->covered = report >> 1;
+    void *acc = job->accs + i * size;
+    if (chunk->covered > 0)
+      memcpy(acc, job->slots + (2 * i + (report & 1)) * size, size);
+    else
+      job->ops->identity(acc, job->ctx);
+    partial->covered += chunk->covered;
+    if (chunk->covered == chunk->end - chunk->begin)
+      partial->finished++;
+  }
+  return true;
+}
+
+bool PreduceRun(const struct PreduceOps *ops, const void *ctx, uint64_t begin,
+                uint64_t end, const struct PreduceConfig *config, void *acc) {
+  enum PreduceBackend backend = config ? config->backend : PREDUCE_SERIAL;
+  int workers = config && config->workers > 0 ? config->workers : 1;
+  if (workers > PREDUCE_MAX_WORKERS)
+    workers = PREDUCE_MAX_WORKERS;
+
+  if (end <= begin || (backend == PREDUCE_SERIAL && workers == 1)) {
+    ops->identity(acc, ctx);
+    if (end > begin)
+      ops->range(acc, ctx, begin, end);
+    return true;
+  }
+
+  struct PreduceJob job;
+  job.ops = ops;
+  job.ctx = ctx;
+  job.remote = backend == PREDUCE_REMOTE ? config->remote : NULL;
+  job.begin = begin;
+  job.end = end;
+  /* Forked workers get one chunk each, threads a few to balance load. */
+  job.chunks = config->chunks > 0 ? config->chunks
+               : backend == PREDUCE_FORK ? (uint64_t)workers
+                                         : (uint64_t)workers * 4;
+  if (job.chunks > end - begin)
+    job.chunks = end - begin;
+  job.progress = NULL;
+  job.slots = NULL;
+  atomic_init(&job.next, 0);
+  atomic_init(&job.failed, false);
+
+  if (backend == PREDUCE_REMOTE && job.remote == NULL) {
+    errno = EINVAL;
+    return false;
+  }
+
+  size_t accs_size = job.chunks * ops->acc_size;
+  size_t map_size = accs_size;
+  bool ok;
+  if (backend == PREDUCE_FORK) {
+    /* The progress reports and their slots follow the accumulators. */
+    size_t progress_offset = (accs_size + 63) / 64 * 64;
+    size_t slots_offset =
+        progress_offset + (job.chunks * sizeof(uint64_t) + 63) / 64 * 64;
+    if (config->partial != NULL)
+      map_size = slots_offset + 2 * accs_size;
+    job.accs = mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (job.accs == MAP_FAILED)
+      return false;
+    if (config->partial != NULL) {
+      job.progress = (_Atomic uint64_t *)(job.accs + progress_offset);
+      job.slots = job.accs + slots_offset;
+    }
+    ok = RunForked(&job, workers, config->timeout, config->by_files);
+    if (config->partial != NULL && (ok || errno == ETIMEDOUT)) {
+      int saved_errno = errno;
+      if (!GatherPartial(&job, config->partial)) {
+        ok = false;
+        saved_errno = ENOMEM;
+      } else if (config->partial->covered > 0) {
+        ok = true;
+      }
+      errno = saved_errno;
+    }
+  } else {
+    job.accs = malloc(accs_size);
+    if (job.accs == NULL)
+      return false;
+    if (backend == PREDUCE_SERIAL)
+      RunChunks(&job);
+    else
+      RunOnPool(&job, workers);
+    ok = !atomic_load(&job.failed);
+    if (!ok)
+      errno = EIO;
+  }
+
+  int saved_errno = errno;
+  if (ok)
+    CombineChunks(&job, acc);
+  if (backend == PREDUCE_FORK)
+    munmap(job.accs, map_size);
+  else
+    free(job.accs);
+  errno = saved_errno;
+  return ok;
+}
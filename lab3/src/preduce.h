@@ -0,0 +1,117 @@
+#ifndef PREDUCE_H
+#define PREDUCE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+/* Parallel reduction over an index range [begin, end). A reduction is
+   described by its accumulator: how to make the identity, how to fold
+   a range of elements into it and how to combine two accumulators.
+   Combine must be associative, partial results are combined in range
+   order so it does not need to be commutative. */
+
+struct PreduceOps {
+  size_t acc_size;
+  void (*identity)(void *acc, const void *ctx);
+  void (*range)(void *acc, const void *ctx, uint64_t begin, uint64_t end);
+  void (*combine)(void *acc, const void *other, const void *ctx);
+};
+
+enum PreduceBackend {
+  PREDUCE_SERIAL,
+  PREDUCE_THREADS, /* persistent thread pool shared by all calls */
+  PREDUCE_FORK,    /* child processes, results in shared memory */
+  PREDUCE_REMOTE,  /* chunks handed to PreduceRemote from pool threads */
+};
+
+/* Computes one chunk somewhere else, must be thread-safe. */
+struct PreduceRemote {
+  bool (*run)(void *remote, uint64_t begin, uint64_t end, void *acc);
+  void *remote;
+};
+
+#define PREDUCE_MAX_WORKERS 4096
+
+struct PreduceChunk {
+  uint64_t begin;
+  uint64_t end;
+  uint64_t covered; /* elements from begin reduced */
+};
+
+/* Progress of a forked run. The workers publish the reduction of the
+   prefix of their chunk done so far, so when the timeout kills them acc
+   still gets the reduction of every element covered, combined in chunk
+   order, and PreduceRun succeeds as long as there were any. */
+struct PreducePartial {
+  uint64_t covered;
+  uint64_t total;
+  uint64_t finished;
+  uint64_t chunk_count;
+  struct PreduceChunk *chunks; /* malloc'd, the caller frees it */
+};
+
+struct PreduceConfig {
+  enum PreduceBackend backend;
+  int workers;     /* threads or processes, 0 means 1 */
+  uint64_t chunks; /* 0 picks a default for the backend */
+  int timeout;     /* seconds, fork backend only, 0 means none */
+  bool by_files;   /* fork backend passes results through files */
+  const struct PreduceRemote *remote;
+  struct PreducePartial *partial; /* fork backend, filled in when set */
+};
+
+/* Stores the reduction of [begin, end) into acc. Returns false with
+   errno set when a worker fails, ETIMEDOUT when the timeout expires
+   before config->partial has anything to show. */
+bool PreduceRun(const struct PreduceOps *ops, const void *ctx, uint64_t begin,
+                uint64_t end, const struct PreduceConfig *config, void *acc);
+
+/* Defines NAME##Ops and a typed NAME##Reduce() for an accumulator of type
+   ACC over a context of type CTX. INIT sets `acc`, STEP folds element `i`
+   into `acc`, MERGE folds `other` into `acc`; all of them can read `ctx`.
+   STEP is inlined into the range loop, so each reduction gets its own
+   specialized kernel. */
+#define PREDUCE_DEFINE(NAME, ACC, CTX, INIT, STEP, MERGE)                      \
+  static void NAME##Identity(void *out, const void *context) {                \
+    const CTX *ctx = context;                                                  \
+    ACC acc;                                                                   \
+    (void)ctx;                                                                 \
+    INIT;                                                                      \
+    memcpy(out, &acc, sizeof(ACC));                                            \
+  }                                                                            \
+  static void NAME##Range(void *out, const void *context, uint64_t begin,     \
+                          uint64_t end) {                                      \
+    const CTX *ctx = context;                                                  \
+    ACC acc;                                                                   \
+    (void)ctx;                                                                 \
+    memcpy(&acc, out, sizeof(ACC));                                            \
+    for (uint64_t i = begin; i < end; i++) {                                   \
+      STEP;                                                                    \
+    }                                                                          \
+    memcpy(out, &acc, sizeof(ACC));                                            \
+  }                                                                            \
+  static void NAME##Combine(void *out, const void *in, const void *context) { \
+    const CTX *ctx = context;                                                  \
+    ACC acc, other;                                                            \
+    (void)ctx;                                                                 \
+    memcpy(&acc, out, sizeof(ACC));                                            \
+    memcpy(&other, in, sizeof(ACC));                                           \
+    MERGE;                                                                     \
+    memcpy(out, &acc, sizeof(ACC));                                            \
+  }                                                                            \
+  static const struct PreduceOps NAME##Ops = {sizeof(ACC), NAME##Identity,    \
+                                              NAME##Range, NAME##Combine};    \
+  static inline bool NAME##Reduce(const CTX *ctx, uint64_t begin,             \
+                                  uint64_t end,                                \
+                                  const struct PreduceConfig *config,          \
+                                  ACC *acc) {                                  \
+    if (config == NULL || config->backend == PREDUCE_SERIAL) {                 \
+      NAME##Identity(acc, ctx);                                                \
+      NAME##Range(acc, ctx, begin, end);                                       \
+      return true;                                                             \
+    }                                                                          \
+    return PreduceRun(&NAME##Ops, ctx, begin, end, config, acc);               \
+  }
+
+#endif
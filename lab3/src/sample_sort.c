@@ -0,0 +1,348 @@
+#include "sample_sort.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SAMPLES_PER_BUCKET 64
+/* Below this a single radix sort beats the cost of the exchange. */
+#define SAMPLE_SORT_MIN 65536
+
+static uint32_t Key(int x) { return (uint32_t)x ^ 0x80000000u; }
+
+void RadixSort(int *array, int *tmp, size_t n) {
+  size_t counts[4][256];
+  memset(counts, 0, sizeof(counts));
+  for (size_t i = 0; i < n; i++) {
+    uint32_t key = Key(array[i]);
+    counts[0][key & 0xff]++;
+    counts[1][(key >> 8) & 0xff]++;
+    counts[2][(key >> 16) & 0xff]++;
+    counts[3][key >> 24]++;
+  }
+
+  int *src = array, *dst = tmp;
+  for (int pass = 0; pass < 4; pass++) {
+    int shift = pass * 8;
+    /* A byte that is the same everywhere does not reorder anything. */
+    if (n == 0 || counts[pass][(Key(src[0]) >> shift) & 0xff] == n)
+      continue;
+
+    size_t offsets[256], sum = 0;
+    for (int b = 0; b < 256; b++) {
+      offsets[b] = sum;
+      sum += counts[pass][b];
+    }
+    for (size_t i = 0; i < n; i++)
+      dst[offsets[(Key(src[i]) >> shift) & 0xff]++] = src[i];
+
+    int *swap = src;
+    src = dst;
+    dst = swap;
+  }
+  if (src != array)
+    memcpy(array, src, n * sizeof(int));
+}
+
+struct SortShared {
+  int *array;
+  int *out;
+  size_t n;
+  int threads;
+  int splitters[256];
+  size_t *counts;  /* counts[t * threads + b]: elements of chunk t in b */
+  size_t *offsets; /* where chunk t writes into bucket b */
+  size_t *bucket_begin;
+  pthread_barrier_t barrier;
+  /* Workers wait here until every one of them is started, or leave at
+     once when one could not be. */
+  pthread_mutex_t gate;
+  pthread_cond_t gate_open;
+  enum { SORT_WAIT, SORT_RUN, SORT_ABORT } state;
+};
+
+struct SortArgs {
+  struct SortShared *shared;
+  int thread;
+};
+
+/* Number of splitters <= x, equal keys always land in one bucket. */
+static int Bucket(const struct SortShared *shared, int x) {
+  int lo = 0, hi = shared->threads - 1;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (shared->splitters[mid] <= x)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+static void OpenGate(struct SortShared *shared, int state) {
+  pthread_mutex_lock(&shared->gate);
+  shared->state = state;
+  pthread_cond_broadcast(&shared->gate_open);
+  pthread_mutex_unlock(&shared->gate);
+}
+
+static void *SortWorker(void *arg) {
+  struct SortArgs *args = arg;
+  struct SortShared *shared = args->shared;
+  pthread_mutex_lock(&shared->gate);
+  while (shared->state == SORT_WAIT)
+    pthread_cond_wait(&shared->gate_open, &shared->gate);
+  bool run = shared->state == SORT_RUN;
+  pthread_mutex_unlock(&shared->gate);
+  if (!run)
+    return NULL;
+
+  int t = args->thread, p = shared->threads;
+  size_t begin = shared->n / p * t, end = t == p - 1 ? shared->n
+                                                     : shared->n / p * (t + 1);
+  size_t *counts = shared->counts + (size_t)t * p;
+
+  for (size_t i = begin; i < end; i++)
+    counts[Bucket(shared, shared->array[i])]++;
+  pthread_barrier_wait(&shared->barrier);
+
+  /* Bucket b gathers chunk 0's part, then chunk 1's and so on. */
+  size_t *offsets = shared->offsets + (size_t)t * p;
+  size_t bucket_start = 0;
+  for (int b = 0; b < p; b++) {
+    size_t before = 0, total = 0;
+    for (int u = 0; u < p; u++) {
+      size_t count = shared->counts[(size_t)u * p + b];
+      before += u < t ? count : 0;
+      total += count;
+    }
+    offsets[b] = bucket_start + before;
+    if (t == 0)
+      shared->bucket_begin[b] = bucket_start;
+    bucket_start += total;
+  }
+  for (size_t i = begin; i < end; i++) {
+    int x = shared->array[i];
+    shared->out[offsets[Bucket(shared, x)]++] = x;
+  }
+  pthread_barrier_wait(&shared->barrier);
+
+  /* Every element has moved to out, so array serves as scratch. */
+  size_t bucket_begin = shared->bucket_begin[t];
+  size_t bucket_end = t == p - 1 ? shared->n : shared->bucket_begin[t + 1];
+  RadixSort(shared->out + bucket_begin, shared->array + bucket_begin,
+            bucket_end - bucket_begin);
+  memcpy(shared->array + bucket_begin, shared->out + bucket_begin,
+         (bucket_end - bucket_begin) * sizeof(int));
+  return NULL;
+}
+
+static int CompareInts(const void *a, const void *b) {
+  int x = *(const int *)a, y = *(const int *)b;
+  return (x > y) - (x < y);
+}
+
+bool SampleSort(int *array, size_t n, int threads) {
+  if (threads > 256)
+    threads = 256;
+  if (threads <= 1 || n < SAMPLE_SORT_MIN) {
+    int *tmp = malloc(n * sizeof(int) + 1);
+    if (tmp == NULL)
+      return false;
+    RadixSort(array, tmp, n);
+    free(tmp);
+    return true;
+  }
+
+  struct SortShared shared;
+  shared.array = array;
+  shared.n = n;
+  shared.threads = threads;
+  shared.out = malloc(n * sizeof(int));
+  shared.counts = calloc((size_t)threads * threads, sizeof(size_t));
+  shared.offsets = malloc((size_t)threads * threads * sizeof(size_t));
+  shared.bucket_begin = malloc(threads * sizeof(size_t));
+  bool ok = shared.out != NULL && shared.counts != NULL &&
+            shared.offsets != NULL && shared.bucket_begin != NULL;
+
+  if (ok) {
+    size_t samples_num = (size_t)threads * SAMPLES_PER_BUCKET;
+    int samples[256 * SAMPLES_PER_BUCKET];
+    unsigned int state = (unsigned int)n;
+    for (size_t i = 0; i < samples_num; i++)
+      samples[i] = array[((size_t)rand_r(&state) << 16 ^ rand_r(&state)) % n];
+    qsort(samples, samples_num, sizeof(int), CompareInts);
+    for (int b = 0; b < threads - 1; b++)
+      shared.splitters[b] = samples[(b + 1) * SAMPLES_PER_BUCKET];
+
+    pthread_t tids[256];
+    struct SortArgs args[256];
+    pthread_barrier_init(&shared.barrier, NULL, threads);
+    pthread_mutex_init(&shared.gate, NULL);
+    pthread_cond_init(&shared.gate_open, NULL);
+    shared.state = SORT_WAIT;
+    int started = 1, error = 0;
+    for (; started < threads && error == 0; started++) {
+      args[started].shared = &shared;
+      args[started].thread = started;
+      error = pthread_create(&tids[started], NULL, SortWorker, &args[started]);
+    }
+    if (error != 0)
+      started--;
+    OpenGate(&shared, error == 0 ? SORT_RUN : SORT_ABORT);
+    args[0].shared = &shared;
+    args[0].thread = 0;
+    if (error == 0)
+      SortWorker(&args[0]);
+    for (int t = 1; t < started; t++)
+      pthread_join(tids[t], NULL);
+    pthread_cond_destroy(&shared.gate_open);
+    pthread_mutex_destroy(&shared.gate);
+    pthread_barrier_destroy(&shared.barrier);
+    if (error != 0) {
+      ok = false;
+      errno = error;
+    }
+  }
+
+  free(shared.out);
+  free(shared.counts);
+  free(shared.offsets);
+  free(shared.bucket_begin);
+  return ok;
+}
+
+struct RunReader {
+  FILE *file;
+  int *buffer;
+  size_t size;
+  size_t pos;
+};
+
+static bool RunNext(struct RunReader *run, size_t capacity) {
+  if (++run->pos < run->size)
+    return true;
+  run->size = fread(run->buffer, sizeof(int), capacity, run->file);
+  run->pos = 0;
+  return run->size > 0;
+}
+
+static void RunFileName(char *name, size_t len, const char *path, int run) {
+  snprintf(name, len, "%s.run%d", path, run);
+}
+
+/* Min-heap of run indices ordered by their current element. */
+static void SiftDown(struct RunReader *runs, int *heap, int size, int i) {
+  for (;;) {
+    int smallest = i, l = 2 * i + 1, r = 2 * i + 2;
+    if (l < size && runs[heap[l]].buffer[runs[heap[l]].pos] <
+                        runs[heap[smallest]].buffer[runs[heap[smallest]].pos])
+      smallest = l;
+    if (r < size && runs[heap[r]].buffer[runs[heap[r]].pos] <
+                        runs[heap[smallest]].buffer[runs[heap[smallest]].pos])
+      smallest = r;
+    if (smallest == i)
+      return;
+    int swap = heap[i];
+    heap[i] = heap[smallest];
+    heap[smallest] = swap;
+    i = smallest;
+  }
+}
+
+static bool MergeRuns(const char *path, int runs_num, size_t memory_size) {
+  struct RunReader *runs = calloc(runs_num, sizeof(struct RunReader));
+  int *heap = malloc(runs_num * sizeof(int));
+  /* Half of the budget for run buffers, half for the output buffer. */
+  size_t capacity = memory_size / 2 / runs_num;
+  if (capacity < 1024)
+    capacity = 1024;
+  size_t out_capacity = memory_size / 2 > 1024 ? memory_size / 2 : 1024;
+  int *out = malloc(out_capacity * sizeof(int));
+  FILE *file = fopen(path, "wb");
+  bool ok = runs != NULL && heap != NULL && out != NULL && file != NULL;
+
+  int heap_size = 0;
+  for (int i = 0; ok && i < runs_num; i++) {
+    char name[4096];
+    RunFileName(name, sizeof(name), path, i);
+    runs[i].file = fopen(name, "rb");
+    runs[i].buffer = malloc(capacity * sizeof(int));
+    if (runs[i].file == NULL || runs[i].buffer == NULL) {
+      ok = false;
+      break;
+    }
+    runs[i].size = 0;
+    runs[i].pos = (size_t)-1;
+    if (RunNext(&runs[i], capacity))
+      heap[heap_size++] = i;
+  }
+  for (int i = heap_size / 2 - 1; ok && i >= 0; i--)
+    SiftDown(runs, heap, heap_size, i);
+
+  size_t out_size = 0;
+  while (ok && heap_size > 0) {
+    struct RunReader *run = &runs[heap[0]];
+    out[out_size++] = run->buffer[run->pos];
+    if (out_size == out_capacity) {
+      ok = fwrite(out, sizeof(int), out_size, file) == out_size;
+      out_size = 0;
+    }
+    if (!RunNext(run, capacity))
+      heap[0] = heap[--heap_size];
+    SiftDown(runs, heap, heap_size, 0);
+  }
+  if (ok && out_size > 0)
+    ok = fwrite(out, sizeof(int), out_size, file) == out_size;
+
+  for (int i = 0; runs != NULL && i < runs_num; i++) {
+    char name[4096];
+    RunFileName(name, sizeof(name), path, i);
+    if (runs[i].file != NULL)
+      fclose(runs[i].file);
+    free(runs[i].buffer);
+    unlink(name);
+  }
+  if (file != NULL && fclose(file) != 0)
+    ok = false;
+  free(runs);
+  free(heap);
+  free(out);
+  return ok;
+}
+
+bool ExternalSort(unsigned int seed, uint64_t array_size, size_t memory_size,
+                  int threads, const char *path) {
+  /* SampleSort needs a second buffer of the same size. */
+  size_t run_size = memory_size / 2;
+  if (run_size == 0)
+    return false;
+  int *buffer = malloc(run_size * sizeof(int));
+  if (buffer == NULL)
+    return false;
+
+  /* The same sequence GenerateArray(seed) would produce. */
+  srand(seed);
+  int runs_num = 0;
+  bool ok = true;
+  for (uint64_t done = 0; ok && done < array_size; done += run_size) {
+    size_t n = array_size - done < run_size ? array_size - done : run_size;
+    for (size_t i = 0; i < n; i++)
+      buffer[i] = rand();
+    ok = SampleSort(buffer, n, threads);
+
+    char name[4096];
+    RunFileName(name, sizeof(name), path, runs_num++);
+    FILE *file = fopen(name, "wb");
+    if (file == NULL || fwrite(buffer, sizeof(int), n, file) != n)
+      ok = false;
+    if (file != NULL && fclose(file) != 0)
+      ok = false;
+  }
+  free(buffer);
+
+  return MergeRuns(path, runs_num, memory_size) && ok;
+}
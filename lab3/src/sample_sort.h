@@ -0,0 +1,23 @@
+#ifndef SAMPLE_SORT_H
+#define SAMPLE_SORT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* LSD radix sort of array[0, n), tmp must hold n elements. */
+void RadixSort(int *array, int *tmp, size_t n);
+
+/* Parallel sample sort in place: splitters are sampled from the array,
+   every thread scatters its chunk into per-thread buckets, then each
+   thread radix sorts one bucket. Returns false with errno set when
+   memory runs out or a thread can not be started. */
+bool SampleSort(int *array, size_t n, int threads);
+
+/* Sorts array_size values of GenerateArray(seed) into a binary file of
+   ints without holding more than memory_size of them at once: sorted
+   runs go to temporary files next to path and are merged at the end. */
+bool ExternalSort(unsigned int seed, uint64_t array_size, size_t memory_size,
+                  int threads, const char *path);
+
+#endif
@@ -0,0 +1,561 @@
+#include "selection.h"
+
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sample_sort.h"
+
+/* Candidate sets this small are selected by one thread. */
+#define SELECT_SERIAL_MAX 65536
+#define SELECT_SAMPLES 4096
+#define SELECT_MAX_THREADS 256
+
+static int CompareInts(const void *a, const void *b) {
+  int x = *(const int *)a, y = *(const int *)b;
+  return (x > y) - (x < y);
+}
+
+static void InsertionSort(int *a, size_t n) {
+  for (size_t i = 1; i < n; i++) {
+    int x = a[i];
+    size_t j = i;
+    for (; j > 0 && a[j - 1] > x; j--)
+      a[j] = a[j - 1];
+    a[j] = x;
+  }
+}
+
+static int MedianOfThree(int a, int b, int c) {
+  if (a > b) {
+    int t = a;
+    a = b;
+    b = t;
+  }
+  return c < a ? a : c > b ? b : c;
+}
+
+/* Introselect: quickselect with a three-way partition, falling back to
+   sorting when the partitions keep coming out lopsided. */
+static int SelectSerial(int *a, size_t n, size_t k) {
+  size_t lo = 0, hi = n;
+  int depth = 2 * (int)log2((double)n + 1) + 4;
+
+  while (hi - lo > 16) {
+    if (depth-- == 0) {
+      qsort(a + lo, hi - lo, sizeof(int), CompareInts);
+      return a[k];
+    }
+    int pivot = MedianOfThree(a[lo], a[lo + (hi - lo) / 2], a[hi - 1]);
+    size_t lt = lo, i = lo, gt = hi;
+    while (i < gt) {
+      if (a[i] < pivot) {
+        int t = a[lt];
+        a[lt++] = a[i];
+        a[i++] = t;
+      } else if (a[i] > pivot) {
+        int t = a[--gt];
+        a[gt] = a[i];
+        a[i] = t;
+      } else {
+        i++;
+      }
+    }
+    if (k < lt)
+      hi = lt;
+    else if (k < gt)
+      return pivot;
+    else
+      lo = gt;
+  }
+  InsertionSort(a + lo, hi - lo);
+  return a[k];
+}
+
+struct FilterArgs {
+  const int *array;
+  size_t begin;
+  size_t end;
+  int lo;
+  int hi;
+  size_t below;
+  int *kept;
+  size_t kept_size;
+  size_t kept_capacity;
+};
+
+/* Counts elements below lo and copies those within [lo, hi]. */
+static void *Filter(void *arg) {
+  struct FilterArgs *args = arg;
+  for (size_t i = args->begin; i < args->end; i++) {
+    int x = args->array[i];
+    if (x < args->lo) {
+      args->below++;
+    } else if (x <= args->hi) {
+      if (args->kept_size == args->kept_capacity) {
+        size_t capacity = args->kept_capacity ? args->kept_capacity * 2 : 1024;
+        int *kept = realloc(args->kept, capacity * sizeof(int));
+        if (kept == NULL)
+          return (void *)1;
+        args->kept = kept;
+        args->kept_capacity = capacity;
+      }
+      args->kept[args->kept_size++] = x;
+    }
+  }
+  return NULL;
+}
+
+bool ParallelSelect(const int *array, size_t n, size_t k, int threads,
+                    int *result) {
+  if (k >= n)
+    return false;
+  if (threads < 1)
+    threads = 1;
+  if (threads > SELECT_MAX_THREADS)
+    threads = SELECT_MAX_THREADS;
+
+  const int *current = array;
+  int *owned = NULL;
+  unsigned int state = (unsigned int)n ^ (unsigned int)k;
+  /* Width of the value window around k, in samples. */
+  double spread = 3 * sqrt(SELECT_SAMPLES);
+
+  while (n > SELECT_SERIAL_MAX) {
+    int samples[SELECT_SAMPLES];
+    for (int i = 0; i < SELECT_SAMPLES; i++)
+      samples[i] = current[((size_t)rand_r(&state) << 16 ^ rand_r(&state)) % n];
+    qsort(samples, SELECT_SAMPLES, sizeof(int), CompareInts);
+    double pos = (double)k / n * SELECT_SAMPLES;
+    /* Past the ends of the sample the window is open, so widening it
+       always ends up catching k. */
+    int lo = pos - spread < 0 ? INT_MIN : samples[(int)(pos - spread)];
+    int hi = pos + spread >= SELECT_SAMPLES ? INT_MAX
+                                            : samples[(int)(pos + spread)];
+
+    struct FilterArgs args[SELECT_MAX_THREADS];
+    pthread_t tids[SELECT_MAX_THREADS];
+    bool started[SELECT_MAX_THREADS];
+    for (int t = 0; t < threads; t++) {
+      memset(&args[t], 0, sizeof(args[t]));
+      args[t].array = current;
+      args[t].begin = n / threads * t;
+      args[t].end = t == threads - 1 ? n : n / threads * (t + 1);
+      args[t].lo = lo;
+      args[t].hi = hi;
+    }
+
+    bool ok = true;
+    for (int t = 1; t < threads; t++) {
+      started[t] = pthread_create(&tids[t], NULL, Filter, &args[t]) == 0;
+      if (!started[t] && Filter(&args[t]) != NULL)
+        ok = false;
+    }
+    if (Filter(&args[0]) != NULL)
+      ok = false;
+    size_t below = 0, kept = 0;
+    for (int t = 0; t < threads; t++) {
+      void *status = NULL;
+      if (t > 0 && started[t])
+        pthread_join(tids[t], &status);
+      if (status != NULL)
+        ok = false;
+      below += args[t].below;
+      kept += args[t].kept_size;
+    }
+
+    /* The window missed k or did not narrow anything: widen and retry. */
+    bool hit = ok && k >= below && k < below + kept;
+    if (hit && lo == hi) {
+      for (int t = 0; t < threads; t++)
+        free(args[t].kept);
+      free(owned);
+      *result = lo;
+      return true;
+    }
+    int *next = hit && kept < n ? malloc(kept * sizeof(int)) : NULL;
+    if (next != NULL) {
+      size_t offset = 0;
+      for (int t = 0; t < threads; t++) {
+        memcpy(next + offset, args[t].kept, args[t].kept_size * sizeof(int));
+        offset += args[t].kept_size;
+      }
+    }
+    for (int t = 0; t < threads; t++)
+      free(args[t].kept);
+    if (!ok) {
+      free(owned);
+      return false;
+    }
+    if (next == NULL) {
+      if (hit)
+        break;
+      spread *= 2;
+      continue;
+    }
+    free(owned);
+    owned = next;
+    current = next;
+    k -= below;
+    n = kept;
+  }
+
+  if (owned == NULL) {
+    owned = malloc(n * sizeof(int));
+    if (owned == NULL)
+      return false;
+    memcpy(owned, current, n * sizeof(int));
+  }
+  *result = SelectSerial(owned, n, k);
+  free(owned);
+  return true;
+}
+
+/* Level capacities shrink by 2/3 going down from the top level, but
+   never below 8 so that the low levels do not compact every few adds. */
+static const uint32_t kKllCapacities[KLL_MAX_LEVELS] = {
+    200, 133, 88, 59, 39, 26, 17, 11, 8, 8, 8, 8, 8, 8, 8, 8,
+    8,   8,   8,  8,  8,  8,  8,  8,  8, 8, 8, 8, 8, 8, 8, 8};
+
+static uint32_t KllCapacity(const struct KllSketch *sketch, uint32_t level) {
+  return kKllCapacities[sketch->levels - 1 - level];
+}
+
+static void KllSetLevels(struct KllSketch *sketch, uint32_t levels) {
+  sketch->levels = levels;
+  sketch->capacity = 0;
+  for (uint32_t level = 0; level < levels; level++)
+    sketch->capacity += KllCapacity(sketch, level);
+}
+
+/* Short runs are cheaper to insertion sort than to qsort. */
+static void SortSmall(int *items, uint32_t size) {
+  if (size > 32) {
+    qsort(items, size, sizeof(int), CompareInts);
+    return;
+  }
+  for (uint32_t i = 1; i < size; i++) {
+    int x = items[i];
+    uint32_t j = i;
+    for (; j > 0 && items[j - 1] > x; j--)
+      items[j] = items[j - 1];
+    items[j] = x;
+  }
+}
+
+static void KllAppend(struct KllSketch *sketch, uint32_t level,
+                      const int *items, uint32_t count);
+
+/* Promotes every other item of a sorted level, an odd one stays. Only
+   level 0 is unsorted, the others are kept sorted by KllAppend. */
+static void KllCompact(struct KllSketch *sketch, uint32_t level) {
+  if (level + 1 >= KLL_MAX_LEVELS)
+    return;
+  if (level + 1 >= sketch->levels)
+    KllSetLevels(sketch, level + 2);
+
+  int *items = sketch->items[level];
+  uint32_t size = sketch->sizes[level];
+  if (level == 0 && size > 32) {
+    int tmp[KLL_LEVEL_STORAGE];
+    RadixSort(items, tmp, size);
+  } else if (level == 0) {
+    SortSmall(items, size);
+  }
+
+  sketch->random = sketch->random * 6364136223846793005ull + 1442695040888963407ull;
+  uint32_t offset = (uint32_t)(sketch->random >> 63);
+  uint32_t even = size & ~1u;
+  int promoted[KLL_LEVEL_STORAGE / 2];
+  uint32_t promoted_count = 0;
+  for (uint32_t i = offset; i < even; i += 2)
+    promoted[promoted_count++] = items[i];
+
+  if (size & 1) {
+    items[0] = items[size - 1];
+    sketch->sizes[level] = 1;
+  } else {
+    sketch->sizes[level] = 0;
+  }
+  /* Half of the even part is dropped, the other half moves up. */
+  sketch->size -= even - promoted_count;
+  KllAppend(sketch, level + 1, promoted, promoted_count);
+}
+
+static void KllAppend(struct KllSketch *sketch, uint32_t level,
+                      const int *items, uint32_t count) {
+  while (count > 0) {
+    uint32_t room = KLL_LEVEL_STORAGE - sketch->sizes[level];
+    if (room == 0) {
+      KllCompact(sketch, level);
+      room = KLL_LEVEL_STORAGE - sketch->sizes[level];
+      /* The top level cannot be compacted, extra items are dropped. */
+      if (room == 0)
+        return;
+    }
+    uint32_t part = count < room ? count : room;
+    int *dst = sketch->items[level];
+    if (level == 0) {
+      memcpy(dst + sketch->sizes[0], items, part * sizeof(int));
+    } else {
+      /* Both runs are sorted: merge from the back, in place. */
+      uint32_t i = sketch->sizes[level], j = part, out = i + j;
+      while (j > 0) {
+        if (i > 0 && dst[i - 1] > items[j - 1])
+          dst[--out] = dst[--i];
+        else
+          dst[--out] = items[--j];
+      }
+    }
+    sketch->sizes[level] += part;
+    items += part;
+    count -= part;
+  }
+}
+
+static void KllUpdate(struct KllSketch *sketch) {
+  sketch->size = 0;
+  for (uint32_t level = 0; level < sketch->levels; level++)
+    sketch->size += sketch->sizes[level];
+  KllSetLevels(sketch, sketch->levels);
+}
+
+/* Lazy compaction: only when the sketch as a whole is full, and then only
+   the lowest level that is over its capacity. Level 0 works as a buffer
+   most of the time, so adding an item is usually just a store. */
+static void KllCompress(struct KllSketch *sketch) {
+  while (sketch->size >= sketch->capacity) {
+    uint32_t level = 0;
+    while (level < sketch->levels &&
+           sketch->sizes[level] < KllCapacity(sketch, level))
+      level++;
+    if (level == sketch->levels || level + 1 >= KLL_MAX_LEVELS)
+      break;
+    KllCompact(sketch, level);
+  }
+}
+
+void KllInit(struct KllSketch *sketch) {
+  sketch->n = 0;
+  sketch->random = 0x9e3779b97f4a7c15ull;
+  sketch->levels = 1;
+  memset(sketch->sizes, 0, sizeof(sketch->sizes));
+  KllUpdate(sketch);
+}
+
+void KllAdd(struct KllSketch *sketch, int value) {
+  if (sketch->sizes[0] == KLL_LEVEL_STORAGE)
+    KllCompact(sketch, 0);
+  sketch->items[0][sketch->sizes[0]++] = value;
+  sketch->n++;
+  /* Level 0 may overflow by up to KLL_K items, so compactions come in
+     batches that sort a few hundred items rather than every few adds. */
+  if (++sketch->size >= sketch->capacity + KLL_K)
+    KllCompress(sketch);
+}
+
+void KllMerge(struct KllSketch *sketch, const struct KllSketch *other) {
+  if (other->levels > sketch->levels)
+    sketch->levels = other->levels;
+  for (uint32_t level = 0; level < other->levels; level++)
+    KllAppend(sketch, level, other->items[level], other->sizes[level]);
+  sketch->n += other->n;
+  sketch->random ^= other->random;
+  KllUpdate(sketch);
+  KllCompress(sketch);
+}
+
+struct WeightedItem {
+  int value;
+  uint64_t weight;
+};
+
+static int CompareItems(const void *a, const void *b) {
+  return CompareInts(&((const struct WeightedItem *)a)->value,
+                     &((const struct WeightedItem *)b)->value);
+}
+
+bool KllQuantile(const struct KllSketch *sketch, double q, int *value) {
+  size_t count = 0;
+  for (uint32_t level = 0; level < sketch->levels; level++)
+    count += sketch->sizes[level];
+  *value = 0;
+  if (count == 0)
+    return true;
+
+  struct WeightedItem *items = malloc(count * sizeof(struct WeightedItem));
+  if (items == NULL)
+    return false;
+  uint64_t total = 0;
+  size_t i = 0;
+  for (uint32_t level = 0; level < sketch->levels; level++) {
+    for (uint32_t j = 0; j < sketch->sizes[level]; j++) {
+      items[i].value = sketch->items[level][j];
+      items[i++].weight = (uint64_t)1 << level;
+    }
+    total += (uint64_t)sketch->sizes[level] << level;
+  }
+  qsort(items, count, sizeof(struct WeightedItem), CompareItems);
+
+  double target = q * total;
+  uint64_t seen = 0;
+  *value = items[count - 1].value;
+  for (i = 0; i < count; i++) {
+    seen += items[i].weight;
+    if (seen >= target) {
+      *value = items[i].value;
+      break;
+    }
+  }
+  free(items);
+  return true;
+}
+
+size_t KllPackedSize(const struct KllSketch *sketch) {
+  size_t size = 2 * sizeof(uint64_t) + sizeof(uint32_t) +
+                sketch->levels * sizeof(uint32_t);
+  for (uint32_t level = 0; level < sketch->levels; level++)
+    size += sketch->sizes[level] * sizeof(int);
+  return size;
+}
+
+void KllPack(const struct KllSketch *sketch, void *buf) {
+  char *p = buf;
+  memcpy(p, &sketch->n, sizeof(uint64_t));
+  p += sizeof(uint64_t);
+  memcpy(p, &sketch->random, sizeof(uint64_t));
+  p += sizeof(uint64_t);
+  memcpy(p, &sketch->levels, sizeof(uint32_t));
+  p += sizeof(uint32_t);
+  memcpy(p, sketch->sizes, sketch->levels * sizeof(uint32_t));
+  p += sketch->levels * sizeof(uint32_t);
+  for (uint32_t level = 0; level < sketch->levels; level++) {
+    memcpy(p, sketch->items[level], sketch->sizes[level] * sizeof(int));
+    p += sketch->sizes[level] * sizeof(int);
+  }
+}
+
+bool KllUnpack(struct KllSketch *sketch, const void *buf, size_t len) {
+  const char *p = buf;
+  size_t header = 2 * sizeof(uint64_t) + sizeof(uint32_t);
+  if (len < header)
+    return false;
+  KllInit(sketch);
+  memcpy(&sketch->n, p, sizeof(uint64_t));
+  memcpy(&sketch->random, p + sizeof(uint64_t), sizeof(uint64_t));
+  memcpy(&sketch->levels, p + 2 * sizeof(uint64_t), sizeof(uint32_t));
+  if (sketch->levels == 0 || sketch->levels > KLL_MAX_LEVELS ||
+      len < header + sketch->levels * sizeof(uint32_t))
+    return false;
+  memcpy(sketch->sizes, p + header, sketch->levels * sizeof(uint32_t));
+
+  size_t offset = header + sketch->levels * sizeof(uint32_t);
+  for (uint32_t level = 0; level < sketch->levels; level++) {
+    size_t bytes = sketch->sizes[level] * sizeof(int);
+    if (sketch->sizes[level] > KLL_LEVEL_STORAGE || offset + bytes > len)
+      return false;
+    memcpy(sketch->items[level], p + offset, bytes);
+    if (level > 0)
+      SortSmall(sketch->items[level], sketch->sizes[level]);
+    offset += bytes;
+  }
+  KllUpdate(sketch);
+  return offset == len;
+}
+
+static void KllIdentity(void *acc, const void *ctx) { KllInit(acc); }
+
+static void KllRange(void *acc, const void *ctx, uint64_t begin,
+                     uint64_t end) {
+  const int *array = ctx;
+  for (uint64_t i = begin; i < end; i++)
+    KllAdd(acc, array[i]);
+}
+
+static void KllCombine(void *acc, const void *other, const void *ctx) {
+  KllMerge(acc, other);
+}
+
+const struct PreduceOps KllOps = {sizeof(struct KllSketch), KllIdentity,
+                                  KllRange, KllCombine};
+
+struct TopKContext {
+  const int *array;
+  uint32_t k;
+};
+
+/* Min-heap of the k largest values seen, the root is the bar to beat. */
+static void TopKPush(struct TopK *top, uint32_t k, int x) {
+  uint32_t i;
+  if (top->size < k) {
+    i = top->size++;
+    while (i > 0 && top->heap[(i - 1) / 2] > x) {
+      top->heap[i] = top->heap[(i - 1) / 2];
+      i = (i - 1) / 2;
+    }
+    top->heap[i] = x;
+    return;
+  }
+  if (x <= top->heap[0])
+    return;
+
+  i = 0;
+  for (;;) {
+    uint32_t child = 2 * i + 1;
+    if (child >= k)
+      break;
+    if (child + 1 < k && top->heap[child + 1] < top->heap[child])
+      child++;
+    if (top->heap[child] >= x)
+      break;
+    top->heap[i] = top->heap[child];
+    i = child;
+  }
+  top->heap[i] = x;
+}
+
+static void TopKIdentity(void *acc, const void *ctx) {
+  ((struct TopK *)acc)->size = 0;
+}
+
+static void TopKRange(void *acc, const void *ctx, uint64_t begin,
+                      uint64_t end) {
+  const struct TopKContext *context = ctx;
+  for (uint64_t i = begin; i < end; i++)
+    TopKPush(acc, context->k, context->array[i]);
+}
+
+static void TopKCombine(void *acc, const void *other, const void *ctx) {
+  const struct TopKContext *context = ctx;
+  const struct TopK *top = other;
+  for (uint32_t i = 0; i < top->size; i++)
+    TopKPush(acc, context->k, top->heap[i]);
+}
+
+static const struct PreduceOps TopKOps = {sizeof(struct TopK), TopKIdentity,
+                                          TopKRange, TopKCombine};
+
+static int CompareIntsDescending(const void *a, const void *b) {
+  return CompareInts(b, a);
+}
+
+bool ParallelTopK(const int *array, size_t n, uint32_t k,
+                  const struct PreduceConfig *config, int *top,
+                  uint32_t *count) {
+  if (k == 0 || k > TOPK_MAX)
+    return false;
+  struct TopKContext context = {array, k};
+  struct TopK *acc = malloc(sizeof(struct TopK));
+  if (acc == NULL)
+    return false;
+  bool ok = PreduceRun(&TopKOps, &context, 0, n, config, acc);
+  if (ok) {
+    memcpy(top, acc->heap, acc->size * sizeof(int));
+    qsort(top, acc->size, sizeof(int), CompareIntsDescending);
+    *count = acc->size;
+  }
+  free(acc);
+  return ok;
+}
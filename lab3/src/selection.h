@@ -0,0 +1,65 @@
+#ifndef SELECTION_H
+#define SELECTION_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "preduce.h"
+
+/* Order statistics without sorting the whole array. */
+
+/* The k-th smallest (from 0) element of array[0, n). Threads filter the
+   array down to a narrow value range around the answer, which is then
+   selected serially. */
+bool ParallelSelect(const int *array, size_t n, size_t k, int threads,
+                    int *result);
+
+/* KLL quantile sketch. Level h holds items of weight 2^h, a full level
+   is sorted and every other item is promoted. Sketches of disjoint parts
+   merge into the sketch of the whole, so they can be built by separate
+   workers, processes or servers. */
+#define KLL_K 200
+#define KLL_MAX_LEVELS 32
+/* Room for a full level plus arrivals; a level that runs out of room
+   is compacted before more items are appended. */
+#define KLL_LEVEL_STORAGE (2 * KLL_K)
+
+struct KllSketch {
+  uint64_t n;
+  uint64_t random;
+  uint32_t levels;
+  uint32_t size;     /* items kept over all levels */
+  uint32_t capacity; /* sum of level capacities */
+  uint32_t sizes[KLL_MAX_LEVELS];
+  int items[KLL_MAX_LEVELS][KLL_LEVEL_STORAGE];
+};
+
+void KllInit(struct KllSketch *sketch);
+void KllAdd(struct KllSketch *sketch, int value);
+void KllMerge(struct KllSketch *sketch, const struct KllSketch *other);
+/* Value at quantile q in [0, 1], rank error is about 1.7 / KLL_K.
+ * Returns false if out of memory. */
+bool KllQuantile(const struct KllSketch *sketch, double q, int *value);
+
+/* Compact form for sending a sketch: header and used items only. */
+size_t KllPackedSize(const struct KllSketch *sketch);
+void KllPack(const struct KllSketch *sketch, void *buf);
+bool KllUnpack(struct KllSketch *sketch, const void *buf, size_t len);
+
+extern const struct PreduceOps KllOps;
+
+/* The k largest elements in descending order, k <= TOPK_MAX. Every
+   worker keeps a bounded min-heap, the heaps are merged at the end. */
+#define TOPK_MAX 4096
+
+struct TopK {
+  uint32_t size;
+  int heap[TOPK_MAX];
+};
+
+bool ParallelTopK(const int *array, size_t n, uint32_t k,
+                  const struct PreduceConfig *config, int *top,
+                  uint32_t *count);
+
+#endif
@@ -1,31 +1,82 @@
+#include <getopt.h>
+#include <limits.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "array_file.h"
 #include "find_min_max.h"
 #include "utils.h"
 
 int main(int argc, char **argv) {
-  if (argc != 3) {
-    printf("Usage: %s seed arraysize\n", argv[0]);
-    return 1;
+  const char *input = NULL;
+  const char *output = NULL;
+
+  while (true) {
+    static struct option options[] = {{"input", required_argument, 0, 0},
+                                      {"output", required_argument, 0, 0},
+                                      {0, 0, 0, 0}};
+
+    int option_index = 0;
+    int c = getopt_long(argc, argv, "", options, &option_index);
+
+    if (c == -1) break;
+
+    if (c == 0 && option_index == 0)
+      input = optarg;
+    else if (c == 0 && option_index == 1)
+      output = optarg;
   }
 
-  int seed = atoi(argv[1]);
-  if (seed <= 0) {
-    printf("seed is a positive number\n");
+  if ((input == NULL && argc - optind != 2) ||
+      (input != NULL && argc != optind)) {
+    printf("Usage: %s seed arraysize [--output file]\n", argv[0]);
+    printf("       %s --input file\n", argv[0]);
     return 1;
   }
 
-  int array_size = atoi(argv[2]);
-  if (array_size <= 0) {
-    printf("array_size is a positive number\n");
-    return 1;
+  struct ArrayFile file = {0};
+  int *array;
+  int array_size;
+  if (input != NULL) {
+    if (!ArrayFileOpen(&file, input)) {
+      perror("can not open input");
+      return 1;
+    }
+    if (file.type != ELEM_I32 || file.count == 0 || file.count > INT_MAX) {
+      printf("input must hold 1 to %d int32 elements\n", INT_MAX);
+      ArrayFileClose(&file);
+      return 1;
+    }
+    array = (int *)file.data;
+    array_size = file.count;
+  } else {
+    int seed = atoi(argv[optind]);
+    if (seed <= 0) {
+      printf("seed is a positive number\n");
+      return 1;
+    }
+
+    array_size = atoi(argv[optind + 1]);
+    if (array_size <= 0) {
+      printf("array_size is a positive number\n");
+      return 1;
+    }
+
+    array = malloc(array_size * sizeof(int));
+    GenerateArray(array, array_size, seed);
+    if (output != NULL && !ArrayFileWrite(output, ELEM_I32, array, array_size)) {
+      perror("can not write output");
+      free(array);
+      return 1;
+    }
   }
 
-  int *array = malloc(array_size * sizeof(int));
-  GenerateArray(array, array_size, seed);
   struct MinMax min_max = GetMinMax(array, 0, array_size);
-  free(array);
+  if (input != NULL)
+    ArrayFileClose(&file);
+  else
+    free(array);
 
   printf("min: %d\n", min_max.min);
   printf("max: %d\n", min_max.max);
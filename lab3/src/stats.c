@@ -0,0 +1,108 @@
+#include "stats.h"
+
+#include <limits.h>
+
+/* Elements are processed in blocks that stay in L1: the first loop finds
+   min, max and the exact sum, the second one the squared deviations from
+   the block mean. Both vectorize, and memory is still read only once. */
+#define STATS_BLOCK 2048
+
+static void StatsIdentity(void *out, const void *ctx) {
+  struct Stats *stats = out;
+  stats->count = 0;
+  stats->min = INT_MAX;
+  stats->max = INT_MIN;
+  stats->argmin = 0;
+  stats->argmax = 0;
+  stats->sum = 0;
+  stats->mean = 0;
+  stats->m2 = 0;
+}
+
+/* Chan et al. pairwise update, other covers positions after stats. */
+static void StatsCombine(void *out, const void *in, const void *ctx) {
+  struct Stats *stats = out;
+  const struct Stats *other = in;
+  if (other->count == 0)
+    return;
+  if (stats->count == 0) {
+    *stats = *other;
+    return;
+  }
+
+  if (other->min < stats->min) {
+    stats->min = other->min;
+    stats->argmin = other->argmin;
+  }
+  if (other->max > stats->max) {
+    stats->max = other->max;
+    stats->argmax = other->argmax;
+  }
+
+  double n_a = stats->count, n_b = other->count, n = n_a + n_b;
+  double delta = other->mean - stats->mean;
+  stats->mean += delta * n_b / n;
+  stats->m2 += other->m2 + delta * delta * n_a * n_b / n;
+  stats->count += other->count;
+  stats->sum += other->sum;
+}
+
+static void StatsBlock(struct Stats *stats, const int *array, uint64_t begin,
+                       uint64_t end) {
+  int min = INT_MAX, max = INT_MIN;
+  int64_t sum = 0;
+#pragma omp simd reduction(min : min) reduction(max : max) reduction(+ : sum)
+  for (uint64_t i = begin; i < end; i++) {
+    int x = array[i];
+    min = x < min ? x : min;
+    max = x > max ? x : max;
+    sum += x;
+  }
+
+  struct Stats block;
+  block.count = end - begin;
+  block.min = min;
+  block.max = max;
+  block.sum = sum;
+  block.mean = (double)sum / block.count;
+
+  double m2 = 0;
+#pragma omp simd reduction(+ : m2)
+  for (uint64_t i = begin; i < end; i++) {
+    double d = array[i] - block.mean;
+    m2 += d * d;
+  }
+  block.m2 = m2;
+
+  /* Positions are only looked up when they can change the answer. */
+  block.argmin = block.argmax = begin;
+  if (stats->count == 0 || min < stats->min) {
+    while (array[block.argmin] != min)
+      block.argmin++;
+  }
+  if (stats->count == 0 || max > stats->max) {
+    while (array[block.argmax] != max)
+      block.argmax++;
+  }
+  StatsCombine(stats, &block, NULL);
+}
+
+static void StatsRange(void *out, const void *ctx, uint64_t begin,
+                       uint64_t end) {
+  for (uint64_t i = begin; i < end; i += STATS_BLOCK) {
+    uint64_t block_end = end - i < STATS_BLOCK ? end : i + STATS_BLOCK;
+    StatsBlock(out, ctx, i, block_end);
+  }
+}
+
+const struct PreduceOps StatsOps = {sizeof(struct Stats), StatsIdentity,
+                                    StatsRange, StatsCombine};
+
+bool GetStats(int *array, unsigned int begin, unsigned int end,
+              const struct PreduceConfig *config, struct Stats *stats) {
+  return PreduceRun(&StatsOps, array, begin, end, config, stats);
+}
+
+double StatsVariance(const struct Stats *stats) {
+  return stats->count > 0 ? stats->m2 / stats->count : 0;
+}
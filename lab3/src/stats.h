@@ -0,0 +1,30 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "preduce.h"
+
+/* Everything one pass over the array can tell. argmin and argmax are the
+   first positions of min and max, mean and m2 are Welford's running mean
+   and sum of squared deviations. */
+struct Stats {
+  uint64_t count;
+  int min;
+  int max;
+  uint64_t argmin;
+  uint64_t argmax;
+  int64_t sum;
+  double mean;
+  double m2;
+};
+
+extern const struct PreduceOps StatsOps;
+
+/* Stats of array[begin, end), config NULL means serial. */
+bool GetStats(int *array, unsigned int begin, unsigned int end,
+              const struct PreduceConfig *config, struct Stats *stats);
+double StatsVariance(const struct Stats *stats);
+
+#endif
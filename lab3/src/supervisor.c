@@ -0,0 +1,326 @@
+#define _GNU_SOURCE
+#include "supervisor.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/epoll.h>
+#include <sys/pidfd.h>
+#include <sys/resource.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+
+extern char **environ;
+
+/* Event data: the worker index, tagged for its output pipe. */
+#define TIMER_EVENT UINT64_MAX
+#define OUTPUT_EVENT (1ull << 32)
+#define MAX_EVENTS 64
+#define OUTPUT_BUFFER 4096
+
+struct Deadline {
+  int worker;
+  int attempt;
+  struct timespec at;
+};
+
+struct Worker {
+  int pidfd;  /* -1 while not running */
+  int out_fd; /* read end of the output pipe, -1 without one */
+  bool timed_out;
+  struct timespec started;
+};
+
+struct Pool {
+  const struct SupervisorJob *job;
+  const struct SupervisorConfig *config;
+  struct WorkerResult *results;
+  struct Worker *workers;
+  int epoll_fd;
+  int timer_fd;
+  int running;
+  /* Every attempt adds one, the oldest expire first. */
+  struct Deadline *deadlines;
+  size_t first;
+  size_t last;
+};
+
+static double Milliseconds(const struct timespec *from,
+                           const struct timespec *to) {
+  return (to->tv_sec - from->tv_sec) * 1000.0 +
+         (to->tv_nsec - from->tv_nsec) / 1000000.0;
+}
+
+/* A pidfd and maybe a pipe per running worker, the soft limit of 1024
+   would cap the pool. */
+static void RaiseFileLimit(int needed) {
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) != 0 || limit.rlim_cur >= (rlim_t)needed)
+    return;
+  limit.rlim_cur = limit.rlim_max;
+  setrlimit(RLIMIT_NOFILE, &limit);
+}
+
+/* Armed for the oldest deadline, or disarmed when there is none. */
+static void ArmTimer(struct Pool *pool) {
+  struct itimerspec spec = {{0, 0}, {0, 0}};
+  if (pool->first < pool->last)
+    spec.it_value = pool->deadlines[pool->first].at;
+  timerfd_settime(pool->timer_fd, TFD_TIMER_ABSTIME, &spec, NULL);
+}
+
+static void Start(struct Pool *pool, int index) {
+  struct Worker *worker = &pool->workers[index];
+  struct WorkerResult *result = &pool->results[index];
+  const struct SupervisorJob *job = pool->job;
+  pid_t pid;
+
+  result->attempts++;
+  if (result->attempts > 1 && job->restart != NULL)
+    job->restart(job->arg, index);
+  worker->timed_out = false;
+  clock_gettime(CLOCK_MONOTONIC, &worker->started);
+  if (job->argv != NULL) {
+    char *const *argv = job->argv(job->arg, index);
+    int out[2] = {-1, -1};
+    posix_spawn_file_actions_t actions;
+    if (job->output != NULL) {
+      if (pipe2(out, O_CLOEXEC | O_NONBLOCK) != 0) {
+        result->outcome = WORKER_NOT_RUN;
+        return;
+      }
+      /* The child's end as a blocking stdout, dup2 drops O_CLOEXEC. */
+      fcntl(out[1], F_SETFL, 0);
+      posix_spawn_file_actions_init(&actions);
+      posix_spawn_file_actions_adddup2(&actions, out[1], STDOUT_FILENO);
+    }
+    int error = posix_spawn(&pid, argv[0], job->output ? &actions : NULL,
+                            NULL, argv, environ);
+    if (job->output != NULL) {
+      posix_spawn_file_actions_destroy(&actions);
+      close(out[1]);
+    }
+    struct epoll_event event = {.events = EPOLLIN,
+                                .data.u64 = OUTPUT_EVENT | index};
+    if (error == 0 && out[0] >= 0 &&
+        epoll_ctl(pool->epoll_fd, EPOLL_CTL_ADD, out[0], &event) != 0) {
+      kill(pid, SIGKILL);
+      waitpid(pid, NULL, 0);
+      error = errno;
+    }
+    if (error != 0) {
+      if (out[0] >= 0)
+        close(out[0]);
+      result->outcome = WORKER_NOT_RUN;
+      return;
+    }
+    worker->out_fd = out[0];
+  } else {
+    pid = fork();
+    if (pid < 0) {
+      result->outcome = WORKER_NOT_RUN;
+      return;
+    }
+    if (pid == 0)
+      _exit(job->run(job->arg, index));
+  }
+
+  /* Not reaped yet, so the pid still names this child. */
+  int pidfd = pidfd_open(pid, 0);
+  struct epoll_event event = {.events = EPOLLIN, .data.u64 = index};
+  if (pidfd < 0 || epoll_ctl(pool->epoll_fd, EPOLL_CTL_ADD, pidfd, &event)) {
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    if (pidfd >= 0)
+      close(pidfd);
+    if (worker->out_fd >= 0)
+      close(worker->out_fd);
+    worker->out_fd = -1;
+    result->outcome = WORKER_NOT_RUN;
+    return;
+  }
+  worker->pidfd = pidfd;
+  result->pid = pid;
+  pool->running++;
+
+  if (pool->config->timeout_ms > 0) {
+    struct Deadline *deadline = &pool->deadlines[pool->last++];
+    deadline->worker = index;
+    deadline->attempt = result->attempts;
+    deadline->at = worker->started;
+    deadline->at.tv_sec += pool->config->timeout_ms / 1000;
+    deadline->at.tv_nsec += pool->config->timeout_ms % 1000 * 1000000L;
+    if (deadline->at.tv_nsec >= 1000000000L) {
+      deadline->at.tv_sec++;
+      deadline->at.tv_nsec -= 1000000000L;
+    }
+    if (pool->last - pool->first == 1)
+      ArmTimer(pool);
+  }
+}
+
+/* Hands over what is in the pipe, and closes it at end of file. */
+static void ReadOutput(struct Pool *pool, int index) {
+  struct Worker *worker = &pool->workers[index];
+  char buffer[OUTPUT_BUFFER];
+  while (worker->out_fd >= 0) {
+    ssize_t n = read(worker->out_fd, buffer, sizeof(buffer));
+    if (n > 0) {
+      pool->job->output(pool->job->arg, index, buffer, n);
+      continue;
+    }
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && errno == EAGAIN)
+      return;
+    epoll_ctl(pool->epoll_fd, EPOLL_CTL_DEL, worker->out_fd, NULL);
+    close(worker->out_fd);
+    worker->out_fd = -1;
+  }
+}
+
+/* The pidfd is readable, so the child has exited and waitpid returns
+   at once. Failed attempts are started again while retries are left. */
+static void Reap(struct Pool *pool, int index) {
+  struct Worker *worker = &pool->workers[index];
+  struct WorkerResult *result = &pool->results[index];
+  int status = 0;
+  struct timespec now;
+
+  if (worker->pidfd < 0)
+    return;
+  waitpid(result->pid, &status, 0);
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  /* Forked workers started later hold copies of the pidfd, closing it
+     alone would leave it in the epoll set. */
+  epoll_ctl(pool->epoll_fd, EPOLL_CTL_DEL, worker->pidfd, NULL);
+  close(worker->pidfd);
+  worker->pidfd = -1;
+  pool->running--;
+  /* What is left in the pipe, unless a grandchild still holds it. */
+  if (worker->out_fd >= 0) {
+    ReadOutput(pool, index);
+    if (worker->out_fd >= 0) {
+      epoll_ctl(pool->epoll_fd, EPOLL_CTL_DEL, worker->out_fd, NULL);
+      close(worker->out_fd);
+      worker->out_fd = -1;
+    }
+  }
+
+  result->elapsed_ms = Milliseconds(&worker->started, &now);
+  result->signaled = WIFSIGNALED(status);
+  result->code = result->signaled ? WTERMSIG(status) : WEXITSTATUS(status);
+  if (worker->timed_out)
+    result->outcome = WORKER_TIMED_OUT;
+  else if (result->signaled || result->code != 0)
+    result->outcome = WORKER_FAILED;
+  else
+    result->outcome = WORKER_EXITED;
+
+  while (result->outcome != WORKER_EXITED &&
+         result->attempts <= pool->config->retries) {
+    Start(pool, index);
+    if (worker->pidfd >= 0)
+      break;
+  }
+}
+
+/* Kills the workers whose attempt is past its deadline. Deadlines of
+   attempts that already ended are dropped on the way. */
+static void Expire(struct Pool *pool) {
+  uint64_t expirations;
+  struct timespec now;
+  if (read(pool->timer_fd, &expirations, sizeof(expirations)) < 0 &&
+      errno != EAGAIN)
+    return;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  while (pool->first < pool->last) {
+    struct Deadline *deadline = &pool->deadlines[pool->first];
+    if (Milliseconds(&now, &deadline->at) > 0)
+      break;
+    pool->first++;
+    struct Worker *worker = &pool->workers[deadline->worker];
+    if (worker->pidfd >= 0 &&
+        pool->results[deadline->worker].attempts == deadline->attempt) {
+      pidfd_send_signal(worker->pidfd, SIGKILL, NULL, 0);
+      worker->timed_out = true;
+    }
+  }
+  ArmTimer(pool);
+}
+
+bool SupervisorRun(const struct SupervisorJob *job, int count,
+                   const struct SupervisorConfig *config,
+                   struct WorkerResult *results) {
+  int parallel =
+      config->parallel > 0 && config->parallel < count ? config->parallel
+                                                       : count;
+  struct Pool pool = {.job = job, .config = config, .results = results};
+  memset(results, 0, count * sizeof(struct WorkerResult));
+  for (int i = 0; i < count; i++)
+    results[i].outcome = WORKER_NOT_RUN;
+  RaiseFileLimit(2 * parallel + 64);
+
+  pool.workers = malloc(count * sizeof(struct Worker));
+  pool.deadlines = config->timeout_ms > 0
+                       ? malloc((size_t)count * (config->retries + 1) *
+                                sizeof(struct Deadline))
+                       : NULL;
+  pool.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  pool.timer_fd =
+      timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  struct epoll_event timer_event = {.events = EPOLLIN,
+                                    .data.u64 = TIMER_EVENT};
+  bool ok = pool.workers != NULL &&
+            (config->timeout_ms == 0 || pool.deadlines != NULL) &&
+            pool.epoll_fd >= 0 && pool.timer_fd >= 0 &&
+            epoll_ctl(pool.epoll_fd, EPOLL_CTL_ADD, pool.timer_fd,
+                      &timer_event) == 0;
+  int saved_errno = errno;
+
+  if (ok) {
+    for (int i = 0; i < count; i++) {
+      pool.workers[i].pidfd = -1;
+      pool.workers[i].out_fd = -1;
+    }
+    int next = 0;
+    struct epoll_event events[MAX_EVENTS];
+    while (true) {
+      while (pool.running < parallel && next < count)
+        Start(&pool, next++);
+      if (pool.running == 0)
+        break;
+      int n = epoll_wait(pool.epoll_fd, events, MAX_EVENTS, -1);
+      for (int i = 0; i < n; i++) {
+        uint64_t data = events[i].data.u64;
+        if (data == TIMER_EVENT)
+          Expire(&pool);
+        else if (data & OUTPUT_EVENT)
+          ReadOutput(&pool, (uint32_t)data);
+        else
+          Reap(&pool, (int)data);
+      }
+    }
+  }
+
+  if (pool.timer_fd >= 0)
+    close(pool.timer_fd);
+  if (pool.epoll_fd >= 0)
+    close(pool.epoll_fd);
+  free(pool.deadlines);
+  free(pool.workers);
+  errno = saved_errno;
+  return ok;
+}
+
+const char *WorkerOutcomeName(enum WorkerOutcome outcome) {
+  static const char *kNames[] = {"exited", "failed", "timed out", "not run"};
+  return kNames[outcome];
+}
@@ -0,0 +1,63 @@
+#ifndef SUPERVISOR_H
+#define SUPERVISOR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* Process pool supervisor. Every worker is watched through a pidfd in
+   one epoll set, whose event data is the worker index, so an exit is
+   matched to its worker in O(1) however many are running, and reaping
+   one worker never waits for another. Timeouts come from a single
+   timerfd armed for the earliest deadline: deadlines are start time
+   plus the same timeout, so they expire in start order and a FIFO of
+   them is enough. No signal handlers, no SIGCHLD, no waitpid(-1), so
+   the supervisor leaves children it did not start alone. */
+
+/* What worker `index` runs: a program when argv is set (started with
+   posix_spawn, which vforks), otherwise run() in a forked child with
+   its return value as the exit code. */
+struct SupervisorJob {
+  int (*run)(void *arg, int index);
+  void *arg;
+  char *const *(*argv)(void *arg, int index);
+  /* Programs only: when set, their standard output comes through a pipe
+     in the same epoll set and is handed over as it arrives. */
+  void (*output)(void *arg, int index, const char *data, size_t size);
+  /* When set, called before every retry, e.g. to drop the output of
+     the failed attempt. */
+  void (*restart)(void *arg, int index);
+};
+
+struct SupervisorConfig {
+  int parallel;   /* workers running at once, 0 for all of them */
+  int timeout_ms; /* per attempt, 0 for none */
+  int retries;    /* attempts after a failed or timed out one */
+};
+
+enum WorkerOutcome {
+  WORKER_EXITED,    /* exit code 0 */
+  WORKER_FAILED,    /* non-zero exit code or killed by a signal */
+  WORKER_TIMED_OUT, /* killed after timeout_ms */
+  WORKER_NOT_RUN,   /* could not be started */
+};
+
+struct WorkerResult {
+  enum WorkerOutcome outcome;
+  int code;      /* exit code, or the signal with WORKER_FAILED */
+  bool signaled;
+  int attempts;
+  pid_t pid;     /* of the last attempt */
+  double elapsed_ms;
+};
+
+/* Runs workers 0..count-1 and fills results, which has count entries.
+   Returns false with errno set when the supervisor itself could not
+   run, a worker that fails only shows in its result. */
+bool SupervisorRun(const struct SupervisorJob *job, int count,
+                   const struct SupervisorConfig *config,
+                   struct WorkerResult *results);
+
+const char *WorkerOutcomeName(enum WorkerOutcome outcome);
+
+#endif
@@ -0,0 +1,229 @@
+#include "typed.h"
+
+#include <errno.h>
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define IS_NAN_INT(x) 0
+#define IS_NAN_FLOAT(x) isnan(x)
+#define FITS_ALWAYS(x) true
+#define FITS_I64(x) ((x) >= INT64_MIN && (x) <= INT64_MAX)
+
+/* Within +-2^40, so the sum of 2^32 of them stays far from the int64
+   limits in practice. */
+static int64_t RandomI64(void) {
+  uint64_t x = (uint64_t)rand() << 33 ^ (uint64_t)rand() << 2 ^ rand();
+  return (int64_t)(x >> 23) - ((int64_t)1 << 40);
+}
+
+static double RandomReal(void) {
+  return ((double)rand() / RAND_MAX * 2 - 1) * 1e6;
+}
+
+/* S is the name suffix, T the element type, MID the block accumulator
+   and BLOCK the number of elements MID can sum without overflow, WIDE
+   the accumulator of the whole range and FITS whether its total fits
+   the result. */
+#define DEFINE_TYPED(S, T, LOWEST, HIGHEST, IS_NAN, MID, BLOCK, WIDE, FITS,   \
+                     FIELD, RANDOM)                                            \
+  struct MinMax##S {                                                           \
+    T min;                                                                     \
+    T max;                                                                     \
+    uint64_t nans;                                                             \
+  };                                                                           \
+                                                                               \
+  static void Generate##S(T *array, uint64_t size) {                           \
+    for (uint64_t i = 0; i < size; i++)                                        \
+      array[i] = (T)(RANDOM);                                                  \
+  }                                                                            \
+                                                                               \
+  static void MinMaxIdentity##S(void *out, const void *ctx) {                  \
+    struct MinMax##S *acc = out;                                               \
+    acc->min = HIGHEST;                                                        \
+    acc->max = LOWEST;                                                         \
+    acc->nans = 0;                                                             \
+  }                                                                            \
+                                                                               \
+  static void MinMaxRange##S(void *out, const void *ctx, uint64_t begin,       \
+                             uint64_t end) {                                   \
+    struct MinMax##S *acc = out;                                               \
+    const T *array = ctx;                                                      \
+    T min = acc->min, max = acc->max;                                          \
+    uint64_t nans = acc->nans;                                                 \
+    _Pragma("omp simd reduction(min : min) reduction(max : max) \
+             reduction(+ : nans)")                                             \
+    for (uint64_t i = begin; i < end; i++) {                                   \
+      T x = array[i];                                                          \
+      nans += IS_NAN(x);                                                       \
+      min = x < min ? x : min;                                                 \
+      max = x > max ? x : max;                                                 \
+    }                                                                          \
+    acc->min = min;                                                            \
+    acc->max = max;                                                            \
+    acc->nans = nans;                                                          \
+  }                                                                            \
+                                                                               \
+  static void MinMaxCombine##S(void *out, const void *in, const void *ctx) {   \
+    struct MinMax##S *acc = out;                                               \
+    const struct MinMax##S *other = in;                                        \
+    acc->min = other->min < acc->min ? other->min : acc->min;                  \
+    acc->max = other->max > acc->max ? other->max : acc->max;                  \
+    acc->nans += other->nans;                                                  \
+  }                                                                            \
+                                                                               \
+  static const struct PreduceOps MinMaxOps##S = {                              \
+      sizeof(struct MinMax##S), MinMaxIdentity##S, MinMaxRange##S,             \
+      MinMaxCombine##S};                                                       \
+                                                                               \
+  static void SumIdentity##S(void *out, const void *ctx) {                     \
+    *(WIDE *)out = 0;                                                          \
+  }                                                                            \
+                                                                               \
+  static void SumRange##S(void *out, const void *ctx, uint64_t begin,          \
+                          uint64_t end) {                                      \
+    const T *array = ctx;                                                      \
+    WIDE sum = *(WIDE *)out;                                                   \
+    for (uint64_t i = begin, block_end; i < end; i = block_end) {            \
+      block_end = end - i < (BLOCK) ? end : i + (BLOCK);                       \
+      MID block = 0;                                                           \
+      _Pragma("omp simd reduction(+ : block)")                                 \
+      for (uint64_t j = i; j < block_end; j++)                                 \
+        block += array[j];                                                     \
+      sum += block;                                                            \
+    }                                                                          \
+    *(WIDE *)out = sum;                                                        \
+  }                                                                            \
+                                                                               \
+  static void SumCombine##S(void *out, const void *in, const void *ctx) {      \
+    *(WIDE *)out += *(const WIDE *)in;                                         \
+  }                                                                            \
+                                                                               \
+  static const struct PreduceOps SumOps##S = {                                 \
+      sizeof(WIDE), SumIdentity##S, SumRange##S, SumCombine##S};               \
+                                                                               \
+  static bool MinMax##S(const void *array, uint64_t begin, uint64_t end,       \
+                        const struct PreduceConfig *config,                    \
+                        struct TypedMinMax *min_max) {                         \
+    struct MinMax##S acc;                                                      \
+    if (!PreduceRun(&MinMaxOps##S, array, begin, end, config, &acc))           \
+      return false;                                                            \
+    min_max->nans = acc.nans;                                                  \
+    if (acc.nans == end - begin) {                                             \
+      min_max->min.f = min_max->max.f = NAN;                                   \
+    } else {                                                                   \
+      min_max->min.FIELD = acc.min;                                            \
+      min_max->max.FIELD = acc.max;                                            \
+    }                                                                          \
+    return true;                                                               \
+  }                                                                            \
+                                                                               \
+  static bool Sum##S(const void *array, uint64_t begin, uint64_t end,          \
+                     const struct PreduceConfig *config,                       \
+                     union TypedScalar *sum) {                                 \
+    WIDE acc;                                                                  \
+    if (!PreduceRun(&SumOps##S, array, begin, end, config, &acc))              \
+      return false;                                                            \
+    if (!FITS(acc)) {                                                          \
+      errno = ERANGE;                                                          \
+      return false;                                                            \
+    }                                                                          \
+    sum->FIELD = acc;                                                          \
+    return true;                                                               \
+  }
+
+/* int8 and int16 blocks stay below INT32_MAX in the worst case, int64
+   is summed in __int128, which 2^64 elements can not overflow. */
+DEFINE_TYPED(I8, int8_t, INT8_MIN, INT8_MAX, IS_NAN_INT, int32_t,
+             (uint64_t)1 << 24, int64_t, FITS_ALWAYS, i, rand())
+DEFINE_TYPED(I16, int16_t, INT16_MIN, INT16_MAX, IS_NAN_INT, int32_t,
+             (uint64_t)1 << 16, int64_t, FITS_ALWAYS, i, rand())
+DEFINE_TYPED(I32, int32_t, INT32_MIN, INT32_MAX, IS_NAN_INT, int64_t,
+             UINT64_MAX, int64_t, FITS_ALWAYS, i, rand())
+DEFINE_TYPED(I64, int64_t, INT64_MIN, INT64_MAX, IS_NAN_INT, __int128,
+             UINT64_MAX, __int128, FITS_I64, i, RandomI64())
+DEFINE_TYPED(F32, float, -INFINITY, INFINITY, IS_NAN_FLOAT, double,
+             UINT64_MAX, double, FITS_ALWAYS, f, RandomReal())
+DEFINE_TYPED(F64, double, -INFINITY, INFINITY, IS_NAN_FLOAT, double,
+             UINT64_MAX, double, FITS_ALWAYS, f, RandomReal())
+
+#define TYPED_DISPATCH(type, CALL)                                             \
+  switch (type) {                                                              \
+  case ELEM_I8:                                                                \
+    return CALL(I8);                                                           \
+  case ELEM_I16:                                                               \
+    return CALL(I16);                                                          \
+  case ELEM_I32:                                                               \
+    return CALL(I32);                                                          \
+  case ELEM_I64:                                                               \
+    return CALL(I64);                                                          \
+  case ELEM_F32:                                                               \
+    return CALL(F32);                                                          \
+  case ELEM_F64:                                                               \
+    return CALL(F64);                                                          \
+  }
+
+static const char *const type_names[] = {"int8",  "int16", "int32",
+                                         "int64", "float", "double"};
+static const size_t type_sizes[] = {1, 2, 4, 8, 4, 8};
+
+bool ElemTypeParse(const char *name, enum ElemType *type) {
+  for (int i = 0; i <= ELEM_F64; i++) {
+    if (strcmp(name, type_names[i]) == 0) {
+      *type = i;
+      return true;
+    }
+  }
+  return false;
+}
+
+const char *ElemTypeName(enum ElemType type) { return type_names[type]; }
+
+size_t ElemTypeSize(enum ElemType type) { return type_sizes[type]; }
+
+bool ElemTypeIsFloat(enum ElemType type) {
+  return type == ELEM_F32 || type == ELEM_F64;
+}
+
+void *GenerateTypedArray(enum ElemType type, uint64_t size, unsigned int seed) {
+  void *array = malloc(size * ElemTypeSize(type));
+  if (array == NULL)
+    return NULL;
+  return FillTypedArray(type, array, size, seed);
+}
+
+void *FillTypedArray(enum ElemType type, void *array, uint64_t size,
+                     unsigned int seed) {
+  srand(seed);
+#define GENERATE(S) (Generate##S(array, size), array)
+  TYPED_DISPATCH(type, GENERATE)
+#undef GENERATE
+  return array;
+}
+
+bool TypedMinMax(enum ElemType type, const void *array, uint64_t begin,
+                 uint64_t end, const struct PreduceConfig *config,
+                 struct TypedMinMax *min_max) {
+#define MIN_MAX(S) MinMax##S(array, begin, end, config, min_max)
+  TYPED_DISPATCH(type, MIN_MAX)
+#undef MIN_MAX
+  return false;
+}
+
+bool TypedSum(enum ElemType type, const void *array, uint64_t begin,
+              uint64_t end, const struct PreduceConfig *config,
+              union TypedScalar *sum) {
+#define SUM(S) Sum##S(array, begin, end, config, sum)
+  TYPED_DISPATCH(type, SUM)
+#undef SUM
+  return false;
+}
+
+int FormatTypedScalar(char *buf, size_t len, enum ElemType type,
+                      union TypedScalar value) {
+  if (ElemTypeIsFloat(type))
+    return snprintf(buf, len, "%.17g", value.f);
+  return snprintf(buf, len, "%ld", value.i);
+}
@@ -0,0 +1,54 @@
+#ifndef TYPED_H
+#define TYPED_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "preduce.h"
+
+/* Generation, min/max and sum for arrays of other element types. The
+   kernels are generated per type, results are widened to int64_t or
+   double so callers can handle all types the same way. */
+
+enum ElemType { ELEM_I8, ELEM_I16, ELEM_I32, ELEM_I64, ELEM_F32, ELEM_F64 };
+
+union TypedScalar {
+  int64_t i;
+  double f;
+};
+
+/* NaNs are skipped and counted, min and max are NaN only when every
+   element is. */
+struct TypedMinMax {
+  union TypedScalar min;
+  union TypedScalar max;
+  uint64_t nans;
+};
+
+bool ElemTypeParse(const char *name, enum ElemType *type);
+const char *ElemTypeName(enum ElemType type);
+size_t ElemTypeSize(enum ElemType type);
+bool ElemTypeIsFloat(enum ElemType type);
+
+/* The int32 variant produces the same array as GenerateArray. */
+void *GenerateTypedArray(enum ElemType type, uint64_t size, unsigned int seed);
+/* The same into memory the caller owns, returns array. */
+void *FillTypedArray(enum ElemType type, void *array, uint64_t size,
+                     unsigned int seed);
+
+bool TypedMinMax(enum ElemType type, const void *array, uint64_t begin,
+                 uint64_t end, const struct PreduceConfig *config,
+                 struct TypedMinMax *min_max);
+/* Narrow integers are summed in int32 blocks and int64 overall, int64
+   in __int128, floats in double. Fails with ERANGE when an int64 total
+   does not fit in int64. */
+bool TypedSum(enum ElemType type, const void *array, uint64_t begin,
+              uint64_t end, const struct PreduceConfig *config,
+              union TypedScalar *sum);
+
+/* "%ld" or "%.17g" depending on the type. */
+int FormatTypedScalar(char *buf, size_t len, enum ElemType type,
+                      union TypedScalar value);
+
+#endif
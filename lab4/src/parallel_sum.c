@@ -1,32 +1,117 @@
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <getopt.h>
 #include <pthread.h>
 #include <sys/time.h>
 
-struct SumArgs {
-  int *array;
-  int begin;
-  int end;
-};
+#include "arena.h"
+#include "array_file.h"
+#include "mem_report.h"
+#include "sum_lib.h"
+#include "typed.h"
+#include "utils.h"
 
-void *ThreadSum(void *args) {
-  struct SumArgs *sum_args = (struct SumArgs *)args;
-  return (void *)(size_t)Sum(sum_args);
+static double ElapsedMs(const struct timeval *start) {
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  return (now.tv_sec - start->tv_sec) * 1000.0 +
+         (now.tv_usec - start->tv_usec) / 1000.0;
+}
+
+/* --scan: prefix sums into output, timed against a memcpy that moves the
+   same number of bytes. The scan reads the input twice (chunk totals,
+   then the scan) and writes 8 bytes per element. */
+static int RunScan(int *array, uint32_t array_size,
+                   const struct PreduceConfig *config, const char *output,
+                   bool mem_report) {
+  size_t out_size = (size_t)array_size * sizeof(int64_t);
+  int64_t *out = malloc(out_size);
+  int64_t *copy = malloc(out_size);
+  if (out == NULL || copy == NULL) {
+    printf("Error: not enough memory for the scan\n");
+    free(out);
+    free(copy);
+    return 1;
+  }
+  /* Fault the pages in first, both runs should measure bandwidth. */
+  memset(out, 0, out_size);
+  memset(copy, 0, out_size);
+
+  struct SumArgs args = {array, 0, array_size};
+  struct timeval start_time;
+  gettimeofday(&start_time, NULL);
+  bool ok = ParallelScan(&args, config, out);
+  double scan_ms = ElapsedMs(&start_time);
+  if (!ok) {
+    printf("Error: parallel scan failed!\n");
+    free(out);
+    free(copy);
+    return 1;
+  }
+
+  gettimeofday(&start_time, NULL);
+  memcpy(copy, out, out_size);
+  double memcpy_ms = ElapsedMs(&start_time);
+
+  double scan_bytes = 2.0 * array_size * sizeof(int) + out_size;
+  double memcpy_bytes = 2.0 * out_size;
+  printf("Total: %ld\n", out[array_size - 1]);
+  printf("Scan: %.2f GB/s (%fms)\n", scan_bytes / scan_ms / 1e6, scan_ms);
+  printf("memcpy: %.2f GB/s (%fms)\n", memcpy_bytes / memcpy_ms / 1e6,
+         memcpy_ms);
+  printf("Scan/memcpy bandwidth: %.2f\n",
+         (scan_bytes / scan_ms) / (memcpy_bytes / memcpy_ms));
+  if (mem_report)
+    MemReportPhase("scan");
+
+  int result = 0;
+  if (output != NULL && !ArrayFileWrite(output, ELEM_I64, out, array_size)) {
+    perror("write failed");
+    result = 1;
+  }
+  free(out);
+  free(copy);
+  return result;
+}
+
+/* The array is either mapped from --input or generated into the arena,
+   whichever is unused is empty. */
+static void FreeArray(struct Arena *arena, struct ArrayFile *file) {
+  ArrayFileClose(file);
+  ArenaFree(arena);
 }
 
 int main(int argc, char **argv) {
   uint32_t threads_num = 0;
   uint32_t array_size = 0;
   uint32_t seed = 0;
+  enum ElemType type = ELEM_I32;
+  bool scan = false;
+  const char *output = NULL;
+  const char *input = NULL;
+  enum ArenaPages pages = ARENA_PAGES_1G;
+  enum ArenaPrefault prefault = ARENA_PREFAULT_NONE;
+  bool arena_report = false;
+  bool mem_report = false;
 
   while (1) {
     static struct option options[] = {
         {"seed", required_argument, 0, 0},
         {"array_size", required_argument, 0, 0},
         {"threads_num", required_argument, 0, 0},
+        {"type", required_argument, 0, 0},
+        {"scan", no_argument, 0, 0},
+        {"output", required_argument, 0, 0},
+        {"input", required_argument, 0, 0},
+        {"pages", required_argument, 0, 0},
+        {"prefault", required_argument, 0, 0},
+        {"mem-report", no_argument, 0, 0},
         {0, 0, 0, 0}
     };
 
@@ -59,6 +144,38 @@ int main(int argc, char **argv) {
                 return 1;
             }
             break;
+          case 3:
+            if (!ElemTypeParse(optarg, &type)) {
+                printf("type must be int8, int16, int32, int64, float or double\n");
+                return 1;
+            }
+            break;
+          case 4:
+            scan = true;
+            break;
+          case 5:
+            output = optarg;
+            break;
+          case 6:
+            input = optarg;
+            break;
+          case 7:
+            if (!ArenaPagesParse(optarg, &pages)) {
+                printf("pages must be 1g, 2m, thp or 4k\n");
+                return 1;
+            }
+            arena_report = true;
+            break;
+          case 8:
+            if (!ArenaPrefaultParse(optarg, &prefault)) {
+                printf("prefault must be none, populate or workers\n");
+                return 1;
+            }
+            arena_report = true;
+            break;
+          case 9:
+            mem_report = true;
+            break;
         }
         break;
       case '?':
@@ -68,51 +185,101 @@ int main(int argc, char **argv) {
     }
   }
 
-  if (seed == 0 || array_size == 0 || threads_num == 0) {
-    printf("Usage: %s --seed \"num\" --array_size \"num\" --threads_num \"num\"\n", argv[0]);
+  if (threads_num == 0 || (input == NULL && (seed == 0 || array_size == 0))) {
+    printf("Usage: %s --seed \"num\" --array_size \"num\" --threads_num \"num\" [--type \"name\"] [--scan] [--output \"file\"] [--pages 1g|2m|thp|4k] [--prefault none|populate|workers] [--mem-report]\n", argv[0]);
+    printf("       %s --input \"file\" --threads_num \"num\" [--scan] [--output \"file\"] [--mem-report]\n", argv[0]);
     return 1;
   }
 
-  int *array = malloc(sizeof(int) * array_size);
-  GenerateArray(array, array_size, seed);
+  struct PreduceConfig config = {.backend = PREDUCE_THREADS,
+                                 .workers = threads_num};
+  struct ArrayFile file = {0};
+  struct Arena arena = {0};
+  void *array;
+  if (input != NULL) {
+    if (!ArrayFileOpen(&file, input)) {
+      perror("can not open input");
+      return 1;
+    }
+    /* SumArgs has int bounds. */
+    if (file.count == 0 || file.count > INT_MAX) {
+      printf("input must hold 1 to %d elements\n", INT_MAX);
+      ArrayFileClose(&file);
+      return 1;
+    }
+    array = (void *)file.data;
+    array_size = file.count;
+    type = file.type;
+  } else {
+    if (!ArenaInit(&arena, (size_t)array_size * ElemTypeSize(type), pages,
+                   prefault, &config)) {
+      perror("can not map the array");
+      return 1;
+    }
+    uint64_t faults = ArenaPageFaults();
+    struct timeval fill_start;
+    gettimeofday(&fill_start, NULL);
+    array = FillTypedArray(type, ArenaAlloc(&arena, arena.size), array_size,
+                           seed);
+    if (arena_report) {
+      printf("Pages: %s\n", ArenaPagesName(arena.pages));
+      printf("Map and prefault: %fms, %lu page faults\n", arena.init_ms,
+             arena.init_faults);
+      printf("Generate: %fms, %lu page faults\n", ElapsedMs(&fill_start),
+             ArenaPageFaults() - faults);
+    }
+  }
+  if (mem_report)
+    MemReportPhase(input != NULL ? "load" : "generate");
 
-  struct SumArgs args[threads_num];
-  int chunk_size = array_size / threads_num;
-  
-  for (uint32_t i = 0; i < threads_num; i++) {
-    args[i].array = array;
-    args[i].begin = i * chunk_size;
-    args[i].end = (i == threads_num - 1) ? array_size : (i + 1) * chunk_size;
+  if (scan && type != ELEM_I32) {
+    printf("--scan supports only int32 arrays\n");
+    FreeArray(&arena, &file);
+    return 1;
+  }
+  if (!scan && output != NULL &&
+      !ArrayFileWrite(output, type, array, array_size)) {
+    perror("can not write output");
+    FreeArray(&arena, &file);
+    return 1;
   }
 
-  pthread_t threads[threads_num];
+  struct SumArgs args = {array, 0, array_size};
+
+  if (scan) {
+    int result = RunScan(array, array_size, &config, output, mem_report);
+    FreeArray(&arena, &file);
+    return result;
+  }
 
   struct timeval start_time;
   gettimeofday(&start_time, NULL);
 
-  for (uint32_t i = 0; i < threads_num; i++) {
-    if (pthread_create(&threads[i], NULL, ThreadSum, (void *)&args[i])) {
-      printf("Error: pthread_create failed!\n");
-      free(array);
-      return 1;
-    }
-  }
-
-  int total_sum = 0;
-  for (uint32_t i = 0; i < threads_num; i++) {
-    int sum = 0;
-    pthread_join(threads[i], (void **)&sum);
-    total_sum += sum;
+  union TypedScalar total_sum;
+  bool ok = type == ELEM_I32 ? ParallelSum(&args, &config, &total_sum.i)
+                             : TypedSum(type, array, 0, array_size, &config,
+                                        &total_sum);
+  if (!ok) {
+    if (errno == ERANGE)
+      printf("Error: the sum does not fit in int64\n");
+    else
+      printf("Error: parallel sum failed!\n");
+    FreeArray(&arena, &file);
+    return 1;
   }
 
   struct timeval finish_time;
   gettimeofday(&finish_time, NULL);
+  if (mem_report)
+    MemReportPhase("sum");
 
   double elapsed_time = (finish_time.tv_sec - start_time.tv_sec) * 1000.0;
   elapsed_time += (finish_time.tv_usec - start_time.tv_usec) / 1000.0;
 
-  free(array);
-  printf("Total: %d\n", total_sum);
+  FreeArray(&arena, &file);
+  char total[32];
+  FormatTypedScalar(total, sizeof(total), type, total_sum);
+  printf("Total: %s\n", total);
   printf("Elapsed time: %fms\n", elapsed_time);
   return 0;
 }
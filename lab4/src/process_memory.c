@@ -7,8 +7,10 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "mem_report.h"
+
 /* Below is a macro definition */
-#define SHW_ADR(ID, I) (printf("ID %s \t is at virtual address: %8X\n", ID, &I))
+#define SHW_ADR(ID, I) (printf("ID %s \t is at virtual address: %p\n", ID, (void *)&I))
 
 extern int etext, edata, end; /* Global variables for process
                                  memory */
@@ -17,13 +19,13 @@ char *cptr = "This message is output by the function showit()\n"; /* Static */
 char buffer1[25];
 int showit(); /* Function prototype */
 
-main() {
+int main() {
   int i = 0; /* Automatic variable */
 
   /* Printing addressing information */
-  printf("\nAddress etext: %8X \n", &etext);
-  printf("Address edata: %8X \n", &edata);
-  printf("Address end  : %8X \n", &end);
+  printf("\nAddress etext: %p \n", (void *)&etext);
+  printf("Address edata: %p \n", (void *)&edata);
+  printf("Address end  : %p \n", (void *)&end);
 
   SHW_ADR("main", main);
   SHW_ADR("showit", showit);
@@ -34,6 +36,9 @@ main() {
   write(1, buffer1, strlen(buffer1) + 1); /* System call */
   showit(cptr);
 
+  /* Where the pages behind those addresses are, by kind of mapping. */
+  MemReportPhase("showit");
+  return 0;
 } /* end of main function */
 
 /* A function follows */
@@ -42,7 +47,7 @@ int showit(p) char *p;
   char *buffer2;
   SHW_ADR("buffer2", buffer2);
   if ((buffer2 = (char *)malloc((unsigned)(strlen(p) + 1))) != NULL) {
-    printf("Alocated memory at %X\n", buffer2);
+    printf("Alocated memory at %p\n", (void *)buffer2);
     strcpy(buffer2, p);    /* copy the string */
     printf("%s", buffer2); /* Didplay the string */
     free(buffer2);         /* Release location */
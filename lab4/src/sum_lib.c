@@ -1,9 +1,130 @@
 #include "sum_lib.h"
 
-int Sum(const struct SumArgs *args) {
-  int sum = 0;
-  for (int i = args->begin; i < args->end; i++) {
-    sum += args->array[i];
-  }
+#include <errno.h>
+#include <stdlib.h>
+
+PREDUCE_DEFINE(Sum, int64_t, int, acc = 0, acc += ctx[i], acc += other)
+
+int64_t Sum(const struct SumArgs *args) {
+  int64_t sum;
+  SumReduce(args->array, args->begin, args->end, NULL, &sum);
   return sum;
-}
\ No newline at end of file
+}
+
+bool ParallelSum(const struct SumArgs *args, const struct PreduceConfig *config,
+                 int64_t *sum) {
+  return SumReduce(args->array, args->begin, args->end, config, sum);
+}
+
+/* Prefixes of four elements are formed in registers first, so the carry
+   from one group to the next is one add per four elements. */
+static int64_t ScanRange(const int *array, uint64_t n, int64_t carry,
+                         int64_t *out) {
+  uint64_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    int64_t p0 = array[i];
+    int64_t p1 = p0 + array[i + 1];
+    int64_t p2 = p1 + array[i + 2];
+    int64_t p3 = p2 + array[i + 3];
+    out[i] = carry + p0;
+    out[i + 1] = carry + p1;
+    out[i + 2] = carry + p2;
+    out[i + 3] = carry + p3;
+    carry += p3;
+  }
+  for (; i < n; i++) {
+    carry += array[i];
+    out[i] = carry;
+  }
+  return carry;
+}
+
+void Scan(const struct SumArgs *args, int64_t *out) {
+  ScanRange(args->array + args->begin, args->end - args->begin, 0, out);
+}
+
+/* Both passes run on the preduce pool as reductions over chunk numbers,
+   one chunk per index, with the work done as a side effect. */
+struct ScanJob {
+  const int *array;
+  int64_t *out;
+  uint64_t n;
+  uint64_t chunks;
+  int64_t *totals;
+};
+
+static void ScanChunkBounds(const struct ScanJob *job, uint64_t chunk,
+                            uint64_t *begin, uint64_t *end) {
+  *begin = job->n / job->chunks * chunk;
+  *end = chunk == job->chunks - 1 ? job->n : job->n / job->chunks * (chunk + 1);
+}
+
+static void ScanNothing(void *acc, const void *ctx) {}
+
+static void ScanMerge(void *acc, const void *other, const void *ctx) {}
+
+static void ScanTotals(void *acc, const void *ctx, uint64_t begin,
+                       uint64_t end) {
+  const struct ScanJob *job = ctx;
+  for (uint64_t chunk = begin; chunk < end; chunk++) {
+    uint64_t from, to;
+    ScanChunkBounds(job, chunk, &from, &to);
+    struct SumArgs args = {(int *)job->array, from, to};
+    job->totals[chunk] = Sum(&args);
+  }
+}
+
+static void ScanChunks(void *acc, const void *ctx, uint64_t begin,
+                       uint64_t end) {
+  const struct ScanJob *job = ctx;
+  for (uint64_t chunk = begin; chunk < end; chunk++) {
+    uint64_t from, to;
+    ScanChunkBounds(job, chunk, &from, &to);
+    ScanRange(job->array + from, to - from, job->totals[chunk],
+              job->out + from);
+  }
+}
+
+bool ParallelScan(const struct SumArgs *args,
+                  const struct PreduceConfig *config, int64_t *out) {
+  if (config == NULL || config->backend == PREDUCE_SERIAL) {
+    Scan(args, out);
+    return true;
+  }
+  if (config->backend != PREDUCE_THREADS) {
+    errno = EINVAL;
+    return false;
+  }
+
+  struct ScanJob job;
+  job.array = args->array + args->begin;
+  job.out = out;
+  job.n = args->end - args->begin;
+  job.chunks = config->chunks > 0 ? config->chunks
+               : config->workers > 0 ? (uint64_t)config->workers : 1;
+  if (job.chunks > job.n)
+    job.chunks = job.n > 0 ? job.n : 1;
+  job.totals = malloc(job.chunks * sizeof(int64_t));
+  if (job.totals == NULL)
+    return false;
+
+  struct PreduceConfig per_chunk = *config;
+  per_chunk.chunks = job.chunks;
+  const struct PreduceOps totals_ops = {1, ScanNothing, ScanTotals, ScanMerge};
+  const struct PreduceOps chunks_ops = {1, ScanNothing, ScanChunks, ScanMerge};
+  char unused;
+
+  bool ok = PreduceRun(&totals_ops, &job, 0, job.chunks, &per_chunk, &unused);
+  if (ok) {
+    /* Exclusive scan of the totals gives every chunk its offset. */
+    int64_t offset = 0;
+    for (uint64_t chunk = 0; chunk < job.chunks; chunk++) {
+      int64_t total = job.totals[chunk];
+      job.totals[chunk] = offset;
+      offset += total;
+    }
+    ok = PreduceRun(&chunks_ops, &job, 0, job.chunks, &per_chunk, &unused);
+  }
+  free(job.totals);
+  return ok;
+}
@@ -1,12 +1,28 @@
 #ifndef SUM_LIB_H
 #define SUM_LIB_H
 
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "preduce.h"
+
 struct SumArgs {
   int *array;
   int begin;
   int end;
 };
 
-int Sum(const struct SumArgs *args);
+/* Sums array[begin, end) in 64 bits, so large arrays do not overflow. */
+int64_t Sum(const struct SumArgs *args);
+bool ParallelSum(const struct SumArgs *args, const struct PreduceConfig *config,
+                 int64_t *sum);
+
+/* Inclusive prefix sums: out[i] is the sum of array[begin, begin + i].
+   The parallel version sums the chunks, scans the chunk totals and then
+   scans every chunk from its offset. out is written by the workers, so
+   config must use the threads backend or be NULL. */
+void Scan(const struct SumArgs *args, int64_t *out);
+bool ParallelScan(const struct SumArgs *args,
+                  const struct PreduceConfig *config, int64_t *out);
 
-#endif
\ No newline at end of file
+#endif
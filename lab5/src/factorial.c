@@ -2,29 +2,14 @@
 #include <stdlib.h>
 #include <pthread.h>
 #include <getopt.h>
+#include <stdint.h>
 
-typedef struct {
-    int start;
-    int end;
-    int mod;
-    long long* result;
-    pthread_mutex_t* mutex;
-} ThreadData;
+#include "preduce.h"
 
-void* compute_partial_factorial(void* arg) {
-    ThreadData* data = (ThreadData*)arg;
-    long long partial_result = 1;
-    
-    for (int i = data->start; i <= data->end; i++) {
-        partial_result = (partial_result * i) % data->mod;
-    }
-    
-    pthread_mutex_lock(data->mutex);
-    *(data->result) = (*(data->result) * partial_result) % data->mod;
-    pthread_mutex_unlock(data->mutex);
-    
-    return NULL;
-}
+/* The product of [begin, end) modulo *ctx, indices are the factors. */
+PREDUCE_DEFINE(Factorial, uint64_t, uint64_t, acc = 1 % *ctx,
+               acc = (unsigned __int128)acc * i % *ctx,
+               acc = (unsigned __int128)acc * other % *ctx)
 
 int main(int argc, char* argv[]) {
     int k = 0;
@@ -62,44 +47,15 @@ int main(int argc, char* argv[]) {
         return 1;
     }
     
-    pthread_t* threads = malloc(pnum * sizeof(pthread_t));
-    ThreadData* thread_data = malloc(pnum * sizeof(ThreadData));
-    pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
-    long long result = 1;
-    
-    int chunk_size = k / pnum;
-    int remainder = k % pnum;
-    int current_start = 1;
-    
-    for (int i = 0; i < pnum; i++) {
-        int chunk = chunk_size;
-        if (i < remainder) {
-            chunk++;
-        }
-        
-        thread_data[i].start = current_start;
-        thread_data[i].end = current_start + chunk - 1;
-        thread_data[i].mod = mod;
-        thread_data[i].result = &result;
-        thread_data[i].mutex = &mutex;
-        
-        current_start += chunk;
-        
-        if (pthread_create(&threads[i], NULL, compute_partial_factorial, &thread_data[i]) != 0) {
-            perror("pthread_create failed");
-            return 1;
-        }
-    }
-    
-    for (int i = 0; i < pnum; i++) {
-        pthread_join(threads[i], NULL);
+    uint64_t modulus = mod;
+    uint64_t result;
+    struct PreduceConfig config = {.backend = PREDUCE_THREADS, .workers = pnum};
+    if (!FactorialReduce(&modulus, 1, (uint64_t)k + 1, &config, &result)) {
+        printf("Factorial computation failed\n");
+        return 1;
     }
-    
-    printf("%d! mod %d = %lld\n", k, mod, result);
-    
-    free(threads);
-    free(thread_data);
-    pthread_mutex_destroy(&mutex);
+
+    printf("%d! mod %d = %lu\n", k, mod, result);
     
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,178 @@
+#include "lock.h"
+
+#include <sched.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+/* Spins between yields, and before the adaptive lock goes to sleep. */
+#define SPINS 128
+
+static const char *kKindNames[LOCK_KINDS] = {"mutex", "ticket", "mcs",
+                                             "adaptive"};
+
+bool LockKindParse(const char *name, enum LockKind *kind) {
+  for (int i = 0; i < LOCK_KINDS; i++) {
+    if (strcmp(name, kKindNames[i]) == 0) {
+      *kind = i;
+      return true;
+    }
+  }
+  return false;
+}
+
+const char *LockKindName(enum LockKind kind) { return kKindNames[kind]; }
+
+static inline void CpuRelax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  __asm__ volatile("yield");
+#endif
+}
+
+/* Called once per failed check, yields every SPINS calls. */
+static inline void Backoff(int *spins) {
+  if (++*spins % SPINS == 0)
+    sched_yield();
+  else
+    CpuRelax();
+}
+
+static void FutexWait(atomic_int *addr, int expected) {
+  syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+static void FutexWake(atomic_int *addr, int count) {
+  syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+void LockInit(struct Lock *lock, enum LockKind kind) {
+  memset(lock, 0, sizeof(*lock));
+  lock->kind = kind;
+  switch (kind) {
+  case LOCK_MUTEX:
+    pthread_mutex_init(&lock->mutex, NULL);
+    break;
+  case LOCK_TICKET:
+    atomic_init(&lock->ticket.next, 0);
+    atomic_init(&lock->ticket.serving, 0);
+    break;
+  case LOCK_MCS:
+    atomic_init(&lock->tail, NULL);
+    break;
+  case LOCK_ADAPTIVE:
+    atomic_init(&lock->state, 0);
+    break;
+  }
+}
+
+void LockDestroy(struct Lock *lock) {
+  if (lock->kind == LOCK_MUTEX)
+    pthread_mutex_destroy(&lock->mutex);
+}
+
+static void TicketAcquire(struct Lock *lock) {
+  unsigned ticket = atomic_fetch_add_explicit(&lock->ticket.next, 1,
+                                              memory_order_relaxed);
+  int spins = 0;
+  while (atomic_load_explicit(&lock->ticket.serving, memory_order_acquire) !=
+         ticket)
+    Backoff(&spins);
+}
+
+static void TicketRelease(struct Lock *lock) {
+  unsigned serving =
+      atomic_load_explicit(&lock->ticket.serving, memory_order_relaxed);
+  atomic_store_explicit(&lock->ticket.serving, serving + 1,
+                        memory_order_release);
+}
+
+static void McsAcquire(struct Lock *lock, struct LockNode *node) {
+  atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+  atomic_store_explicit(&node->waiting, 1, memory_order_relaxed);
+  struct LockNode *prev =
+      atomic_exchange_explicit(&lock->tail, node, memory_order_acq_rel);
+  if (prev == NULL)
+    return;
+  atomic_store_explicit(&prev->next, node, memory_order_release);
+  int spins = 0;
+  while (atomic_load_explicit(&node->waiting, memory_order_acquire))
+    Backoff(&spins);
+}
+
+static void McsRelease(struct Lock *lock, struct LockNode *node) {
+  struct LockNode *next =
+      atomic_load_explicit(&node->next, memory_order_acquire);
+  if (next == NULL) {
+    struct LockNode *expected = node;
+    if (atomic_compare_exchange_strong_explicit(&lock->tail, &expected, NULL,
+                                                memory_order_acq_rel,
+                                                memory_order_relaxed))
+      return;
+    /* A successor swapped the tail but has not linked itself yet. */
+    int spins = 0;
+    while ((next = atomic_load_explicit(&node->next, memory_order_acquire)) ==
+           NULL)
+      Backoff(&spins);
+  }
+  atomic_store_explicit(&next->waiting, 0, memory_order_release);
+}
+
+/* Drepper's three state futex mutex with a spinning phase in front. */
+static void AdaptiveAcquire(struct Lock *lock) {
+  for (int spins = 0; spins < SPINS; spins++) {
+    int expected = 0;
+    if (atomic_load_explicit(&lock->state, memory_order_relaxed) == 0 &&
+        atomic_compare_exchange_weak_explicit(&lock->state, &expected, 1,
+                                              memory_order_acquire,
+                                              memory_order_relaxed))
+      return;
+    CpuRelax();
+  }
+  /* Whoever leaves state 2 behind on release wakes a sleeper, so take
+     the lock as 2 from here on. */
+  while (atomic_exchange_explicit(&lock->state, 2, memory_order_acquire) != 0)
+    FutexWait(&lock->state, 2);
+}
+
+static void AdaptiveRelease(struct Lock *lock) {
+  if (atomic_exchange_explicit(&lock->state, 0, memory_order_release) == 2)
+    FutexWake(&lock->state, 1);
+}
+
+void LockAcquire(struct Lock *lock, struct LockNode *node) {
+  switch (lock->kind) {
+  case LOCK_MUTEX:
+    pthread_mutex_lock(&lock->mutex);
+    break;
+  case LOCK_TICKET:
+    TicketAcquire(lock);
+    break;
+  case LOCK_MCS:
+    McsAcquire(lock, node);
+    break;
+  case LOCK_ADAPTIVE:
+    AdaptiveAcquire(lock);
+    break;
+  }
+}
+
+void LockRelease(struct Lock *lock, struct LockNode *node) {
+  switch (lock->kind) {
+  case LOCK_MUTEX:
+    pthread_mutex_unlock(&lock->mutex);
+    break;
+  case LOCK_TICKET:
+    TicketRelease(lock);
+    break;
+  case LOCK_MCS:
+    McsRelease(lock, node);
+    break;
+  case LOCK_ADAPTIVE:
+    AdaptiveRelease(lock);
+    break;
+  }
+}
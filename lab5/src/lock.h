@@ -0,0 +1,51 @@
+#ifndef LOCK_H
+#define LOCK_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+
+/* Mutual exclusion locks behind one interface, so a critical section
+   can be benchmarked with each of them:
+
+     mutex     pthread_mutex_t, the baseline
+     ticket    FIFO, every waiter spins on the same counter
+     mcs       FIFO queue, every waiter spins on its own node
+     adaptive  spins briefly, then sleeps on a futex
+
+   Spinning waiters yield the CPU now and then, with more threads than
+   cores the holder may be waiting for a CPU itself. */
+
+enum LockKind { LOCK_MUTEX, LOCK_TICKET, LOCK_MCS, LOCK_ADAPTIVE };
+
+#define LOCK_KINDS 4
+
+/* MCS queue entry. It has to stay valid from LockAcquire until the
+   matching LockRelease, other locks ignore it. */
+struct LockNode {
+  _Atomic(struct LockNode *) next;
+  atomic_int waiting;
+};
+
+struct Lock {
+  enum LockKind kind;
+  union {
+    pthread_mutex_t mutex;
+    struct {
+      atomic_uint next;
+      atomic_uint serving;
+    } ticket;
+    _Atomic(struct LockNode *) tail;
+    atomic_int state; /* 0 free, 1 held, 2 held with sleepers */
+  };
+};
+
+bool LockKindParse(const char *name, enum LockKind *kind);
+const char *LockKindName(enum LockKind kind);
+
+void LockInit(struct Lock *lock, enum LockKind kind);
+void LockDestroy(struct Lock *lock);
+void LockAcquire(struct Lock *lock, struct LockNode *node);
+void LockRelease(struct Lock *lock, struct LockNode *node);
+
+#endif
@@ -0,0 +1,169 @@
+/* The two-thread counter loop of mutex.c turned into a contention
+ * benchmark: N threads take the lock, read the shared counter, spin
+ * for the critical section, write the counter back and spin outside
+ * the lock for the think time. Prints acquisitions per second and how
+ * evenly they were spread over the threads. */
+#include <getopt.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "lock.h"
+
+struct Worker {
+  pthread_t thread;
+  uint64_t acquired;
+  char pad[64 - sizeof(pthread_t) - sizeof(uint64_t)];
+};
+
+struct Lock lock;
+long common = 0; /* protected by lock */
+int cs_length = 100;
+int think_length = 100;
+atomic_bool stop;
+pthread_barrier_t start;
+
+static void Spin(int length) {
+  for (int k = 0; k < length; k++)
+    __asm__ volatile(""); /* long cycle */
+}
+
+void *DoThings(void *args) {
+  struct Worker *worker = args;
+  struct LockNode node;
+  uint64_t acquired = 0;
+
+  pthread_barrier_wait(&start);
+  while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+    LockAcquire(&lock, &node);
+    long work = common;
+    work++; /* increment, but not write */
+    Spin(cs_length);
+    common = work; /* write back */
+    LockRelease(&lock, &node);
+    acquired++;
+    Spin(think_length);
+  }
+  worker->acquired = acquired;
+  return NULL;
+}
+
+static double NowMs(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000.0 + now.tv_nsec / 1e6;
+}
+
+/* Returns false when the counter shows a lost update. */
+static bool Run(enum LockKind kind, int threads, int duration_ms) {
+  struct Worker *workers = calloc(threads, sizeof(struct Worker));
+  LockInit(&lock, kind);
+  common = 0;
+  atomic_store(&stop, false);
+  pthread_barrier_init(&start, NULL, threads + 1);
+
+  for (int i = 0; i < threads; i++) {
+    if (pthread_create(&workers[i].thread, NULL, DoThings, &workers[i]) != 0) {
+      perror("pthread_create");
+      exit(1);
+    }
+  }
+  pthread_barrier_wait(&start);
+  double begin = NowMs();
+  usleep(duration_ms * 1000);
+  atomic_store(&stop, true);
+  for (int i = 0; i < threads; i++) {
+    if (pthread_join(workers[i].thread, NULL) != 0) {
+      perror("pthread_join");
+      exit(1);
+    }
+  }
+  double elapsed = NowMs() - begin;
+
+  uint64_t total = 0, min = UINT64_MAX, max = 0;
+  double squares = 0;
+  for (int i = 0; i < threads; i++) {
+    uint64_t n = workers[i].acquired;
+    total += n;
+    squares += (double)n * n;
+    if (n < min)
+      min = n;
+    if (n > max)
+      max = n;
+  }
+  /* Jain's index: 1 when every thread got the same share, 1/threads
+     when one thread got everything. */
+  double fairness = squares > 0 ? (double)total * total / (threads * squares) : 0;
+
+  printf("%-8s %10.0f acq/s  fairness %.3f  per thread %lu..%lu%s\n",
+         LockKindName(kind), total / elapsed * 1000, fairness, min, max,
+         (uint64_t)common == total ? "" : "  LOST UPDATES");
+
+  pthread_barrier_destroy(&start);
+  LockDestroy(&lock);
+  bool ok = (uint64_t)common == total;
+  free(workers);
+  return ok;
+}
+
+int main(int argc, char **argv) {
+  int threads = 2;
+  int duration_ms = 1000;
+  const char *kind_name = "all";
+
+  static struct option options[] = {{"lock", required_argument, 0, 'l'},
+                                    {"threads", required_argument, 0, 't'},
+                                    {"cs", required_argument, 0, 'c'},
+                                    {"think", required_argument, 0, 'k'},
+                                    {"duration", required_argument, 0, 'd'},
+                                    {0, 0, 0, 0}};
+
+  int option_index = 0;
+  int c;
+  while ((c = getopt_long(argc, argv, "l:t:c:k:d:", options,
+                          &option_index)) != -1) {
+    switch (c) {
+    case 'l':
+      kind_name = optarg;
+      break;
+    case 't':
+      threads = atoi(optarg);
+      break;
+    case 'c':
+      cs_length = atoi(optarg);
+      break;
+    case 'k':
+      think_length = atoi(optarg);
+      break;
+    case 'd':
+      duration_ms = atoi(optarg);
+      break;
+    case '?':
+      printf("Unknown option\n");
+      return 1;
+    }
+  }
+
+  enum LockKind kind = LOCK_MUTEX;
+  bool all = strcmp(kind_name, "all") == 0;
+  if (threads <= 0 || cs_length < 0 || think_length < 0 || duration_ms <= 0 ||
+      (!all && !LockKindParse(kind_name, &kind))) {
+    printf("Usage: %s [--lock mutex|ticket|mcs|adaptive|all] [--threads 2] "
+           "[--cs 100] [--think 100] [--duration 1000]\n",
+           argv[0]);
+    return 1;
+  }
+
+  bool ok = true;
+  int first = all ? 0 : (int)kind;
+  int last = all ? LOCK_KINDS : first + 1;
+  for (int k = first; k < last; k++)
+    ok = Run(k, threads, duration_ms) && ok;
+  return ok ? 0 : 1;
+}
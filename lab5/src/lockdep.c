@@ -0,0 +1,272 @@
+/* Lock order validator in the style of the kernel's lockdep, loaded
+   with LD_PRELOAD:
+
+     LD_PRELOAD=./liblockdep.so ./dl
+
+   Every thread keeps the stack of mutexes it holds. Taking mutex B
+   while holding A records the edge A -> B in a global order graph, with
+   the call stack that first took that order. An edge that closes a
+   cycle is an order inversion and is reported with both call stacks
+   before the lock is taken, so it shows up on the first run that takes
+   both orders even when the timing does not deadlock.
+
+   Edges already seen are found in a lock-free hash table, only a new
+   edge takes the graph lock and searches for a cycle.
+
+     LOCKDEP_ABORT=1   abort() after the first report
+
+   Locks are identified by address, a mutex freed and another allocated
+   at the same place inherit its edges. Trylock never waits, so it adds
+   no edges, but the lock it takes counts as held. */
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/syscall.h>
+
+#define MAX_HELD 32
+#define MAX_EDGES 65536 /* a power of two */
+#define MAX_NODES 16384 /* a power of two */
+#define STACK_DEPTH 16
+
+struct Edge {
+  _Atomic uintptr_t from; /* 0 while the slot is free, set last */
+  uintptr_t to;
+  int next_from; /* next edge out of the same lock, -1 ends */
+  pid_t tid;
+  int depth;
+  void *stack[STACK_DEPTH];
+};
+
+/* Locks that have outgoing edges, only used under graph_lock. */
+struct Node {
+  uintptr_t lock;
+  int first_edge;
+  unsigned visited;
+  int parent_edge;
+};
+
+static int (*real_lock)(pthread_mutex_t *);
+static int (*real_trylock)(pthread_mutex_t *);
+static int (*real_unlock)(pthread_mutex_t *);
+
+static struct Edge edges[MAX_EDGES];
+static struct Node nodes[MAX_NODES];
+static int edge_count;
+static int node_count;
+static unsigned generation;
+static bool full_reported;
+static pthread_mutex_t graph_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* initial-exec: the preloaded library is there from the start, and this
+   avoids a __tls_get_addr call on every lock. */
+#define THREAD_LOCAL __thread __attribute__((tls_model("initial-exec")))
+
+static THREAD_LOCAL uintptr_t held[MAX_HELD];
+static THREAD_LOCAL int depth;
+/* Set while the validator itself runs, its own locking is not tracked. */
+static THREAD_LOCAL bool busy;
+
+static void Resolve(void) {
+  real_lock = dlsym(RTLD_NEXT, "pthread_mutex_lock");
+  real_trylock = dlsym(RTLD_NEXT, "pthread_mutex_trylock");
+  real_unlock = dlsym(RTLD_NEXT, "pthread_mutex_unlock");
+}
+
+static inline uint64_t Hash(uintptr_t a, uintptr_t b) {
+  return (a ^ b * 31) * 0x9e3779b97f4a7c15ull >> 32;
+}
+
+/* Lock-free, an edge being inserted may be missed, the caller then
+   checks again under graph_lock. */
+static bool EdgeKnown(uintptr_t from, uintptr_t to) {
+  uint64_t start = Hash(from, to);
+  for (uint64_t i = start; i < start + MAX_EDGES; i++) {
+    struct Edge *e = &edges[i & (MAX_EDGES - 1)];
+    uintptr_t key = atomic_load_explicit(&e->from, memory_order_acquire);
+    if (key == 0)
+      return false;
+    if (key == from && e->to == to)
+      return true;
+  }
+  return false;
+}
+
+/* Like the edges, nodes fill at most half the table, so probes stay
+   short. NULL when lock has no node and none can be created. */
+static struct Node *FindNode(uintptr_t lock, bool create) {
+  uint64_t start = Hash(lock, 0);
+  for (uint64_t i = start; i < start + MAX_NODES; i++) {
+    struct Node *n = &nodes[i & (MAX_NODES - 1)];
+    if (n->lock == lock)
+      return n;
+    if (n->lock == 0) {
+      if (!create || node_count >= MAX_NODES / 2)
+        return NULL;
+      n->lock = lock;
+      n->first_edge = -1;
+      node_count++;
+      return n;
+    }
+  }
+  return NULL;
+}
+
+/* Depth-first search for a path from -> to, each node on it gets the
+   edge it was reached by in parent_edge. */
+static bool FindPath(uintptr_t from, uintptr_t to) {
+  if (from == to)
+    return true;
+  struct Node *node = FindNode(from, false);
+  if (node == NULL || node->visited == generation)
+    return false;
+  node->visited = generation;
+  for (int e = node->first_edge; e >= 0; e = edges[e].next_from) {
+    if (FindPath(edges[e].to, to)) {
+      node->parent_edge = e;
+      return true;
+    }
+  }
+  return false;
+}
+
+static void PrintStack(void *const *stack, int frames) {
+  backtrace_symbols_fd(stack, frames, STDERR_FILENO);
+}
+
+static void ReportCycle(uintptr_t held_lock, uintptr_t lock, void *const *stack,
+                        int frames) {
+  fprintf(stderr,
+          "lockdep: possible deadlock, thread %ld takes %p while holding %p,\n"
+          "lockdep: but %p is already known to be taken before %p:\n",
+          (long)syscall(SYS_gettid), (void *)lock, (void *)held_lock,
+          (void *)lock, (void *)held_lock);
+  for (uintptr_t at = lock; at != held_lock;) {
+    struct Edge *e = &edges[FindNode(at, false)->parent_edge];
+    fprintf(stderr, "lockdep: %p -> %p first taken by thread %d at:\n",
+            (void *)e->from, (void *)e->to, e->tid);
+    PrintStack(e->stack, e->depth);
+    at = e->to;
+  }
+  fprintf(stderr, "lockdep: %p -> %p taken now at:\n", (void *)held_lock,
+          (void *)lock);
+  PrintStack(stack, frames);
+  const char *abort_env = getenv("LOCKDEP_ABORT");
+  if (abort_env != NULL && atoi(abort_env) != 0)
+    abort();
+}
+
+static void AddEdge(uintptr_t from, uintptr_t to, void *const *stack,
+                    int frames) {
+  struct Node *node = FindNode(from, true);
+  if (edge_count >= MAX_EDGES / 2 || node == NULL) {
+    if (!full_reported)
+      fprintf(stderr, "lockdep: order graph full, new orders not checked\n");
+    full_reported = true;
+    return;
+  }
+  generation++;
+  if (FindPath(to, from))
+    ReportCycle(from, to, stack, frames);
+
+  uint64_t i = Hash(from, to);
+  while (atomic_load_explicit(&edges[i & (MAX_EDGES - 1)].from,
+                              memory_order_relaxed) != 0)
+    i++;
+  int index = i & (MAX_EDGES - 1);
+  struct Edge *e = &edges[index];
+  e->to = to;
+  e->tid = syscall(SYS_gettid);
+  e->depth = frames;
+  memcpy(e->stack, stack, frames * sizeof(void *));
+  e->next_from = node->first_edge;
+  node->first_edge = index;
+  edge_count++;
+  atomic_store_explicit(&e->from, from, memory_order_release);
+}
+
+/* Checks the order of lock against everything the thread holds. Not
+   inlined, the recorded stack starts two frames up. */
+__attribute__((noinline)) static void Validate(uintptr_t lock) {
+  int top = depth < MAX_HELD ? depth : MAX_HELD;
+  bool known = true;
+  for (int i = 0; i < top && known; i++)
+    known = held[i] == lock || EdgeKnown(held[i], lock);
+  if (known)
+    return;
+
+  busy = true;
+  void *stack[STACK_DEPTH];
+  int frames = backtrace(stack, STACK_DEPTH);
+  real_lock(&graph_lock);
+  for (int i = 0; i < top; i++) {
+    if (held[i] != lock && !EdgeKnown(held[i], lock))
+      AddEdge(held[i], lock, stack + 2, frames > 2 ? frames - 2 : frames);
+  }
+  real_unlock(&graph_lock);
+  busy = false;
+}
+
+static void Push(uintptr_t lock) {
+  if (depth < MAX_HELD)
+    held[depth] = lock;
+  depth++;
+}
+
+int pthread_mutex_lock(pthread_mutex_t *mutex) {
+  if (real_lock == NULL)
+    Resolve();
+  if (busy)
+    return real_lock(mutex);
+  Validate((uintptr_t)mutex);
+  int result = real_lock(mutex);
+  if (result == 0)
+    Push((uintptr_t)mutex);
+  return result;
+}
+
+int pthread_mutex_trylock(pthread_mutex_t *mutex) {
+  if (real_lock == NULL)
+    Resolve();
+  int result = real_trylock(mutex);
+  if (result == 0 && !busy)
+    Push((uintptr_t)mutex);
+  return result;
+}
+
+int pthread_mutex_unlock(pthread_mutex_t *mutex) {
+  if (real_lock == NULL)
+    Resolve();
+  if (!busy) {
+    int top = depth < MAX_HELD ? depth : MAX_HELD;
+    for (int i = top - 1; i >= 0; i--) {
+      if (held[i] != (uintptr_t)mutex)
+        continue;
+      memmove(&held[i], &held[i + 1], (top - i - 1) * sizeof(uintptr_t));
+      depth--;
+      return real_unlock(mutex);
+    }
+    /* Taken while the held stack was full. */
+    if (depth > MAX_HELD)
+      depth--;
+  }
+  return real_unlock(mutex);
+}
+
+__attribute__((constructor)) static void Start(void) {
+  if (real_lock == NULL)
+    Resolve();
+  /* The first backtrace loads libgcc, better here than under a lock. */
+  void *stack[1];
+  busy = true;
+  backtrace(stack, 1);
+  busy = false;
+}
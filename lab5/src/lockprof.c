@@ -0,0 +1,409 @@
+/* Lock contention profiler, loaded with LD_PRELOAD:
+
+     LD_PRELOAD=./liblockprof.so ./mutex_yes
+
+   Wraps pthread_mutex_lock, trylock and unlock and counts, per mutex and
+   call site, acquisitions, contended acquisitions, wait time and hold
+   time. Every thread records into its own table, nothing is shared on
+   the fast path. A new thread takes over the table of one that exited,
+   so thread-per-connection servers do not grow a table per thread. The
+   tables are merged and printed at exit.
+
+     LOCKPROF_OUTPUT=file   report there instead of stderr
+     LOCKPROF_TOP=n         rows to print, 20 by default
+     LOCKPROF_INTERVAL=s    also report every s seconds, with the locks
+                            every thread is waiting for and holding, so
+                            a hung process can be looked at
+
+   Sites are printed as symbol+offset, or file+offset for addr2line when
+   the binary does not export its symbols (build it with -rdynamic).
+   pthread_cond_wait drops and retakes the mutex inside libc, the time
+   spent there counts as hold time. */
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#define TABLE_SIZE 1024 /* sites per thread, a power of two */
+#define PROBES 16
+#define MAX_HELD 32
+
+/* Written only by the owning thread. The reporter may read them at any
+   time, hence relaxed atomics, which compile to plain moves. */
+struct SiteStats {
+  _Atomic(pthread_mutex_t *) lock; /* NULL while the slot is free */
+  void *site;
+  _Atomic uint64_t acquired;
+  _Atomic uint64_t contended;
+  _Atomic uint64_t wait_ns;
+  _Atomic uint64_t max_wait_ns;
+  _Atomic uint64_t hold_ns;
+};
+
+struct Held {
+  _Atomic(pthread_mutex_t *) lock;
+  struct SiteStats *stats;
+  uint64_t since;
+};
+
+struct ThreadTable {
+  struct ThreadTable *next;
+  _Atomic bool closed; /* the owner has exited */
+  pid_t tid;
+  /* The last slot takes whatever does not fit. */
+  struct SiteStats sites[TABLE_SIZE + 1];
+  struct Held held[MAX_HELD];
+  atomic_int depth;
+  _Atomic(pthread_mutex_t *) waiting_for;
+  _Atomic(void *) waiting_site;
+  _Atomic uint64_t waiting_since;
+};
+
+static int (*real_lock)(pthread_mutex_t *);
+static int (*real_trylock)(pthread_mutex_t *);
+static int (*real_unlock)(pthread_mutex_t *);
+
+static _Atomic(struct ThreadTable *) tables;
+static __thread struct ThreadTable *table;
+static pthread_key_t table_key;
+static bool key_ready;
+/* Set while the profiler itself runs, its own locking is not recorded. */
+static __thread bool busy;
+
+static void Resolve(void) {
+  real_lock = dlsym(RTLD_NEXT, "pthread_mutex_lock");
+  real_trylock = dlsym(RTLD_NEXT, "pthread_mutex_trylock");
+  real_unlock = dlsym(RTLD_NEXT, "pthread_mutex_unlock");
+}
+
+static inline uint64_t NowNs(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+static inline uint64_t Get(_Atomic uint64_t *counter) {
+  return atomic_load_explicit(counter, memory_order_relaxed);
+}
+
+static inline void Add(_Atomic uint64_t *counter, uint64_t value) {
+  atomic_store_explicit(counter, Get(counter) + value, memory_order_relaxed);
+}
+
+static void CloseTable(void *arg) {
+  struct ThreadTable *closing = arg;
+  table = NULL;
+  atomic_store_explicit(&closing->depth, 0, memory_order_relaxed);
+  atomic_store_explicit(&closing->waiting_for, NULL, memory_order_relaxed);
+  atomic_store_explicit(&closing->closed, true, memory_order_release);
+}
+
+/* Tables are never unmapped. The counts of an exited thread stay in its
+   table and the next owner adds to them, the report merges by lock and
+   site anyway. mmap instead of malloc, malloc may be what is being
+   locked. */
+static struct ThreadTable *Table(void) {
+  if (table != NULL)
+    return table;
+  struct ThreadTable *t = NULL;
+  for (struct ThreadTable *at = atomic_load(&tables); at != NULL && t == NULL;
+       at = at->next) {
+    bool closed = true;
+    if (atomic_load_explicit(&at->closed, memory_order_relaxed) &&
+        atomic_compare_exchange_strong(&at->closed, &closed, false))
+      t = at;
+  }
+  if (t == NULL) {
+    t = mmap(NULL, sizeof(struct ThreadTable), PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (t == MAP_FAILED)
+      return NULL;
+    t->next = atomic_load(&tables);
+    while (!atomic_compare_exchange_weak(&tables, &t->next, t))
+      ;
+  }
+  t->tid = syscall(SYS_gettid);
+  table = t;
+  /* Threads that start before the constructor keep their table. */
+  if (key_ready) {
+    busy = true;
+    pthread_setspecific(table_key, t);
+    busy = false;
+  }
+  return t;
+}
+
+static struct SiteStats *Lookup(struct ThreadTable *t, pthread_mutex_t *lock,
+                                void *site) {
+  uintptr_t hash = ((uintptr_t)lock ^ (uintptr_t)site * 31) * 0x9e3779b97f4a7c15ull;
+  for (int probe = 0; probe < PROBES; probe++) {
+    struct SiteStats *s = &t->sites[((hash >> 40) + probe) & (TABLE_SIZE - 1)];
+    pthread_mutex_t *key = atomic_load_explicit(&s->lock, memory_order_relaxed);
+    if (key == lock && s->site == site)
+      return s;
+    if (key == NULL) {
+      s->site = site;
+      atomic_store_explicit(&s->lock, lock, memory_order_release);
+      return s;
+    }
+  }
+  return &t->sites[TABLE_SIZE];
+}
+
+static void Acquired(struct ThreadTable *t, pthread_mutex_t *mutex, void *site,
+                     bool contended, uint64_t wait) {
+  struct SiteStats *s = Lookup(t, mutex, site);
+  Add(&s->acquired, 1);
+  if (contended) {
+    Add(&s->contended, 1);
+    Add(&s->wait_ns, wait);
+    if (wait > Get(&s->max_wait_ns))
+      atomic_store_explicit(&s->max_wait_ns, wait, memory_order_relaxed);
+  }
+  int depth = atomic_load_explicit(&t->depth, memory_order_relaxed);
+  if (depth < MAX_HELD) {
+    t->held[depth].stats = s;
+    t->held[depth].since = NowNs();
+    atomic_store_explicit(&t->held[depth].lock, mutex, memory_order_relaxed);
+    atomic_store_explicit(&t->depth, depth + 1, memory_order_relaxed);
+  }
+}
+
+int pthread_mutex_lock(pthread_mutex_t *mutex) {
+  if (real_lock == NULL)
+    Resolve();
+  struct ThreadTable *t = busy ? NULL : Table();
+  if (t == NULL)
+    return real_lock(mutex);
+
+  void *site = __builtin_return_address(0);
+  int result = real_trylock(mutex);
+  if (result != EBUSY) {
+    if (result == 0)
+      Acquired(t, mutex, site, false, 0);
+    return result;
+  }
+
+  uint64_t start = NowNs();
+  atomic_store_explicit(&t->waiting_since, start, memory_order_relaxed);
+  atomic_store_explicit(&t->waiting_site, site, memory_order_relaxed);
+  atomic_store_explicit(&t->waiting_for, mutex, memory_order_relaxed);
+  result = real_lock(mutex);
+  atomic_store_explicit(&t->waiting_for, NULL, memory_order_relaxed);
+  if (result == 0)
+    Acquired(t, mutex, site, true, NowNs() - start);
+  return result;
+}
+
+int pthread_mutex_trylock(pthread_mutex_t *mutex) {
+  if (real_lock == NULL)
+    Resolve();
+  int result = real_trylock(mutex);
+  struct ThreadTable *t = busy || result != 0 ? NULL : Table();
+  if (t != NULL)
+    Acquired(t, mutex, __builtin_return_address(0), false, 0);
+  return result;
+}
+
+int pthread_mutex_unlock(pthread_mutex_t *mutex) {
+  if (real_lock == NULL)
+    Resolve();
+  struct ThreadTable *t = busy ? NULL : table;
+  if (t != NULL) {
+    int depth = atomic_load_explicit(&t->depth, memory_order_relaxed);
+    for (int i = depth - 1; i >= 0; i--) {
+      if (atomic_load_explicit(&t->held[i].lock, memory_order_relaxed) !=
+          mutex)
+        continue;
+      Add(&t->held[i].stats->hold_ns, NowNs() - t->held[i].since);
+      /* Usually the top one, unlocking out of order shifts the rest. */
+      for (int j = i; j < depth - 1; j++) {
+        t->held[j].stats = t->held[j + 1].stats;
+        t->held[j].since = t->held[j + 1].since;
+        atomic_store_explicit(
+            &t->held[j].lock,
+            atomic_load_explicit(&t->held[j + 1].lock, memory_order_relaxed),
+            memory_order_relaxed);
+      }
+      atomic_store_explicit(&t->depth, depth - 1, memory_order_relaxed);
+      break;
+    }
+  }
+  return real_unlock(mutex);
+}
+
+/* symbol+offset when the address is in an exported symbol, otherwise
+   the object file and the offset into it. */
+static void Describe(char *buf, size_t len, const void *address) {
+  Dl_info info;
+  if (address == NULL) {
+    snprintf(buf, len, "(other)");
+  } else if (dladdr(address, &info) && info.dli_sname != NULL) {
+    snprintf(buf, len, "%s+0x%lx", info.dli_sname,
+             (unsigned long)((const char *)address - (const char *)info.dli_saddr));
+  } else if (info.dli_fname != NULL) {
+    const char *name = strrchr(info.dli_fname, '/');
+    snprintf(buf, len, "%s+0x%lx", name ? name + 1 : info.dli_fname,
+             (unsigned long)((const char *)address - (const char *)info.dli_fbase));
+  } else {
+    snprintf(buf, len, "%p", address);
+  }
+}
+
+struct Row {
+  pthread_mutex_t *lock;
+  void *site;
+  uint64_t acquired, contended, wait_ns, max_wait_ns, hold_ns;
+};
+
+static int ByKey(const void *a, const void *b) {
+  const struct Row *x = a, *y = b;
+  if (x->lock != y->lock)
+    return (uintptr_t)x->lock < (uintptr_t)y->lock ? -1 : 1;
+  if (x->site != y->site)
+    return (uintptr_t)x->site < (uintptr_t)y->site ? -1 : 1;
+  return 0;
+}
+
+static int ByWait(const void *a, const void *b) {
+  const struct Row *x = a, *y = b;
+  if (x->wait_ns != y->wait_ns)
+    return x->wait_ns > y->wait_ns ? -1 : 1;
+  return x->acquired > y->acquired ? -1 : x->acquired < y->acquired;
+}
+
+static void Report(FILE *out, bool show_waiting) {
+  size_t count = 0;
+  for (struct ThreadTable *t = atomic_load(&tables); t; t = t->next)
+    count += TABLE_SIZE + 1;
+  struct Row *rows = malloc(count * sizeof(struct Row));
+  if (rows == NULL)
+    return;
+
+  size_t n = 0;
+  for (struct ThreadTable *t = atomic_load(&tables); t; t = t->next) {
+    for (int i = 0; i <= TABLE_SIZE; i++) {
+      struct SiteStats *s = &t->sites[i];
+      if (Get(&s->acquired) == 0)
+        continue;
+      rows[n].lock = atomic_load_explicit(&s->lock, memory_order_acquire);
+      rows[n].site = s->site;
+      rows[n].acquired = Get(&s->acquired);
+      rows[n].contended = Get(&s->contended);
+      rows[n].wait_ns = Get(&s->wait_ns);
+      rows[n].max_wait_ns = Get(&s->max_wait_ns);
+      rows[n].hold_ns = Get(&s->hold_ns);
+      n++;
+    }
+  }
+
+  /* The same lock and site from different threads make one row. */
+  qsort(rows, n, sizeof(struct Row), ByKey);
+  size_t merged = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (merged > 0 && ByKey(&rows[merged - 1], &rows[i]) == 0) {
+      struct Row *r = &rows[merged - 1];
+      r->acquired += rows[i].acquired;
+      r->contended += rows[i].contended;
+      r->wait_ns += rows[i].wait_ns;
+      r->hold_ns += rows[i].hold_ns;
+      if (rows[i].max_wait_ns > r->max_wait_ns)
+        r->max_wait_ns = rows[i].max_wait_ns;
+    } else {
+      rows[merged++] = rows[i];
+    }
+  }
+  qsort(rows, merged, sizeof(struct Row), ByWait);
+
+  const char *top_env = getenv("LOCKPROF_TOP");
+  size_t top = top_env != NULL && atoi(top_env) > 0 ? atoi(top_env) : 20;
+  char lock[128], site[128];
+  fprintf(out, "lockprof: %zu lock/site pairs, pid %d\n", merged, getpid());
+  fprintf(out, "%-24s %-32s %10s %10s %10s %12s %10s\n", "lock", "site",
+          "acquired", "contended", "wait ms", "max wait us", "hold ms");
+  for (size_t i = 0; i < merged && i < top; i++) {
+    Describe(lock, sizeof(lock), rows[i].lock);
+    Describe(site, sizeof(site), rows[i].site);
+    fprintf(out, "%-24s %-32s %10lu %10lu %10.3f %12.1f %10.3f\n", lock, site,
+            rows[i].acquired, rows[i].contended, rows[i].wait_ns / 1e6,
+            rows[i].max_wait_ns / 1e3, rows[i].hold_ns / 1e6);
+  }
+  free(rows);
+
+  if (!show_waiting)
+    return;
+  uint64_t now = NowNs();
+  for (struct ThreadTable *t = atomic_load(&tables); t; t = t->next) {
+    pthread_mutex_t *waiting =
+        atomic_load_explicit(&t->waiting_for, memory_order_relaxed);
+    if (waiting == NULL)
+      continue;
+    Describe(lock, sizeof(lock), waiting);
+    Describe(site, sizeof(site),
+             atomic_load_explicit(&t->waiting_site, memory_order_relaxed));
+    fprintf(out, "thread %d waits %.1fs for %s at %s, holding", t->tid,
+            (now - Get(&t->waiting_since)) / 1e9, lock, site);
+    int depth = atomic_load_explicit(&t->depth, memory_order_relaxed);
+    for (int i = 0; i < depth; i++) {
+      Describe(lock, sizeof(lock),
+               atomic_load_explicit(&t->held[i].lock, memory_order_relaxed));
+      fprintf(out, " %s", lock);
+    }
+    fprintf(out, depth > 0 ? "\n" : " nothing\n");
+  }
+}
+
+static FILE *OpenOutput(void) {
+  const char *path = getenv("LOCKPROF_OUTPUT");
+  FILE *out = path != NULL ? fopen(path, "a") : NULL;
+  return out != NULL ? out : stderr;
+}
+
+static void *Reporter(void *args) {
+  busy = true;
+  int interval = (int)(intptr_t)args;
+  while (true) {
+    sleep(interval);
+    FILE *out = OpenOutput();
+    Report(out, true);
+    if (out != stderr)
+      fclose(out);
+    else
+      fflush(out);
+  }
+  return NULL;
+}
+
+__attribute__((constructor)) static void Start(void) {
+  if (real_lock == NULL)
+    Resolve();
+  key_ready = pthread_key_create(&table_key, CloseTable) == 0;
+  const char *interval = getenv("LOCKPROF_INTERVAL");
+  if (interval != NULL && atoi(interval) > 0) {
+    busy = true;
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, Reporter,
+                       (void *)(intptr_t)atoi(interval)) == 0)
+      pthread_detach(thread);
+    busy = false;
+  }
+}
+
+__attribute__((destructor)) static void Finish(void) {
+  busy = true;
+  FILE *out = OpenOutput();
+  Report(out, false);
+  if (out != stderr)
+    fclose(out);
+}
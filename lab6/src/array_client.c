@@ -0,0 +1,291 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <getopt.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "common.h"
+#include "range_index.h"
+#include "utils.h"
+
+/* Sends random range queries to array_server, depth of them pipelined
+   at a time, and reports queries per second. With --verify the client
+   generates the same array and checks every answer by scanning it, which
+   needs a freshly started server and no other clients; keep the array or
+   --max_range small. */
+
+enum Mix { MIX_MIN, MIX_MAX, MIX_SUM, MIX_UPDATE, MIX_ALL };
+
+uint64_t NowNs(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+uint64_t NextRandom(uint64_t *state) {
+  *state ^= *state << 13;
+  *state ^= *state >> 7;
+  *state ^= *state << 17;
+  return *state;
+}
+
+int Connect(const char *ip, int port) {
+  struct hostent *hostname = gethostbyname(ip);
+  if (hostname == NULL || hostname->h_addr_list[0] == NULL) {
+    fprintf(stderr, "gethostbyname failed with %s\n", ip);
+    return -1;
+  }
+
+  struct sockaddr_in server_addr;
+  server_addr.sin_family = AF_INET;
+  server_addr.sin_port = htons(port);
+  memcpy(&server_addr.sin_addr.s_addr, hostname->h_addr_list[0],
+         hostname->h_length);
+
+  int sck = socket(AF_INET, SOCK_STREAM, 0);
+  if (sck < 0) {
+    fprintf(stderr, "Socket creation failed\n");
+    return -1;
+  }
+  if (connect(sck, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
+    fprintf(stderr, "Connection to %s:%d failed\n", ip, port);
+    close(sck);
+    return -1;
+  }
+  return sck;
+}
+
+bool SendAll(int sck, const char *data, size_t len) {
+  while (len > 0) {
+    ssize_t sent = send(sck, data, len, 0);
+    if (sent <= 0)
+      return false;
+    data += sent;
+    len -= sent;
+  }
+  return true;
+}
+
+/* What the server should answer, from a plain scan so that a bug in
+   the range index does not check itself. Updates are applied to the
+   local copy in the same order as on the server. */
+int64_t Expected(int *array, uint64_t op, uint64_t a, uint64_t b) {
+  if (op == ARRAY_OP_UPDATE) {
+    int64_t old = array[a];
+    array[a] = (int)(int64_t)b;
+    return old;
+  }
+  int64_t result = op == ARRAY_OP_SUM ? 0 : array[a];
+  for (uint64_t i = a; i <= b; i++) {
+    switch (op) {
+    case ARRAY_OP_MIN:
+      if (array[i] < result)
+        result = array[i];
+      break;
+    case ARRAY_OP_MAX:
+      if (array[i] > result)
+        result = array[i];
+      break;
+    default:
+      result += array[i];
+    }
+  }
+  return result;
+}
+
+int main(int argc, char **argv) {
+  char server[255] = "127.0.0.1";
+  int port = -1;
+  uint64_t array_size = 0;
+  uint64_t queries = 100000;
+  uint64_t max_range = 0;
+  int depth = 64;
+  uint64_t seed = 0;
+  bool verify = false;
+  enum Mix mix = MIX_ALL;
+
+  while (true) {
+    static struct option options[] = {{"server", required_argument, 0, 0},
+                                      {"port", required_argument, 0, 0},
+                                      {"array_size", required_argument, 0, 0},
+                                      {"queries", required_argument, 0, 0},
+                                      {"op", required_argument, 0, 0},
+                                      {"max_range", required_argument, 0, 0},
+                                      {"depth", required_argument, 0, 0},
+                                      {"seed", required_argument, 0, 0},
+                                      {"verify", no_argument, 0, 0},
+                                      {0, 0, 0, 0}};
+
+    int option_index = 0;
+    int c = getopt_long(argc, argv, "", options, &option_index);
+
+    if (c == -1)
+      break;
+
+    switch (c) {
+    case 0: {
+      switch (option_index) {
+      case 0:
+        strncpy(server, optarg, sizeof(server) - 1);
+        break;
+      case 1:
+        port = atoi(optarg);
+        if (port <= 0) {
+          fprintf(stderr, "Port must be positive number\n");
+          return 1;
+        }
+        break;
+      case 2:
+        if (!ConvertStringToUI64(optarg, &array_size) || array_size == 0) {
+          fprintf(stderr, "Array size must be positive\n");
+          return 1;
+        }
+        break;
+      case 3:
+        if (!ConvertStringToUI64(optarg, &queries) || queries == 0) {
+          fprintf(stderr, "Queries must be positive\n");
+          return 1;
+        }
+        break;
+      case 4:
+        if (strcmp(optarg, "min") == 0)
+          mix = MIX_MIN;
+        else if (strcmp(optarg, "max") == 0)
+          mix = MIX_MAX;
+        else if (strcmp(optarg, "sum") == 0)
+          mix = MIX_SUM;
+        else if (strcmp(optarg, "update") == 0)
+          mix = MIX_UPDATE;
+        else if (strcmp(optarg, "mixed") == 0)
+          mix = MIX_ALL;
+        else {
+          fprintf(stderr, "Op must be min, max, sum, update or mixed\n");
+          return 1;
+        }
+        break;
+      case 5:
+        if (!ConvertStringToUI64(optarg, &max_range) || max_range == 0) {
+          fprintf(stderr, "Max range must be positive\n");
+          return 1;
+        }
+        break;
+      case 6:
+        depth = atoi(optarg);
+        if (depth <= 0) {
+          fprintf(stderr, "Depth must be positive\n");
+          return 1;
+        }
+        break;
+      case 7:
+        if (!ConvertStringToUI64(optarg, &seed) || seed == 0) {
+          fprintf(stderr, "Seed must be positive\n");
+          return 1;
+        }
+        break;
+      case 8:
+        verify = true;
+        break;
+      default:
+        printf("Index %d is out of options\n", option_index);
+      }
+    } break;
+
+    case '?':
+      printf("Unknown argument\n");
+      break;
+    default:
+      fprintf(stderr, "getopt returned character code 0%o?\n", c);
+    }
+  }
+
+  if (port == -1 || array_size == 0 || (verify && seed == 0)) {
+    fprintf(stderr,
+            "Using: %s --port 20001 --array_size 1000000 [--server ip] "
+            "[--queries 100000] [--op min|max|sum|update|mixed] "
+            "[--max_range n] [--depth 64] [--verify --seed 1]\n",
+            argv[0]);
+    return 1;
+  }
+  if (max_range == 0 || max_range > array_size)
+    max_range = array_size;
+
+  int *array = NULL;
+  if (verify) {
+    array = malloc(array_size * sizeof(int));
+    if (array == NULL) {
+      fprintf(stderr, "Not enough memory for the array\n");
+      return 1;
+    }
+    GenerateArray(array, array_size, seed);
+  }
+
+  int sck = Connect(server, port);
+  if (sck < 0)
+    return 1;
+
+  char *requests = malloc(depth * ARRAY_REQUEST_SIZE);
+  char *responses = malloc(depth * ARRAY_RESPONSE_SIZE);
+  uint64_t *ops = malloc(depth * 3 * sizeof(uint64_t));
+  uint64_t state = 0x9e3779b97f4a7c15ull;
+  uint64_t mismatches = 0;
+  uint64_t start = NowNs();
+
+  for (uint64_t done = 0; done < queries;) {
+    int batch =
+        queries - done < (uint64_t)depth ? (int)(queries - done) : depth;
+    for (int i = 0; i < batch; i++) {
+      uint64_t *op = ops + 3 * i;
+      op[0] = mix == MIX_ALL ? ARRAY_OP_MIN + NextRandom(&state) % 4
+                             : ARRAY_OP_MIN + (uint64_t)mix;
+      if (op[0] == ARRAY_OP_UPDATE) {
+        op[1] = NextRandom(&state) % array_size;
+        op[2] = (uint64_t)(int64_t)(int)(NextRandom(&state) % RAND_MAX);
+      } else {
+        uint64_t length = 1 + NextRandom(&state) % max_range;
+        op[1] = NextRandom(&state) % (array_size - length + 1);
+        op[2] = op[1] + length - 1;
+      }
+      memcpy(requests + i * ARRAY_REQUEST_SIZE, op, ARRAY_REQUEST_SIZE);
+    }
+
+    if (!SendAll(sck, requests, batch * ARRAY_REQUEST_SIZE)) {
+      fprintf(stderr, "Send failed\n");
+      return 1;
+    }
+    size_t expected = batch * ARRAY_RESPONSE_SIZE;
+    if (recv(sck, responses, expected, MSG_WAITALL) != (ssize_t)expected) {
+      fprintf(stderr, "Server closed the connection\n");
+      return 1;
+    }
+
+    for (int i = 0; verify && i < batch; i++) {
+      uint64_t *op = ops + 3 * i;
+      int64_t answer;
+      memcpy(&answer, responses + i * ARRAY_RESPONSE_SIZE, sizeof(answer));
+      if (answer != Expected(array, op[0], op[1], op[2]))
+        mismatches++;
+    }
+    done += batch;
+  }
+
+  double seconds = (NowNs() - start) / 1e9;
+  printf("Queries: %lu\n", queries);
+  printf("QPS: %.0f\n", queries / seconds);
+  printf("Elapsed time: %fms\n", seconds * 1000);
+  if (verify)
+    printf("Mismatches: %lu\n", mismatches);
+
+  close(sck);
+  free(requests);
+  free(responses);
+  free(ops);
+  free(array);
+  return mismatches > 0;
+}
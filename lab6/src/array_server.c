@@ -0,0 +1,318 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <getopt.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "arena.h"
+#include "common.h"
+#include "range_index.h"
+#include "utils.h"
+
+/* Keeps one array in memory with its range indexes and answers queries
+   about it, so a client does not regenerate and rescan the array for
+   every question. Queries share the index, updates take it alone. */
+
+struct RangeIndex range_index;
+pthread_rwlock_t index_lock = PTHREAD_RWLOCK_INITIALIZER;
+_Atomic uint64_t queries_done;
+
+/* Requests are read in batches of whatever the client has pipelined and
+   answered with one send. */
+#define BATCH 256
+
+bool Answer(const char *request, char *response) {
+  uint64_t op, a, b;
+  memcpy(&op, request, sizeof(uint64_t));
+  memcpy(&a, request + sizeof(uint64_t), sizeof(uint64_t));
+  memcpy(&b, request + 2 * sizeof(uint64_t), sizeof(uint64_t));
+
+  int64_t result = 0;
+  if (op == ARRAY_OP_UPDATE) {
+    if (a >= range_index.n)
+      return false;
+    pthread_rwlock_wrlock(&index_lock);
+    result = RangeIndexGet(&range_index, a);
+    RangeIndexUpdate(&range_index, a, (int)(int64_t)b);
+    pthread_rwlock_unlock(&index_lock);
+  } else {
+    if (a > b || b >= range_index.n)
+      return false;
+    pthread_rwlock_rdlock(&index_lock);
+    switch (op) {
+    case ARRAY_OP_MIN:
+      result = RangeMinMax(&range_index, a, b).min;
+      break;
+    case ARRAY_OP_MAX:
+      result = RangeMinMax(&range_index, a, b).max;
+      break;
+    case ARRAY_OP_SUM:
+      result = RangeSum(&range_index, a, b);
+      break;
+    default:
+      pthread_rwlock_unlock(&index_lock);
+      return false;
+    }
+    pthread_rwlock_unlock(&index_lock);
+  }
+  memcpy(response, &result, sizeof(result));
+  return true;
+}
+
+static bool SendAll(int fd, const char *data, size_t len) {
+  while (len > 0) {
+    ssize_t sent = send(fd, data, len, 0);
+    if (sent <= 0)
+      return false;
+    data += sent;
+    len -= sent;
+  }
+  return true;
+}
+
+void *Session(void *args) {
+  int client_fd = (int)(intptr_t)args;
+  char requests[BATCH * ARRAY_REQUEST_SIZE];
+  char responses[BATCH * ARRAY_RESPONSE_SIZE];
+  size_t buffered = 0;
+
+  while (true) {
+    ssize_t read_bytes = recv(client_fd, requests + buffered,
+                              sizeof(requests) - buffered, 0);
+    if (read_bytes == 0)
+      break;
+    if (read_bytes < 0) {
+      fprintf(stderr, "Client read failed\n");
+      break;
+    }
+    buffered += read_bytes;
+
+    /* Requests before an invalid one are answered and their updates
+       applied, so the client still gets those answers. */
+    size_t complete = buffered / ARRAY_REQUEST_SIZE;
+    size_t answered = 0;
+    while (answered < complete &&
+           Answer(requests + answered * ARRAY_REQUEST_SIZE,
+                  responses + answered * ARRAY_RESPONSE_SIZE))
+      answered++;
+    atomic_fetch_add(&queries_done, answered);
+
+    size_t used = complete * ARRAY_REQUEST_SIZE;
+    memmove(requests, requests + used, buffered - used);
+    buffered -= used;
+
+    if (answered > 0 &&
+        !SendAll(client_fd, responses, answered * ARRAY_RESPONSE_SIZE)) {
+      fprintf(stderr, "Can't send data to client\n");
+      break;
+    }
+    if (answered < complete) {
+      fprintf(stderr, "Invalid request\n");
+      break;
+    }
+  }
+
+  shutdown(client_fd, SHUT_RDWR);
+  close(client_fd);
+  return NULL;
+}
+
+/* Prints the query rate once a second while there is traffic. */
+void *Reporter(void *args) {
+  uint64_t last = 0;
+  while (true) {
+    sleep(1);
+    uint64_t done = atomic_load(&queries_done);
+    if (done != last)
+      printf("Queries: %lu/s\n", done - last);
+    fflush(stdout);
+    last = done;
+  }
+  return NULL;
+}
+
+/* A file of raw ints, as parallel_sort --output writes them, read into
+   the arena. */
+int *LoadArray(const char *path, struct Arena *arena, uint64_t *array_size) {
+  FILE *file = fopen(path, "rb");
+  if (file == NULL)
+    return NULL;
+  struct stat st;
+  if (fstat(fileno(file), &st) < 0 || st.st_size < (off_t)sizeof(int)) {
+    fclose(file);
+    return NULL;
+  }
+  *array_size = st.st_size / sizeof(int);
+  int *array = NULL;
+  if (ArenaInit(arena, *array_size * sizeof(int), ARENA_PAGES_1G,
+                ARENA_PREFAULT_NONE, NULL)) {
+    array = ArenaAlloc(arena, *array_size * sizeof(int));
+    if (array == NULL ||
+        fread(array, sizeof(int), *array_size, file) != *array_size) {
+      ArenaFree(arena);
+      array = NULL;
+    }
+  }
+  fclose(file);
+  return array;
+}
+
+int main(int argc, char **argv) {
+  int port = -1;
+  uint64_t array_size = 0;
+  uint64_t seed = 0;
+  const char *input = NULL;
+
+  while (true) {
+    static struct option options[] = {{"port", required_argument, 0, 0},
+                                      {"array_size", required_argument, 0, 0},
+                                      {"seed", required_argument, 0, 0},
+                                      {"input", required_argument, 0, 0},
+                                      {0, 0, 0, 0}};
+
+    int option_index = 0;
+    int c = getopt_long(argc, argv, "", options, &option_index);
+
+    if (c == -1)
+      break;
+
+    switch (c) {
+    case 0: {
+      switch (option_index) {
+      case 0:
+        port = atoi(optarg);
+        if (port <= 0) {
+          fprintf(stderr, "Port must be positive number\n");
+          return 1;
+        }
+        break;
+      case 1:
+        if (!ConvertStringToUI64(optarg, &array_size) || array_size == 0 ||
+            array_size > UINT32_MAX) {
+          fprintf(stderr, "Array size must be in [1, %u]\n", UINT32_MAX);
+          return 1;
+        }
+        break;
+      case 2:
+        if (!ConvertStringToUI64(optarg, &seed) || seed == 0) {
+          fprintf(stderr, "Seed must be positive\n");
+          return 1;
+        }
+        break;
+      case 3:
+        input = optarg;
+        break;
+      default:
+        printf("Index %d is out of options\n", option_index);
+      }
+    } break;
+
+    case '?':
+      printf("Unknown argument\n");
+      break;
+    default:
+      fprintf(stderr, "getopt returned character code 0%o?\n", c);
+    }
+  }
+
+  if (port == -1 || (input == NULL && (array_size == 0 || seed == 0))) {
+    fprintf(stderr,
+            "Using: %s --port 20001 (--array_size 1000000 --seed 1 | "
+            "--input file)\n",
+            argv[0]);
+    return 1;
+  }
+
+  /* The array only lives until the index is built, large pages make
+     filling it cheaper. */
+  struct Arena arena;
+  int *array;
+  if (input != NULL) {
+    array = LoadArray(input, &arena, &array_size);
+    if (array == NULL) {
+      fprintf(stderr, "Can not load array from %s\n", input);
+      return 1;
+    }
+  } else {
+    if (!ArenaInit(&arena, array_size * sizeof(int), ARENA_PAGES_1G,
+                   ARENA_PREFAULT_NONE, NULL)) {
+      fprintf(stderr, "Not enough memory for the array\n");
+      return 1;
+    }
+    array = ArenaAlloc(&arena, array_size * sizeof(int));
+    if (array == NULL) {
+      fprintf(stderr, "Not enough memory for the array\n");
+      ArenaFree(&arena);
+      return 1;
+    }
+    GenerateArray(array, array_size, seed);
+  }
+
+  bool built = RangeIndexBuild(&range_index, array, array_size);
+  ArenaFree(&arena);
+  if (!built) {
+    fprintf(stderr, "Not enough memory for the index\n");
+    return 1;
+  }
+
+  int server_fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (server_fd < 0) {
+    fprintf(stderr, "Can not create server socket!");
+    return 1;
+  }
+
+  struct sockaddr_in server;
+  server.sin_family = AF_INET;
+  server.sin_port = htons((uint16_t)port);
+  server.sin_addr.s_addr = htonl(INADDR_ANY);
+
+  int opt_val = 1;
+  setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt_val, sizeof(opt_val));
+
+  if (bind(server_fd, (struct sockaddr *)&server, sizeof(server)) < 0) {
+    fprintf(stderr, "Can not bind to socket!");
+    return 1;
+  }
+  if (listen(server_fd, 128) < 0) {
+    fprintf(stderr, "Could not listen on socket\n");
+    return 1;
+  }
+
+  pthread_t reporter;
+  if (pthread_create(&reporter, NULL, Reporter, NULL)) {
+    fprintf(stderr, "Error: pthread_create failed!\n");
+    return 1;
+  }
+  pthread_detach(reporter);
+
+  printf("Array of %lu elements, server listening at %d\n", array_size, port);
+  fflush(stdout);
+
+  while (true) {
+    int client_fd = accept(server_fd, NULL, NULL);
+    if (client_fd < 0) {
+      fprintf(stderr, "Could not establish new connection\n");
+      continue;
+    }
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, Session, (void *)(intptr_t)client_fd)) {
+      fprintf(stderr, "Error: pthread_create failed!\n");
+      close(client_fd);
+      continue;
+    }
+    pthread_detach(thread);
+  }
+
+  close(server_fd);
+  return 0;
+}
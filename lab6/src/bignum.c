@@ -0,0 +1,392 @@
+#include "bignum.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/socket.h>
+
+#define LIMB_BASE 1000000000ull
+#define LIMB_GROUP 16
+#define LIMB_FN(name) name##Dec
+#include "bignum_base.h"
+
+#define LIMB_BASE 4294967296ull
+#define LIMB_GROUP 1
+#define LIMB_FN(name) name##Bin
+#include "bignum_base.h"
+
+/* Ranges this short are multiplied one number at a time. */
+#define RANGE_LEAF 16
+/* Below this many limbs a multiplication is not worth a thread. */
+#define PARALLEL_MUL_THRESHOLD 2048
+
+static void Trim(struct BigNum *n) {
+  while (n->size > 1 && n->limbs[n->size - 1] == 0)
+    n->size--;
+}
+
+void BigNumFromU64(struct BigNum *n, uint64_t value) {
+  n->limbs = malloc(3 * sizeof(uint32_t));
+  n->size = 0;
+  do {
+    n->limbs[n->size++] = (uint32_t)(value % BIGNUM_DECIMAL_BASE);
+    value /= BIGNUM_DECIMAL_BASE;
+  } while (value > 0);
+}
+
+void BigNumFree(struct BigNum *n) {
+  free(n->limbs);
+  n->limbs = NULL;
+  n->size = 0;
+}
+
+struct MulTask {
+  uint32_t *r;
+  const uint32_t *a;
+  size_t n;
+  const uint32_t *b;
+  size_t m;
+  int threads;
+};
+
+static void MulParallel(uint32_t *r, const uint32_t *a, size_t n,
+                        const uint32_t *b, size_t m, int threads);
+
+static void *MulThread(void *args) {
+  struct MulTask *task = (struct MulTask *)args;
+  MulParallel(task->r, task->a, task->n, task->b, task->m, task->threads);
+  return NULL;
+}
+
+/* Runs tasks[1..count) on new threads and tasks[0] on the caller. */
+static void RunMulTasks(struct MulTask *tasks, int count) {
+  pthread_t threads[3];
+  bool started[3] = {false, false, false};
+  for (int i = 1; i < count; i++)
+    started[i] = pthread_create(&threads[i], NULL, MulThread, &tasks[i]) == 0;
+  MulThread(&tasks[0]);
+  for (int i = 1; i < count; i++) {
+    if (started[i])
+      pthread_join(threads[i], NULL);
+    else
+      MulThread(&tasks[i]);
+  }
+}
+
+/* Same split as MulKaratsubaDec, with the sub-products on threads. */
+static void MulParallel(uint32_t *r, const uint32_t *a, size_t n,
+                        const uint32_t *b, size_t m, int threads) {
+  if (n < m) {
+    MulParallel(r, b, m, a, n, threads);
+    return;
+  }
+  if (threads < 2 || m < PARALLEL_MUL_THRESHOLD) {
+    MulDec(r, a, n, b, m);
+    return;
+  }
+
+  size_t h = (n + 1) / 2;
+  if (m <= h) {
+    uint32_t *t = malloc((n - h + m) * sizeof(uint32_t));
+    struct MulTask tasks[2] = {{r, a, h, b, m, threads / 2},
+                               {t, a + h, n - h, b, m, threads - threads / 2}};
+    RunMulTasks(tasks, 2);
+    memset(r + h + m, 0, (n - h) * sizeof(uint32_t));
+    AddDec(r + h, n + m - h, t, n - h + m);
+    free(t);
+    return;
+  }
+
+  size_t an = n - h, bn = m - h;
+  uint32_t *sa = calloc(h + 1, sizeof(uint32_t));
+  uint32_t *sb = calloc(h + 1, sizeof(uint32_t));
+  uint32_t *z1 = malloc((2 * h + 2) * sizeof(uint32_t));
+
+  memcpy(sa, a, h * sizeof(uint32_t));
+  sa[h] = AddDec(sa, h, a + h, an);
+  memcpy(sb, b, h * sizeof(uint32_t));
+  sb[h] = AddDec(sb, h, b + h, bn);
+
+  int share = threads / 3 > 0 ? threads / 3 : 1;
+  struct MulTask tasks[3] = {{z1, sa, h + 1, sb, h + 1, threads - 2 * share},
+                             {r, a, h, b, h, share},
+                             {r + 2 * h, a + h, an, b + h, bn, share}};
+  RunMulTasks(tasks, threads >= 3 ? 3 : 2);
+  if (threads < 3)
+    MulThread(&tasks[2]);
+
+  SubDec(z1, 2 * h + 2, r, 2 * h);
+  SubDec(z1, 2 * h + 2, r + 2 * h, an + bn);
+  size_t z1n = 2 * h + 2;
+  while (z1n > 0 && z1[z1n - 1] == 0)
+    z1n--;
+  AddDec(r + h, n + m - h, z1, z1n);
+
+  free(sa);
+  free(sb);
+  free(z1);
+}
+
+void BigNumMul(struct BigNum *r, const struct BigNum *a, const struct BigNum *b,
+               int threads) {
+  size_t size = a->size + b->size;
+  uint32_t *limbs = malloc(size * sizeof(uint32_t));
+  MulParallel(limbs, a->limbs, a->size, b->limbs, b->size, threads);
+
+  free(r->limbs);
+  r->limbs = limbs;
+  r->size = size;
+  Trim(r);
+}
+
+static void RangeLeaf(struct BigNum *r, uint64_t begin, uint64_t end) {
+  size_t capacity = 3 * (end - begin + 1) + 1;
+  uint32_t *limbs = malloc(capacity * sizeof(uint32_t));
+  uint32_t *tmp = malloc(capacity * sizeof(uint32_t));
+  size_t size = 1;
+  limbs[0] = 1;
+
+  for (uint64_t x = begin; x <= end; x++) {
+    if (x < BIGNUM_DECIMAL_BASE) {
+      uint32_t carry = MulSmallDec(limbs, size, (uint32_t)x);
+      if (carry)
+        limbs[size++] = carry;
+      continue;
+    }
+    struct BigNum factor;
+    BigNumFromU64(&factor, x);
+    MulSchoolDec(tmp, limbs, size, factor.limbs, factor.size);
+    size += factor.size;
+    memcpy(limbs, tmp, size * sizeof(uint32_t));
+    while (size > 1 && limbs[size - 1] == 0)
+      size--;
+    BigNumFree(&factor);
+  }
+
+  free(tmp);
+  r->limbs = limbs;
+  r->size = size;
+}
+
+struct RangeTask {
+  struct BigNum *r;
+  uint64_t begin;
+  uint64_t end;
+  int threads;
+};
+
+static void *RangeThread(void *args) {
+  struct RangeTask *task = (struct RangeTask *)args;
+  BigNumRangeProduct(task->r, task->begin, task->end, task->threads);
+  return NULL;
+}
+
+void BigNumRangeProduct(struct BigNum *r, uint64_t begin, uint64_t end,
+                        int threads) {
+  if (begin > end) {
+    BigNumFromU64(r, 1);
+    return;
+  }
+  if (end - begin < RANGE_LEAF) {
+    RangeLeaf(r, begin, end);
+    return;
+  }
+
+  uint64_t mid = begin + (end - begin) / 2;
+  struct BigNum left, right;
+  struct RangeTask task = {&left, begin, mid, threads / 2};
+  pthread_t thread;
+  bool started = threads > 1 && pthread_create(&thread, NULL, RangeThread,
+                                               &task) == 0;
+  if (!started)
+    task.threads = 1;
+  BigNumRangeProduct(&right, mid + 1, end, started ? threads - threads / 2 : 1);
+  if (started)
+    pthread_join(thread, NULL);
+  else
+    RangeThread(&task);
+
+  r->limbs = NULL;
+  BigNumMul(r, &left, &right, threads);
+  BigNumFree(&left);
+  BigNumFree(&right);
+}
+
+static void ProductTree(struct BigNum *r, struct BigNum *factors, size_t n,
+                        int threads) {
+  if (n == 1) {
+    *r = factors[0];
+    return;
+  }
+  struct BigNum left, right;
+  ProductTree(&left, factors, n / 2, threads);
+  ProductTree(&right, factors + n / 2, n - n / 2, threads);
+  r->limbs = NULL;
+  BigNumMul(r, &left, &right, threads);
+  BigNumFree(&left);
+  BigNumFree(&right);
+}
+
+void BigNumProduct(struct BigNum *r, struct BigNum *factors, size_t n,
+                   int threads) {
+  if (n == 0) {
+    BigNumFromU64(r, 1);
+    return;
+  }
+  ProductTree(r, factors, n, threads);
+}
+
+size_t BigNumDecimalLength(const struct BigNum *n) {
+  size_t length = (n->size - 1) * 9;
+  uint32_t top = n->limbs[n->size - 1];
+  do {
+    length++;
+    top /= 10;
+  } while (top > 0);
+  return length;
+}
+
+void BigNumWriteDecimal(FILE *out, const struct BigNum *n) {
+  fprintf(out, "%u", n->limbs[n->size - 1]);
+  for (size_t i = n->size - 1; i-- > 0;)
+    fprintf(out, "%09u", n->limbs[i]);
+  fprintf(out, "\n");
+}
+
+/* Binary powers (10^9)^(2^k), built by squaring on demand. */
+struct PowerCache {
+  uint32_t *limbs[64];
+  size_t size[64];
+  int levels;
+};
+
+static const uint32_t *Power(struct PowerCache *cache, int k, size_t *size) {
+  while (cache->levels <= k) {
+    int level = cache->levels;
+    if (level == 0) {
+      cache->limbs[0] = malloc(sizeof(uint32_t));
+      cache->limbs[0][0] = BIGNUM_DECIMAL_BASE;
+      cache->size[0] = 1;
+    } else {
+      size_t prev = cache->size[level - 1];
+      uint32_t *sq = malloc(2 * prev * sizeof(uint32_t));
+      MulBin(sq, cache->limbs[level - 1], prev, cache->limbs[level - 1], prev);
+      size_t sq_size = 2 * prev;
+      while (sq_size > 1 && sq[sq_size - 1] == 0)
+        sq_size--;
+      cache->limbs[level] = sq;
+      cache->size[level] = sq_size;
+    }
+    cache->levels++;
+  }
+  *size = cache->size[k];
+  return cache->limbs[k];
+}
+
+/* Converts decimal limbs a[0..n) to binary limbs: the high half times
+   (10^9)^(2^k) plus the low half, so the cost is dominated by a few
+   large Karatsuba multiplications instead of quadratic division. */
+static uint32_t *ToBinary(const uint32_t *a, size_t n, size_t *out_size,
+                          struct PowerCache *cache) {
+  if (n <= 16) {
+    uint32_t *bin = calloc(n + 1, sizeof(uint32_t));
+    size_t size = 1;
+    for (size_t i = n; i-- > 0;) {
+      uint32_t carry = MulSmallBin(bin, size, BIGNUM_DECIMAL_BASE);
+      if (carry)
+        bin[size++] = carry;
+      uint32_t digit = a[i];
+      if (AddBin(bin, size, &digit, 1))
+        bin[size++] = 1;
+    }
+    *out_size = size;
+    return bin;
+  }
+
+  int k = 0;
+  while (((size_t)2 << k) < n)
+    k++;
+  size_t half = (size_t)1 << k;
+
+  size_t lo_size, hi_size, pow_size;
+  uint32_t *lo = ToBinary(a, half, &lo_size, cache);
+  uint32_t *hi = ToBinary(a + half, n - half, &hi_size, cache);
+  const uint32_t *pow = Power(cache, k, &pow_size);
+
+  size_t size = hi_size + pow_size + 1;
+  uint32_t *bin = malloc(size * sizeof(uint32_t));
+  MulBin(bin, hi, hi_size, pow, pow_size);
+  bin[size - 1] = 0;
+  AddBin(bin, size, lo, lo_size);
+  while (size > 1 && bin[size - 1] == 0)
+    size--;
+
+  free(lo);
+  free(hi);
+  *out_size = size;
+  return bin;
+}
+
+void BigNumWriteHex(FILE *out, const struct BigNum *n) {
+  struct PowerCache cache;
+  cache.levels = 0;
+
+  size_t size;
+  uint32_t *bin = ToBinary(n->limbs, n->size, &size, &cache);
+  fprintf(out, "0x%x", bin[size - 1]);
+  for (size_t i = size - 1; i-- > 0;)
+    fprintf(out, "%08x", bin[i]);
+  fprintf(out, "\n");
+
+  free(bin);
+  for (int i = 0; i < cache.levels; i++)
+    free(cache.limbs[i]);
+}
+
+static bool SendAll(int fd, const void *data, size_t len) {
+  const char *p = data;
+  while (len > 0) {
+    ssize_t sent = send(fd, p, len, 0);
+    if (sent <= 0)
+      return false;
+    p += sent;
+    len -= sent;
+  }
+  return true;
+}
+
+bool BigNumSend(int fd, const struct BigNum *n) {
+  uint64_t size = n->size;
+  return SendAll(fd, &size, sizeof(size)) &&
+         SendAll(fd, n->limbs, n->size * sizeof(uint32_t));
+}
+
+bool BigNumRecv(int fd, struct BigNum *n) {
+  uint64_t size = 0;
+  if (recv(fd, &size, sizeof(size), MSG_WAITALL) != sizeof(size) ||
+      size == 0 || size > ((uint64_t)1 << 40))
+    return false;
+
+  n->limbs = malloc(size * sizeof(uint32_t));
+  n->size = size;
+  char *p = (char *)n->limbs;
+  size_t left = size * sizeof(uint32_t);
+  while (left > 0) {
+    ssize_t got = recv(fd, p, left, MSG_WAITALL);
+    if (got <= 0) {
+      BigNumFree(n);
+      return false;
+    }
+    p += got;
+    left -= got;
+  }
+  for (size_t i = 0; i < n->size; i++) {
+    if (n->limbs[i] >= BIGNUM_DECIMAL_BASE) {
+      BigNumFree(n);
+      return false;
+    }
+  }
+  Trim(n);
+  return true;
+}
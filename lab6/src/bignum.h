@@ -0,0 +1,44 @@
+#ifndef BIGNUM_H
+#define BIGNUM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Non-negative integer in base 10^9, little-endian limbs, no leading
+   zero limbs except for the value 0 itself. */
+struct BigNum {
+  uint32_t *limbs;
+  size_t size;
+};
+
+#define BIGNUM_DECIMAL_BASE 1000000000u
+#define BIGNUM_KARATSUBA_THRESHOLD 96
+
+void BigNumFromU64(struct BigNum *n, uint64_t value);
+void BigNumFree(struct BigNum *n);
+
+/* r = a * b. r must hold a number or have limbs == NULL and may be one
+   of the inputs. Up to `threads` threads work on the top levels of
+   Karatsuba. */
+void BigNumMul(struct BigNum *r, const struct BigNum *a, const struct BigNum *b,
+               int threads);
+
+/* r = begin * (begin + 1) * ... * end as a balanced product tree. */
+void BigNumRangeProduct(struct BigNum *r, uint64_t begin, uint64_t end,
+                        int threads);
+
+/* r = product of factors[0..n), the factors are consumed. */
+void BigNumProduct(struct BigNum *r, struct BigNum *factors, size_t n,
+                   int threads);
+
+size_t BigNumDecimalLength(const struct BigNum *n);
+void BigNumWriteDecimal(FILE *out, const struct BigNum *n);
+void BigNumWriteHex(FILE *out, const struct BigNum *n);
+
+/* Wire format: uint64_t limb count followed by the limbs. */
+bool BigNumSend(int fd, const struct BigNum *n);
+bool BigNumRecv(int fd, struct BigNum *n);
+
+#endif
@@ -0,0 +1,174 @@
+/* Limb arithmetic for one base, included by bignum.c once per base with
+   LIMB_BASE, LIMB_GROUP and LIMB_FN(name) defined. Numbers are
+   little-endian limb arrays, sizes are passed explicitly and may include
+   leading zeros. */
+
+#if !defined(LIMB_BASE) || !defined(LIMB_FN) || !defined(LIMB_GROUP)
+#error "bignum_base.h needs LIMB_BASE, LIMB_GROUP and LIMB_FN"
+#endif
+
+/* r[0..rn) += a[0..an), an <= rn. Returns the carry out of r. */
+static uint32_t LIMB_FN(Add)(uint32_t *r, size_t rn, const uint32_t *a,
+                             size_t an) {
+  uint64_t carry = 0;
+  size_t i = 0;
+  for (; i < an; i++) {
+    uint64_t t = (uint64_t)r[i] + a[i] + carry;
+    carry = t >= LIMB_BASE;
+    r[i] = (uint32_t)(carry ? t - LIMB_BASE : t);
+  }
+  for (; carry && i < rn; i++) {
+    uint64_t t = (uint64_t)r[i] + carry;
+    carry = t >= LIMB_BASE;
+    r[i] = (uint32_t)(carry ? t - LIMB_BASE : t);
+  }
+  return (uint32_t)carry;
+}
+
+/* r[0..rn) -= a[0..an), the caller guarantees r >= a. */
+static void LIMB_FN(Sub)(uint32_t *r, size_t rn, const uint32_t *a,
+                         size_t an) {
+  int64_t borrow = 0;
+  size_t i = 0;
+  for (; i < an; i++) {
+    int64_t t = (int64_t)r[i] - a[i] - borrow;
+    borrow = t < 0;
+    r[i] = (uint32_t)(borrow ? t + (int64_t)LIMB_BASE : t);
+  }
+  for (; borrow && i < rn; i++) {
+    int64_t t = (int64_t)r[i] - borrow;
+    borrow = t < 0;
+    r[i] = (uint32_t)(borrow ? t + (int64_t)LIMB_BASE : t);
+  }
+}
+
+/* a[0..n) *= x for x < LIMB_BASE, returns the carry limb. */
+static uint32_t LIMB_FN(MulSmall)(uint32_t *a, size_t n, uint32_t x) {
+  uint64_t carry = 0;
+  for (size_t i = 0; i < n; i++) {
+    uint64_t t = (uint64_t)a[i] * x + carry;
+    a[i] = (uint32_t)(t % LIMB_BASE);
+    carry = t / LIMB_BASE;
+  }
+  return (uint32_t)carry;
+}
+
+/* r[0..n+m) = a * b, r must not alias the inputs. */
+#if LIMB_GROUP > 1
+/* LIMB_GROUP rows of products fit into 64-bit column sums before they
+   must be normalized, so carries are propagated once per group. */
+static void LIMB_FN(MulSchool)(uint32_t *r, const uint32_t *a, size_t n,
+                               const uint32_t *b, size_t m) {
+  uint64_t stack_acc[256];
+  uint64_t *acc = n + m <= 256 ? stack_acc : malloc((n + m) * sizeof(uint64_t));
+  memset(acc, 0, (n + m) * sizeof(uint64_t));
+
+  for (size_t i0 = 0; i0 < n; i0 += LIMB_GROUP) {
+    size_t i1 = i0 + LIMB_GROUP < n ? i0 + LIMB_GROUP : n;
+    for (size_t i = i0; i < i1; i++) {
+      uint64_t x = a[i];
+      uint64_t *row = acc + i;
+      for (size_t j = 0; j < m; j++)
+        row[j] += x * b[j];
+    }
+    uint64_t carry = 0;
+    for (size_t k = i0; k < i1 + m; k++) {
+      uint64_t t = acc[k] + carry;
+      acc[k] = t % LIMB_BASE;
+      carry = t / LIMB_BASE;
+    }
+    if (i1 + m < n + m)
+      acc[i1 + m] += carry;
+  }
+
+  for (size_t k = 0; k < n + m; k++)
+    r[k] = (uint32_t)acc[k];
+  if (acc != stack_acc)
+    free(acc);
+}
+#else
+static void LIMB_FN(MulSchool)(uint32_t *r, const uint32_t *a, size_t n,
+                               const uint32_t *b, size_t m) {
+  memset(r, 0, (n + m) * sizeof(uint32_t));
+  for (size_t i = 0; i < n; i++) {
+    uint64_t carry = 0;
+    uint64_t x = a[i];
+    if (x == 0)
+      continue;
+    for (size_t j = 0; j < m; j++) {
+      uint64_t t = r[i + j] + x * b[j] + carry;
+      r[i + j] = (uint32_t)(t % LIMB_BASE);
+      carry = t / LIMB_BASE;
+    }
+    r[i + m] = (uint32_t)carry;
+  }
+}
+#endif
+
+static void LIMB_FN(Mul)(uint32_t *r, const uint32_t *a, size_t n,
+                         const uint32_t *b, size_t m);
+
+/* Karatsuba for n >= m: a = a1 * B^h + a0, b = b1 * B^h + b0,
+   a * b = z2 * B^2h + ((a0 + a1)(b0 + b1) - z0 - z2) * B^h + z0. */
+static void LIMB_FN(MulKaratsuba)(uint32_t *r, const uint32_t *a, size_t n,
+                                  const uint32_t *b, size_t m) {
+  size_t h = (n + 1) / 2;
+
+  if (m <= h) {
+    /* Unbalanced operands: a0 * b + a1 * b * B^h. */
+    uint32_t *t = malloc((n - h + m) * sizeof(uint32_t));
+    LIMB_FN(Mul)(r, a, h, b, m);
+    memset(r + h + m, 0, (n - h) * sizeof(uint32_t));
+    LIMB_FN(Mul)(t, a + h, n - h, b, m);
+    LIMB_FN(Add)(r + h, n + m - h, t, n - h + m);
+    free(t);
+    return;
+  }
+
+  size_t an = n - h, bn = m - h;
+  uint32_t *sa = calloc(h + 1, sizeof(uint32_t));
+  uint32_t *sb = calloc(h + 1, sizeof(uint32_t));
+  uint32_t *z1 = malloc((2 * h + 2) * sizeof(uint32_t));
+
+  memcpy(sa, a, h * sizeof(uint32_t));
+  sa[h] = LIMB_FN(Add)(sa, h, a + h, an);
+  memcpy(sb, b, h * sizeof(uint32_t));
+  sb[h] = LIMB_FN(Add)(sb, h, b + h, bn);
+
+  /* z0 and z2 land directly in their places in r. */
+  LIMB_FN(Mul)(r, a, h, b, h);
+  LIMB_FN(Mul)(r + 2 * h, a + h, an, b + h, bn);
+  LIMB_FN(Mul)(z1, sa, h + 1, sb, h + 1);
+
+  LIMB_FN(Sub)(z1, 2 * h + 2, r, 2 * h);
+  LIMB_FN(Sub)(z1, 2 * h + 2, r + 2 * h, an + bn);
+
+  size_t z1n = 2 * h + 2;
+  while (z1n > 0 && z1[z1n - 1] == 0)
+    z1n--;
+  LIMB_FN(Add)(r + h, n + m - h, z1, z1n);
+
+  free(sa);
+  free(sb);
+  free(z1);
+}
+
+static void LIMB_FN(Mul)(uint32_t *r, const uint32_t *a, size_t n,
+                         const uint32_t *b, size_t m) {
+  if (n < m) {
+    const uint32_t *tp = a;
+    a = b;
+    b = tp;
+    size_t tn = n;
+    n = m;
+    m = tn;
+  }
+  if (m < BIGNUM_KARATSUBA_THRESHOLD)
+    LIMB_FN(MulSchool)(r, a, n, b, m);
+  else
+    LIMB_FN(MulKaratsuba)(r, a, n, b, m);
+}
+
+#undef LIMB_BASE
+#undef LIMB_GROUP
+#undef LIMB_FN
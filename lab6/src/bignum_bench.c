@@ -0,0 +1,125 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <getopt.h>
+#include <sys/time.h>
+
+#include "bignum.h"
+#include "common.h"
+
+/* Exact k! for k = 10^3 .. max_k: product tree on 1 and on `threads`
+   threads, decimal and hex output, and the one-by-one multiplication
+   loop for small k. */
+
+double ElapsedMs(const struct timeval *start) {
+  struct timeval finish_time;
+  gettimeofday(&finish_time, NULL);
+  double elapsed_time = (finish_time.tv_sec - start->tv_sec) * 1000.0;
+  elapsed_time += (finish_time.tv_usec - start->tv_usec) / 1000.0;
+  return elapsed_time;
+}
+
+int main(int argc, char **argv) {
+  uint64_t max_k = 1000000;
+  uint64_t naive_max_k = 10000;
+  int threads = 4;
+
+  while (true) {
+    static struct option options[] = {{"max_k", required_argument, 0, 0},
+                                      {"naive_max_k", required_argument, 0, 0},
+                                      {"threads", required_argument, 0, 0},
+                                      {0, 0, 0, 0}};
+
+    int option_index = 0;
+    int c = getopt_long(argc, argv, "", options, &option_index);
+
+    if (c == -1)
+      break;
+
+    switch (c) {
+    case 0: {
+      switch (option_index) {
+      case 0:
+        if (!ConvertStringToUI64(optarg, &max_k) || max_k == 0) {
+          fprintf(stderr, "Invalid max_k value\n");
+          return 1;
+        }
+        break;
+      case 1:
+        if (!ConvertStringToUI64(optarg, &naive_max_k)) {
+          fprintf(stderr, "Invalid naive_max_k value\n");
+          return 1;
+        }
+        break;
+      case 2:
+        threads = atoi(optarg);
+        if (threads <= 0) {
+          fprintf(stderr, "Thread number must be positive\n");
+          return 1;
+        }
+        break;
+      default:
+        printf("Index %d is out of options\n", option_index);
+      }
+    } break;
+
+    case '?':
+      printf("Unknown argument\n");
+      break;
+    default:
+      fprintf(stderr, "getopt returned character code 0%o?\n", c);
+    }
+  }
+
+  FILE *null_out = fopen("/dev/null", "w");
+  printf("%10s %10s %12s %12s %12s %12s %12s\n", "k", "digits", "naive_ms",
+         "tree_1_ms", "tree_n_ms", "dec_ms", "hex_ms");
+
+  for (uint64_t k = 1000; k <= max_k; k *= 10) {
+    struct timeval start_time;
+    double naive_ms = -1;
+    if (k <= naive_max_k) {
+      gettimeofday(&start_time, NULL);
+      struct BigNum acc;
+      BigNumFromU64(&acc, 1);
+      for (uint64_t i = 2; i <= k; i++) {
+        struct BigNum factor;
+        BigNumFromU64(&factor, i);
+        BigNumMul(&acc, &acc, &factor, 1);
+        BigNumFree(&factor);
+      }
+      naive_ms = ElapsedMs(&start_time);
+      BigNumFree(&acc);
+    }
+
+    struct BigNum product;
+    gettimeofday(&start_time, NULL);
+    BigNumRangeProduct(&product, 1, k, 1);
+    double tree_ms = ElapsedMs(&start_time);
+    BigNumFree(&product);
+
+    gettimeofday(&start_time, NULL);
+    BigNumRangeProduct(&product, 1, k, threads);
+    double threaded_ms = ElapsedMs(&start_time);
+
+    gettimeofday(&start_time, NULL);
+    BigNumWriteDecimal(null_out, &product);
+    double dec_ms = ElapsedMs(&start_time);
+
+    gettimeofday(&start_time, NULL);
+    BigNumWriteHex(null_out, &product);
+    double hex_ms = ElapsedMs(&start_time);
+
+    char naive[32] = "-";
+    if (naive_ms >= 0)
+      snprintf(naive, sizeof(naive), "%.2f", naive_ms);
+    printf("%10lu %10zu %12s %12.2f %12.2f %12.2f %12.2f\n", k,
+           BigNumDecimalLength(&product), naive, tree_ms, threaded_ms,
+           dec_ms, hex_ms);
+    BigNumFree(&product);
+  }
+
+  fclose(null_out);
+  return 0;
+}
@@ -0,0 +1,106 @@
+#include "checkpoint.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+#define CHECKPOINT_BATCH 256
+
+int CheckpointOpen(const char *path) {
+  return open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+}
+
+bool CheckpointAppend(int fd, const struct CheckpointRecord *record) {
+  /* A single small O_APPEND write lands in one piece even when several
+     threads share the descriptor. */
+  return write(fd, record, sizeof(*record)) == sizeof(*record);
+}
+
+static bool SameRange(const struct CheckpointRecord *record, uint64_t begin,
+                      uint64_t end, uint64_t mod) {
+  return record->begin == begin && record->end == end && record->mod == mod;
+}
+
+bool CheckpointFind(int fd, uint64_t begin, uint64_t end, uint64_t mod,
+                    struct CheckpointRecord *record) {
+  struct CheckpointRecord batch[CHECKPOINT_BATCH];
+  bool found = false;
+  off_t offset = 0;
+
+  while (true) {
+    ssize_t read_bytes = pread(fd, batch, sizeof(batch), offset);
+    if (read_bytes <= 0)
+      break;
+    size_t count = read_bytes / sizeof(struct CheckpointRecord);
+    for (size_t i = 0; i < count; i++) {
+      if (!SameRange(&batch[i], begin, end, mod))
+        continue;
+      if (!found || batch[i].current > record->current) {
+        *record = batch[i];
+        found = true;
+      }
+    }
+    /* A torn record at the tail of a crashed run is ignored. */
+    if (count == 0)
+      break;
+    offset += count * sizeof(struct CheckpointRecord);
+  }
+  return found;
+}
+
+/* Rewrites the file keeping only the most advanced record per range. */
+bool CheckpointCompact(const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return true;
+
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    close(fd);
+    return false;
+  }
+
+  size_t count = st.st_size / sizeof(struct CheckpointRecord);
+  struct CheckpointRecord *records = malloc(count * sizeof(*records) + 1);
+  if (records == NULL) {
+    close(fd);
+    return false;
+  }
+  if (pread(fd, records, count * sizeof(*records), 0) !=
+      (ssize_t)(count * sizeof(*records))) {
+    free(records);
+    close(fd);
+    return false;
+  }
+  close(fd);
+
+  size_t kept = 0;
+  for (size_t i = 0; i < count; i++) {
+    size_t j = 0;
+    while (j < kept && !SameRange(&records[j], records[i].begin,
+                                  records[i].end, records[i].mod))
+      j++;
+    if (j == kept)
+      records[kept++] = records[i];
+    else if (records[i].current > records[j].current)
+      records[j] = records[i];
+  }
+
+  char tmp_path[4096];
+  snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+  fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  bool ok = fd >= 0 &&
+            write(fd, records, kept * sizeof(*records)) ==
+                (ssize_t)(kept * sizeof(*records)) &&
+            fsync(fd) == 0;
+  if (fd >= 0)
+    close(fd);
+  ok = ok && rename(tmp_path, path) == 0;
+
+  free(records);
+  return ok;
+}
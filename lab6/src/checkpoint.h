@@ -0,0 +1,25 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Append-only file of fixed-size records. A record says that the
+   product of [begin, current] modulo mod equals partial; a record with
+   current == end describes a finished range. Servers use it for
+   progress checkpoints, the client as a journal of finished chunks. */
+struct CheckpointRecord {
+  uint64_t begin;
+  uint64_t end;
+  uint64_t current;
+  uint64_t partial;
+  uint64_t mod;
+};
+
+int CheckpointOpen(const char *path);
+bool CheckpointAppend(int fd, const struct CheckpointRecord *record);
+bool CheckpointFind(int fd, uint64_t begin, uint64_t end, uint64_t mod,
+                    struct CheckpointRecord *record);
+bool CheckpointCompact(const char *path);
+
+#endif
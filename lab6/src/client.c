@@ -14,12 +14,13 @@
 #include <fcntl.h>
 #include <pthread.h>
 #include <sys/time.h> 
+#include "bignum.h"
+#include "checkpoint.h"
 #include "common.h"
+#include "log.h"
+#include "shm_transport.h"
 
-struct Server {
-  char ip[255];
-  int port;
-};
+enum Transport { TRANSPORT_AUTO, TRANSPORT_TCP, TRANSPORT_SHM };
 
 struct ClientThreadArgs {
   struct Server server;
@@ -28,18 +29,29 @@ struct ClientThreadArgs {
   uint64_t mod;
   uint64_t result;
   int success;
+  enum Transport transport;
+  int busy_poll;
+  int repeat;
+  int timeout;
+  double latency_us;
+  struct BigNum exact; /* partial product when mod == 0 */
 };
 
+struct Connection {
+  enum Transport transport;
+  int sck;
+  struct ShmChannel *shm;
+};
 
-void* ProcessServer(void* args) {
-  struct ClientThreadArgs* thread_args = (struct ClientThreadArgs*)args;
-  
+bool IsLocalServer(const char *ip) {
+  return strcmp(ip, "localhost") == 0 || strncmp(ip, "127.", 4) == 0;
+}
+
+bool ConnectTcp(struct ClientThreadArgs *thread_args, struct Connection *conn) {
   struct hostent *hostname = gethostbyname(thread_args->server.ip);
   if (hostname == NULL) {
     fprintf(stderr, "gethostbyname failed with %s\n", thread_args->server.ip);
-    thread_args->success = 0;
-    thread_args->result = 1; 
-    return NULL;
+    return false;
   }
 
   struct sockaddr_in server_addr;
@@ -50,22 +62,18 @@ void* ProcessServer(void* args) {
     memcpy(&server_addr.sin_addr.s_addr, hostname->h_addr_list[0], hostname->h_length);
   } else {
     fprintf(stderr, "No address found for %s\n", thread_args->server.ip);
-    thread_args->success = 0;
-    thread_args->result = 1;
-    return NULL;
+    return false;
   }
 
   int sck = socket(AF_INET, SOCK_STREAM, 0);
   if (sck < 0) {
     fprintf(stderr, "Socket creation failed for server %s:%d\n", 
             thread_args->server.ip, thread_args->server.port);
-    thread_args->success = 0;
-    thread_args->result = 1;
-    return NULL;
+    return false;
   }
 
   struct timeval timeout;
-  timeout.tv_sec = 5;
+  timeout.tv_sec = thread_args->timeout;
   timeout.tv_usec = 0;
   setsockopt(sck, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
   setsockopt(sck, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
@@ -74,9 +82,81 @@ void* ProcessServer(void* args) {
     fprintf(stderr, "Connection failed to %s:%d\n", 
             thread_args->server.ip, thread_args->server.port);
     close(sck);
-    thread_args->success = 0;
-    thread_args->result = 1;
-    return NULL;
+    return false;
+  }
+
+  conn->transport = TRANSPORT_TCP;
+  conn->sck = sck;
+  conn->shm = NULL;
+  return true;
+}
+
+bool ConnectShm(struct ClientThreadArgs *thread_args, struct Connection *conn) {
+  int sck = ShmConnect(thread_args->server.port);
+  if (sck < 0)
+    return false;
+
+  int memfd = -1;
+  struct ShmChannel *channel = ShmChannelCreate(&memfd);
+  if (channel == NULL) {
+    close(sck);
+    return false;
+  }
+
+  bool sent = ShmSendFd(sck, memfd);
+  close(memfd);
+  if (!sent) {
+    ShmChannelUnmap(channel);
+    close(sck);
+    return false;
+  }
+
+  conn->transport = TRANSPORT_SHM;
+  conn->sck = sck;
+  conn->shm = channel;
+  return true;
+}
+
+bool OpenConnection(struct ClientThreadArgs *thread_args,
+                    struct Connection *conn) {
+  /* Shared memory slots carry 64-bit results only. */
+  if (thread_args->mod == 0)
+    return ConnectTcp(thread_args, conn);
+  if (thread_args->transport == TRANSPORT_SHM ||
+      (thread_args->transport == TRANSPORT_AUTO &&
+       IsLocalServer(thread_args->server.ip))) {
+    if (ConnectShm(thread_args, conn))
+      return true;
+    if (thread_args->transport == TRANSPORT_SHM) {
+      fprintf(stderr, "Shared memory connection failed to %s:%d\n",
+              thread_args->server.ip, thread_args->server.port);
+      return false;
+    }
+  }
+  return ConnectTcp(thread_args, conn);
+}
+
+void CloseConnection(struct Connection *conn) {
+  if (conn->shm != NULL) {
+    ShmChannelClose(conn->shm);
+    ShmChannelUnmap(conn->shm);
+  }
+  close(conn->sck);
+}
+
+bool Request(struct ClientThreadArgs *thread_args, struct Connection *conn,
+             uint64_t *result) {
+  if (conn->transport == TRANSPORT_SHM) {
+    struct ShmSlot slot = {thread_args->begin, thread_args->end,
+                           thread_args->mod, 0};
+    if (!ShmRingPush(conn->shm, &conn->shm->requests, &slot,
+                     thread_args->busy_poll, conn->sck))
+      return false;
+    if (!ShmRingPop(conn->shm, &conn->shm->responses, &slot,
+                    thread_args->busy_poll, conn->sck))
+      return false;
+    *result = slot.result;
+    return true;
   }
 
   char task[sizeof(uint64_t) * 3];
@@ -84,40 +164,93 @@ void* ProcessServer(void* args) {
   memcpy(task + sizeof(uint64_t), &thread_args->end, sizeof(uint64_t));
   memcpy(task + 2 * sizeof(uint64_t), &thread_args->mod, sizeof(uint64_t));
 
-  if (send(sck, task, sizeof(task), 0) < 0) {
+  if (send(conn->sck, task, sizeof(task), 0) < 0) {
     fprintf(stderr, "Send failed to server %s:%d\n", 
             thread_args->server.ip, thread_args->server.port);
-    close(sck);
-    thread_args->success = 0;
-    thread_args->result = 1;
-    return NULL;
+    return false;
   }
 
-  printf("Sent to server %s:%d: %lu-%lu mod %lu\n", 
-         thread_args->server.ip, thread_args->server.port, 
-         thread_args->begin, thread_args->end, thread_args->mod);
+  if (thread_args->mod == 0) {
+    BigNumFree(&thread_args->exact);
+    if (!BigNumRecv(conn->sck, &thread_args->exact)) {
+      fprintf(stderr, "Receive failed from server %s:%d\n",
+              thread_args->server.ip, thread_args->server.port);
+      return false;
+    }
+    *result = 0;
+    return true;
+  }
 
   char response[sizeof(uint64_t)];
-  if (recv(sck, response, sizeof(response), 0) < 0) {
+  if (recv(conn->sck, response, sizeof(response), MSG_WAITALL) <
+      (ssize_t)sizeof(response)) {
     fprintf(stderr, "Receive failed from server %s:%d\n", 
             thread_args->server.ip, thread_args->server.port);
-    thread_args->success = 0;
-    thread_args->result = 1;
-  } else {
-    memcpy(&thread_args->result, response, sizeof(uint64_t));
+    return false;
+  }
+  memcpy(result, response, sizeof(uint64_t));
+  return true;
+}
+
+void* ProcessServer(void* args) {
+  struct ClientThreadArgs* thread_args = (struct ClientThreadArgs*)args;
+  thread_args->success = 0;
+  thread_args->result = 1;
+
+  struct Connection conn;
+  if (!OpenConnection(thread_args, &conn))
+    return NULL;
+
+  LOG_INFO("Sent to server %s:%d (%s): %lu-%lu mod %lu\n",
+           thread_args->server.ip, thread_args->server.port,
+           conn.transport == TRANSPORT_SHM ? "shm" : "tcp", thread_args->begin,
+           thread_args->end, thread_args->mod);
+
+  struct timeval start_time;
+  gettimeofday(&start_time, NULL);
+
+  uint64_t result = 1;
+  int done = 0;
+  for (; done < thread_args->repeat; done++) {
+    if (!Request(thread_args, &conn, &result))
+      break;
+  }
+
+  struct timeval finish_time;
+  gettimeofday(&finish_time, NULL);
+
+  if (done == thread_args->repeat) {
+    double elapsed_us = (finish_time.tv_sec - start_time.tv_sec) * 1000000.0;
+    elapsed_us += finish_time.tv_usec - start_time.tv_usec;
+    thread_args->latency_us = elapsed_us / done;
+    thread_args->result = result;
     thread_args->success = 1;
-    printf("Received from server %s:%d: %lu\n", 
-           thread_args->server.ip, thread_args->server.port, thread_args->result);
+    if (thread_args->mod == 0)
+      LOG_INFO("Received from server %s:%d: %zu digits\n",
+               thread_args->server.ip, thread_args->server.port,
+               BigNumDecimalLength(&thread_args->exact));
+    else
+      LOG_INFO("Received from server %s:%d: %lu\n", thread_args->server.ip,
+               thread_args->server.port, thread_args->result);
   }
 
-  close(sck);
+  CloseConnection(&conn);
   return NULL;
 }
 
 int main(int argc, char **argv) {
-  uint64_t k = -1;
-  uint64_t mod = -1;
+  uint64_t k = UINT64_MAX;
+  uint64_t mod = UINT64_MAX;
   char servers_file[255] = {'\0'};
+  enum Transport transport = TRANSPORT_AUTO;
+  int busy_poll = 0;
+  int repeat = 1;
+  const char *journal_file = NULL;
+  int timeout = 5;
+  bool hex = false;
+  const char *output_file = NULL;
+  enum LogLevel level = LOG_LEVEL_INFO;
+  enum LogMode log_mode = LOG_ASYNC;
 
   while (true) {
     int current_optind = optind ? optind : 1;
@@ -125,6 +258,15 @@ int main(int argc, char **argv) {
     static struct option options[] = {{"k", required_argument, 0, 0},
                                       {"mod", required_argument, 0, 0},
                                       {"servers", required_argument, 0, 0},
+                                      {"transport", required_argument, 0, 0},
+                                      {"busy_poll", required_argument, 0, 0},
+                                      {"repeat", required_argument, 0, 0},
+                                      {"journal", required_argument, 0, 0},
+                                      {"timeout", required_argument, 0, 0},
+                                      {"exact", no_argument, 0, 0},
+                                      {"format", required_argument, 0, 0},
+                                      {"output", required_argument, 0, 0},
+                                      {"log", required_argument, 0, 0},
                                       {0, 0, 0, 0}};
 
     int option_index = 0;
@@ -152,6 +294,65 @@ int main(int argc, char **argv) {
         strncpy(servers_file, optarg, sizeof(servers_file) - 1);
         servers_file[sizeof(servers_file) - 1] = '\0';
         break;
+      case 3:
+        if (strcmp(optarg, "auto") == 0) {
+          transport = TRANSPORT_AUTO;
+        } else if (strcmp(optarg, "tcp") == 0) {
+          transport = TRANSPORT_TCP;
+        } else if (strcmp(optarg, "shm") == 0) {
+          transport = TRANSPORT_SHM;
+        } else {
+          fprintf(stderr, "Transport must be auto, tcp or shm\n");
+          return 1;
+        }
+        break;
+      case 4:
+        busy_poll = atoi(optarg);
+        if (busy_poll < 0) {
+          fprintf(stderr, "Busy poll iterations must be non-negative\n");
+          return 1;
+        }
+        break;
+      case 5:
+        repeat = atoi(optarg);
+        if (repeat <= 0) {
+          fprintf(stderr, "Repeat count must be positive\n");
+          return 1;
+        }
+        break;
+      case 6:
+        journal_file = optarg;
+        break;
+      case 7:
+        /* Long jobs need --timeout 0: wait for the result forever. */
+        timeout = atoi(optarg);
+        if (timeout < 0) {
+          fprintf(stderr, "Timeout must be non-negative\n");
+          return 1;
+        }
+        break;
+      case 8:
+        mod = 0;
+        break;
+      case 9:
+        if (strcmp(optarg, "dec") == 0) {
+          hex = false;
+        } else if (strcmp(optarg, "hex") == 0) {
+          hex = true;
+        } else {
+          fprintf(stderr, "Format must be dec or hex\n");
+          return 1;
+        }
+        break;
+      case 10:
+        output_file = optarg;
+        break;
+      case 11:
+        if (!LogLevelParse(optarg, &level, &log_mode)) {
+          fprintf(stderr, "Log must be debug, info, warn, error, off or sync\n");
+          return 1;
+        }
+        break;
       default:
         printf("Index %d is out of options\n", option_index);
       }
@@ -165,41 +366,35 @@ int main(int argc, char **argv) {
     }
   }
 
-  if (k == -1 || mod == -1 || !strlen(servers_file)) {
-    fprintf(stderr, "Using: %s --k 1000 --mod 5 --servers /path/to/file\n",
+  if (k == UINT64_MAX || mod == UINT64_MAX || !strlen(servers_file)) {
+    fprintf(stderr, "Using: %s --k 1000 --mod 5 --servers /path/to/file "
+            "[--transport auto|tcp|shm] [--busy_poll 1000] [--repeat 1] "
+            "[--journal file] [--timeout 5] [--exact] [--format dec|hex] "
+            "[--output file] [--log debug|info|warn|error|off|sync]\n",
             argv[0]);
     return 1;
   }
 
-  FILE *file = fopen(servers_file, "r");
-  if (file == NULL) {
-    fprintf(stderr, "Cannot open servers file: %s\n", servers_file);
-    return 1;
+  /* --mod 0 or --exact: compute k! itself. Servers may need a while
+     for large partial products, so wait for them. */
+  bool exact = mod == 0;
+  if (exact) {
+    timeout = 0;
+    repeat = 1;
+    journal_file = NULL;
   }
 
-  struct Server servers[100];
-  int servers_num = 0;
-  char line[255];
+  if (!LogInit(level, log_mode, 0)) {
+    fprintf(stderr, "Could not start the log writer\n");
+    return 1;
+  }
 
-  while (fgets(line, sizeof(line), file) != NULL && servers_num < 100) {
-    char *colon = strchr(line, ':');
-    if (colon == NULL) {
-      fprintf(stderr, "Invalid server format in file: %s\n", line);
-      continue;
-    }
-    
-    *colon = '\0';
-    strncpy(servers[servers_num].ip, line, sizeof(servers[servers_num].ip) - 1);
-    servers[servers_num].port = atoi(colon + 1);
-    
-    if (servers[servers_num].port <= 0) {
-      fprintf(stderr, "Invalid port number: %s\n", colon + 1);
-      continue;
-    }
-    
-    servers_num++;
+  struct Server servers[MAX_SERVERS];
+  int servers_num = ReadServers(servers_file, servers, MAX_SERVERS);
+  if (servers_num < 0) {
+    fprintf(stderr, "Cannot open servers file: %s\n", servers_file);
+    return 1;
   }
-  fclose(file);
 
   if (servers_num == 0) {
     fprintf(stderr, "No valid servers found in file\n");
@@ -207,17 +402,36 @@ int main(int argc, char **argv) {
   }
 
   printf("Found %d servers\n", servers_num);
+  /* Every server gets at least one number, servers past k would get an
+     empty chunk, which they reject. 0! needs none of them. */
+  if ((uint64_t)servers_num > k)
+    servers_num = k;
 
-  uint64_t chunk_size = k / servers_num;
-  uint64_t remainder = k % servers_num;
+  uint64_t chunk_size = servers_num > 0 ? k / servers_num : 0;
+  uint64_t remainder = servers_num > 0 ? k % servers_num : 0;
   uint64_t current_begin = 1;
 
   struct ClientThreadArgs *thread_args = malloc(servers_num * sizeof(struct ClientThreadArgs));
   pthread_t *threads = malloc(servers_num * sizeof(pthread_t));
+  bool *launched = calloc(servers_num, sizeof(bool));
+
+  struct timeval start_time;
+  gettimeofday(&start_time, NULL);
+
+  /* Chunks finished by a previous run of the same job are taken from
+     the journal instead of being sent again. */
+  int journal_fd = -1;
+  if (journal_file != NULL) {
+    journal_fd = CheckpointOpen(journal_file);
+    if (journal_fd < 0) {
+      fprintf(stderr, "Cannot open journal file: %s\n", journal_file);
+      return 1;
+    }
+  }
 
   for (int i = 0; i < servers_num; i++) {
     uint64_t chunk = chunk_size;
-    if (i < remainder) {
+    if ((uint64_t)i < remainder) {
       chunk++;
     }
 
@@ -230,43 +444,135 @@ int main(int argc, char **argv) {
     thread_args[i].mod = mod;
     thread_args[i].result = 1;
     thread_args[i].success = 0;
+    thread_args[i].transport = transport;
+    thread_args[i].busy_poll = busy_poll;
+    thread_args[i].repeat = repeat;
+    thread_args[i].timeout = timeout;
+    thread_args[i].latency_us = 0;
+    thread_args[i].exact.limbs = NULL;
+    thread_args[i].exact.size = 0;
 
     current_begin = end + 1;
 
+    struct CheckpointRecord record;
+    if (journal_fd >= 0 &&
+        CheckpointFind(journal_fd, thread_args[i].begin, end, mod, &record) &&
+        record.current == end) {
+      printf("Journal: %lu-%lu mod %lu = %lu\n", thread_args[i].begin, end,
+             mod, record.partial);
+      thread_args[i].result = record.partial;
+      thread_args[i].success = 1;
+      continue;
+    }
+
     if (pthread_create(&threads[i], NULL, ProcessServer, &thread_args[i]) != 0) {
       fprintf(stderr, "Failed to create thread for server %s:%d\n", 
               servers[i].ip, servers[i].port);
       thread_args[i].success = 0;
       thread_args[i].result = 1;
+      continue;
     }
+    launched[i] = true;
   }
 
   for (int i = 0; i < servers_num; i++) {
+    if (!launched[i])
+      continue;
     pthread_join(threads[i], NULL);
+    if (journal_fd >= 0 && thread_args[i].success) {
+      struct CheckpointRecord record = {thread_args[i].begin,
+                                        thread_args[i].end, thread_args[i].end,
+                                        thread_args[i].result, mod};
+      if (!CheckpointAppend(journal_fd, &record))
+        fprintf(stderr, "Could not write journal\n");
+    }
   }
+  if (journal_fd >= 0)
+    close(journal_fd);
+  LogFlush();
 
-  uint64_t final_result = 1;
+  uint64_t final_result = exact ? 1 : 1 % mod;
   int successful_servers = 0;
+  struct BigNum *partials = calloc(servers_num, sizeof(struct BigNum));
   
   for (int i = 0; i < servers_num; i++) {
     if (thread_args[i].success) {
-      final_result = MultModulo(final_result, thread_args[i].result, mod);
+      if (!exact)
+        final_result = MultModulo(final_result, thread_args[i].result, mod);
+      partials[successful_servers] = thread_args[i].exact;
       successful_servers++;
+      if (repeat > 1) {
+        printf("Server %s:%d: %.2fus per request over %d requests, "
+               "%.0f requests/s\n",
+               thread_args[i].server.ip, thread_args[i].server.port,
+               thread_args[i].latency_us, repeat,
+               1e6 / thread_args[i].latency_us);
+      }
     } else {
       printf("Warning: Server %s:%d failed\n", 
              thread_args[i].server.ip, thread_args[i].server.port);
+      BigNumFree(&thread_args[i].exact);
     }
   }
 
-  if (successful_servers == 0) {
+  if (successful_servers == 0 && servers_num > 0) {
     fprintf(stderr, "All servers failed!\n");
     final_result = 0;
   }
 
-  printf("\nFinal result: %lu! mod %lu = %lu\n", k, mod, final_result);
+  struct timeval finish_time;
+  gettimeofday(&finish_time, NULL);
+
+  double elapsed_time = (finish_time.tv_sec - start_time.tv_sec) * 1000.0;
+  elapsed_time += (finish_time.tv_usec - start_time.tv_usec) / 1000.0;
+
+  if (exact) {
+    if (successful_servers != servers_num) {
+      fprintf(stderr, "Exact result needs every chunk, %d/%d servers failed\n",
+              servers_num - successful_servers, servers_num);
+      for (int i = 0; i < successful_servers; i++)
+        BigNumFree(&partials[i]);
+      free(partials);
+      free(thread_args);
+      free(threads);
+      free(launched);
+      return 1;
+    }
+
+    /* Partial products of the servers are combined as a product tree. */
+    struct BigNum product;
+    BigNumProduct(&product, partials, successful_servers, servers_num);
+
+    gettimeofday(&finish_time, NULL);
+    elapsed_time = (finish_time.tv_sec - start_time.tv_sec) * 1000.0;
+    elapsed_time += (finish_time.tv_usec - start_time.tv_usec) / 1000.0;
+
+    FILE *out = stdout;
+    if (output_file != NULL) {
+      out = fopen(output_file, "w");
+      if (out == NULL) {
+        fprintf(stderr, "Cannot open output file: %s\n", output_file);
+        return 1;
+      }
+    }
+    printf("\nFinal result: %lu! has %zu digits\n", k,
+           BigNumDecimalLength(&product));
+    if (hex)
+      BigNumWriteHex(out, &product);
+    else
+      BigNumWriteDecimal(out, &product);
+    if (out != stdout)
+      fclose(out);
+    BigNumFree(&product);
+  } else {
+    printf("\nFinal result: %lu! mod %lu = %lu\n", k, mod, final_result);
+  }
   printf("Successful servers: %d/%d\n", successful_servers, servers_num);
+  printf("Elapsed time: %fms\n", elapsed_time);
 
+  free(partials);
   free(thread_args);
   free(threads);
+  free(launched);
   return 0;
 }
\ No newline at end of file
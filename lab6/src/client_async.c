@@ -0,0 +1,570 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "common.h"
+
+/* Single-threaded client: every connection is a state machine driven by
+   epoll, requests are pipelined on a few connections per server, so the
+   number of requests in flight is bounded by memory, not by threads. */
+
+#define REQUEST_SIZE (sizeof(uint64_t) * 3)
+#define RESPONSE_SIZE sizeof(uint64_t)
+#define MAX_ATTEMPTS 3
+
+enum RequestState { REQUEST_IDLE, REQUEST_SENT, REQUEST_DONE, REQUEST_FAILED };
+
+struct Request {
+  uint64_t begin;
+  uint64_t end;
+  uint64_t mod;
+  uint64_t result;
+  uint64_t sent_ns;
+  uint64_t latency_ns;
+  int attempts;
+  enum RequestState state;
+};
+
+struct Connection {
+  int fd;
+  struct Server *server;
+  bool connected;
+  bool alive;
+
+  char *out; /* serialized requests not yet written */
+  size_t out_len;
+  size_t out_off;
+  size_t out_cap;
+
+  uint32_t *inflight; /* ids in send order, answers come back in order */
+  size_t head;
+  size_t count;
+  size_t cap;
+
+  char in[RESPONSE_SIZE];
+  size_t in_len;
+};
+
+struct Client {
+  int epoll_fd;
+  struct Connection *conns;
+  int conns_num;
+  int next_conn;
+  struct Request *requests;
+  uint32_t *pending; /* ids waiting to be sent (new or retried) */
+  size_t pending_num;
+  size_t finished;
+  uint64_t timeout_ns;
+};
+
+uint64_t NowNs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+bool OpenConnection(struct Client *client, struct Connection *conn,
+                    struct Server *server) {
+  memset(conn, 0, sizeof(*conn));
+  conn->server = server;
+  conn->fd = -1;
+
+  struct hostent *hostname = gethostbyname(server->ip);
+  if (hostname == NULL || hostname->h_addr_list[0] == NULL) {
+    fprintf(stderr, "gethostbyname failed with %s\n", server->ip);
+    return false;
+  }
+
+  struct sockaddr_in server_addr;
+  memset(&server_addr, 0, sizeof(server_addr));
+  server_addr.sin_family = AF_INET;
+  server_addr.sin_port = htons(server->port);
+  memcpy(&server_addr.sin_addr.s_addr, hostname->h_addr_list[0],
+         hostname->h_length);
+
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  if (fd < 0) {
+    fprintf(stderr, "Socket creation failed for server %s:%d\n", server->ip,
+            server->port);
+    return false;
+  }
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+  if (connect(fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0 &&
+      errno != EINPROGRESS) {
+    fprintf(stderr, "Connection failed to %s:%d\n", server->ip, server->port);
+    close(fd);
+    return false;
+  }
+
+  struct epoll_event event;
+  event.events = EPOLLIN | EPOLLOUT;
+  event.data.ptr = conn;
+  if (epoll_ctl(client->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+    close(fd);
+    return false;
+  }
+
+  conn->fd = fd;
+  conn->alive = true;
+  conn->out_cap = 4096;
+  conn->out = malloc(conn->out_cap);
+  conn->cap = 1024;
+  conn->inflight = malloc(conn->cap * sizeof(uint32_t));
+  return true;
+}
+
+void WatchOutput(struct Client *client, struct Connection *conn, bool on) {
+  struct epoll_event event;
+  event.events = EPOLLIN | (on ? EPOLLOUT : 0);
+  event.data.ptr = conn;
+  epoll_ctl(client->epoll_fd, EPOLL_CTL_MOD, conn->fd, &event);
+}
+
+void FailRequest(struct Client *client, uint32_t id) {
+  struct Request *request = &client->requests[id];
+  if (request->attempts < MAX_ATTEMPTS) {
+    request->state = REQUEST_IDLE;
+    client->pending[client->pending_num++] = id;
+    return;
+  }
+  request->state = REQUEST_FAILED;
+  client->finished++;
+}
+
+/* Drops a broken or timed out connection, its requests are retried on
+   the remaining ones. */
+void CloseConnection(struct Client *client, struct Connection *conn,
+                     const char *reason) {
+  if (!conn->alive)
+    return;
+  fprintf(stderr, "Server %s:%d: %s, %zu requests in flight\n",
+          conn->server->ip, conn->server->port, reason, conn->count);
+  conn->alive = false;
+  epoll_ctl(client->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+  close(conn->fd);
+  for (size_t i = 0; i < conn->count; i++)
+    FailRequest(client, conn->inflight[(conn->head + i) % conn->cap]);
+  conn->count = 0;
+  conn->out_len = conn->out_off = 0;
+}
+
+void Enqueue(struct Client *client, struct Connection *conn, uint32_t id) {
+  if (conn->count == conn->cap) {
+    uint32_t *grown = malloc(2 * conn->cap * sizeof(uint32_t));
+    for (size_t i = 0; i < conn->count; i++)
+      grown[i] = conn->inflight[(conn->head + i) % conn->cap];
+    free(conn->inflight);
+    conn->inflight = grown;
+    conn->head = 0;
+    conn->cap *= 2;
+  }
+  conn->inflight[(conn->head + conn->count) % conn->cap] = id;
+  conn->count++;
+
+  if (conn->out_len + REQUEST_SIZE > conn->out_cap) {
+    memmove(conn->out, conn->out + conn->out_off,
+            conn->out_len - conn->out_off);
+    conn->out_len -= conn->out_off;
+    conn->out_off = 0;
+    while (conn->out_len + REQUEST_SIZE > conn->out_cap)
+      conn->out_cap *= 2;
+    conn->out = realloc(conn->out, conn->out_cap);
+  }
+
+  struct Request *request = &client->requests[id];
+  char *task = conn->out + conn->out_len;
+  memcpy(task, &request->begin, sizeof(uint64_t));
+  memcpy(task + sizeof(uint64_t), &request->end, sizeof(uint64_t));
+  memcpy(task + 2 * sizeof(uint64_t), &request->mod, sizeof(uint64_t));
+  conn->out_len += REQUEST_SIZE;
+
+  request->state = REQUEST_SENT;
+  request->sent_ns = NowNs();
+  request->attempts++;
+  WatchOutput(client, conn, true);
+}
+
+/* Hands pending requests to live connections round-robin. */
+void Dispatch(struct Client *client) {
+  while (client->pending_num > 0) {
+    struct Connection *conn = NULL;
+    for (int i = 0; i < client->conns_num && conn == NULL; i++) {
+      struct Connection *c =
+          &client->conns[(client->next_conn + i) % client->conns_num];
+      if (c->alive)
+        conn = c;
+    }
+    if (conn == NULL) {
+      /* Nothing left to send to. */
+      while (client->pending_num > 0) {
+        uint32_t id = client->pending[--client->pending_num];
+        client->requests[id].state = REQUEST_FAILED;
+        client->finished++;
+      }
+      return;
+    }
+    client->next_conn = (conn - client->conns + 1) % client->conns_num;
+    Enqueue(client, conn, client->pending[--client->pending_num]);
+  }
+}
+
+void HandleWritable(struct Client *client, struct Connection *conn) {
+  if (!conn->connected) {
+    int error = 0;
+    socklen_t len = sizeof(error);
+    getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &error, &len);
+    if (error != 0) {
+      CloseConnection(client, conn, strerror(error));
+      return;
+    }
+    conn->connected = true;
+  }
+
+  while (conn->out_off < conn->out_len) {
+    ssize_t sent = send(conn->fd, conn->out + conn->out_off,
+                        conn->out_len - conn->out_off, MSG_NOSIGNAL);
+    if (sent < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return;
+      CloseConnection(client, conn, "send failed");
+      return;
+    }
+    conn->out_off += sent;
+  }
+  conn->out_off = conn->out_len = 0;
+  WatchOutput(client, conn, false);
+}
+
+void HandleReadable(struct Client *client, struct Connection *conn) {
+  char buffer[65536];
+  while (true) {
+    ssize_t got = recv(conn->fd, buffer, sizeof(buffer), 0);
+    if (got == 0) {
+      CloseConnection(client, conn, "connection closed");
+      return;
+    }
+    if (got < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+        CloseConnection(client, conn, "receive failed");
+      return;
+    }
+
+    uint64_t now = NowNs();
+    for (ssize_t i = 0; i < got;) {
+      size_t take = RESPONSE_SIZE - conn->in_len;
+      if (take > (size_t)(got - i))
+        take = got - i;
+      memcpy(conn->in + conn->in_len, buffer + i, take);
+      conn->in_len += take;
+      i += take;
+      if (conn->in_len < RESPONSE_SIZE)
+        break;
+      conn->in_len = 0;
+
+      if (conn->count == 0) {
+        CloseConnection(client, conn, "unexpected response");
+        return;
+      }
+      uint32_t id = conn->inflight[conn->head];
+      conn->head = (conn->head + 1) % conn->cap;
+      conn->count--;
+
+      struct Request *request = &client->requests[id];
+      memcpy(&request->result, conn->in, sizeof(uint64_t));
+      request->latency_ns = now - request->sent_ns;
+      request->state = REQUEST_DONE;
+      client->finished++;
+    }
+  }
+}
+
+/* The oldest request of every connection is at the head of its queue. */
+int ExpireRequests(struct Client *client) {
+  uint64_t now = NowNs();
+  uint64_t next = UINT64_MAX;
+  for (int i = 0; i < client->conns_num; i++) {
+    struct Connection *conn = &client->conns[i];
+    if (!conn->alive || conn->count == 0)
+      continue;
+    struct Request *oldest = &client->requests[conn->inflight[conn->head]];
+    uint64_t deadline = oldest->sent_ns + client->timeout_ns;
+    if (deadline <= now)
+      CloseConnection(client, conn, "request timed out");
+    else if (deadline < next)
+      next = deadline;
+  }
+  if (next == UINT64_MAX)
+    return 1000;
+  return (int)((next - now) / 1000000) + 1;
+}
+
+/* Keeps at most `window` requests outstanding until all are finished. */
+void Run(struct Client *client, size_t requests_num, size_t window) {
+  size_t submitted = 0;
+  struct epoll_event events[256];
+
+  while (client->finished < requests_num) {
+    while (submitted < requests_num &&
+           submitted - client->finished < window) {
+      client->pending[client->pending_num++] = submitted++;
+    }
+    Dispatch(client);
+    if (client->finished >= requests_num)
+      break;
+
+    int wait_ms = ExpireRequests(client);
+    int ready = epoll_wait(client->epoll_fd, events, 256, wait_ms);
+    for (int i = 0; i < ready; i++) {
+      struct Connection *conn = events[i].data.ptr;
+      if (!conn->alive)
+        continue;
+      if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+        if (!(events[i].events & EPOLLIN)) {
+          CloseConnection(client, conn, "connection error");
+          continue;
+        }
+      }
+      if (events[i].events & EPOLLOUT)
+        HandleWritable(client, conn);
+      if (conn->alive && (events[i].events & EPOLLIN))
+        HandleReadable(client, conn);
+    }
+  }
+}
+
+int CompareU64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+int main(int argc, char **argv) {
+  uint64_t k = UINT64_MAX;
+  uint64_t mod = UINT64_MAX;
+  char servers_file[255] = {'\0'};
+  int connections = 1;
+  uint64_t chunks = 0;
+  uint64_t bench = 0;
+  uint64_t bench_k = 10;
+  uint64_t inflight = 10000;
+  int timeout_ms = 5000;
+
+  while (true) {
+    static struct option options[] = {{"k", required_argument, 0, 0},
+                                      {"mod", required_argument, 0, 0},
+                                      {"servers", required_argument, 0, 0},
+                                      {"connections", required_argument, 0, 0},
+                                      {"chunks", required_argument, 0, 0},
+                                      {"bench", required_argument, 0, 0},
+                                      {"bench_k", required_argument, 0, 0},
+                                      {"inflight", required_argument, 0, 0},
+                                      {"timeout_ms", required_argument, 0, 0},
+                                      {0, 0, 0, 0}};
+
+    int option_index = 0;
+    int c = getopt_long(argc, argv, "", options, &option_index);
+
+    if (c == -1)
+      break;
+
+    switch (c) {
+    case 0: {
+      switch (option_index) {
+      case 0:
+        if (!ConvertStringToUI64(optarg, &k)) {
+          fprintf(stderr, "Invalid k value\n");
+          return 1;
+        }
+        break;
+      case 1:
+        if (!ConvertStringToUI64(optarg, &mod)) {
+          fprintf(stderr, "Invalid mod value\n");
+          return 1;
+        }
+        break;
+      case 2:
+        strncpy(servers_file, optarg, sizeof(servers_file) - 1);
+        servers_file[sizeof(servers_file) - 1] = '\0';
+        break;
+      case 3:
+        connections = atoi(optarg);
+        if (connections <= 0) {
+          fprintf(stderr, "Connections must be positive\n");
+          return 1;
+        }
+        break;
+      case 4:
+        if (!ConvertStringToUI64(optarg, &chunks) || chunks == 0) {
+          fprintf(stderr, "Invalid chunks value\n");
+          return 1;
+        }
+        break;
+      case 5:
+        if (!ConvertStringToUI64(optarg, &bench) || bench == 0) {
+          fprintf(stderr, "Invalid bench value\n");
+          return 1;
+        }
+        break;
+      case 6:
+        if (!ConvertStringToUI64(optarg, &bench_k) || bench_k == 0) {
+          fprintf(stderr, "Invalid bench_k value\n");
+          return 1;
+        }
+        break;
+      case 7:
+        if (!ConvertStringToUI64(optarg, &inflight) || inflight == 0) {
+          fprintf(stderr, "Invalid inflight value\n");
+          return 1;
+        }
+        break;
+      case 8:
+        timeout_ms = atoi(optarg);
+        if (timeout_ms <= 0) {
+          fprintf(stderr, "Timeout must be positive\n");
+          return 1;
+        }
+        break;
+      default:
+        printf("Index %d is out of options\n", option_index);
+      }
+    } break;
+
+    case '?':
+      printf("Arguments error\n");
+      break;
+    default:
+      fprintf(stderr, "getopt returned character code 0%o?\n", c);
+    }
+  }
+
+  if ((bench == 0 && k == UINT64_MAX) || mod == UINT64_MAX ||
+      mod == 0 || !strlen(servers_file)) {
+    fprintf(stderr,
+            "Using: %s --k 1000 --mod 5 --servers /path/to/file "
+            "[--chunks N] [--connections 1] [--timeout_ms 5000]\n"
+            "       %s --bench 100000 --mod 5 --servers /path/to/file "
+            "[--bench_k 10] [--inflight 10000] [--connections 1]\n",
+            argv[0], argv[0]);
+    return 1;
+  }
+
+  struct Server servers[MAX_SERVERS];
+  int servers_num = ReadServers(servers_file, servers, MAX_SERVERS);
+  if (servers_num < 0) {
+    fprintf(stderr, "Cannot open servers file: %s\n", servers_file);
+    return 1;
+  }
+  if (servers_num == 0) {
+    fprintf(stderr, "No valid servers found in file\n");
+    return 1;
+  }
+
+  struct Client client;
+  memset(&client, 0, sizeof(client));
+  client.epoll_fd = epoll_create1(0);
+  client.timeout_ns = (uint64_t)timeout_ms * 1000000;
+  client.conns = calloc(servers_num * connections, sizeof(struct Connection));
+  for (int i = 0; i < servers_num * connections; i++) {
+    if (OpenConnection(&client, &client.conns[client.conns_num],
+                       &servers[i % servers_num]))
+      client.conns_num++;
+  }
+  if (client.conns_num == 0) {
+    fprintf(stderr, "All servers failed!\n");
+    return 1;
+  }
+
+  /* Job mode cuts [1, k] into chunks, bench mode sends bench small
+     identical requests. */
+  uint64_t requests_num = bench;
+  if (bench == 0) {
+    if (chunks == 0)
+      chunks = client.conns_num;
+    /* No empty chunks, servers reject them. 0! needs no request at all,
+       as in the synchronous client. */
+    if (chunks > k)
+      chunks = k;
+    requests_num = chunks;
+  }
+
+  client.requests = calloc(requests_num, sizeof(struct Request));
+  client.pending = malloc((requests_num + 1) * sizeof(uint32_t));
+  uint64_t chunk_size = bench || requests_num == 0 ? 0 : k / requests_num;
+  uint64_t remainder = bench || requests_num == 0 ? 0 : k % requests_num;
+  uint64_t current_begin = 1;
+  for (uint64_t i = 0; i < requests_num; i++) {
+    struct Request *request = &client.requests[i];
+    request->mod = mod;
+    if (bench) {
+      request->begin = 1;
+      request->end = bench_k;
+      continue;
+    }
+    uint64_t chunk = chunk_size + (i < remainder ? 1 : 0);
+    request->begin = current_begin;
+    request->end = current_begin + chunk - 1;
+    current_begin += chunk;
+  }
+
+  uint64_t start_ns = NowNs();
+  Run(&client, requests_num, bench ? inflight : requests_num);
+  double elapsed_ms = (NowNs() - start_ns) / 1e6;
+
+  uint64_t final_result = 1 % mod;
+  uint64_t failed = 0;
+  uint64_t *latencies = malloc(requests_num * sizeof(uint64_t));
+  uint64_t done = 0;
+  for (uint64_t i = 0; i < requests_num; i++) {
+    struct Request *request = &client.requests[i];
+    if (request->state != REQUEST_DONE) {
+      failed++;
+      continue;
+    }
+    final_result = MultModulo(final_result, request->result, mod);
+    latencies[done++] = request->latency_ns;
+  }
+
+  if (bench) {
+    qsort(latencies, done, sizeof(uint64_t), CompareU64);
+    printf("Requests: %lu ok, %lu failed, %lu in flight max, %d connections\n",
+           done, failed, inflight, client.conns_num);
+    printf("Throughput: %.0f requests/s\n", done / (elapsed_ms / 1000.0));
+    if (done > 0) {
+      printf("Latency: p50 %.1fus, p99 %.1fus, max %.1fus\n",
+             latencies[done / 2] / 1000.0, latencies[done * 99 / 100] / 1000.0,
+             latencies[done - 1] / 1000.0);
+    }
+  } else if (failed > 0) {
+    fprintf(stderr, "%lu of %lu chunks failed\n", failed, requests_num);
+  } else {
+    printf("Final result: %lu! mod %lu = %lu\n", k, mod, final_result);
+  }
+  printf("Elapsed time: %fms\n", elapsed_ms);
+
+  for (int i = 0; i < client.conns_num; i++) {
+    if (client.conns[i].alive)
+      close(client.conns[i].fd);
+    free(client.conns[i].out);
+    free(client.conns[i].inflight);
+  }
+  free(client.conns);
+  free(client.requests);
+  free(client.pending);
+  free(latencies);
+  close(client.epoll_fd);
+  return failed > 0 ? 1 : 0;
+}
@@ -1,7 +1,9 @@
 #include "common.h"
 #include <errno.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 uint64_t MultModulo(uint64_t a, uint64_t b, uint64_t mod) {
   uint64_t result = 0;
@@ -25,4 +27,35 @@ bool ConvertStringToUI64(const char *str, uint64_t *val) {
     return false;
   *val = i;
   return true;
-}
\ No newline at end of file
+}
+
+int ReadServers(const char *path, struct Server *servers, int max_servers) {
+  FILE *file = fopen(path, "r");
+  if (file == NULL)
+    return -1;
+
+  int servers_num = 0;
+  char line[255];
+
+  while (fgets(line, sizeof(line), file) != NULL && servers_num < max_servers) {
+    char *colon = strchr(line, ':');
+    if (colon == NULL) {
+      fprintf(stderr, "Invalid server format in file: %s\n", line);
+      continue;
+    }
+
+    *colon = '\0';
+    strncpy(servers[servers_num].ip, line, sizeof(servers[servers_num].ip) - 1);
+    servers[servers_num].ip[sizeof(servers[servers_num].ip) - 1] = '\0';
+    servers[servers_num].port = atoi(colon + 1);
+
+    if (servers[servers_num].port <= 0) {
+      fprintf(stderr, "Invalid port number: %s\n", colon + 1);
+      continue;
+    }
+
+    servers_num++;
+  }
+  fclose(file);
+  return servers_num;
+}
@@ -4,7 +4,17 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#define MAX_SERVERS 100
+
+struct Server {
+  char ip[255];
+  int port;
+};
+
 uint64_t MultModulo(uint64_t a, uint64_t b, uint64_t mod);
 bool ConvertStringToUI64(const char *str, uint64_t *val);
 
+/* Reads "ip:port" lines, returns the number of servers or -1. */
+int ReadServers(const char *path, struct Server *servers, int max_servers);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,132 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <getopt.h>
+#include <sys/time.h>
+
+#include "common.h"
+#include "factorial_engine.h"
+
+/* Compares the per-request scalar MultModulo loop the server used to run
+   with the multi-lane engine on the same batch of (range, mod) jobs. */
+
+double ElapsedMs(const struct timeval *start) {
+  struct timeval finish_time;
+  gettimeofday(&finish_time, NULL);
+  double elapsed_time = (finish_time.tv_sec - start->tv_sec) * 1000.0;
+  elapsed_time += (finish_time.tv_usec - start->tv_usec) / 1000.0;
+  return elapsed_time;
+}
+
+void MakeJobs(struct FactorialJob *jobs, int jobs_num, uint64_t k,
+              uint64_t mod) {
+  /* Every job is a different modulus over the same range, like
+     concurrent requests from several clients. */
+  for (int i = 0; i < jobs_num; i++) {
+    jobs[i].begin = 1;
+    jobs[i].end = k;
+    jobs[i].mod = mod + 2 * i;
+    jobs[i].result = 0;
+  }
+}
+
+int main(int argc, char **argv) {
+  uint64_t k = 1000000;
+  uint64_t mod = 1000000007;
+  int jobs_num = 16;
+  int lanes = 8;
+
+  while (true) {
+    static struct option options[] = {{"k", required_argument, 0, 0},
+                                      {"mod", required_argument, 0, 0},
+                                      {"jobs", required_argument, 0, 0},
+                                      {"lanes", required_argument, 0, 0},
+                                      {0, 0, 0, 0}};
+
+    int option_index = 0;
+    int c = getopt_long(argc, argv, "", options, &option_index);
+
+    if (c == -1)
+      break;
+
+    switch (c) {
+    case 0: {
+      switch (option_index) {
+      case 0:
+        if (!ConvertStringToUI64(optarg, &k) || k == 0) {
+          fprintf(stderr, "Invalid k value\n");
+          return 1;
+        }
+        break;
+      case 1:
+        if (!ConvertStringToUI64(optarg, &mod) || mod == 0) {
+          fprintf(stderr, "Invalid mod value\n");
+          return 1;
+        }
+        break;
+      case 2:
+        jobs_num = atoi(optarg);
+        if (jobs_num <= 0) {
+          fprintf(stderr, "Jobs number must be positive\n");
+          return 1;
+        }
+        break;
+      case 3:
+        lanes = atoi(optarg);
+        if (!FactorialLanesValid(lanes)) {
+          fprintf(stderr, "Lanes must be 1, 2, 4, 8 or 16\n");
+          return 1;
+        }
+        break;
+      default:
+        printf("Index %d is out of options\n", option_index);
+      }
+    } break;
+
+    case '?':
+      printf("Unknown argument\n");
+      break;
+    default:
+      fprintf(stderr, "getopt returned character code 0%o?\n", c);
+    }
+  }
+
+  struct FactorialJob *jobs = malloc(jobs_num * sizeof(struct FactorialJob));
+  uint64_t *expected = malloc(jobs_num * sizeof(uint64_t));
+  MakeJobs(jobs, jobs_num, k, mod);
+
+  struct timeval start_time;
+  gettimeofday(&start_time, NULL);
+  for (int i = 0; i < jobs_num; i++) {
+    uint64_t ans = 1;
+    for (uint64_t j = jobs[i].begin; j <= jobs[i].end; j++)
+      ans = MultModulo(ans, j, jobs[i].mod);
+    expected[i] = ans;
+  }
+  double scalar_ms = ElapsedMs(&start_time);
+  printf("per-request MultModulo: %10.2fms\n", scalar_ms);
+
+  int lane_counts[] = {1, 2, 4, 8, 16};
+  for (int l = 0; l < 5 && lane_counts[l] <= lanes; l++) {
+    MakeJobs(jobs, jobs_num, k, mod);
+    gettimeofday(&start_time, NULL);
+    FactorialEngineRun(jobs, jobs_num, lane_counts[l]);
+    double engine_ms = ElapsedMs(&start_time);
+
+    for (int i = 0; i < jobs_num; i++) {
+      if (jobs[i].result != expected[i]) {
+        fprintf(stderr, "Mismatch for mod %lu: %lu != %lu\n", jobs[i].mod,
+                jobs[i].result, expected[i]);
+        return 1;
+      }
+    }
+    printf("engine, %2d lanes:       %10.2fms  speedup %.2fx\n",
+           lane_counts[l], engine_ms, scalar_ms / engine_ms);
+  }
+
+  free(jobs);
+  free(expected);
+  return 0;
+}
@@ -0,0 +1,181 @@
+#include "factorial_engine.h"
+
+typedef unsigned __int128 uint128_t;
+
+struct LaneState {
+  uint64_t acc[FACTORIAL_MAX_LANES];
+  uint64_t next[FACTORIAL_MAX_LANES];
+  uint64_t mod[FACTORIAL_MAX_LANES];
+  uint64_t inv[FACTORIAL_MAX_LANES]; /* -mod^-1 mod 2^64 */
+};
+
+static uint64_t MulMod(uint64_t a, uint64_t b, uint64_t mod) {
+  return (uint64_t)((uint128_t)a * b % mod);
+}
+
+static uint64_t PowMod(uint64_t base, uint64_t exp, uint64_t mod) {
+  uint64_t result = 1 % mod;
+  while (exp > 0) {
+    if (exp & 1)
+      result = MulMod(result, base, mod);
+    base = MulMod(base, base, mod);
+    exp >>= 1;
+  }
+  return result;
+}
+
+/* Newton iteration for the inverse of an odd number modulo 2^64. */
+static uint64_t NegInverse(uint64_t mod) {
+  uint64_t inv = mod;
+  for (int i = 0; i < 5; i++)
+    inv *= 2 - mod * inv;
+  return -inv;
+}
+
+/* Montgomery reduction: a * b * 2^-64 mod m for a, b < m. */
+static inline uint64_t Redc(uint64_t a, uint64_t b, uint64_t mod,
+                            uint64_t inv) {
+  uint128_t t = (uint128_t)a * b;
+  uint64_t m = (uint64_t)t * inv;
+  uint128_t u = (t + (uint128_t)m * mod) >> 64;
+  /* u < 2 * mod, the addition cannot overflow for mod < 2^63. */
+  return u >= mod ? (uint64_t)u - mod : (uint64_t)u;
+}
+
+#define DEFINE_ENGINE_BLOCK(L)                                                 \
+  static void EngineBlock##L(struct LaneState *state, uint64_t steps) {        \
+    uint64_t acc[L], next[L], mod[L], inv[L];                                  \
+    for (int l = 0; l < L; l++) {                                              \
+      acc[l] = state->acc[l];                                                  \
+      next[l] = state->next[l];                                                \
+      mod[l] = state->mod[l];                                                  \
+      inv[l] = state->inv[l];                                                  \
+    }                                                                          \
+    for (uint64_t s = 0; s < steps; s++) {                                     \
+      for (int l = 0; l < L; l++) {                                            \
+        acc[l] = Redc(acc[l], next[l], mod[l], inv[l]);                        \
+        next[l]++;                                                             \
+      }                                                                        \
+    }                                                                          \
+    for (int l = 0; l < L; l++) {                                              \
+      state->acc[l] = acc[l];                                                  \
+      state->next[l] = next[l];                                                \
+    }                                                                          \
+  }
+
+DEFINE_ENGINE_BLOCK(1)
+DEFINE_ENGINE_BLOCK(2)
+DEFINE_ENGINE_BLOCK(4)
+DEFINE_ENGINE_BLOCK(8)
+DEFINE_ENGINE_BLOCK(16)
+
+bool FactorialLanesValid(int lanes) {
+  return lanes == 1 || lanes == 2 || lanes == 4 || lanes == 8 || lanes == 16;
+}
+
+static void EngineBlock(struct LaneState *state, int lanes, uint64_t steps) {
+  switch (lanes) {
+  case 1:
+    EngineBlock1(state, steps);
+    break;
+  case 2:
+    EngineBlock2(state, steps);
+    break;
+  case 4:
+    EngineBlock4(state, steps);
+    break;
+  case 8:
+    EngineBlock8(state, steps);
+    break;
+  default:
+    EngineBlock16(state, steps);
+  }
+}
+
+/* Reduces the job to a range of residues. Returns false when the answer
+   is already known: the range contains a multiple of mod, or the
+   modulus is not suited for Montgomery multiplication. */
+static bool PrepareJob(struct FactorialJob *job, uint64_t *begin,
+                       uint64_t *end) {
+  if (job->begin > job->end) {
+    job->result = 1 % job->mod;
+    return false;
+  }
+  if (job->begin == 0 || job->begin / job->mod != job->end / job->mod ||
+      job->end % job->mod == 0) {
+    job->result = 0;
+    return false;
+  }
+  *begin = job->begin % job->mod;
+  *end = job->end % job->mod;
+  if (job->mod % 2 == 0 || job->mod >> 63) {
+    uint64_t result = 1;
+    for (uint64_t i = *begin; i <= *end; i++)
+      result = MulMod(result, i, job->mod);
+    job->result = result;
+    return false;
+  }
+  return true;
+}
+
+void FactorialEngineRun(struct FactorialJob *jobs, size_t jobs_num,
+                        int lanes) {
+  struct LaneState state;
+  uint64_t lane_end[FACTORIAL_MAX_LANES];
+  size_t lane_job[FACTORIAL_MAX_LANES];
+  int active = 0;
+  size_t pending = 0;
+
+  /* Idle lanes spin on a dummy modulus, their results are dropped. */
+  for (int l = 0; l < lanes; l++) {
+    state.acc[l] = 1;
+    state.next[l] = 1;
+    state.mod[l] = 3;
+    state.inv[l] = NegInverse(3);
+    lane_job[l] = jobs_num;
+  }
+
+  while (true) {
+    for (int l = 0; l < lanes; l++) {
+      if (lane_job[l] != jobs_num)
+        continue;
+      while (pending < jobs_num) {
+        struct FactorialJob *job = &jobs[pending++];
+        uint64_t begin, end;
+        if (!PrepareJob(job, &begin, &end))
+          continue;
+        state.acc[l] = 1;
+        state.next[l] = begin;
+        state.mod[l] = job->mod;
+        state.inv[l] = NegInverse(job->mod);
+        lane_end[l] = end;
+        lane_job[l] = job - jobs;
+        active++;
+        break;
+      }
+      if (lane_job[l] == jobs_num)
+        state.next[l] = 1;
+    }
+    if (active == 0)
+      break;
+
+    uint64_t steps = UINT64_MAX;
+    for (int l = 0; l < lanes; l++) {
+      if (lane_job[l] != jobs_num && lane_end[l] - state.next[l] + 1 < steps)
+        steps = lane_end[l] - state.next[l] + 1;
+    }
+    EngineBlock(&state, lanes, steps);
+
+    for (int l = 0; l < lanes; l++) {
+      if (lane_job[l] == jobs_num || state.next[l] <= lane_end[l])
+        continue;
+      /* Every Redc step divided by 2^64, multiply the powers back. */
+      struct FactorialJob *job = &jobs[lane_job[l]];
+      uint64_t count = lane_end[l] - (job->begin % job->mod) + 1;
+      uint64_t r = (uint64_t)(((uint128_t)1 << 64) % job->mod);
+      job->result = MulMod(state.acc[l], PowMod(r, count, job->mod), job->mod);
+      lane_job[l] = jobs_num;
+      active--;
+    }
+  }
+}
@@ -0,0 +1,26 @@
+#ifndef FACTORIAL_ENGINE_H
+#define FACTORIAL_ENGINE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define FACTORIAL_MAX_LANES 16
+
+/* Product of [begin, end] modulo mod, filled in by the engine. */
+struct FactorialJob {
+  uint64_t begin;
+  uint64_t end;
+  uint64_t mod;
+  uint64_t result;
+};
+
+bool FactorialLanesValid(int lanes);
+
+/* Computes every job, keeping `lanes` independent multiplication chains
+   in flight so consecutive multiplies do not wait on each other. Jobs
+   may have different moduli. Odd moduli go through Montgomery
+   multiplication, even ones through a scalar fallback. */
+void FactorialEngineRun(struct FactorialJob *jobs, size_t jobs_num, int lanes);
+
+#endif
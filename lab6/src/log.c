@@ -0,0 +1,440 @@
+#include "log.h"
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#define RING_SIZE (64 * 1024) /* per thread, a power of two */
+#define MAX_RECORD 1024
+/* The writer looks at the rings at least this often. */
+#define WRITER_SLEEP_NS 10000000
+#define PADDING 0xff
+
+/* Records are 8-byte aligned and never wrap: one that does not fit
+   before the end of the ring is preceded by a padding record, of which
+   only size and level are written. String arguments are copied after the argument array,
+   their u holds the offset from the record start. */
+struct Record {
+  uint32_t size;
+  uint8_t level;
+  uint8_t nargs;
+  uint32_t suppressed;
+  const char *format;
+  struct LogArg args[];
+};
+
+/* Single producer, the owning thread, and single consumer, the writer. */
+struct Ring {
+  _Alignas(64) _Atomic uint64_t head;
+  _Atomic uint64_t dropped;
+  _Alignas(64) _Atomic uint64_t tail;
+  _Atomic bool closed; /* the owner has exited */
+  struct Ring *next;
+  _Alignas(8) char data[RING_SIZE];
+};
+
+enum LogLevel log_level = LOG_LEVEL_INFO;
+
+static enum LogMode log_mode = LOG_SYNC;
+static unsigned log_rate_limit;
+
+static _Atomic(struct Ring *) rings;
+static pthread_key_t ring_key;
+static __thread __attribute__((tls_model("initial-exec"))) struct Ring *ring;
+
+static _Atomic uint32_t writer_seq;
+static _Atomic uint32_t writer_sleeping;
+static _Atomic uint64_t writer_passes;
+
+static void FutexWait(_Atomic uint32_t *addr, uint32_t expected,
+                      const struct timespec *timeout) {
+  syscall(SYS_futex, (uint32_t *)addr, FUTEX_WAIT_PRIVATE, expected, timeout,
+          NULL, 0);
+}
+
+static void FutexWake(_Atomic uint32_t *addr) {
+  syscall(SYS_futex, (uint32_t *)addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL,
+          0);
+}
+
+static void WakeWriter(void) {
+  if (atomic_load_explicit(&writer_sleeping, memory_order_relaxed) == 0 ||
+      atomic_exchange(&writer_sleeping, 0) == 0)
+    return;
+  atomic_fetch_add(&writer_seq, 1);
+  FutexWake(&writer_seq);
+}
+
+static inline uint32_t Align8(size_t n) { return (n + 7) & ~(size_t)7; }
+
+/* Lays the record out at out, which has room for MAX_RECORD bytes, and
+   returns its size. Strings that do not fit are cut short. */
+static uint32_t Encode(char *out, enum LogLevel level, uint32_t suppressed,
+                       const char *format, const struct LogArg *args,
+                       int nargs) {
+  struct Record *record = (struct Record *)out;
+  if (nargs > LOG_MAX_ARGS)
+    nargs = LOG_MAX_ARGS;
+  record->level = level;
+  record->nargs = nargs;
+  record->suppressed = suppressed;
+  record->format = format;
+  size_t used = sizeof(struct Record) + nargs * sizeof(struct LogArg);
+  for (int i = 0; i < nargs; i++) {
+    record->args[i] = args[i];
+    if (args[i].type != LOG_ARG_STRING)
+      continue;
+    if (used >= MAX_RECORD - 1) {
+      /* No room left, an empty string in the last byte. */
+      out[MAX_RECORD - 1] = '\0';
+      record->args[i].u = MAX_RECORD - 1;
+      continue;
+    }
+    const char *s = args[i].s != NULL ? args[i].s : "(null)";
+    size_t len = strnlen(s, MAX_RECORD - 2 - used);
+    memcpy(out + used, s, len);
+    out[used + len] = '\0';
+    record->args[i].u = used;
+    used += len + 1;
+  }
+  record->size = Align8(used);
+  return record->size;
+}
+
+/* Upper bound of what Encode will take, to find room in the ring. */
+static uint32_t EncodedSize(const struct LogArg *args, int nargs) {
+  if (nargs > LOG_MAX_ARGS)
+    nargs = LOG_MAX_ARGS;
+  size_t size = sizeof(struct Record) + nargs * sizeof(struct LogArg);
+  for (int i = 0; i < nargs && size < MAX_RECORD; i++) {
+    if (args[i].type == LOG_ARG_STRING)
+      size += strnlen(args[i].s != NULL ? args[i].s : "(null)", MAX_RECORD) + 1;
+  }
+  return size < MAX_RECORD ? Align8(size) : MAX_RECORD;
+}
+
+/* One printf conversion of the format, spec is "%...c" with the length
+   modifiers dropped. Returns the bytes written to out, like snprintf. */
+static int FormatOne(char *out, size_t room, char *spec, size_t spec_len,
+                     const struct Record *record, const struct LogArg *arg) {
+  char conversion = spec[spec_len - 1];
+  if (arg == NULL)
+    return snprintf(out, room, "<?>");
+  switch (conversion) {
+  case 'd':
+  case 'i':
+  case 'u':
+  case 'o':
+  case 'x':
+  case 'X':
+  case 'c': {
+    if (arg->type == LOG_ARG_STRING || arg->type == LOG_ARG_DOUBLE)
+      break;
+    if (conversion == 'c')
+      return snprintf(out, room, spec, (int)arg->i);
+    /* Every integer was widened to 64 bits when it was logged. */
+    memmove(spec + spec_len + 1, spec + spec_len - 1, 2);
+    spec[spec_len - 1] = 'l';
+    spec[spec_len] = 'l';
+    return snprintf(out, room, spec, arg->i);
+  }
+  case 'e':
+  case 'E':
+  case 'f':
+  case 'F':
+  case 'g':
+  case 'G':
+  case 'a':
+  case 'A':
+    if (arg->type == LOG_ARG_DOUBLE)
+      return snprintf(out, room, spec, arg->d);
+    if (arg->type == LOG_ARG_INT)
+      return snprintf(out, room, spec, (double)arg->i);
+    if (arg->type == LOG_ARG_UINT)
+      return snprintf(out, room, spec, (double)arg->u);
+    break;
+  case 's':
+    if (arg->type == LOG_ARG_STRING)
+      return snprintf(out, room, spec, (const char *)record + arg->u);
+    break;
+  case 'p':
+    if (arg->type != LOG_ARG_STRING && arg->type != LOG_ARG_DOUBLE)
+      return snprintf(out, room, spec, arg->p);
+    break;
+  }
+  return snprintf(out, room, "<?>");
+}
+
+/* Formats the record into out, returns the length, cut at room - 1. */
+static size_t Format(char *out, size_t room, const struct Record *record) {
+  size_t len = 0;
+  if (record->suppressed > 0)
+    len = snprintf(out, room, "(%u messages suppressed by the rate limit)\n",
+                   record->suppressed);
+  int next_arg = 0;
+  for (const char *f = record->format; *f != '\0' && len < room - 1;) {
+    if (*f != '%') {
+      const char *percent = strchr(f, '%');
+      size_t n = percent != NULL ? (size_t)(percent - f) : strlen(f);
+      if (n > room - 1 - len)
+        n = room - 1 - len;
+      memcpy(out + len, f, n);
+      len += n;
+      f += n;
+      continue;
+    }
+    if (f[1] == '%') {
+      out[len++] = '%';
+      f += 2;
+      continue;
+    }
+    /* Flags, width and precision are kept, length modifiers dropped. */
+    char spec[32];
+    size_t spec_len = 0;
+    spec[spec_len++] = *f++;
+    while (*f != '\0' && strchr("-+ #0123456789.", *f) != NULL &&
+           spec_len < sizeof(spec) - 4)
+      spec[spec_len++] = *f++;
+    while (*f != '\0' && strchr("hlLqjzt", *f) != NULL)
+      f++;
+    if (*f == '\0')
+      break;
+    spec[spec_len++] = *f++;
+    spec[spec_len] = '\0';
+    const struct LogArg *arg =
+        next_arg < record->nargs ? &record->args[next_arg] : NULL;
+    next_arg++;
+    int n = FormatOne(out + len, room - len, spec, spec_len, record, arg);
+    if (n > 0)
+      len += (size_t)n < room - len ? (size_t)n : room - 1 - len;
+  }
+  out[len] = '\0';
+  return len;
+}
+
+static void CloseRing(void *arg) {
+  struct Ring *closing = arg;
+  ring = NULL;
+  atomic_store_explicit(&closing->closed, true, memory_order_release);
+}
+
+/* Rings are never freed, a new thread takes over the ring of one that
+   exited, after its last records, or adds a ring to the list. */
+static struct Ring *ThreadRing(void) {
+  if (ring != NULL)
+    return ring;
+  struct Ring *own = NULL;
+  for (struct Ring *at = atomic_load(&rings); at != NULL && own == NULL;
+       at = at->next) {
+    bool closed = true;
+    if (atomic_load_explicit(&at->closed, memory_order_relaxed) &&
+        atomic_compare_exchange_strong(&at->closed, &closed, false))
+      own = at;
+  }
+  if (own == NULL) {
+    own = aligned_alloc(64, sizeof(struct Ring));
+    if (own == NULL)
+      return NULL;
+    atomic_init(&own->head, 0);
+    atomic_init(&own->dropped, 0);
+    atomic_init(&own->tail, 0);
+    atomic_init(&own->closed, false);
+    own->next = atomic_load(&rings);
+    while (!atomic_compare_exchange_weak(&rings, &own->next, own))
+      ;
+  }
+  pthread_setspecific(ring_key, own);
+  ring = own;
+  return ring;
+}
+
+/* At most one record per call site per second after the limit, the
+   counters are shared by the threads but only touched when limiting. */
+static bool Admit(struct LogSite *site, uint32_t *suppressed) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+  uint64_t second = now.tv_sec;
+  uint64_t window = atomic_load_explicit(&site->window, memory_order_relaxed);
+  if (window != second &&
+      atomic_compare_exchange_strong(&site->window, &window, second))
+    atomic_store_explicit(&site->count, 0, memory_order_relaxed);
+  if (atomic_fetch_add_explicit(&site->count, 1, memory_order_relaxed) >=
+      log_rate_limit) {
+    atomic_fetch_add_explicit(&site->suppressed, 1, memory_order_relaxed);
+    return false;
+  }
+  if (atomic_load_explicit(&site->suppressed, memory_order_relaxed) > 0)
+    *suppressed = atomic_exchange(&site->suppressed, 0);
+  return true;
+}
+
+void LogWrite(enum LogLevel level, struct LogSite *site, const char *format,
+              const struct LogArg *args, int nargs) {
+  uint32_t suppressed = 0;
+  if (log_rate_limit > 0 && !Admit(site, &suppressed))
+    return;
+
+  if (log_mode == LOG_SYNC) {
+    _Alignas(8) char record[MAX_RECORD];
+    char line[MAX_RECORD * 2];
+    Encode(record, level, suppressed, format, args, nargs);
+    size_t len = Format(line, sizeof(line), (struct Record *)record);
+    fwrite(line, 1, len, stdout);
+    return;
+  }
+
+  struct Ring *own = ThreadRing();
+  if (own == NULL)
+    return;
+  uint32_t size = EncodedSize(args, nargs);
+  uint64_t head = atomic_load_explicit(&own->head, memory_order_relaxed);
+  uint64_t tail = atomic_load_explicit(&own->tail, memory_order_acquire);
+  uint32_t offset = head & (RING_SIZE - 1);
+  uint32_t to_end = RING_SIZE - offset;
+  uint32_t needed = size <= to_end ? size : to_end + size;
+  if (head + needed - tail > RING_SIZE) {
+    atomic_fetch_add_explicit(&own->dropped, 1, memory_order_relaxed);
+    WakeWriter();
+    return;
+  }
+  if (size > to_end) {
+    struct Record *pad = (struct Record *)(own->data + offset);
+    pad->size = to_end;
+    pad->level = PADDING;
+    head += to_end;
+    offset = 0;
+  }
+  head += Encode(own->data + offset, level, suppressed, format, args, nargs);
+  atomic_store_explicit(&own->head, head, memory_order_release);
+  if (head - tail > RING_SIZE / 2)
+    WakeWriter();
+}
+
+/* Writes out what is in the ring, returns whether there was anything. */
+static bool Drain(struct Ring *from, char *line, size_t room) {
+  uint64_t tail = atomic_load_explicit(&from->tail, memory_order_relaxed);
+  uint64_t head = atomic_load_explicit(&from->head, memory_order_acquire);
+  uint64_t dropped = 0;
+  if (atomic_load_explicit(&from->dropped, memory_order_relaxed) > 0)
+    dropped = atomic_exchange(&from->dropped, 0);
+  if (dropped > 0)
+    fprintf(stdout, "(%lu messages dropped, log ring full)\n",
+            (unsigned long)dropped);
+  if (tail == head)
+    return dropped > 0;
+  while (tail != head) {
+    const struct Record *record =
+        (const struct Record *)(from->data + (tail & (RING_SIZE - 1)));
+    if (record->level != PADDING) {
+      size_t len = Format(line, room, record);
+      fwrite(line, 1, len, stdout);
+    }
+    tail += record->size;
+    atomic_store_explicit(&from->tail, tail, memory_order_release);
+  }
+  return true;
+}
+
+/* One pass over the rings. */
+static bool DrainAll(char *line, size_t room) {
+  bool any = false;
+  for (struct Ring *at = atomic_load_explicit(&rings, memory_order_acquire);
+       at != NULL; at = at->next)
+    any |= Drain(at, line, room);
+  return any;
+}
+
+static void *Writer(void *unused) {
+  (void)unused;
+  static char line[MAX_RECORD * 2];
+  struct timespec timeout = {0, WRITER_SLEEP_NS};
+  while (true) {
+    if (DrainAll(line, sizeof(line))) {
+      fflush(stdout);
+      atomic_fetch_add(&writer_passes, 1);
+      continue;
+    }
+    uint32_t seq = atomic_load(&writer_seq);
+    atomic_store(&writer_sleeping, 1);
+    bool any = DrainAll(line, sizeof(line));
+    fflush(stdout);
+    atomic_fetch_add(&writer_passes, 1);
+    if (!any)
+      FutexWait(&writer_seq, seq, &timeout);
+    atomic_store(&writer_sleeping, 0);
+  }
+  return NULL;
+}
+
+static bool RingsEmpty(void) {
+  for (struct Ring *at = atomic_load(&rings); at != NULL; at = at->next) {
+    if (atomic_load(&at->head) != atomic_load(&at->tail) ||
+        atomic_load(&at->dropped) > 0)
+      return false;
+  }
+  return true;
+}
+
+/* Records are flushed by the end of the pass that took them, so once
+   the rings are empty one more finished pass is enough. */
+void LogFlush(void) {
+  if (log_mode == LOG_SYNC) {
+    fflush(stdout);
+    return;
+  }
+  struct timespec pause = {0, 100000};
+  while (true) {
+    uint64_t passes = atomic_load(&writer_passes);
+    WakeWriter();
+    if (RingsEmpty()) {
+      while (atomic_load(&writer_passes) <= passes) {
+        WakeWriter();
+        nanosleep(&pause, NULL);
+      }
+      return;
+    }
+    nanosleep(&pause, NULL);
+  }
+}
+
+bool LogInit(enum LogLevel level, enum LogMode mode, unsigned rate_limit) {
+  log_level = level;
+  log_rate_limit = rate_limit;
+  if (mode == LOG_SYNC || level == LOG_LEVEL_OFF) {
+    log_mode = LOG_SYNC;
+    return true;
+  }
+  if (pthread_key_create(&ring_key, CloseRing) != 0)
+    return false;
+  pthread_t writer;
+  if (pthread_create(&writer, NULL, Writer, NULL) != 0)
+    return false;
+  pthread_detach(writer);
+  log_mode = LOG_ASYNC;
+  atexit(LogFlush);
+  return true;
+}
+
+bool LogLevelParse(const char *name, enum LogLevel *level, enum LogMode *mode) {
+  static const char *kNames[] = {"debug", "info", "warn", "error", "off"};
+  *mode = LOG_ASYNC;
+  if (strcmp(name, "sync") == 0) {
+    *level = LOG_LEVEL_INFO;
+    *mode = LOG_SYNC;
+    return true;
+  }
+  for (int i = 0; i <= LOG_LEVEL_OFF; i++) {
+    if (strcmp(name, kNames[i]) == 0) {
+      *level = i;
+      return true;
+    }
+  }
+  return false;
+}
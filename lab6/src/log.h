@@ -0,0 +1,146 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Asynchronous logger for hot paths. LOG_INFO("Total: %lu\n", total)
+   does not format anything: it copies the format pointer and the raw
+   arguments (strings by value) into a ring owned by the calling thread,
+   and a background thread formats and writes the records. Threads never
+   share a lock or a cache line while logging, and a slow terminal only
+   slows the writer thread. When a ring is full the record is dropped and
+   counted rather than blocking the caller.
+
+   Formats must be string literals or otherwise outlive the program's
+   logging. Conversions are the usual printf ones without '*' width or
+   precision; at most LOG_MAX_ARGS arguments. */
+
+enum LogLevel {
+  LOG_LEVEL_DEBUG,
+  LOG_LEVEL_INFO,
+  LOG_LEVEL_WARN,
+  LOG_LEVEL_ERROR,
+  LOG_LEVEL_OFF
+};
+
+/* LOG_ASYNC is the ring and writer thread, LOG_SYNC formats with stdio
+   in the calling thread, as plain printf would. */
+enum LogMode { LOG_ASYNC, LOG_SYNC };
+
+#define LOG_MAX_ARGS 8
+
+enum LogArgType {
+  LOG_ARG_INT,
+  LOG_ARG_UINT,
+  LOG_ARG_DOUBLE,
+  LOG_ARG_STRING,
+  LOG_ARG_POINTER
+};
+
+struct LogArg {
+  enum LogArgType type;
+  union {
+    int64_t i;
+    uint64_t u;
+    double d;
+    const char *s;
+    const void *p;
+  };
+};
+
+/* Per call site, for the rate limit. */
+struct LogSite {
+  _Atomic uint64_t window; /* second the count is for */
+  _Atomic uint32_t count;
+  _Atomic uint32_t suppressed;
+};
+
+extern enum LogLevel log_level;
+
+/* Starts the writer thread in LOG_ASYNC mode. rate_limit is the number
+   of records per second a call site may log, 0 for no limit; the rest
+   are counted and reported with the next record that gets through.
+   Output goes to stdout, a flush is registered with atexit. */
+bool LogInit(enum LogLevel level, enum LogMode mode, unsigned rate_limit);
+/* Waits until every record logged so far is written. */
+void LogFlush(void);
+
+/* "debug", "info", "warn", "error", "off" and "sync", which is info in
+   LOG_SYNC mode. */
+bool LogLevelParse(const char *name, enum LogLevel *level, enum LogMode *mode);
+
+void LogWrite(enum LogLevel level, struct LogSite *site, const char *format,
+              const struct LogArg *args, int nargs);
+
+static inline struct LogArg LogArgInt(int64_t v) {
+  return (struct LogArg){.type = LOG_ARG_INT, .i = v};
+}
+static inline struct LogArg LogArgUint(uint64_t v) {
+  return (struct LogArg){.type = LOG_ARG_UINT, .u = v};
+}
+static inline struct LogArg LogArgDouble(double v) {
+  return (struct LogArg){.type = LOG_ARG_DOUBLE, .d = v};
+}
+static inline struct LogArg LogArgString(const char *v) {
+  return (struct LogArg){.type = LOG_ARG_STRING, .s = v};
+}
+static inline struct LogArg LogArgPointer(const void *v) {
+  return (struct LogArg){.type = LOG_ARG_POINTER, .p = v};
+}
+
+#define LOG_ARG(x)                                                            \
+  _Generic((x),                                                               \
+      char *: LogArgString,                                                   \
+      const char *: LogArgString,                                             \
+      void *: LogArgPointer,                                                  \
+      const void *: LogArgPointer,                                            \
+      float: LogArgDouble,                                                    \
+      double: LogArgDouble,                                                   \
+      char: LogArgInt,                                                        \
+      signed char: LogArgInt,                                                 \
+      short: LogArgInt,                                                       \
+      int: LogArgInt,                                                         \
+      long: LogArgInt,                                                        \
+      long long: LogArgInt,                                                   \
+      default: LogArgUint)(x)
+
+/* Argument counting for LOG(level, format, ...), the format included. */
+#define LOG_COUNT(...) LOG_COUNT_(__VA_ARGS__, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define LOG_COUNT_(_1, _2, _3, _4, _5, _6, _7, _8, _9, n, ...) n
+#define LOG_CAT(a, b) LOG_CAT_(a, b)
+#define LOG_CAT_(a, b) a##b
+#define LOG_FORMAT(format, ...) format
+
+/* A leading zero keeps the array from being empty. */
+#define LOG_ARGS(...) LOG_CAT(LOG_ARGS_, LOG_COUNT(__VA_ARGS__))(__VA_ARGS__)
+#define LOG_ARGS_1(f) {0}
+#define LOG_ARGS_2(f, a) {0}, LOG_ARG(a)
+#define LOG_ARGS_3(f, a, b) LOG_ARGS_2(f, a), LOG_ARG(b)
+#define LOG_ARGS_4(f, a, b, c) LOG_ARGS_3(f, a, b), LOG_ARG(c)
+#define LOG_ARGS_5(f, a, b, c, d) LOG_ARGS_4(f, a, b, c), LOG_ARG(d)
+#define LOG_ARGS_6(f, a, b, c, d, e) LOG_ARGS_5(f, a, b, c, d), LOG_ARG(e)
+#define LOG_ARGS_7(f, a, b, c, d, e, g)                                       \
+  LOG_ARGS_6(f, a, b, c, d, e), LOG_ARG(g)
+#define LOG_ARGS_8(f, a, b, c, d, e, g, h)                                    \
+  LOG_ARGS_7(f, a, b, c, d, e, g), LOG_ARG(h)
+#define LOG_ARGS_9(f, a, b, c, d, e, g, h, i)                                 \
+  LOG_ARGS_8(f, a, b, c, d, e, g, h), LOG_ARG(i)
+
+#define LOG(level, ...)                                                       \
+  do {                                                                        \
+    if ((level) >= log_level) {                                               \
+      static struct LogSite log_site_;                                        \
+      const struct LogArg log_args_[] = {LOG_ARGS(__VA_ARGS__)};              \
+      LogWrite((level), &log_site_, LOG_FORMAT(__VA_ARGS__, 0), log_args_ + 1, \
+               LOG_COUNT(__VA_ARGS__) - 1);                                   \
+    }                                                                         \
+  } while (0)
+
+#define LOG_DEBUG(...) LOG(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_INFO(...) LOG(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_WARN(...) LOG(LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_ERROR(...) LOG(LOG_LEVEL_ERROR, __VA_ARGS__)
+
+#endif
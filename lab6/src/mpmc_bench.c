@@ -0,0 +1,327 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <getopt.h>
+
+#include "mpmc_queue.h"
+
+/* Stress test and throughput benchmark for the MPMC queue. Producers
+   push tagged sequence numbers, consumers pop them; --stress checks
+   that every item arrives exactly once and that items of one producer
+   reach each consumer in order, --bench compares the queue with a
+   mutex and condvar ring at 1 to --max_threads producer/consumer
+   pairs. */
+
+#define STOP UINT64_MAX
+#define MAX_BATCH 64
+
+/* The queue under test, either kind behind the same two calls. */
+struct Queue {
+  void (*push)(struct Queue *queue, const uint64_t *items, size_t n);
+  size_t (*pop)(struct Queue *queue, uint64_t *items, size_t max);
+  struct MpmcQueue mpmc;
+  /* The mutex queue. */
+  pthread_mutex_t mutex;
+  pthread_cond_t not_empty;
+  pthread_cond_t not_full;
+  uint64_t *ring;
+  size_t capacity;
+  size_t head;
+  size_t count;
+};
+
+static void MpmcPush(struct Queue *queue, const uint64_t *items, size_t n) {
+  MpmcQueuePushBatch(&queue->mpmc, items, n);
+}
+
+static size_t MpmcPop(struct Queue *queue, uint64_t *items, size_t max) {
+  return MpmcQueuePopBatch(&queue->mpmc, items, max);
+}
+
+static void MutexPush(struct Queue *queue, const uint64_t *items, size_t n) {
+  pthread_mutex_lock(&queue->mutex);
+  for (size_t i = 0; i < n; i++) {
+    while (queue->count == queue->capacity) {
+      /* A batch larger than the ring has to hand the part in so far. */
+      pthread_cond_broadcast(&queue->not_empty);
+      pthread_cond_wait(&queue->not_full, &queue->mutex);
+    }
+    queue->ring[(queue->head + queue->count) % queue->capacity] = items[i];
+    queue->count++;
+  }
+  pthread_cond_broadcast(&queue->not_empty);
+  pthread_mutex_unlock(&queue->mutex);
+}
+
+static size_t MutexPop(struct Queue *queue, uint64_t *items, size_t max) {
+  pthread_mutex_lock(&queue->mutex);
+  while (queue->count == 0)
+    pthread_cond_wait(&queue->not_empty, &queue->mutex);
+  size_t taken = 0;
+  while (taken < max && queue->count > 0) {
+    items[taken++] = queue->ring[queue->head];
+    queue->head = (queue->head + 1) % queue->capacity;
+    queue->count--;
+  }
+  pthread_cond_broadcast(&queue->not_full);
+  pthread_mutex_unlock(&queue->mutex);
+  return taken;
+}
+
+static bool QueueInit(struct Queue *queue, bool mpmc, size_t capacity) {
+  memset(queue, 0, sizeof(*queue));
+  if (mpmc) {
+    queue->push = MpmcPush;
+    queue->pop = MpmcPop;
+    return MpmcQueueInit(&queue->mpmc, capacity, sizeof(uint64_t));
+  }
+  queue->push = MutexPush;
+  queue->pop = MutexPop;
+  pthread_mutex_init(&queue->mutex, NULL);
+  pthread_cond_init(&queue->not_empty, NULL);
+  pthread_cond_init(&queue->not_full, NULL);
+  queue->capacity = capacity;
+  queue->ring = malloc(capacity * sizeof(uint64_t));
+  return queue->ring != NULL;
+}
+
+static void QueueDestroy(struct Queue *queue, bool mpmc) {
+  if (mpmc) {
+    MpmcQueueDestroy(&queue->mpmc);
+    return;
+  }
+  pthread_mutex_destroy(&queue->mutex);
+  pthread_cond_destroy(&queue->not_empty);
+  pthread_cond_destroy(&queue->not_full);
+  free(queue->ring);
+}
+
+struct Run {
+  struct Queue queue;
+  int producers;
+  int consumers;
+  uint64_t items; /* per producer */
+  size_t batch;
+  bool check;
+  _Atomic uint64_t *received; /* per producer, with check */
+  _Atomic uint64_t errors;
+};
+
+struct Worker {
+  pthread_t thread;
+  struct Run *run;
+  int id;
+};
+
+static uint64_t NextRandom(uint64_t *state) {
+  *state ^= *state << 13;
+  *state ^= *state >> 7;
+  *state ^= *state << 17;
+  return *state;
+}
+
+/* Items are the producer id in the top 16 bits and a sequence number. */
+static void *Produce(void *args) {
+  struct Worker *worker = args;
+  struct Run *run = worker->run;
+  uint64_t items[MAX_BATCH];
+  uint64_t state = 0x9e3779b97f4a7c15ull * (worker->id + 1);
+
+  for (uint64_t next = 0; next < run->items;) {
+    size_t n = run->check ? 1 + NextRandom(&state) % run->batch : run->batch;
+    if (n > run->items - next)
+      n = run->items - next;
+    for (size_t i = 0; i < n; i++)
+      items[i] = (uint64_t)worker->id << 48 | (next + i);
+    run->queue.push(&run->queue, items, n);
+    next += n;
+  }
+  return NULL;
+}
+
+static void *Consume(void *args) {
+  struct Worker *worker = args;
+  struct Run *run = worker->run;
+  uint64_t items[MAX_BATCH];
+  uint64_t *last = calloc(run->producers, sizeof(uint64_t));
+
+  while (true) {
+    size_t n = run->queue.pop(&run->queue, items, run->batch);
+    size_t stops = 0;
+    for (size_t i = 0; i < n; i++) {
+      if (items[i] == STOP) {
+        stops++;
+        continue;
+      }
+      if (!run->check)
+        continue;
+      int producer = items[i] >> 48;
+      uint64_t seq = items[i] & ((1ull << 48) - 1);
+      /* One producer's items take increasing positions, so a consumer
+         sees them in increasing order. */
+      if (producer >= run->producers || seq + 1 <= last[producer])
+        atomic_fetch_add(&run->errors, 1);
+      else
+        last[producer] = seq + 1;
+      if (producer < run->producers)
+        atomic_fetch_add(&run->received[producer], 1);
+    }
+    if (stops > 0) {
+      /* One stop per consumer, hand back any taken for others. */
+      uint64_t stop = STOP;
+      for (size_t i = 1; i < stops; i++)
+        run->queue.push(&run->queue, &stop, 1);
+      break;
+    }
+  }
+  free(last);
+  return NULL;
+}
+
+/* Returns elapsed seconds, or -1 when a check failed. */
+static double RunQueue(bool mpmc, int producers, int consumers,
+                       uint64_t items, size_t batch, size_t capacity,
+                       bool check) {
+  struct Run run = {.producers = producers,
+                    .consumers = consumers,
+                    .items = items,
+                    .batch = batch,
+                    .check = check};
+  if (!QueueInit(&run.queue, mpmc, capacity)) {
+    fprintf(stderr, "Not enough memory for the queue\n");
+    exit(1);
+  }
+  run.received = calloc(producers, sizeof(uint64_t));
+  struct Worker *workers = calloc(producers + consumers, sizeof(struct Worker));
+
+  struct timespec start, finish;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 0; i < producers + consumers; i++) {
+    workers[i].run = &run;
+    workers[i].id = i < producers ? i : i - producers;
+    if (pthread_create(&workers[i].thread, NULL,
+                       i < producers ? Produce : Consume, &workers[i])) {
+      fprintf(stderr, "Error: pthread_create failed!\n");
+      exit(1);
+    }
+  }
+  for (int i = 0; i < producers; i++)
+    pthread_join(workers[i].thread, NULL);
+  uint64_t stop = STOP;
+  for (int i = 0; i < consumers; i++)
+    run.queue.push(&run.queue, &stop, 1);
+  for (int i = producers; i < producers + consumers; i++)
+    pthread_join(workers[i].thread, NULL);
+  clock_gettime(CLOCK_MONOTONIC, &finish);
+
+  bool ok = atomic_load(&run.errors) == 0;
+  for (int i = 0; check && i < producers; i++)
+    ok = ok && atomic_load(&run.received[i]) == items;
+
+  QueueDestroy(&run.queue, mpmc);
+  free(run.received);
+  free(workers);
+  if (!ok)
+    return -1;
+  return (finish.tv_sec - start.tv_sec) +
+         (finish.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+int main(int argc, char **argv) {
+  bool stress = false;
+  bool bench = false;
+  int max_threads = 64;
+  uint64_t items = 1000000;
+  int batch = 1;
+  int capacity = 1024;
+
+  while (true) {
+    static struct option options[] = {{"stress", no_argument, 0, 0},
+                                      {"bench", no_argument, 0, 0},
+                                      {"max_threads", required_argument, 0, 0},
+                                      {"items", required_argument, 0, 0},
+                                      {"batch", required_argument, 0, 0},
+                                      {"capacity", required_argument, 0, 0},
+                                      {0, 0, 0, 0}};
+
+    int option_index = 0;
+    int c = getopt_long(argc, argv, "", options, &option_index);
+
+    if (c == -1)
+      break;
+
+    switch (c) {
+    case 0: {
+      switch (option_index) {
+      case 0:
+        stress = true;
+        break;
+      case 1:
+        bench = true;
+        break;
+      case 2:
+        max_threads = atoi(optarg);
+        break;
+      case 3:
+        items = strtoull(optarg, NULL, 10);
+        break;
+      case 4:
+        batch = atoi(optarg);
+        break;
+      case 5:
+        capacity = atoi(optarg);
+        break;
+      default:
+        printf("Index %d is out of options\n", option_index);
+      }
+    } break;
+
+    case '?':
+      printf("Unknown argument\n");
+      break;
+    default:
+      fprintf(stderr, "getopt returned character code 0%o?\n", c);
+    }
+  }
+
+  if ((!stress && !bench) || max_threads <= 0 || items == 0 || batch <= 0 ||
+      batch > MAX_BATCH || capacity <= 0) {
+    fprintf(stderr,
+            "Using: %s --stress|--bench [--max_threads 64] [--items 1000000] "
+            "[--batch 1..%d] [--capacity 1024]\n",
+            argv[0], MAX_BATCH);
+    return 1;
+  }
+
+  int failures = 0;
+  if (stress) {
+    /* A small ring wraps around often and keeps both sides blocking. */
+    static const int kShapes[][2] = {{1, 1}, {1, 4}, {4, 1}, {4, 4}, {8, 3}};
+    for (size_t s = 0; s < sizeof(kShapes) / sizeof(kShapes[0]); s++) {
+      int p = kShapes[s][0], c = kShapes[s][1];
+      uint64_t per_producer = items / p;
+      double seconds = RunQueue(true, p, c, per_producer, batch < 8 ? 8 : batch,
+                                8, true);
+      printf("stress %d producers %d consumers: %s\n", p, c,
+             seconds < 0 ? "FAILED" : "ok");
+      failures += seconds < 0;
+    }
+  }
+
+  if (bench) {
+    printf("%8s %14s %14s\n", "threads", "mpmc Mitem/s", "mutex Mitem/s");
+    for (int t = 1; t <= max_threads; t *= 2) {
+      uint64_t per_producer = items / t;
+      double mpmc = RunQueue(true, t, t, per_producer, batch, capacity, false);
+      double mutex = RunQueue(false, t, t, per_producer, batch, capacity, false);
+      printf("%8d %14.2f %14.2f\n", t, per_producer * t / mpmc / 1e6,
+             per_producer * t / mutex / 1e6);
+    }
+  }
+  return failures > 0;
+}
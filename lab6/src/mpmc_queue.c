@@ -0,0 +1,200 @@
+#include "mpmc_queue.h"
+
+#include <limits.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+/* Failed tries before a blocking call goes to sleep. */
+#define SPINS 64
+
+struct Cell {
+  _Atomic size_t seq;
+  _Alignas(max_align_t) char data[];
+};
+
+static inline struct Cell *CellAt(const struct MpmcQueue *queue, size_t pos) {
+  return (struct Cell *)(queue->cells + (pos & queue->mask) * queue->cell_size);
+}
+
+static inline void CpuRelax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#endif
+}
+
+static void FutexWait(_Atomic uint32_t *addr, uint32_t expected) {
+  syscall(SYS_futex, (uint32_t *)addr, FUTEX_WAIT_PRIVATE, expected, NULL,
+          NULL, 0);
+}
+
+static void FutexWake(_Atomic uint32_t *addr, int count) {
+  syscall(SYS_futex, (uint32_t *)addr, FUTEX_WAKE_PRIVATE, count, NULL, NULL,
+          0);
+}
+
+bool MpmcQueueInit(struct MpmcQueue *queue, size_t capacity,
+                   size_t elem_size) {
+  size_t slots = 2;
+  while (slots < capacity)
+    slots *= 2;
+  size_t align = _Alignof(max_align_t);
+  memset(queue, 0, sizeof(*queue));
+  queue->mask = slots - 1;
+  queue->elem_size = elem_size;
+  queue->cell_size =
+      (offsetof(struct Cell, data) + elem_size + align - 1) / align * align;
+  queue->cells = aligned_alloc(64, (slots * queue->cell_size + 63) / 64 * 64);
+  if (queue->cells == NULL)
+    return false;
+  for (size_t i = 0; i < slots; i++)
+    atomic_init(&CellAt(queue, i)->seq, i);
+  return true;
+}
+
+void MpmcQueueDestroy(struct MpmcQueue *queue) {
+  free(queue->cells);
+  queue->cells = NULL;
+}
+
+/* A cell is free for the producer at pos when its seq is pos and holds
+   data for the consumer at pos when its seq is pos + 1. The consumer
+   hands it back for the next round with pos + capacity. */
+size_t MpmcQueueTryPushBatch(struct MpmcQueue *queue, const void *elems,
+                             size_t n) {
+  size_t pos = atomic_load_explicit(&queue->enqueue_pos, memory_order_relaxed);
+  size_t k;
+  while (true) {
+    for (k = 0; k < n; k++) {
+      size_t seq = atomic_load_explicit(&CellAt(queue, pos + k)->seq,
+                                        memory_order_acquire);
+      if (seq != pos + k)
+        break;
+    }
+    if (k > 0) {
+      /* Cells found free stay free until someone moves enqueue_pos. */
+      if (atomic_compare_exchange_weak_explicit(&queue->enqueue_pos, &pos,
+                                                pos + k, memory_order_relaxed,
+                                                memory_order_relaxed))
+        break;
+      continue;
+    }
+    size_t seq =
+        atomic_load_explicit(&CellAt(queue, pos)->seq, memory_order_acquire);
+    if ((intptr_t)(seq - pos) < 0)
+      return 0; /* full */
+    pos = atomic_load_explicit(&queue->enqueue_pos, memory_order_relaxed);
+  }
+
+  for (size_t i = 0; i < k; i++) {
+    struct Cell *cell = CellAt(queue, pos + i);
+    memcpy(cell->data, (const char *)elems + i * queue->elem_size,
+           queue->elem_size);
+    atomic_store_explicit(&cell->seq, pos + i + 1, memory_order_release);
+  }
+  return k;
+}
+
+size_t MpmcQueueTryPopBatch(struct MpmcQueue *queue, void *elems,
+                            size_t max) {
+  size_t pos = atomic_load_explicit(&queue->dequeue_pos, memory_order_relaxed);
+  size_t k;
+  while (true) {
+    for (k = 0; k < max; k++) {
+      size_t seq = atomic_load_explicit(&CellAt(queue, pos + k)->seq,
+                                        memory_order_acquire);
+      if (seq != pos + k + 1)
+        break;
+    }
+    if (k > 0) {
+      if (atomic_compare_exchange_weak_explicit(&queue->dequeue_pos, &pos,
+                                                pos + k, memory_order_relaxed,
+                                                memory_order_relaxed))
+        break;
+      continue;
+    }
+    size_t seq =
+        atomic_load_explicit(&CellAt(queue, pos)->seq, memory_order_acquire);
+    if ((intptr_t)(seq - (pos + 1)) < 0)
+      return 0; /* empty */
+    pos = atomic_load_explicit(&queue->dequeue_pos, memory_order_relaxed);
+  }
+
+  for (size_t i = 0; i < k; i++) {
+    struct Cell *cell = CellAt(queue, pos + i);
+    memcpy((char *)elems + i * queue->elem_size, cell->data, queue->elem_size);
+    atomic_store_explicit(&cell->seq, pos + i + queue->mask + 1,
+                          memory_order_release);
+  }
+  return k;
+}
+
+bool MpmcQueueTryPush(struct MpmcQueue *queue, const void *elem) {
+  return MpmcQueueTryPushBatch(queue, elem, 1) == 1;
+}
+
+bool MpmcQueueTryPop(struct MpmcQueue *queue, void *elem) {
+  return MpmcQueueTryPopBatch(queue, elem, 1) == 1;
+}
+
+/* The fence pairs with the one in Sleep: either the sleeper's retry
+   sees the change or this sees the flag. Everyone asleep is woken, the
+   ones that find nothing set the flag again. */
+static void Signal(struct MpmcEvent *event) {
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(&event->sleeping, memory_order_relaxed) == 0 ||
+      atomic_exchange(&event->sleeping, 0) == 0)
+    return;
+  atomic_fetch_add(&event->seq, 1);
+  FutexWake(&event->seq, INT_MAX);
+}
+
+typedef size_t (*TryBatch)(struct MpmcQueue *, void *, size_t);
+
+/* Runs try until it moves something, sleeping on event in between. */
+static size_t Sleep(struct MpmcQueue *queue, struct MpmcEvent *event,
+                    TryBatch try, void *elems, size_t n) {
+  for (int spins = 0; spins < SPINS; spins++) {
+    size_t done = try(queue, elems, n);
+    if (done > 0)
+      return done;
+    CpuRelax();
+  }
+  while (true) {
+    uint32_t seq = atomic_load(&event->seq);
+    atomic_store(&event->sleeping, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+    size_t done = try(queue, elems, n);
+    if (done > 0)
+      return done;
+    FutexWait(&event->seq, seq);
+  }
+}
+
+static size_t TryPush(struct MpmcQueue *queue, void *elems, size_t n) {
+  return MpmcQueueTryPushBatch(queue, elems, n);
+}
+
+void MpmcQueuePushBatch(struct MpmcQueue *queue, const void *elems, size_t n) {
+  const char *next = elems;
+  while (n > 0) {
+    size_t done = MpmcQueueTryPushBatch(queue, next, n);
+    if (done == 0)
+      done = Sleep(queue, &queue->not_full, TryPush, (void *)next, n);
+    Signal(&queue->not_empty);
+    next += done * queue->elem_size;
+    n -= done;
+  }
+}
+
+size_t MpmcQueuePopBatch(struct MpmcQueue *queue, void *elems, size_t max) {
+  size_t done = MpmcQueueTryPopBatch(queue, elems, max);
+  if (done == 0)
+    done = Sleep(queue, &queue->not_empty, MpmcQueueTryPopBatch, elems, max);
+  Signal(&queue->not_full);
+  return done;
+}
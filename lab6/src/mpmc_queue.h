@@ -0,0 +1,54 @@
+#ifndef MPMC_QUEUE_H
+#define MPMC_QUEUE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Bounded multi-producer multi-consumer queue of fixed-size elements,
+   Vyukov's ring: every cell carries a sequence number that says whose
+   turn it is, so producers and consumers only contend on their own
+   position counter and never take a lock. Batches claim a run of cells
+   with one CAS. The blocking calls sleep on a futex when the queue is
+   empty (Pop) or full (Push), the Try calls never block. */
+
+/* An eventcount: a waker only makes the futex call when a sleeper has
+   raised the flag since the last wakeup, not on every push or pop. */
+struct MpmcEvent {
+  _Atomic uint32_t seq;      /* bumped to wake sleepers */
+  _Atomic uint32_t sleeping; /* set by threads about to sleep */
+};
+
+struct MpmcQueue {
+  char *cells;
+  size_t mask; /* capacity - 1 */
+  size_t elem_size;
+  size_t cell_size;
+  _Alignas(64) _Atomic size_t enqueue_pos;
+  _Alignas(64) _Atomic size_t dequeue_pos;
+  _Alignas(64) struct MpmcEvent not_empty;
+  _Alignas(64) struct MpmcEvent not_full;
+};
+
+/* capacity is rounded up to a power of two. */
+bool MpmcQueueInit(struct MpmcQueue *queue, size_t capacity,
+                   size_t elem_size);
+void MpmcQueueDestroy(struct MpmcQueue *queue);
+
+/* Up to n elements from an array, returns how many went in. */
+size_t MpmcQueueTryPushBatch(struct MpmcQueue *queue, const void *elems,
+                             size_t n);
+/* Up to max elements into an array, returns how many came out. */
+size_t MpmcQueueTryPopBatch(struct MpmcQueue *queue, void *elems, size_t max);
+
+bool MpmcQueueTryPush(struct MpmcQueue *queue, const void *elem);
+bool MpmcQueueTryPop(struct MpmcQueue *queue, void *elem);
+
+/* All n elements, waiting for room as needed. */
+void MpmcQueuePushBatch(struct MpmcQueue *queue, const void *elems, size_t n);
+/* At least one and up to max elements, waiting while the queue is
+   empty. */
+size_t MpmcQueuePopBatch(struct MpmcQueue *queue, void *elems, size_t max);
+
+#endif
@@ -0,0 +1,88 @@
+#include "range_index.h"
+
+#include <limits.h>
+#include <stdlib.h>
+
+static struct RangeNode Merge(struct RangeNode a, struct RangeNode b) {
+  struct RangeNode node;
+  node.min = a.min < b.min ? a.min : b.min;
+  node.max = a.max > b.max ? a.max : b.max;
+  return node;
+}
+
+bool RangeIndexBuild(struct RangeIndex *index, const int *array, uint64_t n) {
+  index->n = n;
+  index->nodes = NULL;
+  index->fenwick = NULL;
+  if (n == 0)
+    return false;
+  index->nodes = malloc(2 * n * sizeof(struct RangeNode));
+  index->fenwick = calloc(n + 1, sizeof(int64_t));
+  if (index->nodes == NULL || index->fenwick == NULL) {
+    RangeIndexFree(index);
+    return false;
+  }
+
+  for (uint64_t i = 0; i < n; i++) {
+    index->nodes[n + i].min = array[i];
+    index->nodes[n + i].max = array[i];
+  }
+  for (uint64_t i = n - 1; i >= 1; i--)
+    index->nodes[i] = Merge(index->nodes[2 * i], index->nodes[2 * i + 1]);
+
+  /* Linear build: every node passes its total on to its parent. */
+  for (uint64_t i = 1; i <= n; i++) {
+    index->fenwick[i] += array[i - 1];
+    uint64_t parent = i + (i & -i);
+    if (parent <= n)
+      index->fenwick[parent] += index->fenwick[i];
+  }
+  return true;
+}
+
+void RangeIndexFree(struct RangeIndex *index) {
+  free(index->nodes);
+  free(index->fenwick);
+  index->nodes = NULL;
+  index->fenwick = NULL;
+}
+
+struct RangeNode RangeMinMax(const struct RangeIndex *index, uint64_t l,
+                             uint64_t r) {
+  struct RangeNode result = {INT_MAX, INT_MIN};
+  for (l += index->n, r += index->n + 1; l < r; l /= 2, r /= 2) {
+    if (l & 1)
+      result = Merge(result, index->nodes[l++]);
+    if (r & 1)
+      result = Merge(result, index->nodes[--r]);
+  }
+  return result;
+}
+
+static int64_t PrefixSum(const struct RangeIndex *index, uint64_t end) {
+  int64_t sum = 0;
+  for (; end > 0; end -= end & -end)
+    sum += index->fenwick[end];
+  return sum;
+}
+
+int64_t RangeSum(const struct RangeIndex *index, uint64_t l, uint64_t r) {
+  return PrefixSum(index, r + 1) - PrefixSum(index, l);
+}
+
+int RangeIndexGet(const struct RangeIndex *index, uint64_t i) {
+  return index->nodes[index->n + i].min;
+}
+
+void RangeIndexUpdate(struct RangeIndex *index, uint64_t i, int value) {
+  int64_t delta = (int64_t)value - RangeIndexGet(index, i);
+  for (uint64_t j = i + 1; j <= index->n; j += j & -j)
+    index->fenwick[j] += delta;
+
+  uint64_t node = index->n + i;
+  index->nodes[node].min = value;
+  index->nodes[node].max = value;
+  for (node /= 2; node >= 1; node /= 2)
+    index->nodes[node] =
+        Merge(index->nodes[2 * node], index->nodes[2 * node + 1]);
+}
@@ -0,0 +1,46 @@
+#ifndef RANGE_INDEX_H
+#define RANGE_INDEX_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Range min, max and sum over an int array with point updates. A
+   bottom-up segment tree of 2n nodes keeps min and max, a Fenwick tree
+   the sums; queries and updates are O(log n). */
+struct RangeNode {
+  int min;
+  int max;
+};
+
+struct RangeIndex {
+  uint64_t n;
+  struct RangeNode *nodes; /* node i has children 2i and 2i + 1,
+                              element i is node n + i */
+  int64_t *fenwick;        /* 1-based */
+};
+
+bool RangeIndexBuild(struct RangeIndex *index, const int *array, uint64_t n);
+void RangeIndexFree(struct RangeIndex *index);
+
+/* Queries over [l, r], l <= r < n. */
+struct RangeNode RangeMinMax(const struct RangeIndex *index, uint64_t l,
+                             uint64_t r);
+int64_t RangeSum(const struct RangeIndex *index, uint64_t l, uint64_t r);
+
+int RangeIndexGet(const struct RangeIndex *index, uint64_t i);
+void RangeIndexUpdate(struct RangeIndex *index, uint64_t i, int value);
+
+/* Wire format of the array server: a request is three uint64 (op, a, b),
+   the answer one int64. For UPDATE a is the index and b the new value,
+   the answer is the old value. */
+enum ArrayOp {
+  ARRAY_OP_MIN = 1,
+  ARRAY_OP_MAX = 2,
+  ARRAY_OP_SUM = 3,
+  ARRAY_OP_UPDATE = 4,
+};
+
+#define ARRAY_REQUEST_SIZE (sizeof(uint64_t) * 3)
+#define ARRAY_RESPONSE_SIZE sizeof(int64_t)
+
+#endif
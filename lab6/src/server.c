@@ -12,7 +12,14 @@
 #include <sys/types.h>
 
 #include "pthread.h"
+#include "bignum.h"
+#include "checkpoint.h"
 #include "common.h"
+#include "factorial_engine.h"
+#include "log.h"
+#include "mem_report.h"
+#include "mpmc_queue.h"
+#include "shm_transport.h"
 
 struct FactorialArgs {
   uint64_t begin;
@@ -20,30 +27,354 @@ struct FactorialArgs {
   uint64_t mod;
 };
 
+/* Progress of ranges longer than checkpoint_interval is recorded
+   every checkpoint_interval multiplications. */
+int checkpoint_fd = -1;
+uint64_t checkpoint_interval = 0;
+/* --mem-report: footprint at startup and whenever a session ends. */
+bool mem_report = false;
+
 uint64_t Factorial(const struct FactorialArgs *args) {
   uint64_t ans = 1;
+  uint64_t i = args->begin;
+  bool checkpointing = checkpoint_fd >= 0 &&
+                       args->end - args->begin + 1 > checkpoint_interval;
+
+  if (checkpointing) {
+    struct CheckpointRecord record;
+    if (CheckpointFind(checkpoint_fd, args->begin, args->end, args->mod,
+                       &record)) {
+      LOG_INFO("Resume %lu-%lu mod %lu from %lu\n", args->begin, args->end,
+               args->mod, record.current);
+      if (record.current == args->end)
+        return record.partial;
+      ans = record.partial;
+      i = record.current + 1;
+    }
+  }
+
+  if (!checkpointing) {
+    for (; i <= args->end; i++) {
+      ans = MultModulo(ans, i, args->mod);
+    }
+    return ans;
+  }
 
-  for (uint64_t i = args->begin; i <= args->end; i++) {
+  uint64_t countdown = checkpoint_interval;
+  for (; i <= args->end; i++) {
     ans = MultModulo(ans, i, args->mod);
+    if (--countdown == 0 || i == args->end) {
+      struct CheckpointRecord record = {args->begin, args->end, i, ans,
+                                        args->mod};
+      if (!CheckpointAppend(checkpoint_fd, &record))
+        fprintf(stderr, "Could not write checkpoint\n");
+      countdown = checkpoint_interval;
+    }
   }
 
   return ans;
 }
 
-void *ThreadFactorial(void *args) {
-  struct FactorialArgs *fargs = (struct FactorialArgs *)args;
-  return (void *)(uint64_t)Factorial(fargs);
+/* Requests are cut into tasks and queued to a fixed set of compute
+   threads. A thread takes up to `lanes` tasks at once, possibly from
+   different requests, and runs them through the multi-lane engine. */
+struct Request {
+  uint64_t mod;
+  uint64_t result;
+  int remaining;
+  pthread_mutex_t mutex;
+  pthread_cond_t done;
+};
+
+struct Task {
+  struct FactorialArgs args;
+  struct Request *request;
+};
+
+#define POOL_CAPACITY 4096
+
+struct ComputePool {
+  struct MpmcQueue tasks;
+  int tnum;
+  int lanes;
+};
+
+struct ComputePool pool;
+
+void CompleteTask(struct Task *task, uint64_t result) {
+  struct Request *request = task->request;
+  pthread_mutex_lock(&request->mutex);
+  request->result = MultModulo(request->result, result, request->mod);
+  if (--request->remaining == 0)
+    pthread_cond_signal(&request->done);
+  pthread_mutex_unlock(&request->mutex);
+}
+
+void *ComputeWorker(void *args) {
+  struct Task batch[FACTORIAL_MAX_LANES];
+  struct FactorialJob jobs[FACTORIAL_MAX_LANES];
+
+  while (true) {
+    size_t taken = MpmcQueuePopBatch(&pool.tasks, batch, pool.lanes);
+
+    /* Checkpointed ranges keep the scalar path that records progress. */
+    if (checkpoint_fd >= 0) {
+      for (size_t i = 0; i < taken; i++)
+        CompleteTask(&batch[i], Factorial(&batch[i].args));
+      continue;
+    }
+
+    for (size_t i = 0; i < taken; i++) {
+      jobs[i].begin = batch[i].args.begin;
+      jobs[i].end = batch[i].args.end;
+      jobs[i].mod = batch[i].args.mod;
+    }
+    FactorialEngineRun(jobs, taken, pool.lanes);
+    for (size_t i = 0; i < taken; i++)
+      CompleteTask(&batch[i], jobs[i].result);
+  }
+  return NULL;
+}
+
+bool StartComputePool(int tnum, int lanes) {
+  pool.tnum = tnum;
+  pool.lanes = lanes;
+  if (!MpmcQueueInit(&pool.tasks, POOL_CAPACITY, sizeof(struct Task))) {
+    fprintf(stderr, "Not enough memory for the task queue\n");
+    return false;
+  }
+  for (int i = 0; i < tnum; i++) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, ComputeWorker, NULL)) {
+      fprintf(stderr, "Error: pthread_create failed!\n");
+      return false;
+    }
+    pthread_detach(thread);
+  }
+  return true;
+}
+
+uint64_t ComputeFactorial(uint64_t begin, uint64_t end, uint64_t mod) {
+  struct Request request;
+  request.mod = mod;
+  request.result = 1;
+  pthread_mutex_init(&request.mutex, NULL);
+  pthread_cond_init(&request.done, NULL);
+
+  /* Enough tasks to fill every lane of every compute thread. */
+  uint64_t range = end - begin + 1;
+  uint64_t parts = (uint64_t)pool.tnum * pool.lanes;
+  if (parts > range)
+    parts = range;
+  uint64_t chunk_size = range / parts;
+  uint64_t remainder = range % parts;
+  uint64_t current_begin = begin;
+  request.remaining = parts;
+
+  /* Pushed a lane group at a time, one claim on the queue per group. */
+  struct Task tasks[FACTORIAL_MAX_LANES];
+  size_t pending = 0;
+  for (uint64_t i = 0; i < parts; i++) {
+    uint64_t chunk = chunk_size;
+    if (i < remainder) {
+      chunk++;
+    }
+
+    struct Task *task = &tasks[pending++];
+    task->args.begin = current_begin;
+    task->args.end = current_begin + chunk - 1;
+    task->args.mod = mod;
+    task->request = &request;
+    current_begin += chunk;
+
+    if (pending == FACTORIAL_MAX_LANES || i == parts - 1) {
+      MpmcQueuePushBatch(&pool.tasks, tasks, pending);
+      pending = 0;
+    }
+  }
+
+  pthread_mutex_lock(&request.mutex);
+  while (request.remaining > 0)
+    pthread_cond_wait(&request.done, &request.mutex);
+  pthread_mutex_unlock(&request.mutex);
+
+  pthread_mutex_destroy(&request.mutex);
+  pthread_cond_destroy(&request.done);
+  return request.result;
+}
+
+struct ShmSessionArgs {
+  int sock;
+  int busy_poll;
+};
+
+void *ShmSession(void *args) {
+  struct ShmSessionArgs *session = (struct ShmSessionArgs *)args;
+
+  int memfd = ShmRecvFd(session->sock);
+  struct ShmChannel *channel = memfd < 0 ? NULL : ShmChannelMap(memfd);
+  if (memfd >= 0)
+    close(memfd);
+  if (channel == NULL) {
+    fprintf(stderr, "Could not map shared memory channel\n");
+    close(session->sock);
+    free(session);
+    return NULL;
+  }
+
+  struct ShmSlot slot;
+  while (ShmRingPop(channel, &channel->requests, &slot, session->busy_poll,
+                    session->sock)) {
+    LOG_INFO("Receive (shm): %lu %lu %lu\n", slot.begin, slot.end, slot.mod);
+    if (slot.begin > slot.end || slot.mod == 0) {
+      fprintf(stderr, "Invalid parameters: begin=%lu, end=%lu, mod=%lu\n",
+              slot.begin, slot.end, slot.mod);
+      break;
+    }
+
+    slot.result = ComputeFactorial(slot.begin, slot.end, slot.mod);
+    LOG_INFO("Total: %lu\n", slot.result);
+    if (!ShmRingPush(channel, &channel->responses, &slot, session->busy_poll,
+                     session->sock))
+      break;
+  }
+
+  if (mem_report)
+    MemReportPhase("shm session");
+  ShmChannelClose(channel);
+  ShmChannelUnmap(channel);
+  close(session->sock);
+  free(session);
+  return NULL;
+}
+
+struct ShmListenerArgs {
+  int listen_fd;
+  int busy_poll;
+};
+
+void *ShmListener(void *args) {
+  struct ShmListenerArgs *listener = (struct ShmListenerArgs *)args;
+
+  while (true) {
+    int sock = accept(listener->listen_fd, NULL, NULL);
+    if (sock < 0) {
+      fprintf(stderr, "Could not accept shm connection\n");
+      continue;
+    }
+
+    struct ShmSessionArgs *session = malloc(sizeof(*session));
+    if (session == NULL) {
+      fprintf(stderr, "Error: not enough memory for a session\n");
+      close(sock);
+      continue;
+    }
+    session->sock = sock;
+    session->busy_poll = listener->busy_poll;
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, ShmSession, session)) {
+      fprintf(stderr, "Error: pthread_create failed!\n");
+      close(sock);
+      free(session);
+      continue;
+    }
+    pthread_detach(thread);
+  }
+  return NULL;
+}
+
+void *TcpSession(void *args) {
+  int client_fd = (int)(intptr_t)args;
+
+  while (true) {
+    int buffer_size = sizeof(uint64_t) * 3;
+    char from_client[buffer_size];
+    /* Clients may pipeline requests, so a request can arrive in pieces. */
+    int read_bytes = recv(client_fd, from_client, buffer_size, MSG_WAITALL);
+
+    if (read_bytes == 0)
+      break;
+    if (read_bytes < 0) {
+      fprintf(stderr, "Client read failed\n");
+      break;
+    }
+    if (read_bytes < buffer_size) {
+      fprintf(stderr, "Client send wrong data format\n");
+      break;
+    }
+
+    uint64_t begin = 0;
+    uint64_t end = 0;
+    uint64_t mod = 0;
+    memcpy(&begin, from_client, sizeof(uint64_t));
+    memcpy(&end, from_client + sizeof(uint64_t), sizeof(uint64_t));
+    memcpy(&mod, from_client + 2 * sizeof(uint64_t), sizeof(uint64_t));
+
+    LOG_INFO("Receive: %lu %lu %lu\n", begin, end, mod);
+
+    if (begin > end) {
+      fprintf(stderr, "Invalid parameters: begin=%lu, end=%lu, mod=%lu\n", begin, end, mod);
+      break;
+    }
+
+    /* mod == 0 asks for the exact product, sent back as a bignum. */
+    if (mod == 0) {
+      struct BigNum product;
+      BigNumRangeProduct(&product, begin, end, pool.tnum);
+      LOG_INFO("Total: %zu digits\n", BigNumDecimalLength(&product));
+      bool sent = BigNumSend(client_fd, &product);
+      BigNumFree(&product);
+      if (!sent) {
+        fprintf(stderr, "Can't send data to client\n");
+        break;
+      }
+      continue;
+    }
+
+    uint64_t total = ComputeFactorial(begin, end, mod);
+
+    LOG_INFO("Total: %lu\n", total);
+
+    char buffer[sizeof(total)];
+    memcpy(buffer, &total, sizeof(total));
+    if (send(client_fd, buffer, sizeof(total), 0) < 0) {
+      fprintf(stderr, "Can't send data to client\n");
+      break;
+    }
+  }
+
+  shutdown(client_fd, SHUT_RDWR);
+  close(client_fd);
+  if (mem_report)
+    MemReportPhase("tcp session");
+  return NULL;
 }
 
 int main(int argc, char **argv) {
   int tnum = -1;
   int port = -1;
+  int busy_poll = 0;
+  int lanes = 1;
+  const char *checkpoint_file = NULL;
+  checkpoint_interval = 10000000;
+  enum LogLevel level = LOG_LEVEL_INFO;
+  enum LogMode log_mode = LOG_ASYNC;
+  int log_rate = 0;
 
   while (true) {
     int current_optind = optind ? optind : 1;
 
     static struct option options[] = {{"port", required_argument, 0, 0},
                                       {"tnum", required_argument, 0, 0},
+                                      {"busy_poll", required_argument, 0, 0},
+                                      {"checkpoint", required_argument, 0, 0},
+                                      {"checkpoint_interval", required_argument,
+                                       0, 0},
+                                      {"lanes", required_argument, 0, 0},
+                                      {"log", required_argument, 0, 0},
+                                      {"log_rate", required_argument, 0, 0},
+                                      {"mem-report", no_argument, 0, 0},
                                       {0, 0, 0, 0}};
 
     int option_index = 0;
@@ -69,6 +400,46 @@ int main(int argc, char **argv) {
           return 1;
         }
         break;
+      case 2:
+        busy_poll = atoi(optarg);
+        if (busy_poll < 0) {
+          fprintf(stderr, "Busy poll iterations must be non-negative\n");
+          return 1;
+        }
+        break;
+      case 3:
+        checkpoint_file = optarg;
+        break;
+      case 4:
+        if (!ConvertStringToUI64(optarg, &checkpoint_interval) ||
+            checkpoint_interval == 0) {
+          fprintf(stderr, "Checkpoint interval must be positive\n");
+          return 1;
+        }
+        break;
+      case 5:
+        lanes = atoi(optarg);
+        if (!FactorialLanesValid(lanes)) {
+          fprintf(stderr, "Lanes must be 1, 2, 4, 8 or 16\n");
+          return 1;
+        }
+        break;
+      case 6:
+        if (!LogLevelParse(optarg, &level, &log_mode)) {
+          fprintf(stderr, "Log must be debug, info, warn, error, off or sync\n");
+          return 1;
+        }
+        break;
+      case 7:
+        log_rate = atoi(optarg);
+        if (log_rate < 0) {
+          fprintf(stderr, "Log rate must be non-negative\n");
+          return 1;
+        }
+        break;
+      case 8:
+        mem_report = true;
+        break;
       default:
         printf("Index %d is out of options\n", option_index);
       }
@@ -83,10 +454,32 @@ int main(int argc, char **argv) {
   }
 
   if (port == -1 || tnum == -1) {
-    fprintf(stderr, "Using: %s --port 20001 --tnum 4\n", argv[0]);
+    fprintf(stderr, "Using: %s --port 20001 --tnum 4 [--busy_poll 1000] "
+            "[--checkpoint file] [--checkpoint_interval 10000000] "
+            "[--lanes 1|2|4|8|16] [--log debug|info|warn|error|off|sync] "
+            "[--log_rate 0] [--mem-report]\n",
+            argv[0]);
     return 1;
   }
 
+  if (!LogInit(level, log_mode, log_rate)) {
+    fprintf(stderr, "Could not start the log writer\n");
+    return 1;
+  }
+
+  if (checkpoint_file != NULL) {
+    if (!CheckpointCompact(checkpoint_file)) {
+      fprintf(stderr, "Could not compact checkpoint file %s\n",
+              checkpoint_file);
+      return 1;
+    }
+    checkpoint_fd = CheckpointOpen(checkpoint_file);
+    if (checkpoint_fd < 0) {
+      fprintf(stderr, "Can not open checkpoint file %s\n", checkpoint_file);
+      return 1;
+    }
+  }
+
   int server_fd = socket(AF_INET, SOCK_STREAM, 0);
   if (server_fd < 0) {
     fprintf(stderr, "Can not create server socket!");
@@ -113,7 +506,25 @@ int main(int argc, char **argv) {
     return 1;
   }
 
+  if (!StartComputePool(tnum, lanes))
+    return 1;
+
   printf("Server listening at %d\n", port);
+  if (mem_report)
+    MemReportPhase("startup");
+
+  /* Local clients may skip the TCP stack and talk through shared memory. */
+  struct ShmListenerArgs shm_listener = {ShmListen(port), busy_poll};
+  if (shm_listener.listen_fd < 0) {
+    fprintf(stderr, "Shared memory transport is not available\n");
+  } else {
+    pthread_t shm_thread;
+    if (pthread_create(&shm_thread, NULL, ShmListener, &shm_listener)) {
+      fprintf(stderr, "Error: pthread_create failed!\n");
+      return 1;
+    }
+    pthread_detach(shm_thread);
+  }
 
   while (true) {
     struct sockaddr_in client;
@@ -125,81 +536,14 @@ int main(int argc, char **argv) {
       continue;
     }
 
-    while (true) {
-      unsigned int buffer_size = sizeof(uint64_t) * 3;
-      char from_client[buffer_size];
-      int read_bytes = recv(client_fd, from_client, buffer_size, 0);
-
-      if (read_bytes == 0)
-        break;
-      if (read_bytes < 0) {
-        fprintf(stderr, "Client read failed\n");
-        break;
-      }
-      if (read_bytes < buffer_size) {
-        fprintf(stderr, "Client send wrong data format\n");
-        break;
-      }
-
-      uint64_t begin = 0;
-      uint64_t end = 0;
-      uint64_t mod = 0;
-      memcpy(&begin, from_client, sizeof(uint64_t));
-      memcpy(&end, from_client + sizeof(uint64_t), sizeof(uint64_t));
-      memcpy(&mod, from_client + 2 * sizeof(uint64_t), sizeof(uint64_t));
-
-      fprintf(stdout, "Receive: %lu %lu %lu\n", begin, end, mod);
-
-      if (begin > end || mod == 0) {
-        fprintf(stderr, "Invalid parameters: begin=%lu, end=%lu, mod=%lu\n", begin, end, mod);
-        break;
-      }
-
-      pthread_t threads[tnum];
-      struct FactorialArgs args[tnum];
-      
-      uint64_t range = end - begin + 1;
-      uint64_t chunk_size = range / tnum;
-      uint64_t remainder = range % tnum;
-      uint64_t current_begin = begin;
-
-      for (uint32_t i = 0; i < tnum; i++) {
-        uint64_t chunk = chunk_size;
-        if (i < remainder) {
-          chunk++;
-        }
-
-        args[i].begin = current_begin;
-        args[i].end = current_begin + chunk - 1;
-        args[i].mod = mod;
-        current_begin += chunk;
-
-        if (pthread_create(&threads[i], NULL, ThreadFactorial, (void *)&args[i])) {
-          fprintf(stderr, "Error: pthread_create failed!\n");
-          break;
-        }
-      }
-
-      uint64_t total = 1;
-      for (uint32_t i = 0; i < tnum; i++) {
-        uint64_t result = 0;
-        pthread_join(threads[i], (void **)&result);
-        total = MultModulo(total, result, mod);
-      }
-
-      printf("Total: %lu\n", total);
-
-      char buffer[sizeof(total)];
-      memcpy(buffer, &total, sizeof(total));
-      err = send(client_fd, buffer, sizeof(total), 0);
-      if (err < 0) {
-        fprintf(stderr, "Can't send data to client\n");
-        break;
-      }
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, TcpSession,
+                       (void *)(intptr_t)client_fd)) {
+      fprintf(stderr, "Error: pthread_create failed!\n");
+      close(client_fd);
+      continue;
     }
-
-    shutdown(client_fd, SHUT_RDWR);
-    close(client_fd);
+    pthread_detach(thread);
   }
 
   close(server_fd);
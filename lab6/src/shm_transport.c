@@ -0,0 +1,235 @@
+#define _GNU_SOURCE
+#include "shm_transport.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+
+#define SHM_FUTEX_TIMEOUT_NS 50000000L
+
+static void FutexWait(_Atomic uint32_t *addr, uint32_t expected) {
+  struct timespec timeout = {0, SHM_FUTEX_TIMEOUT_NS};
+  syscall(SYS_futex, (uint32_t *)addr, FUTEX_WAIT, expected, &timeout, NULL, 0);
+}
+
+static void FutexWake(_Atomic uint32_t *addr) {
+  syscall(SYS_futex, (uint32_t *)addr, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+static void CpuRelax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#endif
+}
+
+static bool PeerGone(struct ShmChannel *channel, int peer_fd) {
+  if (atomic_load(&channel->closed))
+    return true;
+  if (peer_fd < 0)
+    return false;
+  struct pollfd pfd = {peer_fd, POLLRDHUP, 0};
+  if (poll(&pfd, 1, 0) > 0 && (pfd.revents & (POLLRDHUP | POLLHUP | POLLERR)))
+    return true;
+  return false;
+}
+
+/* Blocks until *index != seen or the peer goes away. */
+static bool WaitIndex(struct ShmChannel *channel, struct ShmRing *ring,
+                      _Atomic uint32_t *index, uint32_t seen, int spin,
+                      int peer_fd) {
+  for (int i = 0; i < spin; i++) {
+    if (atomic_load_explicit(index, memory_order_acquire) != seen)
+      return true;
+    CpuRelax();
+  }
+  while (atomic_load_explicit(index, memory_order_acquire) == seen) {
+    if (PeerGone(channel, peer_fd))
+      return false;
+    atomic_fetch_add(&ring->waiters, 1);
+    if (atomic_load(index) == seen)
+      FutexWait(index, seen);
+    atomic_fetch_sub(&ring->waiters, 1);
+  }
+  return true;
+}
+
+bool ShmRingPush(struct ShmChannel *channel, struct ShmRing *ring,
+                 const struct ShmSlot *slot, int spin, int peer_fd) {
+  uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  for (;;) {
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head - tail < SHM_RING_SLOTS)
+      break;
+    if (!WaitIndex(channel, ring, &ring->tail, tail, spin, peer_fd))
+      return false;
+  }
+
+  ring->slots[head % SHM_RING_SLOTS] = *slot;
+  atomic_store_explicit(&ring->head, head + 1, memory_order_seq_cst);
+  if (atomic_load(&ring->waiters) > 0)
+    FutexWake(&ring->head);
+  return true;
+}
+
+bool ShmRingPop(struct ShmChannel *channel, struct ShmRing *ring,
+                struct ShmSlot *slot, int spin, int peer_fd) {
+  uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+  if (head == tail) {
+    if (!WaitIndex(channel, ring, &ring->head, tail, spin, peer_fd))
+      return false;
+  }
+
+  *slot = ring->slots[tail % SHM_RING_SLOTS];
+  atomic_store_explicit(&ring->tail, tail + 1, memory_order_seq_cst);
+  if (atomic_load(&ring->waiters) > 0)
+    FutexWake(&ring->tail);
+  return true;
+}
+
+void ShmSocketAddress(int port, char *path, size_t len) {
+  snprintf(path, len, "factorial-server-%d", port);
+}
+
+static socklen_t FillAddress(int port, struct sockaddr_un *addr) {
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  /* Abstract namespace: leading zero byte, nothing left on disk. */
+  ShmSocketAddress(port, addr->sun_path + 1, sizeof(addr->sun_path) - 1);
+  return offsetof(struct sockaddr_un, sun_path) + 1 +
+         strlen(addr->sun_path + 1);
+}
+
+int ShmListen(int port) {
+  struct sockaddr_un addr;
+  socklen_t addr_len = FillAddress(port, &addr);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+  if (bind(fd, (struct sockaddr *)&addr, addr_len) < 0 || listen(fd, 128) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int ShmConnect(int port) {
+  struct sockaddr_un addr;
+  socklen_t addr_len = FillAddress(port, &addr);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+  if (connect(fd, (struct sockaddr *)&addr, addr_len) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+bool ShmSendFd(int sock, int fd) {
+  char data = 0;
+  struct iovec iov = {&data, 1};
+  char control[CMSG_SPACE(sizeof(int))];
+  memset(control, 0, sizeof(control));
+
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+  return sendmsg(sock, &msg, 0) == 1;
+}
+
+int ShmRecvFd(int sock) {
+  char data = 0;
+  struct iovec iov = {&data, 1};
+  char control[CMSG_SPACE(sizeof(int))];
+
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  if (recvmsg(sock, &msg, 0) != 1)
+    return -1;
+
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET ||
+      cmsg->cmsg_type != SCM_RIGHTS)
+    return -1;
+
+  int fd = -1;
+  memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+  return fd;
+}
+
+struct ShmChannel *ShmChannelCreate(int *memfd) {
+  int fd = memfd_create("factorial-channel", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (fd < 0)
+    return NULL;
+  if (ftruncate(fd, sizeof(struct ShmChannel)) < 0 ||
+      fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK) < 0) {
+    close(fd);
+    return NULL;
+  }
+  struct ShmChannel *channel = ShmChannelMap(fd);
+  if (channel == NULL) {
+    close(fd);
+    return NULL;
+  }
+  *memfd = fd;
+  return channel;
+}
+
+struct ShmChannel *ShmChannelMap(int memfd) {
+  /* The fd comes from the peer: a short or shrinkable one would fault
+     with SIGBUS on the first touch past its end. */
+  struct stat st;
+  int seals = fcntl(memfd, F_GET_SEALS);
+  if (fstat(memfd, &st) < 0 || seals < 0)
+    return NULL;
+  if ((size_t)st.st_size < sizeof(struct ShmChannel) ||
+      !(seals & F_SEAL_SHRINK)) {
+    errno = EINVAL;
+    return NULL;
+  }
+  void *addr = mmap(NULL, sizeof(struct ShmChannel), PROT_READ | PROT_WRITE,
+                    MAP_SHARED, memfd, 0);
+  if (addr == MAP_FAILED)
+    return NULL;
+  return (struct ShmChannel *)addr;
+}
+
+void ShmChannelClose(struct ShmChannel *channel) {
+  atomic_store(&channel->closed, 1);
+  FutexWake(&channel->requests.head);
+  FutexWake(&channel->responses.head);
+}
+
+void ShmChannelUnmap(struct ShmChannel *channel) {
+  munmap(channel, sizeof(struct ShmChannel));
+}
@@ -0,0 +1,60 @@
+#ifndef SHM_TRANSPORT_H
+#define SHM_TRANSPORT_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Same-host transport: client and server share a memfd with two
+   single-producer/single-consumer rings (requests and responses).
+   The memfd is passed over an abstract Unix socket, wakeups go
+   through futexes on the ring indices. */
+
+#define SHM_RING_SLOTS 64
+
+struct ShmSlot {
+  uint64_t begin;
+  uint64_t end;
+  uint64_t mod;
+  uint64_t result;
+};
+
+struct ShmRing {
+  _Atomic uint32_t head; /* written by producer */
+  char pad1[64 - sizeof(uint32_t)];
+  _Atomic uint32_t tail; /* written by consumer */
+  char pad2[64 - sizeof(uint32_t)];
+  _Atomic uint32_t waiters;
+  char pad3[64 - sizeof(uint32_t)];
+  struct ShmSlot slots[SHM_RING_SLOTS];
+};
+
+struct ShmChannel {
+  struct ShmRing requests;  /* client -> server */
+  struct ShmRing responses; /* server -> client */
+  _Atomic uint32_t closed;
+};
+
+void ShmSocketAddress(int port, char *path, size_t len);
+int ShmListen(int port);
+int ShmConnect(int port);
+
+bool ShmSendFd(int sock, int fd);
+int ShmRecvFd(int sock);
+
+struct ShmChannel *ShmChannelCreate(int *memfd);
+/* Refuses a memfd shorter than a channel or not sealed against
+   shrinking. */
+struct ShmChannel *ShmChannelMap(int memfd);
+void ShmChannelClose(struct ShmChannel *channel);
+void ShmChannelUnmap(struct ShmChannel *channel);
+
+/* spin is the number of busy-poll iterations before sleeping on a
+   futex, peer_fd is polled for hangup while sleeping. */
+bool ShmRingPush(struct ShmChannel *channel, struct ShmRing *ring,
+                 const struct ShmSlot *slot, int spin, int peer_fd);
+bool ShmRingPop(struct ShmChannel *channel, struct ShmRing *ring,
+                struct ShmSlot *slot, int spin, int peer_fd);
+
+#endif
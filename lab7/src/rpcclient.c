@@ -0,0 +1,273 @@
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "common.h"
+#include "udp_rpc.h"
+
+/* Splits a factorial or an array reduction into chunks, sends them to the
+   RPC server batch by batch and combines the partial results. */
+
+enum Op { OP_FACTORIAL, OP_SUM, OP_MIN, OP_MAX };
+
+/* The i-th of chunks parts of [begin, end). */
+void ChunkRange(uint64_t begin, uint64_t end, uint64_t chunks, uint64_t i,
+                uint64_t *chunk_begin, uint64_t *chunk_end) {
+  uint64_t length = end - begin;
+  *chunk_begin = begin + length / chunks * i + (i < length % chunks ? i : length % chunks);
+  *chunk_end = *chunk_begin + length / chunks + (i < length % chunks ? 1 : 0);
+}
+
+void FillOp(struct RpcOp *op, enum Op type, uint64_t begin, uint64_t end,
+            uint64_t mod, uint64_t seed, uint64_t array_size) {
+  memset(op, 0, sizeof(*op));
+  if (type == OP_FACTORIAL) {
+    op->code = RPC_FACTORIAL;
+    op->args[0] = begin;
+    op->args[1] = end;
+    op->args[2] = mod;
+    return;
+  }
+  op->code = type == OP_SUM ? RPC_SUM : type == OP_MIN ? RPC_MIN : RPC_MAX;
+  op->args[0] = seed;
+  op->args[1] = array_size;
+  op->args[2] = begin;
+  op->args[3] = end;
+}
+
+int64_t Combine(enum Op type, int64_t acc, int64_t value, uint64_t mod) {
+  switch (type) {
+  case OP_FACTORIAL:
+    return (int64_t)MultModulo((uint64_t)acc, (uint64_t)value, mod);
+  case OP_SUM:
+    return acc + value;
+  case OP_MIN:
+    return value < acc ? value : acc;
+  default:
+    return value > acc ? value : acc;
+  }
+}
+
+/* Runs one computation of chunks operations, batch operations per
+   datagram. */
+bool Compute(struct RpcClient *client, enum Op type, uint64_t begin,
+             uint64_t end, uint64_t mod, uint64_t seed, uint64_t array_size,
+             uint64_t chunks, int batch, int64_t *answer, uint64_t *calls) {
+  struct RpcOp ops[RPC_MAX_BATCH];
+  struct RpcResult results[RPC_MAX_BATCH];
+  bool first = true;
+
+  if (chunks > end - begin)
+    chunks = end - begin;
+  for (uint64_t i = 0; i < chunks; i += batch) {
+    size_t count = chunks - i < (uint64_t)batch ? chunks - i : (uint64_t)batch;
+    for (size_t j = 0; j < count; j++) {
+      uint64_t chunk_begin, chunk_end;
+      ChunkRange(begin, end, chunks, i + j, &chunk_begin, &chunk_end);
+      /* Factorial ranges are inclusive. */
+      if (type == OP_FACTORIAL)
+        chunk_end--;
+      FillOp(&ops[j], type, chunk_begin, chunk_end, mod, seed, array_size);
+    }
+
+    if (!RpcCall(client, ops, count, results))
+      return false;
+    (*calls)++;
+
+    for (size_t j = 0; j < count; j++) {
+      if (results[j].status != RPC_OK) {
+        fprintf(stderr, "Server rejected operation %lu\n", i + j);
+        return false;
+      }
+      *answer = first ? results[j].value
+                      : Combine(type, *answer, results[j].value, mod);
+      first = false;
+    }
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  char server[255] = "127.0.0.1";
+  int port = 20001;
+  uint64_t k = 0;
+  uint64_t mod = 0;
+  enum Op type = OP_FACTORIAL;
+  uint64_t seed = 0;
+  uint64_t array_size = 0;
+  uint64_t chunks = 8;
+  int batch = 8;
+  int bench = 0;
+  int retries = 5;
+
+  while (true) {
+    static struct option options[] = {{"server", required_argument, 0, 0},
+                                      {"port", required_argument, 0, 0},
+                                      {"k", required_argument, 0, 0},
+                                      {"mod", required_argument, 0, 0},
+                                      {"op", required_argument, 0, 0},
+                                      {"seed", required_argument, 0, 0},
+                                      {"array_size", required_argument, 0, 0},
+                                      {"chunks", required_argument, 0, 0},
+                                      {"batch", required_argument, 0, 0},
+                                      {"bench", required_argument, 0, 0},
+                                      {"retries", required_argument, 0, 0},
+                                      {0, 0, 0, 0}};
+
+    int option_index = 0;
+    int c = getopt_long(argc, argv, "", options, &option_index);
+
+    if (c == -1)
+      break;
+
+    switch (c) {
+    case 0:
+      switch (option_index) {
+      case 0:
+        strncpy(server, optarg, sizeof(server) - 1);
+        break;
+      case 1:
+        port = atoi(optarg);
+        if (port <= 0) {
+          fprintf(stderr, "Port must be positive number\n");
+          return 1;
+        }
+        break;
+      case 2:
+        if (!ConvertStringToUI64(optarg, &k)) {
+          fprintf(stderr, "Arguments error: k must be a number\n");
+          return 1;
+        }
+        break;
+      case 3:
+        if (!ConvertStringToUI64(optarg, &mod) || mod == 0) {
+          fprintf(stderr, "Arguments error: mod must be positive\n");
+          return 1;
+        }
+        break;
+      case 4:
+        if (strcmp(optarg, "factorial") == 0)
+          type = OP_FACTORIAL;
+        else if (strcmp(optarg, "sum") == 0)
+          type = OP_SUM;
+        else if (strcmp(optarg, "min") == 0)
+          type = OP_MIN;
+        else if (strcmp(optarg, "max") == 0)
+          type = OP_MAX;
+        else {
+          fprintf(stderr, "Op must be factorial, sum, min or max\n");
+          return 1;
+        }
+        break;
+      case 5:
+        if (!ConvertStringToUI64(optarg, &seed)) {
+          fprintf(stderr, "Arguments error: seed must be a number\n");
+          return 1;
+        }
+        break;
+      case 6:
+        if (!ConvertStringToUI64(optarg, &array_size) || array_size == 0) {
+          fprintf(stderr, "Arguments error: array_size must be positive\n");
+          return 1;
+        }
+        break;
+      case 7:
+        if (!ConvertStringToUI64(optarg, &chunks) || chunks == 0) {
+          fprintf(stderr, "Arguments error: chunks must be positive\n");
+          return 1;
+        }
+        break;
+      case 8:
+        batch = atoi(optarg);
+        if (batch <= 0 || batch > RPC_MAX_BATCH) {
+          fprintf(stderr, "Batch must be in [1, %d]\n", RPC_MAX_BATCH);
+          return 1;
+        }
+        break;
+      case 9:
+        bench = atoi(optarg);
+        if (bench <= 0) {
+          fprintf(stderr, "Bench must be positive\n");
+          return 1;
+        }
+        break;
+      case 10:
+        retries = atoi(optarg);
+        if (retries < 0) {
+          fprintf(stderr, "Retries must be non-negative\n");
+          return 1;
+        }
+        break;
+      default:
+        printf("Index %d is out of options\n", option_index);
+      }
+      break;
+    case '?':
+      printf("Unknown argument\n");
+      break;
+    default:
+      fprintf(stderr, "getopt returned character code 0%o?\n", c);
+    }
+  }
+
+  uint64_t begin, end;
+  if (type == OP_FACTORIAL) {
+    if (k == 0 || mod == 0) {
+      fprintf(stderr, "Using: %s --k 1000 --mod 5 [--server ip --port 20001]\n",
+              argv[0]);
+      return 1;
+    }
+    begin = 1;
+    end = k + 1;
+  } else {
+    if (array_size == 0) {
+      fprintf(stderr, "Using: %s --op sum --seed 1 --array_size 1000000\n",
+              argv[0]);
+      return 1;
+    }
+    begin = 0;
+    end = array_size;
+  }
+
+  struct RpcClient client;
+  if (!RpcClientInit(&client, server, port, retries)) {
+    fprintf(stderr, "Can't reach %s:%d\n", server, port);
+    return 1;
+  }
+
+  int rounds = bench > 0 ? bench : 1;
+  uint64_t calls = 0;
+  int64_t answer = 0;
+  struct timeval start_time;
+  gettimeofday(&start_time, NULL);
+
+  for (int i = 0; i < rounds; i++) {
+    if (!Compute(&client, type, begin, end, mod, seed, array_size, chunks,
+                 batch, &answer, &calls)) {
+      fprintf(stderr, "No reply from %s:%d after %d retries\n", server, port,
+              retries);
+      RpcClientClose(&client);
+      return 1;
+    }
+  }
+
+  struct timeval finish_time;
+  gettimeofday(&finish_time, NULL);
+  double elapsed_time = (finish_time.tv_sec - start_time.tv_sec) * 1000.0;
+  elapsed_time += (finish_time.tv_usec - start_time.tv_usec) / 1000.0;
+
+  printf("answer: %ld\n", answer);
+  printf("Round trips: %lu, retransmits: %lu, rto: %.0fus\n", calls,
+         client.retransmits, client.rto);
+  if (bench > 0)
+    printf("Bench: %d computations, %.1fus per round trip\n", bench,
+           elapsed_time * 1000.0 / calls);
+  printf("Elapsed time: %fms\n", elapsed_time);
+
+  RpcClientClose(&client);
+  return 0;
+}
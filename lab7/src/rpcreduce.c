@@ -0,0 +1,227 @@
+#include <getopt.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "find_min_max.h"
+#include "preduce.h"
+#include "sum_lib.h"
+#include "udp_rpc.h"
+#include "utils.h"
+
+/* Reduces a generated array with the remote libpreduce backend, every
+   chunk computed by rpcserver, and checks the answer against the serial
+   backend run locally on the same array. */
+
+enum Op { OP_SUM, OP_MIN_MAX };
+
+/* The server is one loop over one socket, so the pool threads take
+   turns on a single client instead of opening one each. */
+struct RemoteReduce {
+  struct RpcClient client;
+  pthread_mutex_t lock;
+  enum Op type;
+  uint64_t seed;
+  uint64_t array_size;
+};
+
+bool RunRemote(void *remote, uint64_t begin, uint64_t end, void *acc) {
+  struct RemoteReduce *reduce = remote;
+  struct RpcOp ops[2];
+  struct RpcResult results[2];
+  size_t count = reduce->type == OP_SUM ? 1 : 2;
+
+  for (size_t i = 0; i < count; i++) {
+    memset(&ops[i], 0, sizeof(ops[i]));
+    ops[i].code = reduce->type == OP_SUM ? RPC_SUM : i == 0 ? RPC_MIN : RPC_MAX;
+    ops[i].args[0] = reduce->seed;
+    ops[i].args[1] = reduce->array_size;
+    ops[i].args[2] = begin;
+    ops[i].args[3] = end;
+  }
+
+  pthread_mutex_lock(&reduce->lock);
+  bool ok = RpcCall(&reduce->client, ops, count, results);
+  pthread_mutex_unlock(&reduce->lock);
+  if (!ok)
+    return false;
+  for (size_t i = 0; i < count; i++)
+    if (results[i].status != RPC_OK)
+      return false;
+
+  if (reduce->type == OP_SUM) {
+    *(int64_t *)acc = results[0].value;
+  } else {
+    struct MinMax *min_max = acc;
+    min_max->min = (int)results[0].value;
+    min_max->max = (int)results[1].value;
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  char server[255] = "127.0.0.1";
+  int port = 20001;
+  enum Op type = OP_SUM;
+  uint64_t seed = 0;
+  uint64_t array_size = 0;
+  uint64_t chunks = 0;
+  int workers = 4;
+  int retries = 5;
+
+  while (true) {
+    static struct option options[] = {{"server", required_argument, 0, 0},
+                                      {"port", required_argument, 0, 0},
+                                      {"op", required_argument, 0, 0},
+                                      {"seed", required_argument, 0, 0},
+                                      {"array_size", required_argument, 0, 0},
+                                      {"chunks", required_argument, 0, 0},
+                                      {"workers", required_argument, 0, 0},
+                                      {"retries", required_argument, 0, 0},
+                                      {0, 0, 0, 0}};
+
+    int option_index = 0;
+    int c = getopt_long(argc, argv, "", options, &option_index);
+
+    if (c == -1)
+      break;
+
+    switch (c) {
+    case 0:
+      switch (option_index) {
+      case 0:
+        strncpy(server, optarg, sizeof(server) - 1);
+        break;
+      case 1:
+        port = atoi(optarg);
+        if (port <= 0) {
+          fprintf(stderr, "Port must be positive number\n");
+          return 1;
+        }
+        break;
+      case 2:
+        if (strcmp(optarg, "sum") == 0)
+          type = OP_SUM;
+        else if (strcmp(optarg, "minmax") == 0)
+          type = OP_MIN_MAX;
+        else {
+          fprintf(stderr, "Op must be sum or minmax\n");
+          return 1;
+        }
+        break;
+      case 3:
+        if (!ConvertStringToUI64(optarg, &seed)) {
+          fprintf(stderr, "Arguments error: seed must be a number\n");
+          return 1;
+        }
+        break;
+      case 4:
+        if (!ConvertStringToUI64(optarg, &array_size) || array_size == 0 ||
+            array_size > INT_MAX) {
+          fprintf(stderr, "Arguments error: array_size must be in [1, %d]\n",
+                  INT_MAX);
+          return 1;
+        }
+        break;
+      case 5:
+        if (!ConvertStringToUI64(optarg, &chunks) || chunks == 0) {
+          fprintf(stderr, "Arguments error: chunks must be positive\n");
+          return 1;
+        }
+        break;
+      case 6:
+        workers = atoi(optarg);
+        if (workers <= 0) {
+          fprintf(stderr, "Workers must be positive\n");
+          return 1;
+        }
+        break;
+      case 7:
+        retries = atoi(optarg);
+        if (retries < 0) {
+          fprintf(stderr, "Retries must be non-negative\n");
+          return 1;
+        }
+        break;
+      default:
+        printf("Index %d is out of options\n", option_index);
+      }
+      break;
+    case '?':
+      printf("Unknown argument\n");
+      break;
+    default:
+      fprintf(stderr, "getopt returned character code 0%o?\n", c);
+    }
+  }
+
+  if (array_size == 0) {
+    fprintf(stderr,
+            "Using: %s --op sum|minmax --seed 1 --array_size 1000000 "
+            "[--chunks 16] [--workers 4] [--server ip --port 20001]\n",
+            argv[0]);
+    return 1;
+  }
+
+  int *array = malloc(array_size * sizeof(int));
+  if (array == NULL) {
+    fprintf(stderr, "Not enough memory for the array\n");
+    return 1;
+  }
+  GenerateArray(array, array_size, seed);
+
+  struct RemoteReduce reduce;
+  if (!RpcClientInit(&reduce.client, server, port, retries)) {
+    fprintf(stderr, "Can't reach %s:%d\n", server, port);
+    free(array);
+    return 1;
+  }
+  pthread_mutex_init(&reduce.lock, NULL);
+  reduce.type = type;
+  reduce.seed = seed;
+  reduce.array_size = array_size;
+
+  struct PreduceRemote remote = {RunRemote, &reduce};
+  struct PreduceConfig config = {.backend = PREDUCE_REMOTE,
+                                 .workers = workers,
+                                 .chunks = chunks,
+                                 .remote = &remote};
+  struct PreduceConfig serial = {.backend = PREDUCE_SERIAL};
+  bool ok, same;
+
+  if (type == OP_SUM) {
+    struct SumArgs args = {array, 0, (int)array_size};
+    int64_t expected, sum;
+    ParallelSum(&args, &serial, &expected);
+    ok = ParallelSum(&args, &config, &sum);
+    same = ok && sum == expected;
+    if (ok)
+      printf("Sum: remote %" PRId64 ", serial %" PRId64 "\n", sum, expected);
+  } else {
+    struct MinMax expected, min_max;
+    ParallelMinMax(array, 0, array_size, &serial, &expected);
+    ok = ParallelMinMax(array, 0, array_size, &config, &min_max);
+    same = ok && min_max.min == expected.min && min_max.max == expected.max;
+    if (ok)
+      printf("Min: remote %d, serial %d\nMax: remote %d, serial %d\n",
+             min_max.min, expected.min, min_max.max, expected.max);
+  }
+
+  if (!ok)
+    fprintf(stderr, "No reply from %s:%d after %d retries\n", server, port,
+            retries);
+  else
+    printf("Retransmits: %" PRIu64 "\n%s\n", reduce.client.retransmits,
+           same ? "Remote matches serial" : "Remote differs from serial");
+
+  RpcClientClose(&reduce.client);
+  pthread_mutex_destroy(&reduce.lock);
+  free(array);
+  return same ? 0 : 1;
+}
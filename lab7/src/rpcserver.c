@@ -0,0 +1,179 @@
+#include <arpa/inet.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "factorial_engine.h"
+#include "find_min_max.h"
+#include "udp_rpc.h"
+#include "utils.h"
+
+/* Factorial chunks and array reductions served over UDP RPC. */
+
+int lanes = 8;
+
+/* The array of the last reduction request, regenerated on change. */
+int *array = NULL;
+uint64_t array_seed = 0;
+uint64_t array_size = 0;
+
+bool PrepareArray(uint64_t seed, uint64_t size) {
+  if (array != NULL && seed == array_seed && size == array_size)
+    return true;
+  if (size == 0 || size > UINT32_MAX)
+    return false;
+  free(array);
+  array = malloc(size * sizeof(int));
+  if (array == NULL)
+    return false;
+  GenerateArray(array, size, seed);
+  array_seed = seed;
+  array_size = size;
+  return true;
+}
+
+void Reduce(const struct RpcOp *op, struct RpcResult *result) {
+  uint64_t begin = op->args[2], end = op->args[3];
+  if (!PrepareArray(op->args[0], op->args[1]) || begin >= end ||
+      end > array_size) {
+    result->status = RPC_BAD_REQUEST;
+    return;
+  }
+
+  if (op->code == RPC_SUM) {
+    int64_t sum = 0;
+    for (uint64_t i = begin; i < end; i++)
+      sum += array[i];
+    result->value = sum;
+  } else {
+    struct MinMax min_max = GetMinMax(array, begin, end);
+    result->value = op->code == RPC_MIN ? min_max.min : min_max.max;
+  }
+  result->status = RPC_OK;
+}
+
+/* Factorial operations of one datagram go to the multi-lane engine
+   together. */
+void Handle(const struct RpcOp *ops, size_t count, struct RpcResult *results) {
+  struct FactorialJob jobs[RPC_MAX_BATCH];
+  size_t job_index[RPC_MAX_BATCH];
+  size_t jobs_num = 0;
+
+  for (size_t i = 0; i < count; i++) {
+    results[i].status = RPC_OK;
+    results[i].pad = 0;
+    results[i].value = 0;
+    switch (ops[i].code) {
+    case RPC_FACTORIAL:
+      if (ops[i].args[2] == 0 || ops[i].args[0] > ops[i].args[1]) {
+        results[i].status = RPC_BAD_REQUEST;
+        break;
+      }
+      jobs[jobs_num].begin = ops[i].args[0];
+      jobs[jobs_num].end = ops[i].args[1];
+      jobs[jobs_num].mod = ops[i].args[2];
+      job_index[jobs_num++] = i;
+      break;
+    case RPC_SUM:
+    case RPC_MIN:
+    case RPC_MAX:
+      Reduce(&ops[i], &results[i]);
+      break;
+    default:
+      results[i].status = RPC_BAD_REQUEST;
+    }
+  }
+
+  FactorialEngineRun(jobs, jobs_num, lanes);
+  for (size_t j = 0; j < jobs_num; j++)
+    results[job_index[j]].value = (int64_t)jobs[j].result;
+}
+
+int main(int argc, char **argv) {
+  int port = 20001;
+  int cache_size = 1024;
+  double drop_rate = 0;
+
+  while (true) {
+    static struct option options[] = {{"port", required_argument, 0, 0},
+                                      {"cache", required_argument, 0, 0},
+                                      {"drop", required_argument, 0, 0},
+                                      {"lanes", required_argument, 0, 0},
+                                      {0, 0, 0, 0}};
+
+    int option_index = 0;
+    int c = getopt_long(argc, argv, "", options, &option_index);
+
+    if (c == -1)
+      break;
+
+    switch (c) {
+    case 0:
+      switch (option_index) {
+      case 0:
+        port = atoi(optarg);
+        if (port <= 0) {
+          fprintf(stderr, "Port must be positive number\n");
+          return 1;
+        }
+        break;
+      case 1:
+        cache_size = atoi(optarg);
+        if (cache_size <= 0) {
+          fprintf(stderr, "Cache size must be positive\n");
+          return 1;
+        }
+        break;
+      case 2:
+        drop_rate = atof(optarg);
+        if (drop_rate < 0 || drop_rate >= 1) {
+          fprintf(stderr, "Drop rate must be in [0, 1)\n");
+          return 1;
+        }
+        break;
+      case 3:
+        lanes = atoi(optarg);
+        if (!FactorialLanesValid(lanes)) {
+          fprintf(stderr, "Lanes must be 1, 2, 4, 8 or 16\n");
+          return 1;
+        }
+        break;
+      default:
+        printf("Index %d is out of options\n", option_index);
+      }
+      break;
+    case '?':
+      printf("Unknown argument\n");
+      break;
+    default:
+      fprintf(stderr, "getopt returned character code 0%o?\n", c);
+    }
+  }
+
+  int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (sockfd < 0) {
+    perror("socket problem");
+    return 1;
+  }
+
+  struct sockaddr_in servaddr;
+  memset(&servaddr, 0, sizeof(servaddr));
+  servaddr.sin_family = AF_INET;
+  servaddr.sin_addr.s_addr = htonl(INADDR_ANY);
+  servaddr.sin_port = htons(port);
+
+  if (bind(sockfd, (struct sockaddr *)&servaddr, sizeof(servaddr)) < 0) {
+    perror("bind problem");
+    return 1;
+  }
+  printf("RPC server listening at %d\n", port);
+  fflush(stdout);
+
+  RpcServe(sockfd, Handle, cache_size, drop_rate);
+  return 0;
+}
@@ -0,0 +1,201 @@
+#include "udp_rpc.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RPC_INITIAL_RTO_US 100000.0
+#define RPC_MIN_RTO_US 1000.0
+#define RPC_MAX_RTO_US 2000000.0
+
+static uint64_t NowUs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static double ClampRto(double rto) {
+  if (rto < RPC_MIN_RTO_US)
+    return RPC_MIN_RTO_US;
+  if (rto > RPC_MAX_RTO_US)
+    return RPC_MAX_RTO_US;
+  return rto;
+}
+
+bool RpcClientInit(struct RpcClient *client, const char *ip, int port,
+                   int max_retries) {
+  memset(client, 0, sizeof(*client));
+  client->server.sin_family = AF_INET;
+  client->server.sin_port = htons(port);
+  if (inet_pton(AF_INET, ip, &client->server.sin_addr) != 1)
+    return false;
+
+  client->fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (client->fd < 0)
+    return false;
+  /* A connected socket only sees datagrams from the server. */
+  if (connect(client->fd, (struct sockaddr *)&client->server,
+              sizeof(client->server)) < 0) {
+    close(client->fd);
+    return false;
+  }
+
+  /* Ids must not repeat across client restarts, the server caches
+     replies by (address, id). */
+  client->next_id = ((uint64_t)time(NULL) << 32) ^ ((uint64_t)getpid() << 16);
+  client->rto = RPC_INITIAL_RTO_US;
+  client->max_retries = max_retries;
+  return true;
+}
+
+void RpcClientClose(struct RpcClient *client) { close(client->fd); }
+
+static void UpdateRto(struct RpcClient *client, double rtt) {
+  if (client->srtt == 0) {
+    client->srtt = rtt;
+    client->rttvar = rtt / 2;
+  } else {
+    double delta = client->srtt > rtt ? client->srtt - rtt : rtt - client->srtt;
+    client->rttvar = 0.75 * client->rttvar + 0.25 * delta;
+    client->srtt = 0.875 * client->srtt + 0.125 * rtt;
+  }
+  client->rto = ClampRto(client->srtt + 4 * client->rttvar);
+}
+
+bool RpcCall(struct RpcClient *client, const struct RpcOp *ops, size_t count,
+             struct RpcResult *results) {
+  if (count == 0 || count > RPC_MAX_BATCH)
+    return false;
+
+  struct RpcRequestPacket request;
+  request.header.magic = RPC_MAGIC;
+  request.header.type = RPC_REQUEST;
+  request.header.count = count;
+  request.header.request_id = client->next_id++;
+  memcpy(request.ops, ops, count * sizeof(struct RpcOp));
+  size_t request_len = sizeof(struct RpcHeader) + count * sizeof(struct RpcOp);
+
+  double rto = client->rto;
+  for (int attempt = 0; attempt <= client->max_retries; attempt++) {
+    uint64_t sent_us = NowUs();
+    if (send(client->fd, &request, request_len, 0) < 0 &&
+        errno != ECONNREFUSED) {
+      perror("send");
+      return false;
+    }
+
+    uint64_t deadline = sent_us + (uint64_t)rto;
+    while (true) {
+      uint64_t now = NowUs();
+      if (now >= deadline)
+        break;
+      struct pollfd pfd = {client->fd, POLLIN, 0};
+      int timeout_ms = (int)((deadline - now + 999) / 1000);
+      if (poll(&pfd, 1, timeout_ms) <= 0)
+        continue;
+
+      struct RpcReplyPacket reply;
+      ssize_t n = recv(client->fd, &reply, sizeof(reply), 0);
+      /* Port unreachable from a restarting server counts as a loss. */
+      if (n < (ssize_t)sizeof(struct RpcHeader))
+        continue;
+      if (reply.header.magic != RPC_MAGIC || reply.header.type != RPC_REPLY ||
+          reply.header.request_id != request.header.request_id ||
+          reply.header.count != count ||
+          n != (ssize_t)(sizeof(struct RpcHeader) +
+                         count * sizeof(struct RpcResult)))
+        continue; /* late reply to an earlier call */
+
+      /* Karn: only unambiguous round trips feed the estimator. */
+      if (attempt == 0)
+        UpdateRto(client, (double)(NowUs() - sent_us));
+      memcpy(results, reply.results, count * sizeof(struct RpcResult));
+      return true;
+    }
+
+    client->retransmits++;
+    rto = ClampRto(rto * 2);
+  }
+  return false;
+}
+
+struct CacheEntry {
+  bool valid;
+  struct sockaddr_in addr;
+  uint64_t request_id;
+  size_t len;
+  struct RpcReplyPacket reply;
+};
+
+static size_t CacheSlot(const struct sockaddr_in *addr, uint64_t id,
+                        size_t cache_size) {
+  uint64_t h = id * 0x9E3779B97F4A7C15ull;
+  h ^= ((uint64_t)addr->sin_addr.s_addr << 16) ^ addr->sin_port;
+  h *= 0xBF58476D1CE4E5B9ull;
+  return (size_t)(h >> 32) % cache_size;
+}
+
+static bool SameClient(const struct sockaddr_in *a, const struct sockaddr_in *b) {
+  return a->sin_addr.s_addr == b->sin_addr.s_addr && a->sin_port == b->sin_port;
+}
+
+static bool Dropped(double drop_rate) {
+  return drop_rate > 0 && (double)rand() / RAND_MAX < drop_rate;
+}
+
+void RpcServe(int fd, RpcHandler handler, size_t cache_size, double drop_rate) {
+  struct CacheEntry *cache = calloc(cache_size, sizeof(struct CacheEntry));
+
+  while (true) {
+    struct RpcRequestPacket request;
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    ssize_t n = recvfrom(fd, &request, sizeof(request), 0,
+                         (struct sockaddr *)&addr, &addr_len);
+    if (n < 0) {
+      perror("recvfrom");
+      continue;
+    }
+    if (n < (ssize_t)sizeof(struct RpcHeader) ||
+        request.header.magic != RPC_MAGIC ||
+        request.header.type != RPC_REQUEST || request.header.count == 0 ||
+        request.header.count > RPC_MAX_BATCH ||
+        n != (ssize_t)(sizeof(struct RpcHeader) +
+                       request.header.count * sizeof(struct RpcOp)))
+      continue;
+    if (Dropped(drop_rate))
+      continue;
+
+    struct CacheEntry *entry =
+        &cache[CacheSlot(&addr, request.header.request_id, cache_size)];
+    if (entry->valid && entry->request_id == request.header.request_id &&
+        SameClient(&entry->addr, &addr)) {
+      char ip[INET_ADDRSTRLEN];
+      printf("Duplicate %lu from %s:%d answered from cache\n",
+             request.header.request_id,
+             inet_ntop(AF_INET, &addr.sin_addr, ip, sizeof(ip)),
+             ntohs(addr.sin_port));
+    } else {
+      entry->valid = true;
+      entry->addr = addr;
+      entry->request_id = request.header.request_id;
+      entry->reply.header = request.header;
+      entry->reply.header.type = RPC_REPLY;
+      handler(request.ops, request.header.count, entry->reply.results);
+      entry->len = sizeof(struct RpcHeader) +
+                   request.header.count * sizeof(struct RpcResult);
+    }
+
+    if (Dropped(drop_rate))
+      continue;
+    if (sendto(fd, &entry->reply, entry->len, 0, (struct sockaddr *)&addr,
+               addr_len) < 0)
+      perror("sendto");
+  }
+}
@@ -0,0 +1,83 @@
+#ifndef UDP_RPC_H
+#define UDP_RPC_H
+
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Request/response over UDP: one datagram carries a batch of operations
+   under one request id and is answered by one datagram. The client
+   retransmits with an adaptive timeout, the server answers duplicates
+   from a reply cache instead of computing them again. */
+
+#define RPC_MAGIC 0x52504331u /* "RPC1" */
+#define RPC_MAX_BATCH 32
+
+enum RpcType { RPC_REQUEST = 1, RPC_REPLY = 2 };
+
+enum RpcOpCode {
+  RPC_FACTORIAL = 1, /* args: begin, end, mod */
+  RPC_SUM = 2,       /* args: seed, array_size, begin, end */
+  RPC_MIN = 3,
+  RPC_MAX = 4,
+};
+
+enum RpcStatus { RPC_OK = 0, RPC_BAD_REQUEST = 1 };
+
+struct RpcHeader {
+  uint32_t magic;
+  uint16_t type;
+  uint16_t count;
+  uint64_t request_id;
+};
+
+struct RpcOp {
+  uint32_t code;
+  uint32_t pad;
+  uint64_t args[4];
+};
+
+struct RpcResult {
+  uint32_t status;
+  uint32_t pad;
+  int64_t value;
+};
+
+struct RpcRequestPacket {
+  struct RpcHeader header;
+  struct RpcOp ops[RPC_MAX_BATCH];
+};
+
+struct RpcReplyPacket {
+  struct RpcHeader header;
+  struct RpcResult results[RPC_MAX_BATCH];
+};
+
+struct RpcClient {
+  int fd;
+  struct sockaddr_in server;
+  uint64_t next_id;
+  /* RFC 6298 estimator, microseconds. */
+  double srtt;
+  double rttvar;
+  double rto;
+  int max_retries;
+  uint64_t retransmits;
+};
+
+bool RpcClientInit(struct RpcClient *client, const char *ip, int port,
+                   int max_retries);
+void RpcClientClose(struct RpcClient *client);
+/* Sends count <= RPC_MAX_BATCH operations and waits for their results. */
+bool RpcCall(struct RpcClient *client, const struct RpcOp *ops, size_t count,
+             struct RpcResult *results);
+
+typedef void (*RpcHandler)(const struct RpcOp *ops, size_t count,
+                           struct RpcResult *results);
+
+/* Serves requests on fd forever, duplicates are answered from a cache
+   of cache_size recent replies. drop_rate simulates datagram loss. */
+void RpcServe(int fd, RpcHandler handler, size_t cache_size, double drop_rate);
+
+#endif
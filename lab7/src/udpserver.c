@@ -1,5 +1,7 @@
 #include <arpa/inet.h>
+#include <getopt.h>
 #include <netinet/in.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -8,16 +10,67 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "log.h"
+
 #define SERV_PORT 20001
 #define BUFSIZE 1024
 #define SADDR struct sockaddr
 #define SLEN sizeof(struct sockaddr_in)
 
-int main() {
+int main(int argc, char **argv) {
   int sockfd, n;
-  char mesg[BUFSIZE], ipadr[16];
+  char mesg[BUFSIZE + 1], ipadr[16];
   struct sockaddr_in servaddr;
   struct sockaddr_in cliaddr;
+  enum LogLevel level = LOG_LEVEL_INFO;
+  enum LogMode log_mode = LOG_ASYNC;
+  int log_rate = 0;
+
+  while (true) {
+    static struct option options[] = {{"log", required_argument, 0, 0},
+                                      {"log_rate", required_argument, 0, 0},
+                                      {0, 0, 0, 0}};
+
+    int option_index = 0;
+    int c = getopt_long(argc, argv, "", options, &option_index);
+
+    if (c == -1)
+      break;
+
+    switch (c) {
+    case 0: {
+      switch (option_index) {
+      case 0:
+        if (!LogLevelParse(optarg, &level, &log_mode)) {
+          fprintf(stderr, "Log must be debug, info, warn, error, off or sync\n");
+          return 1;
+        }
+        break;
+      case 1:
+        log_rate = atoi(optarg);
+        if (log_rate < 0) {
+          fprintf(stderr, "Log rate must be non-negative\n");
+          return 1;
+        }
+        break;
+      default:
+        printf("Index %d is out of options\n", option_index);
+      }
+    } break;
+
+    case '?':
+      fprintf(stderr, "Using: %s [--log debug|info|warn|error|off|sync] "
+              "[--log_rate 0]\n", argv[0]);
+      return 1;
+    default:
+      fprintf(stderr, "getopt returned character code 0%o?\n", c);
+    }
+  }
+
+  if (!LogInit(level, log_mode, log_rate)) {
+    fprintf(stderr, "Could not start the log writer\n");
+    exit(1);
+  }
 
   if ((sockfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
     perror("socket problem");
@@ -44,9 +97,9 @@ int main() {
     }
     mesg[n] = 0;
 
-    printf("REQUEST %s      FROM %s : %d\n", mesg,
-           inet_ntop(AF_INET, (void *)&cliaddr.sin_addr.s_addr, ipadr, 16),
-           ntohs(cliaddr.sin_port));
+    LOG_INFO("REQUEST %s      FROM %s : %d\n", mesg,
+             inet_ntop(AF_INET, (void *)&cliaddr.sin_addr.s_addr, ipadr, 16),
+             ntohs(cliaddr.sin_port));
 
     if (sendto(sockfd, mesg, n, 0, (SADDR *)&cliaddr, len) < 0) {
       perror("sendto");